@@ -0,0 +1,291 @@
+/* batch.c: Run many files headlessly, as fast as possible
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif				/* #ifndef WIN32 */
+
+#include "libspectrum.h"
+
+#include "batch.h"
+#include "debugger/debugger.h"
+#include "event.h"
+#include "fuse.h"
+#include "machine.h"
+#include "memory_pages.h"
+#include "menu.h"
+#include "periph.h"
+#include "peripherals/dck.h"
+#include "peripherals/if2.h"
+#include "settings.h"
+#include "spectrum.h"
+#include "timer/timer.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+/* Every job is the emulation of one file from the command line. The
+   emulator's state is all global, so parallelism comes from running
+   several worker processes, each with its own emulated machine; worker
+   `n' of `count' runs jobs n, n + count, n + 2 * count, ... */
+
+static char **jobs = NULL;
+static int job_count = 0;
+
+static int worker_index = 0;
+static int worker_count = 1;
+
+/* Where this worker writes its results */
+static FILE *results = NULL;
+
+/* Set if the jobs are being run in the original process */
+static int in_process = 0;
+
+/* The machine every job starts from. Loading a snapshot for another
+   machine changes settings_current.start_machine, so this is what was
+   configured when the batch started */
+static char *start_machine = NULL;
+
+/* The length of a line of results, including the job index prefix */
+#define BATCH_LINE_LENGTH 1024
+
+static libspectrum_dword
+screen_hash( void )
+{
+  libspectrum_dword hash = 2166136261U;
+  const libspectrum_byte *screen = RAM[ memory_current_screen ];
+  size_t i;
+
+  /* The bitmap and the attributes */
+  for( i = 0; i < 6912; i++ ) hash = ( hash ^ screen[i] ) * 16777619U;
+
+  return hash;
+}
+
+static void
+run_job( int index )
+{
+  libspectrum_dword frames;
+  const char *exit_condition;
+  double start, elapsed;
+  char exit_text[32];
+  int error;
+
+  fuse_exiting = 0;
+
+  /* Start each job from a freshly selected machine, with none of the
+     media an earlier job inserted */
+  menu_check_media_changed();
+  if( settings_current.dck_file ) dck_eject();
+  if( settings_current.if2_file && periph_is_active( PERIPH_TYPE_INTERFACE2 ) )
+    if2_eject();
+
+  error = machine_select_id( start_machine );
+  if( !error ) error = utils_open_file( jobs[ index ], 1, NULL );
+  if( error ) {
+    fprintf( results, "%d\t%s\terror\t0\t0.0\t00000000\n", index,
+             jobs[ index ] );
+    fflush( results );
+    return;
+  }
+
+  start = timer_get_time();
+
+  while( !fuse_exiting && spectrum_frame_count() <
+           (libspectrum_dword)settings_current.batch_frames ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  elapsed = timer_get_time() - start;
+  frames = spectrum_frame_count();
+
+  if( fuse_exiting ) {
+    snprintf( exit_text, sizeof( exit_text ), "exit %d",
+              debugger_get_exit_code() );
+    exit_condition = exit_text;
+  } else {
+    exit_condition = "frames";
+  }
+
+  fprintf( results, "%d\t%s\t%s\t%lu\t%.1f\t%08x\n", index, jobs[ index ],
+           exit_condition, (unsigned long)frames,
+           elapsed > 0 ? frames / elapsed : 0.0, screen_hash() );
+  fflush( results );
+}
+
+static int
+print_results( char **lines )
+{
+  int i, failed = 0;
+
+  printf( "# file\texit\tframes\tfps\tscreen\n" );
+
+  for( i = 0; i < job_count; i++ ) {
+    const char *line = lines[i];
+    if( line ) {
+      /* Strip the job index */
+      line = strchr( line, '\t' ) + 1;
+      if( strstr( line, "\terror\t" ) ) failed++;
+      printf( "%s", line );
+    } else {
+      printf( "%s\tcrashed\t0\t0.0\t00000000\n", jobs[i] );
+      failed++;
+    }
+  }
+
+  return failed;
+}
+
+/* Read the results from each worker, and print them in job order */
+static int
+collect_results( FILE **files, int count )
+{
+  char **lines, buffer[ BATCH_LINE_LENGTH ];
+  int i, failed;
+
+  lines = libspectrum_new0( char*, job_count );
+
+  for( i = 0; i < count; i++ ) {
+    while( fgets( buffer, sizeof( buffer ), files[i] ) ) {
+      int index = atoi( buffer );
+      if( index >= 0 && index < job_count && strchr( buffer, '\t' ) ) {
+        libspectrum_free( lines[ index ] );
+        lines[ index ] = utils_safe_strdup( buffer );
+      }
+    }
+    fclose( files[i] );
+  }
+
+  failed = print_results( lines );
+
+  for( i = 0; i < job_count; i++ ) libspectrum_free( lines[i] );
+  libspectrum_free( lines );
+
+  return failed;
+}
+
+int
+batch_run( void )
+{
+  int i, failed = 0;
+
+  for( i = worker_index; i < job_count; i += worker_count ) run_job( i );
+
+  /* If we're running in the original process, there's no one else to
+     report the results */
+  if( in_process ) {
+    rewind( results );
+    failed = collect_results( &results, 1 );
+  }
+
+  fuse_exiting = 1;
+
+  return failed ? 1 : 0;
+}
+
+int
+batch_start( int argc, char **argv, int first_arg )
+{
+  job_count = argc - first_arg;
+  jobs = argv + first_arg;
+
+  if( job_count <= 0 ) {
+    fprintf( stderr, "%s: --batch needs at least one file to run\n",
+             fuse_progname );
+    return 1;
+  }
+
+  /* No point in making sounds nobody will hear, and no throttling */
+  settings_current.sound = 0;
+
+  start_machine = utils_safe_strdup( settings_current.start_machine );
+
+  worker_count = settings_current.batch_jobs;
+  if( worker_count < 1 ) worker_count = 1;
+  if( worker_count > job_count ) worker_count = job_count;
+
+#ifndef WIN32
+
+  if( worker_count > 1 ) {
+    FILE **files = libspectrum_new( FILE*, worker_count );
+    int i, failed;
+
+    /* Flush anything already printed so it is not duplicated in the
+       workers */
+    fflush( stdout );
+
+    /* Each worker writes to its own temporary file, which is read back
+       once all the workers have finished */
+    for( i = 0; i < worker_count; i++ ) {
+      pid_t pid;
+
+      files[i] = tmpfile();
+      if( !files[i] ) {
+        fprintf( stderr, "%s: couldn't create temporary file for results\n",
+                 fuse_progname );
+        return 1;
+      }
+
+      pid = fork();
+      if( pid < 0 ) {
+        fprintf( stderr, "%s: couldn't start batch worker\n",
+                 fuse_progname );
+        return 1;
+      }
+
+      if( pid == 0 ) {
+        /* The worker: carry on initialising the emulator */
+        results = files[i];
+        worker_index = i;
+        libspectrum_free( files );
+        return 0;
+      }
+    }
+
+    for( i = 0; i < worker_count; i++ ) wait( NULL );
+    for( i = 0; i < worker_count; i++ ) rewind( files[i] );
+
+    failed = collect_results( files, worker_count );
+    libspectrum_free( files );
+
+    exit( failed ? 1 : 0 );
+  }
+
+#endif				/* #ifndef WIN32 */
+
+  /* Just the one worker, in this process */
+  worker_count = 1;
+  in_process = 1;
+  results = tmpfile();
+  if( !results ) {
+    fprintf( stderr, "%s: couldn't create temporary file for results\n",
+             fuse_progname );
+    return 1;
+  }
+
+  return 0;
+}
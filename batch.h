@@ -0,0 +1,32 @@
+/* batch.h: Run many files headlessly, as fast as possible
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_BATCH_H
+#define FUSE_BATCH_H
+
+/* Split the files on the command line into jobs and start the worker
+   processes. Only returns in a worker process (or if workers are not
+   supported); the original process waits for the workers, prints the
+   results and exits */
+int batch_start( int argc, char **argv, int first_arg );
+
+/* Run this process's share of the jobs */
+int batch_run( void );
+
+#endif			/* #ifndef FUSE_BATCH_H */
@@ -46,6 +46,20 @@ GSList *debugger_breakpoints;
 /* The next breakpoint ID to use */
 static size_t next_breakpoint_id;
 
+/* Indexes of the current breakpoints, rebuilt from debugger_breakpoints
+   whenever it changes so that debugger_check() need not look at every
+   breakpoint */
+#define BREAKPOINT_TYPE_COUNT ( DEBUGGER_BREAKPOINT_TYPE_EVENT + 1 )
+
+/* The address and port types, which also have a bitmap of the values which
+   could possibly trigger a breakpoint */
+#define BREAKPOINT_BITMAP_COUNT ( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE + 1 )
+
+static GSList *breakpoints_by_type[ BREAKPOINT_TYPE_COUNT ];
+static libspectrum_byte
+  breakpoint_bitmap[ BREAKPOINT_BITMAP_COUNT ][ 0x10000 / 8 ];
+static int breakpoint_index_dirty = 1;
+
 /* Textual representations of the breakpoint types and lifetimes */
 const char *debugger_breakpoint_type_text[] = {
   "Execute", "Read", "Write", "Port Read", "Port Write", "Time", "Event",
@@ -73,12 +87,12 @@ static int breakpoint_check( debugger_breakpoint *bp,
 static debugger_breakpoint* get_breakpoint_by_id( size_t id );
 static gint find_breakpoint_by_id( gconstpointer data,
 				   gconstpointer user_data );
-static void remove_time( gpointer data, gpointer user_data );
 static gint find_breakpoint_by_id( gconstpointer data,
 				   gconstpointer user_data );
 static gint find_breakpoint_by_address( gconstpointer data,
 					gconstpointer user_data );
 static void free_breakpoint( gpointer data, gpointer user_data );
+static void breakpoint_index_update( void );
 static void add_time_event( gpointer data, gpointer user_data );
 
 /* Add a breakpoint */
@@ -214,6 +228,7 @@ breakpoint_add( debugger_breakpoint_type type, debugger_breakpoint_value value,
   bp->commands = NULL;
 
   debugger_breakpoints = g_slist_append( debugger_breakpoints, bp );
+  debugger_breakpoint_index_invalidate();
 
   if( debugger_mode == DEBUGGER_MODE_INACTIVE )
     debugger_mode = DEBUGGER_MODE_ACTIVE;
@@ -242,7 +257,15 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
   case DEBUGGER_MODE_INACTIVE: return 0;
 
   case DEBUGGER_MODE_ACTIVE:
-    for( ptr = debugger_breakpoints; ptr; ptr = ptr_next ) {
+    if( breakpoint_index_dirty ) breakpoint_index_update();
+
+    /* The common case: nothing could trigger here */
+    if( type < BREAKPOINT_BITMAP_COUNT &&
+        !( breakpoint_bitmap[ type ][ ( value & 0xffff ) >> 3 ] &
+           ( 1 << ( value & 0x07 ) ) ) )
+      return 0;
+
+    for( ptr = breakpoints_by_type[ type ]; ptr; ptr = ptr_next ) {
 
       bp = ptr->data;
       ptr_next = ptr->next;
@@ -253,6 +276,7 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
 
         if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
           debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+          debugger_breakpoint_index_invalidate();
           libspectrum_free( bp );
           signal_breakpoints_updated = 1;
         }
@@ -287,14 +311,95 @@ debugger_breakpoint_reduce_tstates( libspectrum_dword tstates )
 
   if( debugger_mode != DEBUGGER_MODE_ACTIVE ) return;
 
-  for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+  for( ptr = debugger_breakpoint_list( DEBUGGER_BREAKPOINT_TYPE_TIME ); ptr;
+       ptr = ptr->next ) {
     bp = ptr->data;
 
-    if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME && !bp->value.time.triggered )
+    if( !bp->value.time.triggered )
       bp->value.time.tstates -= tstates;
   }
 }
 
+/* Mark the indexes as needing to be rebuilt; must be called whenever
+   debugger_breakpoints is changed */
+void
+debugger_breakpoint_index_invalidate( void )
+{
+  breakpoint_index_dirty = 1;
+}
+
+static void
+bitmap_set( libspectrum_byte *bitmap, libspectrum_word value )
+{
+  bitmap[ value >> 3 ] |= 1 << ( value & 0x07 );
+}
+
+static void
+breakpoint_index_update( void )
+{
+  GSList *ptr;
+  debugger_breakpoint *bp;
+  size_t i;
+  int value;
+
+  for( i = 0; i < BREAKPOINT_TYPE_COUNT; i++ ) {
+    g_slist_free( breakpoints_by_type[i] );
+    breakpoints_by_type[i] = NULL;
+  }
+
+  memset( breakpoint_bitmap, 0, sizeof( breakpoint_bitmap ) );
+
+  for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+    bp = ptr->data;
+
+    breakpoints_by_type[ bp->type ] =
+      g_slist_prepend( breakpoints_by_type[ bp->type ], bp );
+
+    switch( bp->type ) {
+
+    case DEBUGGER_BREAKPOINT_TYPE_EXECUTE:
+    case DEBUGGER_BREAKPOINT_TYPE_READ:
+    case DEBUGGER_BREAKPOINT_TYPE_WRITE:
+      /* Page-specific breakpoints could trigger at any address with the
+         right offset within a 16K page */
+      if( bp->value.address.source == memory_source_any ) {
+        bitmap_set( breakpoint_bitmap[ bp->type ], bp->value.address.offset );
+      } else {
+        for( value = 0; value < 0x10000; value += 0x4000 )
+          bitmap_set( breakpoint_bitmap[ bp->type ],
+                      value | ( bp->value.address.offset & 0x3fff ) );
+      }
+      break;
+
+    case DEBUGGER_BREAKPOINT_TYPE_PORT_READ:
+    case DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE:
+      for( value = 0; value < 0x10000; value++ )
+        if( ( value & bp->value.port.mask ) == bp->value.port.port )
+          bitmap_set( breakpoint_bitmap[ bp->type ], value );
+      break;
+
+    case DEBUGGER_BREAKPOINT_TYPE_TIME:
+    case DEBUGGER_BREAKPOINT_TYPE_EVENT:
+      break;
+
+    }
+  }
+
+  for( i = 0; i < BREAKPOINT_TYPE_COUNT; i++ )
+    breakpoints_by_type[i] = g_slist_reverse( breakpoints_by_type[i] );
+
+  breakpoint_index_dirty = 0;
+}
+
+/* The breakpoints of a specific type, in the order they were added */
+GSList*
+debugger_breakpoint_list( debugger_breakpoint_type type )
+{
+  if( breakpoint_index_dirty ) breakpoint_index_update();
+
+  return breakpoints_by_type[ type ];
+}
+
 static memory_page*
 get_page( debugger_breakpoint_type type, libspectrum_word address )
 {
@@ -379,13 +484,6 @@ breakpoint_check( debugger_breakpoint *bp, debugger_breakpoint_type type,
   return debugger_breakpoint_trigger( bp );
 }
 
-struct remove_t {
-
-  libspectrum_dword tstates;
-  int done;
-
-};
-
 /* Remove breakpoint with the given ID */
 int
 debugger_breakpoint_remove( size_t id )
@@ -395,19 +493,14 @@ debugger_breakpoint_remove( size_t id )
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
   debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+  debugger_breakpoint_index_invalidate();
   if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
     debugger_mode = DEBUGGER_MODE_INACTIVE;
 
   /* If this was a timed breakpoint, remove the event as well */
-  if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME ) {
-
-    struct remove_t remove;
-
-    remove.tstates = bp->value.time.tstates;
-    remove.done = 0;
-
-    event_foreach( remove_time, &remove );
-  }
+  if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME )
+    event_remove_type_tstates( debugger_breakpoint_event,
+                               bp->value.time.tstates );
 
   libspectrum_free( bp );
 
@@ -441,23 +534,6 @@ find_breakpoint_by_id( gconstpointer data, gconstpointer user_data )
   return bp->id - id;
 }
 
-static void
-remove_time( gpointer data, gpointer user_data )
-{
-  event_t *event;
-  struct remove_t *remove;
-
-  event = data; remove = user_data;
-
-  if( remove->done ) return;
-
-  if( event->type == debugger_breakpoint_event &&
-      event->tstates == remove->tstates ) {
-    event->type = event_type_null;
-    remove->done = 1;
-  }
-}
-
 /* Remove all breakpoints at the given address */
 int
 debugger_breakpoint_clear( libspectrum_word address )
@@ -477,6 +553,7 @@ debugger_breakpoint_clear( libspectrum_word address )
 
     ptr_data = ptr->data;
     debugger_breakpoints = g_slist_remove( debugger_breakpoints, ptr_data );
+    debugger_breakpoint_index_invalidate();
     if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
       debugger_mode = DEBUGGER_MODE_INACTIVE;
 
@@ -519,6 +596,7 @@ debugger_breakpoint_remove_all( void )
 {
   g_slist_foreach( debugger_breakpoints, free_breakpoint, NULL );
   g_slist_free( debugger_breakpoints ); debugger_breakpoints = NULL;
+  debugger_breakpoint_index_invalidate();
 
   if( debugger_mode == DEBUGGER_MODE_ACTIVE )
     debugger_mode = DEBUGGER_MODE_INACTIVE;
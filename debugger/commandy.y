@@ -90,6 +90,7 @@
 %token		 PORT
 %token		 DEBUGGER_PRINT
 %token		 READ
+%token		 REWIND
 %token		 SET
 %token		 STEP
 %token		 TIME
@@ -184,6 +185,8 @@ command:   BASE number { debugger_output_base = $2; }
 	 | NEXT	    { debugger_next(); }
 	 | DEBUGGER_OUT number NUMBER { debugger_port_write( $2, $3 ); }
 	 | DEBUGGER_PRINT number { printf( "0x%x\n", $2 ); }
+	 | REWIND { debugger_rewind( 1 ); }
+	 | REWIND number { debugger_rewind( $2 ); }
 	 | SET NUMBER number { debugger_poke( $2, $3 ); }
 	 | SET VARIABLE number { debugger_variable_set( $2, $3 ); }
          | SET STRING ':' STRING number { debugger_system_variable_set( $2, $4, $5 ); }
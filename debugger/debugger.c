@@ -32,6 +32,7 @@
 #include "memory_pages.h"
 #include "mempool.h"
 #include "periph.h"
+#include "rewind.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 #include "z80/z80_macros.h"
@@ -193,6 +194,13 @@ debugger_poke( libspectrum_word address, libspectrum_byte value )
   return 0;
 }
 
+/* Go back in time via the rewind buffer */
+int
+debugger_rewind( size_t frames )
+{
+  return rewind_step_back( frames );
+}
+
 /* Write a value to a port */
 int
 debugger_port_write( libspectrum_word port, libspectrum_byte value )
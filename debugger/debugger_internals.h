@@ -43,9 +43,12 @@ int debugger_breakpoint_set_condition( size_t id,
 				       debugger_expression *condition );
 int debugger_breakpoint_set_commands( size_t id, const char *commands );
 int debugger_breakpoint_trigger( debugger_breakpoint *bp );
+void debugger_breakpoint_index_invalidate( void );
+GSList* debugger_breakpoint_list( debugger_breakpoint_type type );
 
 int debugger_poke( libspectrum_word address, libspectrum_byte value );
 int debugger_port_write( libspectrum_word address, libspectrum_byte value );
+int debugger_rewind( size_t frames );
 
 /* Utility functions called by the flex scanner */
 
@@ -123,13 +123,12 @@ debugger_event( int event_code )
 
   event = g_array_index( registered_events, debugger_event_t, event_code );
 
-  for( ptr = debugger_breakpoints; ptr; ptr = ptr_next ) {
+  for( ptr = debugger_breakpoint_list( DEBUGGER_BREAKPOINT_TYPE_EVENT ); ptr;
+       ptr = ptr_next ) {
 
     bp = ptr->data;
     ptr_next = ptr->next;
 
-    if( bp->type != DEBUGGER_BREAKPOINT_TYPE_EVENT ) continue;
-
     if( event_matches( &bp->value.event, event.type, event.detail ) &&
         debugger_breakpoint_trigger( bp ) ) {
       debugger_mode = DEBUGGER_MODE_HALTED;
@@ -137,6 +136,7 @@ debugger_event( int event_code )
 
       if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
         debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+        debugger_breakpoint_index_invalidate();
         libspectrum_free( bp );
         signal_breakpoints_updated = 1;
       }
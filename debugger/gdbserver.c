@@ -12,8 +12,10 @@
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "memory.h"
+#include "memory_pages.h"
 #include "mempool.h"
 #include "periph.h"
+#include "rewind.h"
 #include "peripherals/fs/xfs.h"
 #include "peripherals/spectranet.h"
 #include "settings.h"
@@ -62,6 +64,14 @@ static const void* scheduled_action_data = NULL;
 static void* scheduled_action_response = NULL;
 static uint8_t scheduled_action_response_delivered = 0;
 
+// A copy of the 64K address space as the debugger sees it, taken the first
+// time memory is read after each stop, so that the reads gdb makes while
+// the machine is halted don't each have to wait for the main thread;
+// mem_snapshot_valid is protected by trap_process_mutex
+static uint8_t mem_snapshot[0x10000];
+static uint8_t mem_snapshot_valid = 0;
+static uint8_t mem_read_buf[0x10000];
+
 static pthread_cond_t trapped_cond;
 static pthread_cond_t response_cond;
 static pthread_mutex_t trap_process_mutex;
@@ -89,7 +99,7 @@ static uint8_t gdbserver_execute_on_main_thread(trapped_action_t call, const voi
 
 static uint8_t action_get_registers(const void* arg, void* response);
 static uint8_t action_set_registers(const void* arg, void* response);
-static uint8_t action_get_mem(const void* arg, void* response);
+static uint8_t action_snapshot_mem(const void* arg, void* response);
 static uint8_t action_set_mem(const void* arg, void* response);
 static uint8_t action_get_register(const void* arg, void* response);
 static uint8_t action_set_register(const void* arg, void* response);
@@ -98,10 +108,12 @@ static uint8_t action_remove_breakpoint(const void* arg, void* response);
 static uint8_t action_step_instruction(const void* arg, void* response);
 static uint8_t action_reset(const void* arg, void* response);
 static uint8_t action_autoboot(const void* arg, void* response);
+static uint8_t action_rewind(const void* arg, void* response);
 
 struct action_mem_args_t {
     size_t maddr, mlen;
     uint8_t* payload;
+    int binary;
 };
 
 struct action_step_args_t {
@@ -121,6 +133,10 @@ struct action_breakpoint_args_t {
     size_t maddr, mlen;
 };
 
+struct action_rewind_args_t {
+    int all;
+};
+
 static void process_xfer(const char *name, char *args)
 {
   const char *mode = args;
@@ -156,7 +172,10 @@ static void process_query(char *payload)
     if (!strcmp(name, "Offsets"))
         packet_send_message((const uint8_t*)"", 0);
     if (!strcmp(name, "Supported"))
-        packet_send_message((const uint8_t*)"PacketSize=4000;qXfer:features:read+;qXfer:auxv:read+;vSpectranext+", strlen("PacketSize=4000;qXfer:features:read+;qXfer:auxv:read+;vSpectranext+"));
+    {
+        snprintf((char*)tmpbuf, sizeof(tmpbuf), "PacketSize=%x;QStartNoAckMode+;binary-upload+;qXfer:features:read+;qXfer:auxv:read+;vSpectranext+;ReverseStep+;ReverseContinue+", PACKET_BUF_SIZE);
+        packet_send_message((const uint8_t*)tmpbuf, strlen((const char*)tmpbuf));
+    }
     if (!strcmp(name, "Symbol"))
         packet_send_message((const uint8_t*)"OK", 2);
     if (name == strstr(name, "ThreadExtraInfo"))
@@ -238,6 +257,29 @@ static void process_vpacket(char *payload)
       packet_send_message((const uint8_t*)"", 0);
 }
 
+// Read memory from the snapshot, taking it first if the machine has run
+// since the last one
+static int read_mem(size_t addr, size_t len, uint8_t* out)
+{
+    uint8_t valid;
+    size_t i;
+
+    pthread_mutex_lock(&trap_process_mutex);
+    valid = mem_snapshot_valid;
+    pthread_mutex_unlock(&trap_process_mutex);
+
+    if (!valid && !gdbserver_execute_on_main_thread(action_snapshot_mem, NULL, NULL))
+    {
+        return 1;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        out[i] = mem_snapshot[(addr + i) & 0xffff];
+    }
+    return 0;
+}
+
 static int set_register_value(int reg, libspectrum_word value)
 {
     if (reg >= (sizeof(registers) / (sizeof(libspectrum_word*))))
@@ -274,6 +316,24 @@ uint8_t process_packet()
 
     switch (request)
     {
+        case 'b':
+        {
+            // Reverse execution goes through the rewind buffer, which only
+            // holds the state at the start of each frame: "bs" goes back to
+            // the start of the current frame, "bc" as far back as possible
+            struct action_rewind_args_t r;
+            if ((payload[0] != 's' && payload[0] != 'c') || payload[1] != '\0')
+            {
+                packet_send_message((const uint8_t*)"", 0);
+                break;
+            }
+            r.all = (payload[0] == 'c');
+            if (gdbserver_trapped && gdbserver_execute_on_main_thread(action_rewind, &r, tmpbuf))
+                packet_send_message((const uint8_t*)tmpbuf, strlen((const char*)tmpbuf));
+            else
+                packet_send_message((const uint8_t*)"E01", 3);
+            break;
+        }
         case 'c':
         {
             gdbserver_detrap();
@@ -317,17 +377,39 @@ uint8_t process_packet()
             break;
         }
         case 'm':
+        case 'x':
         {
-            struct action_mem_args_t mem;
-            assert(sscanf(payload, "%zx,%zx", &mem.maddr, &mem.mlen) == 2);
-            if (mem.mlen * SZ * 2 > 0x20000)
+            // 'm' replies in hex, 'x' with a 'b' followed by escaped binary;
+            // either may return less than was asked for if it won't fit
+            size_t maddr, mlen;
+            if (sscanf(payload, "%zx,%zx", &maddr, &mlen) != 2)
+            {
+                packet_send_message((const uint8_t*)"E01", 3);
+                break;
+            }
+            if (mlen > sizeof(mem_read_buf))
+                mlen = sizeof(mem_read_buf);
+            if (request == 'm' && mlen > (sizeof(tmpbuf) - 1) / 2)
+                mlen = (sizeof(tmpbuf) - 1) / 2;
+
+            if (read_mem(maddr, mlen, mem_read_buf))
             {
-              puts("Buffer overflow!");
-              exit(-1);
+                packet_send_message((const uint8_t*)"E01", 3);
+                break;
+            }
+
+            if (request == 'm')
+            {
+                mem2hex(mem_read_buf, (char*)tmpbuf, mlen);
+                packet_send_message((const uint8_t*)tmpbuf, mlen * 2);
+            }
+            else
+            {
+                int written;
+                tmpbuf[0] = 'b';
+                escape(mem_read_buf, mlen, (char*)tmpbuf + 1, sizeof(tmpbuf) - 1, &written);
+                packet_send_message((const uint8_t*)tmpbuf, written + 1);
             }
-          
-            if (gdbserver_execute_on_main_thread(action_get_mem, &mem, tmpbuf))
-                packet_send_message((const uint8_t*)tmpbuf, strlen((const char*)tmpbuf));
             break;
         }
         case 'M':
@@ -338,7 +420,12 @@ uint8_t process_packet()
                 packet_send_message((const uint8_t*)"E01", 3);
                 break;
             }
+            if (strlen(payload + offset) < mem.mlen * 2) {
+                packet_send_message((const uint8_t*)"E01", 3);
+                break;
+            }
             mem.payload = (uint8_t*)(payload + offset);
+            mem.binary = 0;
             if (gdbserver_execute_on_main_thread(action_set_mem, &mem, tmpbuf))
                 packet_send_message((const uint8_t*)tmpbuf, strlen((const char*)tmpbuf));
             break;
@@ -369,6 +456,20 @@ uint8_t process_packet()
             process_query(payload);
             break;
         }
+        case 'Q':
+        {
+            // This reply is the last one gdb acknowledges
+            if (!strcmp(payload, "StartNoAckMode"))
+            {
+                packet_send_message((const uint8_t*)"OK", 2);
+                packets_set_no_ack_mode(true);
+            }
+            else
+            {
+                packet_send_message((const uint8_t*)"", 0);
+            }
+            break;
+        }
         case 's':
         {
             gdbserver_execute_on_main_thread(action_step_instruction, NULL, NULL);
@@ -437,6 +538,7 @@ uint8_t process_packet()
             mem.payload = (uint8_t*)payload;
             mem.maddr = maddr;
             mem.mlen = mlen;
+            mem.binary = 1;
           
             if (gdbserver_execute_on_main_thread(action_set_mem, &mem, tmpbuf))
                 packet_send_message((const uint8_t*)tmpbuf, strlen((const char*)tmpbuf));
@@ -600,6 +702,7 @@ static void* network_thread(void* arg)
         // Reset packets subsystem for new connection
         packets_reset();
         packets_clear_incoming_raw();
+        packets_set_no_ack_mode(false);
         gdbserver_do_not_report_trap = 1;
         debugger_mode = DEBUGGER_MODE_HALTED;
 
@@ -775,6 +878,7 @@ static uint8_t gdbserver_detrap()
     if (gdbserver_trapped)
     {
         gdbserver_trapped = 0;
+        mem_snapshot_valid = 0;
         pthread_cond_signal(&trapped_cond);
         result = 1;
     }
@@ -795,6 +899,13 @@ static uint8_t gdbserver_execute_on_main_thread(trapped_action_t call, const voi
         return 0;
     }
 
+    // anything other than a read may change memory
+    if (call != action_snapshot_mem && call != action_get_registers &&
+        call != action_get_register)
+    {
+        mem_snapshot_valid = 0;
+    }
+
     // prepare the action arguments
     scheduled_action = call;
     scheduled_action_data = data;
@@ -855,31 +966,27 @@ static uint8_t action_set_registers(const void* arg, void* response)
     return 0;
 }
 
-static uint8_t action_get_mem(const void* arg, void* response)
+// Copy the memory map a page at a time; like the rest of the debugger, this
+// bypasses read breakpoints, contention and memory-mapped I/O
+static uint8_t action_snapshot_mem(const void* arg, void* response)
 {
-    int i;
-    struct action_mem_args_t* mem = (struct action_mem_args_t*)arg;
-    char* resp_buff = (char*)response;
-  
-    uint32_t t = tstates;
-  
-    libspectrum_word address = mem->maddr;
-    for (i = 0; i < mem->mlen; i++, address++)
+    size_t i;
+
+    (void)arg;
+    (void)response;
+
+    for (i = 0; i < MEMORY_PAGES_IN_64K; i++)
     {
-        libspectrum_byte data = readbyte(address);
-        mem2hex((void *)&data, resp_buff + i * 2, 1);
+        memcpy(mem_snapshot + i * MEMORY_PAGE_SIZE, memory_map_read[i].page,
+               MEMORY_PAGE_SIZE);
     }
-  
-    tstates = t;
 
-    resp_buff[mem->mlen * 2] = '\0';
+    mem_snapshot_valid = 1;
     return 0;
 }
 
 static uint8_t action_set_mem(const void* arg, void* response)
 {
-    uint32_t t = tstates;
-  
     int i;
     struct action_mem_args_t* mem = (struct action_mem_args_t*)arg;
     char* resp_buff = (char*)response;
@@ -888,12 +995,13 @@ static uint8_t action_set_mem(const void* arg, void* response)
     libspectrum_word address = mem->maddr;
     for (i = 0; i < mem->mlen; i++, address++)
     {
-        hex2mem((char*)mem->payload + i * 2, (uint8_t *)&data, 1);
-        writebyte(address, data);
+        if (mem->binary)
+            data = mem->payload[i];
+        else
+            hex2mem((char*)mem->payload + i * 2, (uint8_t *)&data, 1);
+        writebyte_internal(address, data);
     }
   
-    tstates = t;
-  
     strcpy(resp_buff, "OK");
     return 0;
 }
@@ -1021,6 +1129,23 @@ static uint8_t action_autoboot(const void* arg, void* response)
     return 0;
 }
 
+static uint8_t action_rewind(const void* arg, void* response)
+{
+    const struct action_rewind_args_t* r = (const struct action_rewind_args_t*)arg;
+    char* resp_buff = (char*)response;
+
+    if (r->all ? rewind_step_back_all() : rewind_step_back(1))
+    {
+        strcpy(resp_buff, "E01");
+        return 0;
+    }
+
+    // Still trapped, so report where we've stopped
+    sprintf(resp_buff, "T%02x%sthread:p%02x.%02x;", 5,
+            rewind_frame_count() ? "" : "replaylog:begin;", 1, 1);
+    return 0;
+}
+
 static uint8_t action_step_instruction(const void* arg, void* response)
 {
     struct action_step_args_t* a = (struct action_step_args_t*)arg;
@@ -51,3 +51,23 @@ int unescape(char *msg, int len)
     }
     return w - msg;
 }
+
+int escape(const uint8_t *mem, int count, char *buf, int size, int *written)
+{
+    int i, w = 0;
+    for (i = 0; i < count; i++)
+    {
+        uint8_t v = mem[i];
+        int escaped = (v == '#' || v == '$' || v == '}' || v == '*');
+        if (w + 1 + escaped > size)
+            break;
+        if (escaped)
+        {
+            buf[w++] = '}';
+            v ^= 0x20;
+        }
+        buf[w++] = v;
+    }
+    *written = w;
+    return i;
+}
@@ -9,5 +9,8 @@ int hex(char ch);
 char *mem2hex(const uint8_t *mem, char *buf, int count);
 uint8_t *hex2mem(const char *buf, uint8_t *mem, int count);
 int unescape(char *msg, int len);
+// Escape up to count bytes for a binary packet, writing no more than size
+// bytes to buf; returns how many of the bytes were escaped
+int escape(const uint8_t *mem, int count, char *buf, int size, int *written);
 
 #endif /* GDBSERVER_UTILS_H */
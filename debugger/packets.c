@@ -34,8 +34,8 @@ typedef struct
 {
     rsp_state_t state;
     uint8_t    *buf;
-    uint16_t    cap;
-    uint16_t    len;
+    size_t      cap;
+    size_t      len;
     uint8_t     csum;
     int         hi;
 } rsp_deframer_t;
@@ -46,7 +46,11 @@ static size_t incoming_raw_len = 0;
 
 // Deframer state
 static rsp_deframer_t deframer = {};
-static uint8_t deframer_buffer[PACKET_BUF_SIZE];
+// One spare byte so that a full packet can still be null-terminated
+static uint8_t deframer_buffer[PACKET_BUF_SIZE + 1];
+
+// Set once the client has sent QStartNoAckMode
+static bool no_ack_mode = false;
 
 // Helper: hex nibble to value
 static inline int hex_nib(int c)
@@ -60,7 +64,7 @@ static inline int hex_nib(int c)
 // Send ACK response
 static void send_ack(void)
 {
-    if (gdbserver_client_socket >= 0)
+    if (gdbserver_client_socket >= 0 && !no_ack_mode)
     {
         const char ack = '+';
         send(gdbserver_client_socket, &ack, 1, 0);
@@ -70,7 +74,7 @@ static void send_ack(void)
 // Send NAK response
 static void send_nak(void)
 {
-    if (gdbserver_client_socket >= 0)
+    if (gdbserver_client_socket >= 0 && !no_ack_mode)
     {
         const char nak = '-';
         send(gdbserver_client_socket, &nak, 1, 0);
@@ -337,6 +341,12 @@ void packet_send_message(const uint8_t *data, size_t len)
     libspectrum_free(packet_buf);
 }
 
+// Stop (or start again) sending and expecting ACKs
+void packets_set_no_ack_mode(bool enabled)
+{
+    no_ack_mode = enabled;
+}
+
 // Send ACK
 void acknowledge_packet(void)
 {
@@ -3,8 +3,11 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
-#define PACKET_BUF_SIZE 0x4000
+// Also the PacketSize offered to gdb, so large enough for a whole 48K of
+// RAM in one binary 'x' read
+#define PACKET_BUF_SIZE 0x10000
 
 static const char INTERRUPT_CHAR = '\x03';
 
@@ -48,6 +51,9 @@ void packets_clear_incoming_raw(void);
 // Send packet with CRC calculation
 void packet_send_message(const uint8_t *data, size_t len);
 
+// Stop (or start again) sending and expecting ACKs, after QStartNoAckMode
+void packets_set_no_ack_mode(bool enabled);
+
 // Send ACK
 void acknowledge_packet(void);
 
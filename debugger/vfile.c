@@ -283,6 +283,8 @@ static char* handle_vfile_pread(const char* args, uint32_t n)
     const size_t buf_size = vfile_ext_get_response_buf_size();
     const uint32_t max_binary = (buf_size - 1) / 2;  // Reserve 1 byte for null terminator
     if (count > max_binary) count = max_binary;
+    // ...and to what the xfs engine can report as read
+    if (count > INT16_MAX) count = INT16_MAX;
     
     // Read data
     const int16_t bytes_read = xfs_ram_engine.read(&vfile_xfs_ram_mount, &active_handle, (uint8_t*)response_buf, count);
@@ -347,11 +349,15 @@ static char* handle_vfile_pwrite(const char* args, uint32_t n)
     char* decode_buf = vfile_ext_get_response_buf();
     size_t decode_buf_size = vfile_ext_get_response_buf_size();
     
-    // Limit decoded_len to what fits in decode buffer
+    // Limit decoded_len to what fits in decode buffer, and to what the
+    // xfs engine can report as written; gdb sends the rest again
     size_t actual_decoded_len = decoded_len;
     if (actual_decoded_len > decode_buf_size) {
         actual_decoded_len = decode_buf_size;
     }
+    if (actual_decoded_len > INT16_MAX) {
+        actual_decoded_len = INT16_MAX;
+    }
     
     // Limit hex_len to match (must be even)
     size_t actual_hex_len = actual_decoded_len * 2;
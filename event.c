@@ -23,6 +23,8 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "libspectrum.h"
@@ -39,11 +41,27 @@ static const libspectrum_dword event_no_events = 0xffffffff;
 /* When will the next event happen? */
 libspectrum_dword event_next_event;
 
-/* The actual list of events */
-static GSList *event_list = NULL;
+/* An entry in the event queue. Times are stored relative to
+   `event_epoch' rather than to the start of the current frame so that
+   event_frame() does not need to touch every entry */
+typedef struct event_entry_t {
+  libspectrum_qword time;
+  int type;
+  libspectrum_dword sequence;
+  void *user_data;
+} event_entry_t;
 
-/* An event ready to be reused */
-static event_t *event_free = NULL;
+/* The actual queue of events, stored as a binary min-heap */
+static event_entry_t *event_heap = NULL;
+static size_t event_heap_count = 0;
+static size_t event_heap_size = 0;
+
+/* The absolute time at which the current frame started */
+static libspectrum_qword event_epoch = 0;
+
+/* Used to keep events with identical times and types in the order in
+   which they were added */
+static libspectrum_dword event_sequence = 0;
 
 /* A null event */
 int event_type_null;
@@ -80,90 +98,118 @@ event_register( event_fn_t fn, const char *description )
   return registered_events->len - 1;
 }
 
-static gint
-event_add_cmp( gconstpointer a1, gconstpointer b1 )
+/* Is event `a' due before event `b'? */
+static inline int
+event_before( const event_entry_t *a, const event_entry_t *b )
+{
+  if( a->time != b->time ) return a->time < b->time;
+  if( a->type != b->type ) return a->type < b->type;
+  return (libspectrum_signed_dword)( a->sequence - b->sequence ) < 0;
+}
+
+static void
+event_sift_up( size_t i )
+{
+  event_entry_t entry = event_heap[i];
+
+  while( i ) {
+    size_t parent = ( i - 1 ) / 2;
+    if( !event_before( &entry, &event_heap[ parent ] ) ) break;
+    event_heap[i] = event_heap[ parent ];
+    i = parent;
+  }
+
+  event_heap[i] = entry;
+}
+
+static void
+event_sift_down( size_t i )
+{
+  event_entry_t entry = event_heap[i];
+
+  while( 1 ) {
+    size_t child = 2 * i + 1;
+    if( child >= event_heap_count ) break;
+    if( child + 1 < event_heap_count &&
+        event_before( &event_heap[ child + 1 ], &event_heap[ child ] ) )
+      child++;
+    if( !event_before( &event_heap[ child ], &entry ) ) break;
+    event_heap[i] = event_heap[ child ];
+    i = child;
+  }
+
+  event_heap[i] = entry;
+}
+
+/* Restore the heap property after arbitrary entries have been removed */
+static void
+event_heapify( void )
 {
-  const event_t *a = a1, *b = b1;
+  size_t i;
+
+  for( i = event_heap_count / 2; i > 0; i-- ) event_sift_down( i - 1 );
+}
 
-  return a->tstates != b->tstates ? a->tstates - b->tstates
-		                  : a->type - b->type;
+static void
+event_update_next( void )
+{
+  event_next_event = event_heap_count ?
+    (libspectrum_dword)( event_heap[0].time - event_epoch ) : event_no_events;
 }
 
 /* Add an event at the correct place in the event list */
 void
 event_add_with_data( libspectrum_dword event_time, int type, void *user_data )
 {
-  event_t *ptr;
+  event_entry_t *entry;
 
-  if( event_free ) {
-    ptr = event_free;
-    event_free = NULL;
-  } else {
-    ptr = libspectrum_new( event_t, 1 );
+  if( event_heap_count == event_heap_size ) {
+    event_heap_size = event_heap_size ? 2 * event_heap_size : 64;
+    event_heap = libspectrum_renew( event_entry_t, event_heap,
+                                    event_heap_size );
   }
 
-  ptr->tstates = event_time;
-  ptr->type =type;
-  ptr->user_data = user_data;
+  entry = &event_heap[ event_heap_count++ ];
+  entry->time = event_epoch + event_time;
+  entry->type = type;
+  entry->sequence = event_sequence++;
+  entry->user_data = user_data;
 
-  if( event_time < event_next_event ) {
-    event_next_event = event_time;
-    event_list = g_slist_prepend( event_list, ptr );
-  } else {
-    event_list = g_slist_insert_sorted( event_list, ptr, event_add_cmp );
-  }
+  event_sift_up( event_heap_count - 1 );
+
+  if( event_time < event_next_event ) event_next_event = event_time;
 }
 
 /* Do all events which have passed */
 int
 event_do_events( void )
 {
-  event_t *ptr;
-
   while(event_next_event <= tstates) {
     event_descriptor_t descriptor;
-    ptr = event_list->data;
-    descriptor =
-      g_array_index( registered_events, event_descriptor_t, ptr->type );
-
-    /* Remove the event from the list *before* processing */
-    event_list = g_slist_remove( event_list, ptr );
+    event_entry_t entry = event_heap[0];
 
-    if( event_list == NULL ) {
-      event_next_event = event_no_events;
-    } else {
-      event_next_event = ((event_t*)(event_list->data))->tstates;
-    }
+    descriptor =
+      g_array_index( registered_events, event_descriptor_t, entry.type );
 
-    if( descriptor.fn ) descriptor.fn( ptr->tstates, ptr->type, ptr->user_data );
+    /* Remove the event from the queue *before* processing */
+    event_heap[0] = event_heap[ --event_heap_count ];
+    if( event_heap_count ) event_sift_down( 0 );
+    event_update_next();
 
-    if( event_free ) {
-      libspectrum_free( ptr );
-    } else {
-      event_free = ptr;
-    }
+    if( descriptor.fn )
+      descriptor.fn( (libspectrum_dword)( entry.time - event_epoch ),
+                     entry.type, entry.user_data );
   }
 
   return 0;
 }
 
-static void
-event_reduce_tstates( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-  libspectrum_dword *tstates_per_frame = user_data;
-
-  ptr->tstates -= *tstates_per_frame;
-}
-
 /* Called at end of frame to reduce T-state count of all entries */
 void
 event_frame( libspectrum_dword tstates_per_frame )
 {
-  g_slist_foreach( event_list, event_reduce_tstates, &tstates_per_frame );
-
-  event_next_event = event_list ?
-    ((event_t*)(event_list->data))->tstates : event_no_events;
+  event_epoch += tstates_per_frame;
+  event_update_next();
 }
 
 /* Do all events that would happen between the current time and when
@@ -183,69 +229,208 @@ event_force_events( void )
   }
 }
 
+/* Remove all events matching `type' and, if `check_user_data' is set,
+   `user_data' or, if `check_time' is set, `event_time'; if `just_one'
+   is set, stop after the earliest such event */
 static void
-set_event_null( gpointer data, gpointer user_data )
+event_remove( int type, int check_user_data, void *user_data,
+              int check_time, libspectrum_dword event_time, int just_one )
 {
-  event_t *ptr = data;
-  int *type = user_data;
+  size_t i, j;
+  libspectrum_qword time = event_epoch + event_time;
+
+  if( just_one ) {
+    size_t found = event_heap_count;
+
+    for( i = 0; i < event_heap_count; i++ ) {
+      if( event_heap[i].type != type ) continue;
+      if( check_user_data && event_heap[i].user_data != user_data ) continue;
+      if( check_time && event_heap[i].time != time ) continue;
+      if( found == event_heap_count ||
+          event_before( &event_heap[i], &event_heap[ found ] ) )
+        found = i;
+    }
 
-  if( ptr->type == *type ) ptr->type = event_type_null;
-}
+    if( found == event_heap_count ) return;
 
-static void
-set_event_null_with_user_data( gpointer data, gpointer user_data )
-{
-  event_t *event = data;
-  event_t *template = user_data;
+    event_heap[ found ] = event_heap[ --event_heap_count ];
+    if( found < event_heap_count ) {
+      event_sift_up( found );
+      event_sift_down( found );
+    }
+
+  } else {
+
+    for( i = 0, j = 0; i < event_heap_count; i++ ) {
+      if( event_heap[i].type == type &&
+          ( !check_user_data || event_heap[i].user_data == user_data ) &&
+          ( !check_time || event_heap[i].time == time ) )
+        continue;
+      event_heap[ j++ ] = event_heap[i];
+    }
 
-  if( event->type == template->type && event->user_data == template->user_data )
-    event->type = event_type_null;
+    if( j == event_heap_count ) return;
+
+    event_heap_count = j;
+    event_heapify();
+
+  }
+
+  event_update_next();
 }
 
 /* Remove all events of a specific type from the stack */
 void
 event_remove_type( int type )
 {
-  g_slist_foreach( event_list, set_event_null, &type );
+  event_remove( type, 0, NULL, 0, 0, 0 );
 }
 
 /* Remove all events of a specific type and user data from the stack */
 void
 event_remove_type_user_data( int type, gpointer user_data )
 {
-  event_t template;
-
-  template.type = type;
-  template.user_data = user_data;
-  g_slist_foreach( event_list, set_event_null_with_user_data, &template );
+  event_remove( type, 1, user_data, 0, 0, 0 );
 }
 
-/* Free the memory used by a specific entry */
-static void
-event_free_entry( gpointer data, gpointer user_data GCC_UNUSED )
+/* Remove the first event of a specific type at a specific time */
+void
+event_remove_type_tstates( int type, libspectrum_dword event_time )
 {
-  libspectrum_free( data );
+  event_remove( type, 0, NULL, 1, event_time, 1 );
 }
 
 /* Clear the event stack */
 void
 event_reset( void )
 {
-  g_slist_foreach( event_list, event_free_entry, NULL );
-  g_slist_free( event_list );
-  event_list = NULL;
+  event_heap_count = 0;
+  event_epoch = 0;
 
   event_next_event = event_no_events;
+}
+
+static int
+event_entry_cmp( const void *a, const void *b )
+{
+  const event_entry_t *entry_a = a, *entry_b = b;
 
-  libspectrum_free( event_free );
-  event_free = NULL;
+  if( event_before( entry_a, entry_b ) ) return -1;
+  if( event_before( entry_b, entry_a ) ) return 1;
+  return 0;
 }
 
-/* Call a user-supplied function for every event in the current list */
+/* Call a user-supplied function for every event in the current list, in
+   the order in which they will occur */
 void
 event_foreach( GFunc function, gpointer user_data )
 {
-  g_slist_foreach( event_list, function, user_data );
+  event_entry_t *entries;
+  size_t i, count = event_heap_count;
+
+  if( !count ) return;
+
+  /* Work on a copy so the function is free to add or remove events */
+  entries = libspectrum_new( event_entry_t, count );
+  memcpy( entries, event_heap, count * sizeof( *entries ) );
+  qsort( entries, count, sizeof( *entries ), event_entry_cmp );
+
+  for( i = 0; i < count; i++ ) {
+    event_t event;
+
+    event.tstates = (libspectrum_dword)( entries[i].time - event_epoch );
+    event.type = entries[i].type;
+    event.user_data = entries[i].user_data;
+
+    function( &event, user_data );
+  }
+
+  libspectrum_free( entries );
+}
+
+#define EVENT_UNITTEST_MAX 8
+
+static int event_unittest_count;
+static libspectrum_dword event_unittest_tstates[ EVENT_UNITTEST_MAX ];
+static void *event_unittest_data[ EVENT_UNITTEST_MAX ];
+
+static void
+event_unittest_fn( libspectrum_dword event_tstates, int type, void *user_data )
+{
+  if( event_unittest_count < EVENT_UNITTEST_MAX ) {
+    event_unittest_tstates[ event_unittest_count ] = event_tstates;
+    event_unittest_data[ event_unittest_count ] = user_data;
+  }
+  event_unittest_count++;
+}
+
+static int
+event_unittest_check( int count, const libspectrum_dword *expected_tstates,
+                      const size_t *expected_data )
+{
+  int i;
+
+  if( event_unittest_count != count ) {
+    printf( "%s: event test: %d events run, expected %d\n", fuse_progname,
+            event_unittest_count, count );
+    return 1;
+  }
+
+  for( i = 0; i < count; i++ ) {
+    if( event_unittest_tstates[i] != expected_tstates[i] ||
+        event_unittest_data[i] != (void*)expected_data[i] ) {
+      printf( "%s: event test: event %d at %u with data %p, expected %u/%p\n",
+              fuse_progname, i, event_unittest_tstates[i],
+              event_unittest_data[i], expected_tstates[i],
+              (void*)expected_data[i] );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int
+event_unittest( void )
+{
+  static const libspectrum_dword order_tstates[] = { 100, 100, 200, 300 };
+  static const size_t order_data[] = { 1, 2, 3, 4 };
+  static const libspectrum_dword frame_tstates[] = { 50, 400 };
+  static const size_t frame_data[] = { 2, 1 };
+  libspectrum_dword old_tstates = tstates;
+  int test_type, other_type, r = 0;
+
+  test_type = event_register( event_unittest_fn, "Unit test" );
+  other_type = event_register( event_unittest_fn, "Unit test (other)" );
+
+  /* Events run in time order, with equal times run in insertion order */
+  event_reset(); event_unittest_count = 0;
+  event_add_with_data( 300, test_type, (void*)4 );
+  event_add_with_data( 100, test_type, (void*)1 );
+  event_add_with_data( 200, test_type, (void*)3 );
+  event_add_with_data( 100, test_type, (void*)2 );
+  tstates = 1000; event_do_events();
+  r += event_unittest_check( 4, order_tstates, order_data );
+
+  /* Removed events are not run and frame rollover preserves order */
+  event_reset(); event_unittest_count = 0;
+  event_add_with_data( 1200, test_type, (void*)1 );
+  event_add_with_data( 1050, test_type, (void*)2 );
+  event_add_with_data( 1100, test_type, (void*)3 );
+  event_add_with_data( 1100, other_type, (void*)4 );
+  event_add_with_data( 1150, other_type, (void*)5 );
+  event_remove_type_user_data( test_type, (void*)3 );
+  event_remove_type( other_type );
+  event_frame( 1000 );
+  event_add_with_data( 400, test_type, (void*)1 );
+  event_remove_type_tstates( test_type, 200 );
+  tstates = 500; event_do_events();
+  r += event_unittest_check( 2, frame_tstates, frame_data );
+
+  event_reset();
+  tstates = old_tstates;
+
+  return r;
 }
 
 /* A textual representation of each event type */
@@ -277,6 +462,11 @@ static void
 event_end( void )
 {
   event_reset();
+
+  libspectrum_free( event_heap );
+  event_heap = NULL;
+  event_heap_size = 0;
+
   registered_events_free();
 }
 
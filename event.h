@@ -74,15 +74,22 @@ void event_remove_type( int type );
 /* Remove all events of a specific type and user data from the stack */
 void event_remove_type_user_data( int type, gpointer user_data );
 
+/* Remove the first event of a specific type at a specific time */
+void event_remove_type_tstates( int type, libspectrum_dword event_time );
+
 /* Clear the event stack */
 void event_reset( void );
 
-/* Call a user-supplied function for every event in the current list */
+/* Call a user-supplied function for every event in the current list, in
+   the order in which they will occur. The events passed are copies, so
+   use the event_remove_*() functions to change the list */
 void event_foreach( GFunc function, gpointer user_data );
 
 /* A textual representation of each event type */
 const char *event_name( int type );
 
+int event_unittest( void );
+
 /* Register the init and end functions */
 void event_register_startup( void );
 
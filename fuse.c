@@ -53,6 +53,7 @@
 #include <libxml/encoding.h>
 #endif
 
+#include "batch.h"
 #include "debugger/debugger.h"
 #include "debugger/gdbserver.h"
 #include "display.h"
@@ -95,6 +96,7 @@
 #include "pokefinder/pokemem.h"
 #include "profile.h"
 #include "psg.h"
+#include "rewind.h"
 #include "rzx.h"
 #include "screenshot.h"
 #include "settings.h"
@@ -107,6 +109,7 @@
 #include "ui/scaler/scaler.h"
 #include "ui/ui.h"
 #include "ui/uimedia.h"
+#include "unittests/benchmark.h"
 #include "unittests/unittests.h"
 #include "utils.h"
 
@@ -197,6 +200,10 @@ int main(int argc, char **argv)
 
   if( settings_current.unittests ) {
     r = unittests_run();
+  } else if( settings_current.benchmark ) {
+    r = benchmark_run();
+  } else if( settings_current.batch ) {
+    r = batch_run();
   } else {
     while( !fuse_exiting ) {
       z80_do_opcodes();
@@ -327,6 +334,7 @@ run_startup_manager( int *argc, char ***argv )
   printer_register_startup();
   profile_register_startup();
   psg_register_startup();
+  rewind_register_startup();
   rzx_register_startup();
   scld_register_startup();
   screenshot_register_startup();
@@ -386,6 +394,11 @@ static int fuse_init(int argc, char **argv)
     return 0;
   }
 
+  /* In batch mode, the files on the command line are the jobs to run, not
+     media to load, and the workers must be started before any threads */
+  if( settings_current.batch &&
+      batch_start( argc, argv, first_arg ) ) return 1;
+
   start_scaler = utils_safe_strdup( settings_current.start_scaler_mode );
 
   fuse_show_copyright();
@@ -399,7 +412,8 @@ static int fuse_init(int argc, char **argv)
   if( error ) return error;
 
   if( setup_start_files( &start_files ) ) return 1;
-  if( parse_nonoption_args( argc, argv, first_arg, &start_files ) ) return 1;
+  if( !settings_current.batch &&
+      parse_nonoption_args( argc, argv, first_arg, &start_files ) ) return 1;
   if( do_start_files( &start_files ) ) return 1;
 
 
@@ -958,6 +972,7 @@ static int fuse_end(void)
 
   periph_end();
   ui_end();
+  scaler_end();
   ui_media_drive_end();
   module_end();
   pokemem_end();
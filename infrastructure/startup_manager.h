@@ -59,6 +59,7 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_PRINTER,
   STARTUP_MANAGER_MODULE_PROFILE,
   STARTUP_MANAGER_MODULE_PSG,
+  STARTUP_MANAGER_MODULE_REWIND,
   STARTUP_MANAGER_MODULE_RZX,
   STARTUP_MANAGER_MODULE_SCLD,
   STARTUP_MANAGER_MODULE_SCREENSHOT,
@@ -50,6 +50,7 @@
 #include "ui/ui.h"
 #include "ui/uidisplay.h"
 #include "utils.h"
+#include "z80/z80.h"
 
 fuse_machine_info **machine_types = NULL; /* Array of available machines */
 int machine_count = 0;
@@ -362,6 +363,8 @@ machine_reset( int hard_reset )
     ula_contention_no_mreq[ i ] = machine_current->ram.contend_delay_no_mreq( i );
   }
 
+  z80_loop_select();
+
   /* Update the disk menu items */
   ui_menu_disk_update();
 
@@ -42,10 +42,6 @@
 #include "memory_pages.h"
 #include "module.h"
 #include "peripherals/disk/opus.h"
-#include "peripherals/spectranet.h"
-#include "peripherals/fs/xfs.h"
-#include "peripherals/nic/spectranext_config.h"
-#include "peripherals/ttx2000s.h"
 #include "peripherals/ula.h"
 #include "settings.h"
 #include "spectrum.h"
@@ -73,6 +69,12 @@ memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 /* Standard mappings for the ROMs */
 memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 
+/* Which chunks of the 'normal' RAM have been written to, and for whom */
+libspectrum_byte memory_ram_dirty[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
+
+/* Should snapshots include the 'normal' RAM? */
+int memory_snapshot_contents = 1;
+
 /* Some allocated memory */
 typedef struct memory_pool_entry_t {
   int persistent;
@@ -137,6 +139,7 @@ memory_init( void *context )
       page->offset = j * MEMORY_PAGE_SIZE;
       page->writable = 1;
       page->source = memory_source_ram;
+      page->dirty = &memory_ram_dirty[i * MEMORY_PAGES_IN_16K + j];
     }
 
   module_register( &memory_module_info );
@@ -372,6 +375,21 @@ memory_map_romcs_2k( libspectrum_word address, memory_page source[] )
   memory_map_2k_read_write( address, source, 0, 1, 1 );
 }
 
+/* Pass reads and writes of the 2K currently mapped at address to the given
+   handlers, for I/O devices which sit on top of other memory */
+void
+memory_map_mmio_2k( libspectrum_word address, memory_read_fn read,
+                    memory_write_fn write )
+{
+  int i;
+
+  for( i = 0; i < MEMORY_PAGES_IN_2K; i++ ) {
+    int page_offset = ( address >> MEMORY_PAGE_SIZE_LOGARITHM ) + i;
+    memory_map_read[ page_offset ].read = read;
+    memory_map_write[ page_offset ].write = write;
+  }
+}
+
 libspectrum_byte
 readbyte( libspectrum_word address )
 {
@@ -387,28 +405,7 @@ readbyte( libspectrum_word address )
   if( mapping->contended ) tstates += ula_contention[ tstates ];
   tstates += 3;
 
-  if( address < 0x4000 ) {
-    if( opus_active && address >= 0x2800 && address < 0x3800 )
-      return opus_read( address );
-
-    if( spectranet_paged ) {
-      if( spectranet_w5100_paged_a && address >= 0x1000 && address < 0x2000 )
-        return spectranet_w5100_read( mapping, address );
-      if( spectranet_w5100_paged_b && address >= 0x2000 && address < 0x3000 )
-        return spectranet_w5100_read( mapping, address );
-      if( spectranet_xfs_paged_a && address >= 0x1000 && address < 0x2000 )
-        return spectranet_xfs_read( mapping, address );
-      if( spectranet_xfs_paged_b && address >= 0x2000 && address < 0x3000 )
-        return spectranet_xfs_read( mapping, address );
-      if( spectranet_spectranext_config_paged_a && address >= 0x1000 && address < 0x2000 )
-        return spectranet_spectranext_config_read( mapping, address );
-      if( spectranet_spectranext_config_paged_b && address >= 0x2000 && address < 0x3000 )
-        return spectranet_spectranext_config_read( mapping, address );
-    }
-
-    if( ttx2000s_paged && address >= 0x2000 )
-        return ttx2000s_sram_read( address );
-  }
+  if( mapping->read ) return mapping->read( mapping, address );
 
   return mapping->page[ address & MEMORY_PAGE_SIZE_MASK ];
 }
@@ -487,46 +484,9 @@ writebyte_internal( libspectrum_word address, libspectrum_byte b )
 {
   libspectrum_word bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
   memory_page *mapping = &memory_map_write[ bank ];
-  
-  if( spectranet_paged ) {
-    /* all writes need to be parsed by the flash rom emulation */
-    spectranet_flash_rom_write(address, b);
-    
-    if( spectranet_w5100_paged_a && address >= 0x1000 && address < 0x2000 ) {
-      spectranet_w5100_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_w5100_paged_b && address >= 0x2000 && address < 0x3000 ) {
-      spectranet_w5100_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_xfs_paged_a && address >= 0x1000 && address < 0x2000 ) {
-      spectranet_xfs_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_xfs_paged_b && address >= 0x2000 && address < 0x3000 ) {
-      spectranet_xfs_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_spectranext_config_paged_a && address >= 0x1000 && address < 0x2000 ) {
-      spectranet_spectranext_config_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_spectranext_config_paged_b && address >= 0x2000 && address < 0x3000 ) {
-      spectranet_spectranext_config_write( mapping, address, b );
-      return;
-    }
-  }
-  
-  if( ttx2000s_paged ) {
-    if( address >= 0x2000 && address < 0x4000 ) {
-      ttx2000s_sram_write( address, b );
-      return;
-    }
-  }
 
-  if( opus_active && address >= 0x2800 && address < 0x3800 ) {
-    opus_write( address, b );
+  if( mapping->write ) {
+    mapping->write( mapping, address, b );
   } else if( mapping->writable ||
              (mapping->source != memory_source_none &&
               settings_current.writable_roms) ) {
@@ -536,9 +496,36 @@ writebyte_internal( libspectrum_word address, libspectrum_byte b )
     memory_display_dirty( address, b );
 
     memory[ offset ] = b;
+    if( mapping->dirty ) *mapping->dirty = MEMORY_RAM_DIRTY_ALL;
   }
 }
 
+void
+memory_ram_dirty_clear( libspectrum_byte flags )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( memory_ram_dirty ); i++ )
+    memory_ram_dirty[i] &= ~flags;
+}
+
+void
+memory_ram_dirty_all( libspectrum_byte flags )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( memory_ram_dirty ); i++ )
+    memory_ram_dirty[i] |= flags;
+}
+
+void
+memory_ram_dirty_mark( int page_num, libspectrum_word offset )
+{
+  memory_ram_dirty[ page_num * MEMORY_PAGES_IN_16K +
+                    ( ( offset & 0x3fff ) >> MEMORY_PAGE_SIZE_LOGARITHM ) ] =
+    MEMORY_RAM_DIRTY_ALL;
+}
+
 void
 memory_romcs_map( void )
 {
@@ -592,6 +579,8 @@ memory_from_snapshot( libspectrum_snap *snap )
     if( libspectrum_snap_pages( snap, i ) )
       memcpy( RAM[i], libspectrum_snap_pages( snap, i ), 0x4000 );
 
+  memory_ram_dirty_all( MEMORY_RAM_DIRTY_ALL );
+
   if( libspectrum_snap_custom_rom( snap ) ) {
     for( i = 0; i < libspectrum_snap_custom_rom_pages( snap ) && i < 4; i++ ) {
       if( libspectrum_snap_roms( snap, i ) ) {
@@ -692,7 +681,7 @@ memory_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_out_plus3_memoryport( snap,
 					     machine_current->ram.last_byte2 );
 
-  for( i = 0; i < 64; i++ ) {
+  for( i = 0; i < 64 && memory_snapshot_contents; i++ ) {
     if( RAM[i] != NULL ) {
 
       buffer = libspectrum_new( libspectrum_byte, 0x4000 );
@@ -44,6 +44,15 @@ extern int memory_source_exrom; /* Timex EXROM */
 extern int memory_source_any; /* Used by the debugger to signify an absolute address */
 extern int memory_source_none; /* No memory attached here */
 
+struct memory_page;
+
+/* Handlers for memory-mapped I/O */
+typedef libspectrum_byte
+  (*memory_read_fn)( struct memory_page *page, libspectrum_word address );
+typedef void
+  (*memory_write_fn)( struct memory_page *page, libspectrum_word address,
+                      libspectrum_byte b );
+
 typedef struct memory_page {
 
   libspectrum_byte *page;	/* The data for this page */
@@ -58,6 +67,16 @@ typedef struct memory_page {
   int page_num;			/* Which page from the source */
   libspectrum_word offset;	/* How far into the page this chunk starts */
 
+  /* If set, readbyte() and writebyte_internal() pass accesses to this
+     chunk to these functions rather than to `page', which instruction
+     fetches and the debugger still see */
+  memory_read_fn read;
+  memory_write_fn write;
+
+  /* If set, writebyte_internal() sets every flag here whenever it writes
+     to the chunk; see memory_ram_dirty[] */
+  libspectrum_byte *dirty;
+
 } memory_page;
 
 /* A memory page will be 1 << (this many) bytes in size
@@ -109,6 +128,28 @@ extern memory_page memory_map_write[MEMORY_PAGES_IN_64K];
 extern memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 extern memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 
+/* Which 2Kb chunks of RAM have been written to, indexed like
+   memory_map_ram[]. Each user has its own flag, which it resets with
+   memory_ram_dirty_clear() once it has stored the chunks it needs */
+extern libspectrum_byte
+  memory_ram_dirty[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
+
+#define MEMORY_RAM_DIRTY_RZX    ( 1 << 0 )	/* RZX autosaves */
+#define MEMORY_RAM_DIRTY_REWIND ( 1 << 1 )	/* The rewind buffer */
+#define MEMORY_RAM_DIRTY_ALL    0xff
+
+void memory_ram_dirty_clear( libspectrum_byte flags );
+void memory_ram_dirty_all( libspectrum_byte flags );
+
+/* Anything which writes to RAM[] other than via writebyte_internal() must
+   call this */
+void memory_ram_dirty_mark( int page_num, libspectrum_word offset );
+
+/* If zero, snapshots are taken without the contents of the 'normal' RAM,
+   or of peripheral RAM, flash and stock ROMs; see
+   snapshot_copy_to_without_memory() */
+extern int memory_snapshot_contents;
+
 /* Which RAM page contains the current screen */
 extern int memory_current_screen;
 
@@ -173,6 +214,9 @@ void memory_map_romcs_4k( libspectrum_word address, memory_page source[] );
 /* Page in 2K from /ROMCS */
 void memory_map_romcs_2k( libspectrum_word address, memory_page source[] );
 
+void memory_map_mmio_2k( libspectrum_word address, memory_read_fn read,
+                         memory_write_fn write );
+
 libspectrum_byte readbyte( libspectrum_word address );
 
 /* Use a macro for performance in the main core, but a function for
@@ -31,6 +31,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif	/* #ifdef HAVE_PTHREAD */
+
 #include "libspectrum.h"
 #ifdef HAVE_ZLIB_H
 #define ZLIB_CONST
@@ -47,6 +51,7 @@
 #include "screenshot.h"
 #include "settings.h"
 #include "sound.h"
+#include "timer/timer.h"
 #include "ui/ui.h"
 
 #undef MOVIE_DEBUG_PRINT
@@ -126,7 +131,6 @@ static libspectrum_byte head[8];
 static int freq = 0;
 static char stereo = 'M';
 static char format = '?';
-static int framesiz = 4;
 
 static libspectrum_byte sbuff[ 4096 ];
 #ifdef HAVE_ZLIB_H
@@ -138,6 +142,54 @@ static unsigned char zbuf_o[ ZBUF_SIZE ];
 
 static unsigned char alaw_table[2048 + 1] = { ALAW_ENC_TAB };
 
+/* The emulation thread just copies each frame's screen slices and sound
+   into one of a ring of frame buffers; the RLE and alaw encoding,
+   compression and file writes are done by an encoder thread (or straight
+   away if we don't have threads), in exactly the same order as they were
+   captured */
+#define MOVIE_FRAMES 8
+
+/* Enough for a full screen slice and a frame of sound */
+#define MOVIE_FRAME_SIZE 65536
+
+typedef enum movie_record_type {
+  MOVIE_RECORD_DATA,		/* Bytes to be written as is */
+  MOVIE_RECORD_AREA,		/* A screen slice, to be RLE compressed */
+  MOVIE_RECORD_SOUND,		/* Sound samples */
+} movie_record_type;
+
+typedef struct movie_record_t {
+  movie_record_type type;
+  int w, h, hires;		/* For screen slices */
+  int freq;			/* For sound, the format it was captured in */
+  char format, stereo;
+  size_t length;		/* Length of the data following */
+} movie_record_t;
+
+typedef struct movie_frame_t {
+  libspectrum_byte *data;
+  size_t used, allocated;
+} movie_frame_t;
+
+static movie_frame_t frames[ MOVIE_FRAMES ];
+
+/* The next frame to be captured and the next to be encoded */
+static size_t frame_fill, frame_encode, frames_queued;
+
+/* How often, and for how long, capture has had to wait for the encoder */
+static struct {
+  int frames, stalls, max_queued;
+  double stall_time;
+} movie_stats;
+
+#ifdef HAVE_PTHREAD
+static pthread_t encoder_thread;
+static pthread_mutex_t encoder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t frame_encoded_cond = PTHREAD_COND_INITIALIZER;
+static int encoder_running = 0, encoder_stopping = 0;
+#endif	/* #ifdef HAVE_PTHREAD */
+
 void movie_start_frame( void );
 void movie_init_sound( int f, int s );
 
@@ -212,19 +264,52 @@ fwrite_compr( const void *b, size_t n, size_t m, FILE *f )
 #define fwrite_compr fwrite
 #endif	/* HAVE_ZLIB_H */
 
+/* Add a record with `length' bytes of data to the frame being captured,
+   returning where to put the data */
+static void*
+record_add( movie_record_type type, size_t length )
+{
+  movie_frame_t *frame = &frames[ frame_fill ];
+  movie_record_t *record;
+  size_t needed;
+
+  /* Keep the records aligned */
+  needed = frame->used + sizeof( movie_record_t ) +
+           ( ( length + 7 ) & ~(size_t)7 );
+
+  if( needed > frame->allocated ) {
+    while( needed > frame->allocated ) frame->allocated *= 2;
+    frame->data = libspectrum_renew( libspectrum_byte, frame->data,
+                                     frame->allocated );
+  }
+
+  record = (movie_record_t*)( frame->data + frame->used );
+  record->type = type;
+  record->length = length;
+  frame->used = needed;
+
+  return record + 1;
+}
+
+static void
+record_data( const void *data, size_t length )
+{
+  memcpy( record_add( MOVIE_RECORD_DATA, length ), data, length );
+}
+
 static void
-movie_compress_area( int x, int y, int w, int h, int s )
+movie_compress_area( const libspectrum_dword *area, int w, int h, int s )
 {
-  libspectrum_dword *dpoint, *dline;
+  const libspectrum_dword *dpoint, *dline;
   libspectrum_byte d, d1, *b;
   libspectrum_byte buff[ 960 ];
   int w0, h0, l;
 
-  dline = &display_last_screen[x + 40 * y];
+  dline = area;
   b = buff; l = -1;
   d1 = ( ( *dline >> s ) & 0xff ) + 1;		/* *d1 != dpoint :-) */
 
-  for( h0 = h; h0 > 0; h0--, dline += 40 ) {
+  for( h0 = h; h0 > 0; h0--, dline += w ) {
     dpoint = dline;
     for( w0 = w; w0 > 0; w0--, dpoint++) {
       d = ( *dpoint >> s ) & 0xff;	/* bitmask1 */
@@ -270,6 +355,10 @@ movie_compress_area( int x, int y, int w, int h, int s )
 void
 movie_add_area( int x, int y, int w, int h )
 {
+  movie_record_t *record;
+  libspectrum_dword *area;
+  int i;
+
   if( movie_paused ) {
     movie_start_frame();
     return;
@@ -281,22 +370,262 @@ movie_add_area( int x, int y, int w, int h )
   head[4] = w;
   head[5] = h & 0xff;
   head[6] = h >> 8;
-  fwrite_compr( head, 7, 1, of );
-  movie_compress_area( x, y, w, h, 0 );	/* Bitmap1 */
-  movie_compress_area( x, y, w, h, 8 );	/* Attrib/B2 */
-  if( fmf_screen == 'R' ) {
-    movie_compress_area( x, y, w, h, 16 );	/* HiRes attrib */
-  }
+  record_data( head, 7 );
+
+  /* Take a copy of the slice for the encoder */
+  area = record_add( MOVIE_RECORD_AREA, w * h * sizeof( *area ) );
+  record = (movie_record_t*)area - 1;
+  record->w = w;
+  record->h = h;
+  record->hires = fmf_screen == 'R';
+  for( i = 0; i < h; i++ )
+    memcpy( area + i * w, &display_last_screen[ x + 40 * ( y + i ) ],
+            w * sizeof( *area ) );
+
   slice_no++;
 }
 
 static void
+movie_encode_area( movie_record_t *record )
+{
+  const libspectrum_dword *area = (const libspectrum_dword*)( record + 1 );
+
+  movie_compress_area( area, record->w, record->h, 0 );	/* Bitmap1 */
+  movie_compress_area( area, record->w, record->h, 8 );	/* Attrib/B2 */
+  if( record->hires ) {
+    movie_compress_area( area, record->w, record->h, 16 );	/* HiRes attrib */
+  }
+}
+
+static inline void
+write_alaw( libspectrum_signed_word *buff, int len )
+{
+  int i = 0;
+  while( len-- ) {  
+    if( *buff >= 0)
+      sbuff[i++] = alaw_table[*buff >> 4];
+    else
+      sbuff[i++] = 0x7f & alaw_table [- *buff >> 4];
+    buff++;
+    if( i == 4096 ) {
+      i = 0;
+      fwrite_compr( sbuff, 4096, 1, of );	/* write frame */
+    }
+  }
+  if( i )
+    fwrite_compr( sbuff, i, 1, of );	/* write remaind */
+}
+
+static void
+add_sound( const movie_record_t *record, libspectrum_signed_word *buff,
+           int len )
+{
+  libspectrum_byte sound_head[7];
+  int framesiz = ( record->stereo == 'S' ? 2 : 1 ) *
+                 ( record->format == 'P' ? 2 : 1 );
+
+  sound_head[0] = 'S';	/* sound frame */
+  sound_head[1] = record->format;	/* sound format */
+  sound_head[2] = record->freq & 0xff;
+  sound_head[3] = record->freq >> 8;
+  sound_head[4] = record->stereo;
+  len--;		/*len - 1*/
+  sound_head[5] = len & 0xff;
+  sound_head[6] = len >> 8;
+  len++;		/* len :-) */
+  fwrite_compr( sound_head, 7, 1, of );	/* Sound frame */
+  if( record->format == 'P' )
+    fwrite_compr( buff, len * framesiz , 1, of );	/* write frame */
+  else if( record->format == 'A' )
+    write_alaw( buff, len * framesiz );
+}
+
+static void
+movie_encode_sound( movie_record_t *record )
+{
+  libspectrum_signed_word *buff = (libspectrum_signed_word*)( record + 1 );
+  int len = record->length / sizeof( *buff );
+
+  while( len ) {
+    if( record->stereo == 'S' ) {
+      add_sound( record, buff, len > 131072 ? 65536 : len >> 1 );
+      buff += len > 131072 ? 131072 : len;
+      len -= len > 131072 ? 131072 : len;
+    } else {
+      add_sound( record, buff, len > 65536 ? 65536 : len );
+      buff += len > 65536 ? 65536 : len;
+      len -= len > 65536 ? 65536 : len;
+    }
+  }
+}
+
+void
+movie_add_sound( libspectrum_signed_word *buff, int len )
+{
+  libspectrum_signed_word *samples;
+  movie_record_t *record;
+
+  samples = record_add( MOVIE_RECORD_SOUND, len * sizeof( *buff ) );
+  record = (movie_record_t*)samples - 1;
+  record->format = format;
+  record->freq = freq;
+  record->stereo = stereo;
+  memcpy( samples, buff, len * sizeof( *buff ) );
+}
+
+/* Encode and write everything captured in a frame */
+static void
+movie_encode_frame( movie_frame_t *frame )
+{
+  size_t offset = 0;
+
+  while( offset < frame->used ) {
+    movie_record_t *record = (movie_record_t*)( frame->data + offset );
+
+    switch( record->type ) {
+    case MOVIE_RECORD_DATA:
+      fwrite_compr( record + 1, record->length, 1, of );
+      break;
+    case MOVIE_RECORD_AREA:
+      movie_encode_area( record );
+      break;
+    case MOVIE_RECORD_SOUND:
+      movie_encode_sound( record );
+      break;
+    }
+
+    offset += sizeof( movie_record_t ) + ( ( record->length + 7 ) & ~(size_t)7 );
+  }
+
+  frame->used = 0;
+}
+
+#ifdef HAVE_PTHREAD
+
+static void*
+movie_encoder( void *arg GCC_UNUSED )
+{
+  pthread_mutex_lock( &encoder_mutex );
+
+  while( 1 ) {
+    movie_frame_t *frame;
+
+    while( !frames_queued && !encoder_stopping )
+      pthread_cond_wait( &frame_queued_cond, &encoder_mutex );
+
+    if( !frames_queued ) break;
+
+    /* The capture side won't touch a queued frame, so it can be encoded
+       without holding the lock */
+    frame = &frames[ frame_encode ];
+    pthread_mutex_unlock( &encoder_mutex );
+
+    movie_encode_frame( frame );
+
+    pthread_mutex_lock( &encoder_mutex );
+    frame_encode = ( frame_encode + 1 ) % MOVIE_FRAMES;
+    frames_queued--;
+    pthread_cond_signal( &frame_encoded_cond );
+  }
+
+  pthread_mutex_unlock( &encoder_mutex );
+
+  return NULL;
+}
+
+#endif	/* #ifdef HAVE_PTHREAD */
+
+/* Hand the frame which has been captured over to be encoded, and get the
+   next one ready */
+static void
+movie_queue_frame( void )
+{
+  if( !frames[ frame_fill ].used ) return;
+
+  movie_stats.frames++;
+
+#ifdef HAVE_PTHREAD
+  if( encoder_running ) {
+    pthread_mutex_lock( &encoder_mutex );
+
+    frame_fill = ( frame_fill + 1 ) % MOVIE_FRAMES;
+    frames_queued++;
+    if( (int)frames_queued > movie_stats.max_queued )
+      movie_stats.max_queued = frames_queued;
+    pthread_cond_signal( &frame_queued_cond );
+
+    /* Every buffer is full, so we have to wait for the encoder to catch
+       up */
+    if( frames_queued == MOVIE_FRAMES ) {
+      double start = timer_get_time();
+
+      movie_stats.stalls++;
+      while( frames_queued == MOVIE_FRAMES )
+        pthread_cond_wait( &frame_encoded_cond, &encoder_mutex );
+      movie_stats.stall_time += timer_get_time() - start;
+    }
+
+    pthread_mutex_unlock( &encoder_mutex );
+    return;
+  }
+#endif	/* #ifdef HAVE_PTHREAD */
+
+  movie_encode_frame( &frames[ frame_fill ] );
+}
+
+static void
+movie_encoder_start( void )
+{
+  size_t i;
+
+  for( i = 0; i < MOVIE_FRAMES; i++ ) {
+    frames[i].allocated = MOVIE_FRAME_SIZE;
+    frames[i].data = libspectrum_new( libspectrum_byte, frames[i].allocated );
+    frames[i].used = 0;
+  }
+  frame_fill = frame_encode = frames_queued = 0;
+  memset( &movie_stats, 0, sizeof( movie_stats ) );
+
+#ifdef HAVE_PTHREAD
+  encoder_stopping = 0;
+  encoder_running = !pthread_create( &encoder_thread, NULL, movie_encoder,
+                                     NULL );
+#endif	/* #ifdef HAVE_PTHREAD */
+}
+
+/* Write out everything which has been captured */
+static void
+movie_encoder_stop( void )
+{
+  size_t i;
+
+  movie_queue_frame();
+
+#ifdef HAVE_PTHREAD
+  if( encoder_running ) {
+    pthread_mutex_lock( &encoder_mutex );
+    encoder_stopping = 1;
+    pthread_cond_signal( &frame_queued_cond );
+    pthread_mutex_unlock( &encoder_mutex );
+
+    pthread_join( encoder_thread, NULL );
+    encoder_running = 0;
+  }
+#endif	/* #ifdef HAVE_PTHREAD */
+
+  for( i = 0; i < MOVIE_FRAMES; i++ ) {
+    libspectrum_free( frames[i].data );
+    frames[i].data = NULL;
+  }
+}
+
+static int
 movie_start_fmf( const char *name )
 {
   if( ( of = fopen(name, "wb") ) == NULL ) {  /* trunc old file ? or append ? */
     ui_error( UI_ERROR_ERROR, "error opening movie file '%s': %s", name,
               strerror( errno ) );
-    return;
+    return 1;
   }
 #ifdef WORDS_BIGENDIAN
   fwrite( "FMF_V1E", 7, 1, of );	/* write magic header Fuse Movie File */
@@ -333,7 +662,10 @@ movie_start_fmf( const char *name )
   head[6] = stereo;
   head[7] = '\n';	/* padding */
   fwrite( head, 8, 1, of );		/* write initial params */
+  movie_encoder_start();
   movie_add_area( 0, 0, 40, 240 );
+
+  return 0;
 }
 
 void
@@ -343,7 +675,7 @@ movie_start( const char *name )	/* some init, open file (name)*/
   if( name == NULL || *name == '\0' )
     name = "fuse.fmf";			/* fuse movie file */
 
-  movie_start_fmf( name );
+  if( movie_start_fmf( name ) ) return;
   movie_recording = 1;
   ui_menu_activate( UI_MENU_ITEM_FILE_MOVIE_RECORDING, 1 );
   ui_menu_activate( UI_MENU_ITEM_FILE_MOVIE_PAUSE, 1 );
@@ -354,7 +686,8 @@ movie_stop( void )
 {
   if( !movie_paused && !movie_recording ) return;
 
-  fwrite_compr( "X", 1, 1, of );	/* End of Recording! */
+  record_data( "X", 1 );		/* End of Recording! */
+  movie_encoder_stop();
 #ifdef HAVE_ZLIB_H
   {
     if( fmf_compr != 0 ) {		/* close zlib */
@@ -378,6 +711,10 @@ movie_stop( void )
   }
 #ifdef MOVIE_DEBUG_PRINT
   fprintf( stderr, "Debug movie: saved %d.%d frame(.slice)\n", frame_no, slice_no );
+  fprintf( stderr, "Debug movie: %d frames encoded, at most %d queued, "
+           "waited for the encoder %d times (%.3f s)\n", movie_stats.frames,
+           movie_stats.max_queued, movie_stats.stalls,
+           movie_stats.stall_time );
 #endif 	/* MOVIE_DEBUG_PRINT */
   movie_recording = 0;
   movie_paused = 0;
@@ -407,72 +744,20 @@ movie_init_sound( int f, int s )
   format = option_enumerate_movie_movie_compr() == 2 ? 'A' : 'P';
   freq = f;
   stereo = ( s ? 'S' : 'M' );
-  framesiz = ( stereo == 'S' ? 2 : 1 ) * ( format == 'P' ? 2 : 1 );
-}
-
-static inline void
-write_alaw( libspectrum_signed_word *buff, int len )
-{
-  int i = 0;
-  while( len-- ) {  
-    if( *buff >= 0)
-      sbuff[i++] = alaw_table[*buff >> 4];
-    else
-      sbuff[i++] = 0x7f & alaw_table [- *buff >> 4];
-    buff++;
-    if( i == 4096 ) {
-      i = 0;
-      fwrite_compr( sbuff, 4096, 1, of );	/* write frame */
-    }
-  }
-  if( i )
-    fwrite_compr( sbuff, i, 1, of );	/* write remaind */
-}
-
-static void
-add_sound( libspectrum_signed_word *buff, int len )
-{
-  head[0] = 'S';	/* sound frame */
-  head[1] = format;	/* sound format */
-  head[2] = freq & 0xff;
-  head[3] = freq >> 8;
-  head[4] = stereo;
-  len--;		/*len - 1*/
-  head[5] = len & 0xff;
-  head[6] = len >> 8;
-  len++;		/* len :-) */
-  fwrite_compr( head, 7, 1, of );	/* Sound frame */
-  if( format == 'P' )
-    fwrite_compr( buff, len * framesiz , 1, of );	/* write frame */
-  else if( format == 'A' )
-    write_alaw( buff, len * framesiz );
-}
-
-void
-movie_add_sound( libspectrum_signed_word *buff, int len )
-{
-  while( len ) {
-    if( stereo == 'S' ) {
-      add_sound( buff, len > 131072 ? 65536 : len >> 1 );
-      buff += len > 131072 ? 131072 : len;
-      len -= len > 131072 ? 131072 : len;
-    } else {
-      add_sound( buff, len > 65536 ? 65536 : len );
-      buff += len > 65536 ? 65536 : len;
-      len -= len > 65536 ? 65536 : len;
-    }
-  }
 }
 
 void
 movie_start_frame( void )
 {
+  /* The previous frame is complete */
+  movie_queue_frame();
+
   /* $ - ZX$, T - TX$, C - HiCol, R - HiRes */
   head[0] = 'N';
   head[1] = settings_current.frame_rate;
   head[2] = get_screentype();
   head[3] = get_timing();
-  fwrite_compr( head, 4, 1, of );	/* New frame! */
+  record_data( head, 4 );	/* New frame! */
   frame_no++;
   if( movie_paused ) {
     movie_paused = 0;
@@ -24,6 +24,9 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "libspectrum.h"
 
 #include "debugger/debugger.h"
@@ -64,6 +67,25 @@ typedef struct periph_port_private_t {
 /* The list of currently active ports */
 static GSList *ports = NULL;
 
+/* Port decoding table, built from `ports' so that each port access calls
+   only the handlers which actually respond to that port */
+typedef struct port_decode_t {
+  /* For each port, the index into `lists' of its handlers */
+  libspectrum_word *list;
+  /* The distinct lists of handlers; each is terminated by an entry with
+     no read or write function */
+  periph_port_t **lists;
+  size_t list_count;
+  /* The storage for all the lists */
+  periph_port_t *handlers;
+} port_decode_t;
+
+static port_decode_t read_decode, write_decode;
+
+/* Set whenever `ports' changes; the tables are rebuilt on the next port
+   access */
+static int decode_dirty = 1;
+
 /* The strings used for debugger events */
 static const char * const page_event_string = "page",
   * const unpage_event_string = "unpage";
@@ -80,6 +102,7 @@ port_register( periph_type type, const periph_port_t *port )
   private->port = *port;
 
   ports = g_slist_append( ports, private );
+  decode_dirty = 1;
 }
 
 /* Register a peripheral with the system */
@@ -134,8 +157,12 @@ periph_activate_type( periph_type type, int active )
       port_register( type, ptr );
   } else {
     GSList *found;
-    while( ( found = g_slist_find_custom( ports, GINT_TO_POINTER( type ), find_by_type ) ) != NULL )
-      ports = g_slist_remove( ports, found->data );
+    while( ( found = g_slist_find_custom( ports, GINT_TO_POINTER( type ), find_by_type ) ) != NULL ) {
+      periph_port_private_t *port_private = found->data;
+      ports = g_slist_remove( ports, port_private );
+      libspectrum_free( port_private );
+    }
+    decode_dirty = 1;
   }
 
   return 1;
@@ -215,6 +242,169 @@ free_peripheral( gpointer data, gpointer user_data GCC_UNUSED )
   libspectrum_free( private );
 }
 
+/* The set of handlers which respond to one port, as a bitmap of
+   positions in the list of candidate handlers */
+static size_t decode_set_words;
+
+static guint
+decode_set_hash( gconstpointer key )
+{
+  const libspectrum_dword *set = key;
+  guint hash = 2166136261U;
+  size_t i;
+
+  for( i = 0; i < decode_set_words; i++ ) hash = ( hash ^ set[i] ) * 16777619U;
+
+  return hash;
+}
+
+static gboolean
+decode_set_equal( gconstpointer a, gconstpointer b )
+{
+  return !memcmp( a, b, decode_set_words * sizeof( libspectrum_dword ) );
+}
+
+static void
+port_decode_free( port_decode_t *decode )
+{
+  libspectrum_free( decode->list ); decode->list = NULL;
+  libspectrum_free( decode->lists ); decode->lists = NULL;
+  libspectrum_free( decode->handlers ); decode->handlers = NULL;
+  decode->list_count = 0;
+}
+
+/* Build the decoding table for either the read or the write handlers */
+static void
+port_decode_build( port_decode_t *decode, int write )
+{
+  periph_port_t *candidates;
+  libspectrum_dword *set, **sets;
+  size_t candidate_count = 0, handler_count = 0, i, j;
+  GHashTable *seen;
+  GSList *ptr;
+  periph_port_t *handler;
+  int port;
+
+  port_decode_free( decode );
+
+  candidates = libspectrum_new( periph_port_t, g_slist_length( ports ) + 1 );
+  for( ptr = ports; ptr; ptr = ptr->next ) {
+    const periph_port_t *port_info = &( (periph_port_private_t*)ptr->data )->port;
+    if( write ? port_info->write != NULL : port_info->read != NULL )
+      candidates[ candidate_count++ ] = *port_info;
+  }
+
+  decode_set_words = candidate_count / 32 + 1;
+  seen = g_hash_table_new( decode_set_hash, decode_set_equal );
+
+  decode->list = libspectrum_new( libspectrum_word, 0x10000 );
+  sets = libspectrum_new( libspectrum_dword*, 0x10000 );
+  set = libspectrum_new( libspectrum_dword, decode_set_words );
+
+  for( port = 0; port < 0x10000; port++ ) {
+    gpointer index;
+
+    memset( set, 0, decode_set_words * sizeof( *set ) );
+    for( i = 0; i < candidate_count; i++ )
+      if( ( port & candidates[i].mask ) == candidates[i].value )
+        set[ i / 32 ] |= 1U << ( i % 32 );
+
+    index = g_hash_table_lookup( seen, set );
+    if( !index ) {
+      sets[ decode->list_count ] = set;
+      index = GINT_TO_POINTER( ++decode->list_count );
+      g_hash_table_insert( seen, set, index );
+      set = libspectrum_new( libspectrum_dword, decode_set_words );
+    }
+
+    decode->list[ port ] = GPOINTER_TO_INT( index ) - 1;
+  }
+
+  g_hash_table_destroy( seen );
+  libspectrum_free( set );
+
+  /* Lay out each distinct list, keeping the original handler order */
+  for( i = 0; i < decode->list_count; i++ ) {
+    for( j = 0; j < candidate_count; j++ )
+      if( sets[i][ j / 32 ] & ( 1U << ( j % 32 ) ) ) handler_count++;
+    handler_count++;
+  }
+
+  decode->lists = libspectrum_new( periph_port_t*, decode->list_count );
+  decode->handlers = libspectrum_new0( periph_port_t, handler_count );
+
+  handler = decode->handlers;
+  for( i = 0; i < decode->list_count; i++ ) {
+    decode->lists[i] = handler;
+    for( j = 0; j < candidate_count; j++ )
+      if( sets[i][ j / 32 ] & ( 1U << ( j % 32 ) ) ) *handler++ = candidates[j];
+    handler++;		/* The zeroed terminator */
+    libspectrum_free( sets[i] );
+  }
+
+  libspectrum_free( sets );
+  libspectrum_free( candidates );
+}
+
+static void
+port_decode_update( void )
+{
+  port_decode_build( &read_decode, 0 );
+  port_decode_build( &write_decode, 1 );
+  decode_dirty = 0;
+}
+
+/* Check the decoding tables call exactly the handlers a walk of the full
+   list of ports would, in the same order */
+static int
+port_decode_check( const port_decode_t *decode, int write )
+{
+  int port;
+
+  for( port = 0; port < 0x10000; port++ ) {
+    const periph_port_t *handler = decode->lists[ decode->list[ port ] ];
+    GSList *ptr;
+
+    for( ptr = ports; ptr; ptr = ptr->next ) {
+      const periph_port_t *port_info =
+        &( (periph_port_private_t*)ptr->data )->port;
+
+      if( !( write ? port_info->write != NULL : port_info->read != NULL ) ||
+          ( port & port_info->mask ) != port_info->value )
+        continue;
+
+      if( handler->mask != port_info->mask ||
+          handler->value != port_info->value ||
+          handler->read != port_info->read ||
+          handler->write != port_info->write )
+        break;
+
+      handler++;
+    }
+
+    if( ptr || ( write ? handler->write != NULL : handler->read != NULL ) ) {
+      printf( "%s: port decode test: wrong %s handlers for port 0x%04x\n",
+              fuse_progname, write ? "write" : "read", port );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int
+periph_unittest( void )
+{
+  int r = 0;
+
+  if( decode_dirty ) port_decode_update();
+
+  r += port_decode_check( &read_decode, 0 );
+  r += port_decode_check( &write_decode, 1 );
+
+  return r;
+}
+
 /* Make a peripheral as being never present on this machine */
 static void
 set_type_inactive( gpointer key, gpointer value, gpointer user_data )
@@ -238,6 +428,7 @@ periph_clear( void )
   g_slist_foreach( ports, free_peripheral, NULL );
   g_slist_free( ports );
   ports = NULL;
+  decode_dirty = 1;
   set_types_inactive();
 }
 
@@ -251,21 +442,16 @@ periph_end( void )
 
   g_hash_table_destroy( peripherals );
   peripherals = NULL;
+
+  port_decode_free( &read_decode );
+  port_decode_free( &write_decode );
+  decode_dirty = 1;
 }
 
 /*
  * The actual routines to read and write a port
  */
 
-/* Internal type used for passing to read_peripheral and write_peripheral */
-struct peripheral_data_t {
-
-  libspectrum_word port;
-
-  libspectrum_byte attached;
-  libspectrum_byte value;
-};
-
 /* Read a byte from a port, taking the appropriate time */
 libspectrum_byte
 readport( libspectrum_word port )
@@ -288,30 +474,12 @@ readport( libspectrum_word port )
   return b;
 }
 
-/* Read a byte from a specific port response */
-static void
-read_peripheral( gpointer data, gpointer user_data )
-{
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
-  libspectrum_byte last_attached;
-
-  periph_port_t *port = &( private->port );
-
-  if( port->read &&
-      ( ( callback_info->port & port->mask ) == port->value ) ) {
-    last_attached = callback_info->attached;
-    callback_info->value &= (   port->read( callback_info->port,
-					    &( callback_info->attached ) )
-			      | last_attached );
-  }
-}
-
 /* Read a byte from a port, taking no time */
 libspectrum_byte
 readport_internal( libspectrum_word port )
 {
-  struct peripheral_data_t callback_info;
+  const periph_port_t *handler;
+  libspectrum_byte attached, value;
 
   /* Trigger the debugger if wanted */
   if( debugger_mode != DEBUGGER_MODE_INACTIVE )
@@ -321,9 +489,9 @@ readport_internal( libspectrum_word port )
   if( rzx_playback ) {
 
     libspectrum_error error;
-    libspectrum_byte value;
+    libspectrum_byte rzx_value;
 
-    error = libspectrum_rzx_playback( rzx, &value );
+    error = libspectrum_rzx_playback( rzx, &rzx_value );
     if( error ) {
       rzx_stop_playback( 1 );
 
@@ -333,25 +501,29 @@ readport_internal( libspectrum_word port )
       return readport_internal( port );
     }
 
-    return value;
+    return rzx_value;
   }
 
   /* If we're not doing RZX playback, get the byte normally */
-  callback_info.port = port;
-  callback_info.attached = 0x00;
-  callback_info.value = 0xff;
+  attached = 0x00;
+  value = 0xff;
+
+  if( decode_dirty ) port_decode_update();
 
-  g_slist_foreach( ports, read_peripheral, &callback_info );
+  for( handler = read_decode.lists[ read_decode.list[ port ] ];
+       handler->read; handler++ ) {
+    libspectrum_byte last_attached = attached;
+    value &= handler->read( port, &attached ) | last_attached;
+  }
 
-  if( callback_info.attached != 0xff )
-    callback_info.value =
-      periph_merge_floating_bus( callback_info.value, callback_info.attached,
-                                 machine_current->unattached_port() );
+  if( attached != 0xff )
+    value = periph_merge_floating_bus( value, attached,
+                                       machine_current->unattached_port() );
 
   /* If we're RZX recording, store this byte */
-  if( rzx_recording ) rzx_store_byte( callback_info.value );
+  if( rzx_recording ) rzx_store_byte( value );
 
-  return callback_info.value;
+  return value;
 }
 
 /* Merge the read value with the floating bus. Deliberately doesn't take
@@ -372,34 +544,21 @@ writeport( libspectrum_word port, libspectrum_byte b )
   ula_contend_port_late( port ); tstates++;
 }
 
-/* Write a byte to a specific port response */
-static void
-write_peripheral( gpointer data, gpointer user_data )
-{
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
-
-  periph_port_t *port = &( private->port );
-  
-  if( port->write &&
-      ( ( callback_info->port & port->mask ) == port->value ) )
-    port->write( callback_info->port, callback_info->value );
-}
-
 /* Write a byte to a port, taking no time */
 void
 writeport_internal( libspectrum_word port, libspectrum_byte b )
 {
-  struct peripheral_data_t callback_info;
+  const periph_port_t *handler;
 
   /* Trigger the debugger if wanted */
   if( debugger_mode != DEBUGGER_MODE_INACTIVE )
     debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE, port );
 
-  callback_info.port = port;
-  callback_info.value = b;
-  
-  g_slist_foreach( ports, write_peripheral, &callback_info );
+  if( decode_dirty ) port_decode_update();
+
+  for( handler = write_decode.lists[ write_decode.list[ port ] ];
+       handler->write; handler++ )
+    handler->write( port, b );
 }
 
 /*
@@ -45,6 +45,7 @@
 #include "event.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "settings.h"
 #include "ui/ui.h"
@@ -470,16 +471,19 @@ beta_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_beta_active( snap, 1 );
 
-  buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
+  if( memory_snapshot_contents ||
+      beta_memory_map_romcs[0].save_to_snapshot ) {
+    buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
 
-  for( i = 0; i < MEMORY_PAGES_IN_16K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            beta_memory_map_romcs[ i ].page, MEMORY_PAGE_SIZE );
+    for( i = 0; i < MEMORY_PAGES_IN_16K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              beta_memory_map_romcs[ i ].page, MEMORY_PAGE_SIZE );
 
-  libspectrum_snap_set_beta_rom( snap, 0, buffer );
+    libspectrum_snap_set_beta_rom( snap, 0, buffer );
 
-  if( beta_memory_map_romcs[0].save_to_snapshot )
-    libspectrum_snap_set_beta_custom_rom( snap, 1 );
+    if( beta_memory_map_romcs[0].save_to_snapshot )
+      libspectrum_snap_set_beta_custom_rom( snap, 1 );
+  }
 
   drive_count++; /* Drive A is not removable */
   if( option_enumerate_diskoptions_drive_beta128b_type() > 0 ) drive_count++;
@@ -35,6 +35,7 @@
 #include "didaktik.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "peripherals/printer.h"
 #include "settings.h"
@@ -522,26 +523,31 @@ didaktik_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_didaktik80_active( snap, 1 );
 
-  memory_length = ROM_SIZE;
+  if( memory_snapshot_contents ||
+      didaktik_memory_map_romcs_rom[0].save_to_snapshot ) {
+    memory_length = ROM_SIZE;
 
-  libspectrum_snap_set_didaktik80_custom_rom( snap, 1 );
-  libspectrum_snap_set_didaktik80_rom_length( snap, 0, memory_length );
+    libspectrum_snap_set_didaktik80_custom_rom( snap, 1 );
+    libspectrum_snap_set_didaktik80_rom_length( snap, 0, memory_length );
 
-  buffer = libspectrum_new( libspectrum_byte, memory_length );
+    buffer = libspectrum_new( libspectrum_byte, memory_length );
 
-  for( i = 0; i < MEMORY_PAGES_IN_14K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            didaktik_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
+    for( i = 0; i < MEMORY_PAGES_IN_14K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              didaktik_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
 
-  libspectrum_snap_set_didaktik80_rom( snap, 0, buffer );
+    libspectrum_snap_set_didaktik80_rom( snap, 0, buffer );
+  }
 
-  memory_length = RAM_SIZE;
-  buffer = libspectrum_new( libspectrum_byte, memory_length );
+  if( memory_snapshot_contents ) {
+    memory_length = RAM_SIZE;
+    buffer = libspectrum_new( libspectrum_byte, memory_length );
 
-  for( i = 0; i < MEMORY_PAGES_IN_2K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            didaktik_memory_map_romcs_ram[ i ].page, MEMORY_PAGE_SIZE );
-  libspectrum_snap_set_didaktik80_ram( snap, 0, buffer );
+    for( i = 0; i < MEMORY_PAGES_IN_2K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              didaktik_memory_map_romcs_ram[ i ].page, MEMORY_PAGE_SIZE );
+    libspectrum_snap_set_didaktik80_ram( snap, 0, buffer );
+  }
 
   drive_count++; /* Drive 1 is not removable */
   if( option_enumerate_diskoptions_drive_didaktik80b_type() > 0 ) drive_count++;
@@ -35,6 +35,7 @@
 #include "disciple.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "peripherals/printer.h"
 #include "settings.h"
@@ -661,25 +662,30 @@ disciple_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_disciple_active( snap, 1 );
 
-  /* Always save ROM to snapshot to ensure any loading emulator has the matching
-     image */
-  libspectrum_snap_set_disciple_custom_rom( snap, 1 );
-  libspectrum_snap_set_disciple_rom_length( snap, 0, ROM_SIZE );
+  if( memory_snapshot_contents ||
+      disciple_memory_map_romcs_rom[0].save_to_snapshot ) {
+    /* Always save ROM to snapshot to ensure any loading emulator has the
+       matching image */
+    libspectrum_snap_set_disciple_custom_rom( snap, 1 );
+    libspectrum_snap_set_disciple_rom_length( snap, 0, ROM_SIZE );
 
-  buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
+    buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
 
-  for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            disciple_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
+    for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              disciple_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
 
-  libspectrum_snap_set_disciple_rom( snap, 0, buffer );
+    libspectrum_snap_set_disciple_rom( snap, 0, buffer );
+  }
 
-  buffer = libspectrum_new( libspectrum_byte, RAM_SIZE );
+  if( memory_snapshot_contents ) {
+    buffer = libspectrum_new( libspectrum_byte, RAM_SIZE );
 
-  for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            disciple_memory_map_romcs_ram[ i ].page, MEMORY_PAGE_SIZE );
-  libspectrum_snap_set_disciple_ram( snap, 0, buffer );
+    for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              disciple_memory_map_romcs_ram[ i ].page, MEMORY_PAGE_SIZE );
+    libspectrum_snap_set_disciple_ram( snap, 0, buffer );
+  }
 
   drive_count++; /* Drive 1 is not removable */
   if( option_enumerate_diskoptions_drive_disciple2_type() > 0 ) drive_count++;
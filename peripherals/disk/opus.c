@@ -34,6 +34,7 @@
 #include "debugger/debugger.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "opus.h"
 #include "peripherals/printer.h"
@@ -72,6 +73,10 @@ static libspectrum_byte data_reg_b, data_dir_b, control_b;
 
 static void opus_reset( int hard_reset );
 static void opus_memory_map( void );
+static libspectrum_byte opus_read( memory_page *page,
+                                   libspectrum_word address );
+static void opus_write( memory_page *page, libspectrum_word address,
+                        libspectrum_byte b );
 static void opus_enabled_snapshot( libspectrum_snap *snap );
 static void opus_from_snapshot( libspectrum_snap *snap );
 static void opus_to_snapshot( libspectrum_snap *snap );
@@ -123,6 +128,10 @@ opus_memory_map( void )
   memory_map_romcs_8k( 0x0000, opus_memory_map_romcs_rom );
   memory_map_romcs_2k( 0x2000, opus_memory_map_romcs_ram );
   /* FIXME: should we add mirroring at 0x2800, 0x3000 and/or 0x3800? */
+
+  /* The FDC and the PIA sit on top of whatever is at 0x2800 to 0x37ff */
+  memory_map_mmio_2k( 0x2800, opus_read, opus_write );
+  memory_map_mmio_2k( 0x3000, opus_read, opus_write );
 }
 
 static void
@@ -368,8 +377,8 @@ opus_get_fdd( opus_drive_number which )
   return &( opus_drives[ which ] );
 }
 
-libspectrum_byte
-opus_read( libspectrum_word address )
+static libspectrum_byte
+opus_read( memory_page *page GCC_UNUSED, libspectrum_word address )
 {
   libspectrum_byte data = 0xff;
 
@@ -396,8 +405,9 @@ opus_read( libspectrum_word address )
   return data;
 }
 
-void
-opus_write( libspectrum_word address, libspectrum_byte b )
+static void
+opus_write( memory_page *page GCC_UNUSED, libspectrum_word address,
+            libspectrum_byte b )
 {
   if( address < 0x2000 ) return;
   if( address >= 0x3800 ) return;
@@ -482,19 +492,24 @@ opus_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_opus_active( snap, 1 );
 
-  buffer = libspectrum_new( libspectrum_byte, OPUS_ROM_SIZE );
-  for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            opus_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
+  if( memory_snapshot_contents ||
+      opus_memory_map_romcs_rom[0].save_to_snapshot ) {
+    buffer = libspectrum_new( libspectrum_byte, OPUS_ROM_SIZE );
+    for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              opus_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
 
-  libspectrum_snap_set_opus_rom( snap, 0, buffer );
+    libspectrum_snap_set_opus_rom( snap, 0, buffer );
 
-  if( opus_memory_map_romcs_rom[0].save_to_snapshot )
-    libspectrum_snap_set_opus_custom_rom( snap, 1 );
+    if( opus_memory_map_romcs_rom[0].save_to_snapshot )
+      libspectrum_snap_set_opus_custom_rom( snap, 1 );
+  }
 
-  buffer = libspectrum_new( libspectrum_byte, OPUS_RAM_SIZE );
-  memcpy( buffer, opus_ram, OPUS_RAM_SIZE );
-  libspectrum_snap_set_opus_ram( snap, 0, buffer );
+  if( memory_snapshot_contents ) {
+    buffer = libspectrum_new( libspectrum_byte, OPUS_RAM_SIZE );
+    memcpy( buffer, opus_ram, OPUS_RAM_SIZE );
+    libspectrum_snap_set_opus_ram( snap, 0, buffer );
+  }
 
   drive_count++; /* Drive 1 is not removable */
   if( option_enumerate_diskoptions_drive_opus2_type() > 0 ) drive_count++;
@@ -34,6 +34,7 @@
 #include "debugger/debugger.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "peripherals/printer.h"
 #include "plusd.h"
@@ -460,18 +461,23 @@ plusd_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_plusd_active( snap, 1 );
 
-  buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
-  for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
-    memcpy( buffer + i * MEMORY_PAGE_SIZE,
-            plusd_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
-  libspectrum_snap_set_plusd_rom( snap, 0, buffer );
+  if( memory_snapshot_contents ||
+      plusd_memory_map_romcs_rom[ 0 ].save_to_snapshot ) {
+    buffer = libspectrum_new( libspectrum_byte, ROM_SIZE );
+    for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
+      memcpy( buffer + i * MEMORY_PAGE_SIZE,
+              plusd_memory_map_romcs_rom[ i ].page, MEMORY_PAGE_SIZE );
+    libspectrum_snap_set_plusd_rom( snap, 0, buffer );
 
-  if( plusd_memory_map_romcs_rom[ 0 ].save_to_snapshot )
-    libspectrum_snap_set_plusd_custom_rom( snap, 1 );
+    if( plusd_memory_map_romcs_rom[ 0 ].save_to_snapshot )
+      libspectrum_snap_set_plusd_custom_rom( snap, 1 );
+  }
 
-  buffer = libspectrum_new( libspectrum_byte, RAM_SIZE );
-  memcpy( buffer, plusd_ram, RAM_SIZE );
-  libspectrum_snap_set_plusd_ram( snap, 0, buffer );
+  if( memory_snapshot_contents ) {
+    buffer = libspectrum_new( libspectrum_byte, RAM_SIZE );
+    memcpy( buffer, plusd_ram, RAM_SIZE );
+    libspectrum_snap_set_plusd_ram( snap, 0, buffer );
+  }
 
   drive_count++; /* Drive 1 is not removable */
   if( option_enumerate_diskoptions_drive_plusd2_type() > 0 ) drive_count++;
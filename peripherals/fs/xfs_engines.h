@@ -4,3 +4,6 @@
 
 extern struct xfs_engine_t https_engine;
 extern struct xfs_engine_t xfs_ram_engine;
+
+// Free the directory listings cached by the https engine
+void https_dir_cache_free(void);
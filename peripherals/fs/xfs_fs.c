@@ -76,10 +76,21 @@ struct xfs_fs_mount_data_t
     char base_path[PATH_MAX];
 };
 
+// Read-only handles read the file in chunks this big, so that the Z80's
+// sequential reads of a workspace at a time are served from memory
+#define FS_READ_AHEAD_SIZE 65536
+
 // File handle structure
 struct xfs_fs_file_handle_t
 {
     int fd;
+    // Read-ahead buffer, only for read-only handles (NULL otherwise). The
+    // fd is always positioned at cache_offset + cache_length, and pos is
+    // always within the buffered range or just past it.
+    uint8_t *cache;
+    off_t cache_offset;
+    size_t cache_length;
+    off_t pos;
 };
 
 // Directory handle structure
@@ -186,6 +197,7 @@ static int16_t fs_open(const struct xfs_engine_mount_t* engine, struct xfs_handl
     if (!file_handle) {
         return XFS_ERR_NOMEM;
     }
+    memset(file_handle, 0, sizeof(struct xfs_fs_file_handle_t));
     
     file_handle->fd = open(full_path, open_flags, 0644);
     
@@ -194,6 +206,12 @@ static int16_t fs_open(const struct xfs_engine_mount_t* engine, struct xfs_handl
         libspectrum_free(file_handle);
         return xfs_error_from_errno(errno);
     }
+
+    // Nothing else moves the file position of a read-only handle, so it can
+    // safely read ahead
+    if (accmode == XFS_O_RDONLY) {
+        file_handle->cache = libspectrum_malloc(FS_READ_AHEAD_SIZE);
+    }
     
     handle->type = XFS_HANDLE_TYPE_FILE;
     handle->data = file_handle;
@@ -209,15 +227,51 @@ static int16_t fs_read(const struct xfs_engine_mount_t* engine, struct xfs_handl
         return XFS_ERR_BADF;
     }
     
-    ssize_t bytes_read = read(file_handle->fd, buffer, size);
-    
-    if (bytes_read < 0) {
-        XFS_DEBUG("fs: read failed: %s\n", strerror(errno));
-        return xfs_error_from_errno(errno);
+    if (!file_handle->cache) {
+        ssize_t bytes_read = read(file_handle->fd, buffer, size);
+        
+        if (bytes_read < 0) {
+            XFS_DEBUG("fs: read failed: %s\n", strerror(errno));
+            return xfs_error_from_errno(errno);
+        }
+        
+        XFS_DEBUG("fs: read success bytes=%zd\n", bytes_read);
+        return (int16_t)bytes_read;
     }
-    
-    XFS_DEBUG("fs: read success bytes=%zd\n", bytes_read);
-    return (int16_t)bytes_read;
+
+    uint16_t copied = 0;
+    while (copied < size) {
+        size_t available = file_handle->cache_offset + file_handle->cache_length - file_handle->pos;
+
+        if (!available) {
+            ssize_t bytes_read = read(file_handle->fd, file_handle->cache, FS_READ_AHEAD_SIZE);
+            if (bytes_read < 0) {
+                XFS_DEBUG("fs: read failed: %s\n", strerror(errno));
+                if (copied) {
+                    break;
+                }
+                return xfs_error_from_errno(errno);
+            }
+            if (bytes_read == 0) {
+                break;
+            }
+            file_handle->cache_offset = file_handle->pos;
+            file_handle->cache_length = bytes_read;
+            available = bytes_read;
+        }
+
+        size_t chunk = size - copied;
+        if (chunk > available) {
+            chunk = available;
+        }
+        memcpy((uint8_t*)buffer + copied,
+               file_handle->cache + (file_handle->pos - file_handle->cache_offset), chunk);
+        file_handle->pos += chunk;
+        copied += chunk;
+    }
+
+    XFS_DEBUG("fs: read success bytes=%u (buffered)\n", (unsigned)copied);
+    return (int16_t)copied;
 }
 
 // Write to file
@@ -297,6 +351,7 @@ static int16_t fs_close(const struct xfs_engine_mount_t* engine, struct xfs_hand
     }
     
     int ret = close(file_handle->fd);
+    libspectrum_free(file_handle->cache);
     libspectrum_free(file_handle);
     handle->data = NULL;
     
@@ -326,6 +381,20 @@ static int16_t fs_lseek(const struct xfs_engine_mount_t* engine, struct xfs_hand
         posix_whence = SEEK_END;
     else
         return XFS_ERR_INVAL;
+
+    if (file_handle->cache && posix_whence != SEEK_END) {
+        // Seeks within what has already been read need no system call
+        off_t target = (posix_whence == SEEK_SET) ? (off_t)offset :
+                       file_handle->pos + (off_t)offset;
+        if (target >= file_handle->cache_offset &&
+            target <= file_handle->cache_offset + (off_t)file_handle->cache_length) {
+            file_handle->pos = target;
+            XFS_DEBUG("fs: lseek success new_pos=%ld (buffered)\n", (long)target);
+            return (int16_t)target;
+        }
+        offset = (uint32_t)target;
+        posix_whence = SEEK_SET;
+    }
     
     off_t new_pos = lseek(file_handle->fd, (off_t)offset, posix_whence);
     
@@ -333,6 +402,12 @@ static int16_t fs_lseek(const struct xfs_engine_mount_t* engine, struct xfs_hand
         XFS_DEBUG("fs: lseek failed: %s\n", strerror(errno));
         return xfs_error_from_errno(errno);
     }
+
+    if (file_handle->cache) {
+        file_handle->cache_offset = new_pos;
+        file_handle->cache_length = 0;
+        file_handle->pos = new_pos;
+    }
     
     XFS_DEBUG("fs: lseek success new_pos=%ld\n", (long)new_pos);
     return (int16_t)new_pos;
@@ -612,6 +687,7 @@ static void fs_free_handle(const struct xfs_engine_mount_t* engine, struct xfs_h
         if (file_handle && file_handle->fd >= 0)
         {
             close(file_handle->fd);
+            libspectrum_free(file_handle->cache);
             libspectrum_free(file_handle);
             handle->data = NULL;
         }
@@ -1,9 +1,15 @@
 #include "config.h"
 
 #include "xfs.h"
+#include "xfs_https_cache.h"
 #include "xfs_worker.h"
+#ifdef WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#endif
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -11,8 +17,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "libspectrum.h"
+#include "settings.h"
 #include "../http/httpc.h"
 #include "../http/http_sck.h"
 
@@ -21,9 +30,9 @@
 
 struct xfs_handle_https_file_t
 {
-    void* data;                          // Pointer to file data buffer
-    size_t size;                         // Size of file data buffer
-    size_t pos;                          // Current read position in buffer
+    struct https_entity_t* entity;       // Remote file, read through the block cache
+    size_t size;                         // Size of file
+    size_t pos;                          // Current read position
 };
 
 struct xfs_handle_https_dir_t
@@ -46,24 +55,51 @@ static struct xfs_handle_https_dir_t* get_https_dir_handle(const struct xfs_hand
 
 // Maximum hostname length
 #define HTTPS_MAX_HOSTNAME 256
-// Maximum cached directories
-#define HTTPS_DIR_CACHE_SIZE 4
 // Maximum path length for cache
 #define HTTPS_CACHE_PATH_MAX 256
-
+// Maximum URL length of a directory's index.txt
+#define HTTPS_DIR_URL_MAX 512
+// Maximum cached directories, shared by all mounts
+#define HTTPS_DIR_CACHE_SIZE 64
+// Hash buckets for the directory cache (power of two)
+#define HTTPS_DIR_CACHE_BUCKETS 64
+// Seconds a listing stays fresh when the server does not say (Cache-Control: max-age)
+#define HTTPS_DIR_CACHE_TTL 300
+// Maximum entries in one directory
+#define HTTPS_DIR_MAX_ENTRIES 128
+// Hash buckets for the names in one directory (power of two)
+#define HTTPS_DIR_NAME_BUCKETS 64
+// Maximum length of an ETag
+#define HTTPS_ETAG_MAX 64
+
+#define HTTPS_DIR_NONE 0xff
+
+// A directory listing, keyed by the URL of its index.txt so that it is shared
+// by every mount of the same server and survives unmounting
 struct https_dir_cache_entry_t
 {
-    char path[HTTPS_CACHE_PATH_MAX];
+    char url[HTTPS_DIR_URL_MAX];
+    uint32_t url_hash;
+    char etag[HTTPS_ETAG_MAX];           // For If-None-Match revalidation
+    time_t expires;                      // Fresh until then, revalidated after
+    uint8_t persist;                     // Zero if the server said no-store
     struct xfs_handle_https_dir_entry_t** dir_entries;
     uint8_t dir_entries_count;
-    uint8_t in_use;  // Non-zero if this cache slot is in use
+    uint8_t name_buckets[HTTPS_DIR_NAME_BUCKETS];
+    uint8_t name_next[HTTPS_DIR_MAX_ENTRIES];
+    uint8_t bucket_next;                 // Next cache slot in the same URL bucket
+    uint8_t in_use;                      // Non-zero if this cache slot is in use
+    uint32_t last_used;
 };
 
+static struct https_dir_cache_entry_t https_dir_cache[HTTPS_DIR_CACHE_SIZE];
+static uint8_t https_dir_cache_buckets[HTTPS_DIR_CACHE_BUCKETS];
+static uint8_t https_dir_cache_initialised = 0;
+static uint32_t https_dir_cache_counter = 0;
+
 struct https_engine_mount_data_t
 {
     char url[HTTPS_MAX_HOSTNAME];
-    struct https_dir_cache_entry_t https_dir_cache[HTTPS_DIR_CACHE_SIZE];
-    uint8_t next_cache;
 };
 
 static inline struct https_engine_mount_data_t* get_mount_data(const struct xfs_engine_mount_t* engine_mount)
@@ -71,14 +107,6 @@ static inline struct https_engine_mount_data_t* get_mount_data(const struct xfs_
     return (struct https_engine_mount_data_t*)engine_mount->mount_data;
 }
 
-// Structure to hold buffer information during download
-struct https_buffer_info_t
-{
-    void* data;                          // Buffer pointer
-    size_t size;                         // Current buffer size
-    size_t capacity;                     // Current buffer capacity
-};
-
 // Helper function to build full URL from base URL + path
 // base_url should be the mount URL (e.g., "https://hostname/path/")
 // path is the relative path to append
@@ -130,53 +158,58 @@ static int build_https_url(const char* base_url, const char* path, char* url_buf
     return 0;
 }
 
-// Normalize directory path for cache lookup (same logic used in stat)
-static void https_normalize_dir_path(const char* path, char normalized[HTTPS_CACHE_PATH_MAX])
+// FNV-1a, used for both directory URLs and entry names
+static uint32_t https_hash_string(const char* s)
 {
-    if (!path || strcmp(path, ".") == 0 || strcmp(path, "./") == 0)
+    uint32_t hash = 2166136261u;
+    while (*s)
     {
-        strncpy(normalized, "/", HTTPS_CACHE_PATH_MAX);
-        return;
+        hash = (hash ^ (uint8_t)*s++) * 16777619u;
     }
+    return hash;
+}
 
-    strncpy(normalized, path, HTTPS_CACHE_PATH_MAX);
-
-    const uint16_t path_len = strlen(path);
-    if (path_len > 1 && normalized[path_len - 1] == '/')
+static void https_dir_cache_init(void)
+{
+    if (https_dir_cache_initialised)
     {
-        normalized[path_len - 1] = '\0';
+        return;
     }
+
+    memset(https_dir_cache, 0, sizeof(https_dir_cache));
+    memset(https_dir_cache_buckets, HTTPS_DIR_NONE, sizeof(https_dir_cache_buckets));
+    https_dir_cache_initialised = 1;
 }
 
-static struct xfs_handle_https_dir_entry_t* https_cache_find_entry(
-    const struct xfs_engine_mount_t* engine, const char* dir_path, const char* entry_name)
+// Find the listing of url without counting it as used
+static struct https_dir_cache_entry_t* https_dir_cache_lookup(const char* url)
 {
-    char normalized_path[HTTPS_CACHE_PATH_MAX];
-    https_normalize_dir_path(dir_path, normalized_path);
+    const uint32_t hash = https_hash_string(url);
+    uint8_t slot = https_dir_cache_buckets[hash & (HTTPS_DIR_CACHE_BUCKETS - 1)];
 
-    const struct https_engine_mount_data_t* mount_data = get_mount_data(engine);
-    
-    // Find cache entry for this directory
-    for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
+    while (slot != HTTPS_DIR_NONE)
     {
-        if (mount_data->https_dir_cache[i].in_use && strcmp(mount_data->https_dir_cache[i].path, normalized_path) == 0)
+        struct https_dir_cache_entry_t* cache_entry = &https_dir_cache[slot];
+        if (cache_entry->url_hash == hash && strcmp(cache_entry->url, url) == 0)
         {
-            // Search entries in this cached directory
-            for (uint8_t j = 0; j < mount_data->https_dir_cache[i].dir_entries_count; j++)
-            {
-                if (mount_data->https_dir_cache[i].dir_entries[j] &&
-                    strcmp(mount_data->https_dir_cache[i].dir_entries[j]->name, entry_name) == 0)
-                {
-                    return mount_data->https_dir_cache[i].dir_entries[j];
-                }
-            }
-            break;
+            return cache_entry;
         }
+        slot = cache_entry->bucket_next;
     }
-    
+
     return NULL;
 }
 
+static struct https_dir_cache_entry_t* https_dir_cache_find(const char* url)
+{
+    struct https_dir_cache_entry_t* cache_entry = https_dir_cache_lookup(url);
+    if (cache_entry)
+    {
+        cache_entry->last_used = ++https_dir_cache_counter;
+    }
+    return cache_entry;
+}
+
 // Free directory entries from a cache entry
 static void https_cache_free_entries(struct https_dir_cache_entry_t* cache_entry)
 {
@@ -197,6 +230,96 @@ static void https_cache_free_entries(struct https_dir_cache_entry_t* cache_entry
     cache_entry->dir_entries_count = 0;
 }
 
+static void https_dir_cache_evict(struct https_dir_cache_entry_t* cache_entry)
+{
+    uint8_t* link = &https_dir_cache_buckets[cache_entry->url_hash & (HTTPS_DIR_CACHE_BUCKETS - 1)];
+    const uint8_t slot = (uint8_t)(cache_entry - https_dir_cache);
+
+    while (*link != HTTPS_DIR_NONE)
+    {
+        if (*link == slot)
+        {
+            *link = cache_entry->bucket_next;
+            break;
+        }
+        link = &https_dir_cache[*link].bucket_next;
+    }
+
+    https_cache_free_entries(cache_entry);
+    cache_entry->in_use = 0;
+}
+
+// Take a free slot for url, or the least recently used one
+static struct https_dir_cache_entry_t* https_dir_cache_new(const char* url)
+{
+    struct https_dir_cache_entry_t* victim = NULL;
+
+    for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
+    {
+        if (!https_dir_cache[i].in_use)
+        {
+            victim = &https_dir_cache[i];
+            break;
+        }
+        if (!victim || https_dir_cache[i].last_used < victim->last_used)
+        {
+            victim = &https_dir_cache[i];
+        }
+    }
+
+    if (victim->in_use)
+    {
+        XFS_DEBUG("https: dir cache evicting '%s'\n", victim->url);
+        https_dir_cache_evict(victim);
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->url, url, sizeof(victim->url) - 1);
+    victim->url_hash = https_hash_string(victim->url);
+    victim->in_use = 1;
+    victim->last_used = ++https_dir_cache_counter;
+
+    const uint8_t bucket = victim->url_hash & (HTTPS_DIR_CACHE_BUCKETS - 1);
+    victim->bucket_next = https_dir_cache_buckets[bucket];
+    https_dir_cache_buckets[bucket] = (uint8_t)(victim - https_dir_cache);
+
+    return victim;
+}
+
+// Replace the listing of a cache entry, taking ownership of entries
+static void https_dir_cache_set_entries(struct https_dir_cache_entry_t* cache_entry,
+    struct xfs_handle_https_dir_entry_t** entries, uint8_t count)
+{
+    https_cache_free_entries(cache_entry);
+    cache_entry->dir_entries = entries;
+    cache_entry->dir_entries_count = count;
+
+    memset(cache_entry->name_buckets, HTTPS_DIR_NONE, sizeof(cache_entry->name_buckets));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t bucket = https_hash_string(entries[i]->name) & (HTTPS_DIR_NAME_BUCKETS - 1);
+        cache_entry->name_next[i] = cache_entry->name_buckets[bucket];
+        cache_entry->name_buckets[bucket] = i;
+    }
+}
+
+static const struct xfs_handle_https_dir_entry_t* https_dir_cache_find_name(
+    const struct https_dir_cache_entry_t* cache_entry, const char* entry_name)
+{
+    uint8_t i = cache_entry->name_buckets[https_hash_string(entry_name) & (HTTPS_DIR_NAME_BUCKETS - 1)];
+
+    while (i != HTTPS_DIR_NONE)
+    {
+        if (strcmp(cache_entry->dir_entries[i]->name, entry_name) == 0)
+        {
+            return cache_entry->dir_entries[i];
+        }
+        i = cache_entry->name_next[i];
+    }
+
+    return NULL;
+}
+
 static struct xfs_handle_https_dir_entry_t* https_cache_copy_entry(const struct xfs_handle_https_dir_entry_t* src)
 {
     if (!src)
@@ -204,334 +327,801 @@ static struct xfs_handle_https_dir_entry_t* https_cache_copy_entry(const struct
         return NULL;
     }
 
-    struct xfs_handle_https_dir_entry_t* dst = libspectrum_malloc(sizeof(struct xfs_handle_https_dir_entry_t));
-
-    if (!dst)
+    struct xfs_handle_https_dir_entry_t* dst = libspectrum_malloc(sizeof(struct xfs_handle_https_dir_entry_t));
+
+    if (!dst)
+    {
+        return NULL;
+    }
+
+    memcpy(dst, src, sizeof(struct xfs_handle_https_dir_entry_t));
+    return dst;
+}
+
+static int parse_index_line_to_entry(const char* line, struct xfs_handle_https_dir_entry_t* entry);
+static int https_parse_index_txt(const char* buffer, const size_t buffer_len,
+    struct xfs_handle_https_dir_entry_t** entries,
+    const uint8_t max_entries);
+
+// Parse an index.txt body into a freshly allocated entries array
+static int16_t https_parse_index_entries(const char* buffer, size_t length,
+    struct xfs_handle_https_dir_entry_t*** out_entries, uint8_t* out_entry_count)
+{
+    *out_entries = NULL;
+    *out_entry_count = 0;
+
+    // First pass: count entries
+    int entry_count = https_parse_index_txt(buffer, length, NULL, 0);
+    if (entry_count < 0)
+    {
+        XFS_DEBUG("https: fetch_index failed: parse error\n");
+        return XFS_ERR_IO;
+    }
+
+    if (entry_count > HTTPS_DIR_MAX_ENTRIES)
+    {
+        entry_count = HTTPS_DIR_MAX_ENTRIES;
+    }
+
+    if (entry_count == 0)
+    {
+        return XFS_ERR_OK; // Empty directory
+    }
+
+    struct xfs_handle_https_dir_entry_t** entries = (struct xfs_handle_https_dir_entry_t**)libspectrum_malloc(entry_count *
+    sizeof(struct xfs_handle_https_dir_entry_t*));
+
+    if (!entries)
+    {
+        XFS_DEBUG("https: fetch_index failed: no memory for entries array\n");
+        return XFS_ERR_NOMEM;
+    }
+
+    // Second pass: parse entries
+    const int parsed_count = https_parse_index_txt(buffer, length, entries, entry_count);
+
+    if (parsed_count < 0)
+    {
+        // Free already allocated entries
+        for (int i = 0; i < entry_count; i++)
+        {
+            if (entries[i])
+            {
+                libspectrum_free(entries[i]);
+            }
+        }
+        libspectrum_free(entries);
+        return XFS_ERR_NOMEM;
+    }
+
+    *out_entries = entries;
+    *out_entry_count = (uint8_t)parsed_count;
+    return XFS_ERR_OK;
+}
+
+// Listings are kept on disk too, so that they survive restarting the emulator:
+// one file per index.txt URL, holding a small header followed by the entries
+// in index.txt format
+static void https_dir_cache_disk_path(const struct https_dir_cache_entry_t* cache_entry, char* path, size_t size)
+{
+    snprintf(path, size, "%s/xfs-https-cache/%08lx.idx", compat_get_config_path(),
+        (unsigned long)cache_entry->url_hash);
+}
+
+static void https_dir_cache_save(const struct https_dir_cache_entry_t* cache_entry)
+{
+    char path[HTTPS_DIR_URL_MAX];
+
+    if (!cache_entry->persist)
+    {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/xfs-https-cache", compat_get_config_path());
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    {
+        XFS_DEBUG("https: dir cache can't create '%s'\n", path);
+        return;
+    }
+
+    https_dir_cache_disk_path(cache_entry, path, sizeof(path));
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        return;
+    }
+
+    fprintf(f, "url=%s\netag=%s\nexpires=%lld\n\n", cache_entry->url, cache_entry->etag,
+        (long long)cache_entry->expires);
+
+    for (uint8_t i = 0; i < cache_entry->dir_entries_count; i++)
+    {
+        const struct xfs_handle_https_dir_entry_t* entry = cache_entry->dir_entries[i];
+        if (entry->is_dir)
+        {
+            fprintf(f, "type=dir name=%s\n", entry->name);
+        }
+        else
+        {
+            fprintf(f, "type=file name=%s size=%lu\n", entry->name, (unsigned long)entry->size);
+        }
+    }
+
+    fclose(f);
+}
+
+// Fill a new cache entry from disk; returns zero if it was there
+static int https_dir_cache_load(struct https_dir_cache_entry_t* cache_entry)
+{
+    char path[HTTPS_DIR_URL_MAX];
+    https_dir_cache_disk_path(cache_entry, path, sizeof(path));
+
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        return -1;
+    }
+
+    char line[HTTPS_DIR_URL_MAX + 8];
+    char* body = NULL;
+    size_t body_length = 0;
+    int header = 1, url_matches = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (header)
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+            {
+                header = 0;
+            }
+            else if (strncmp(line, "url=", 4) == 0)
+            {
+                // Different URLs may share a hash
+                url_matches = strcmp(line + 4, cache_entry->url) == 0;
+            }
+            else if (strncmp(line, "etag=", 5) == 0)
+            {
+                strncpy(cache_entry->etag, line + 5, sizeof(cache_entry->etag) - 1);
+            }
+            else if (strncmp(line, "expires=", 8) == 0)
+            {
+                cache_entry->expires = (time_t)strtoll(line + 8, NULL, 10);
+            }
+            continue;
+        }
+
+        const size_t length = strlen(line);
+        char* new_body = libspectrum_realloc(body, body_length + length);
+        if (!new_body)
+        {
+            break;
+        }
+        body = new_body;
+        memcpy(body + body_length, line, length);
+        body_length += length;
+    }
+
+    fclose(f);
+
+    struct xfs_handle_https_dir_entry_t** entries = NULL;
+    uint8_t entry_count = 0;
+    const int16_t result = url_matches ?
+        https_parse_index_entries(body ? body : "", body_length, &entries, &entry_count) : XFS_ERR_NOENT;
+    libspectrum_free(body);
+
+    if (result != XFS_ERR_OK)
+    {
+        cache_entry->etag[0] = '\0';
+        cache_entry->expires = 0;
+        return -1;
+    }
+
+    https_dir_cache_set_entries(cache_entry, entries, entry_count);
+    cache_entry->persist = 1;
+
+    XFS_DEBUG("https: dir cache loaded '%s' from disk (%d entries)\n", cache_entry->url, entry_count);
+    return 0;
+}
+
+// Caching headers of the index.txt response being fetched
+struct https_dir_fetch_t
+{
+    char etag[HTTPS_ETAG_MAX];
+    long max_age;                        // -1 if not given
+    uint8_t no_store;
+};
+
+static int https_dir_fetch_field(httpc_options_t* os, const char* line)
+{
+    struct https_dir_fetch_t* fetch = os->context;
+
+    if (!fetch)
+    {
+        return 0;
+    }
+
+    if (strncasecmp(line, "ETag:", 5) == 0)
+    {
+        const char* value = line + 5;
+        while (*value == ' ' || *value == '\t')
+            value++;
+        strncpy(fetch->etag, value, sizeof(fetch->etag) - 1);
+        fetch->etag[strcspn(fetch->etag, " \t\r")] = '\0';
+    }
+    else if (strncasecmp(line, "Cache-Control:", 14) == 0)
+    {
+        for (const char* p = line + 14; *p; p++)
+        {
+            if (strncasecmp(p, "max-age=", 8) == 0)
+            {
+                fetch->max_age = strtol(p + 8, NULL, 10);
+            }
+            else if (strncasecmp(p, "no-cache", 8) == 0)
+            {
+                fetch->max_age = 0;
+            }
+            else if (strncasecmp(p, "no-store", 8) == 0)
+            {
+                fetch->max_age = 0;
+                fetch->no_store = 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Fetch and parse the index.txt at url, revalidating against etag if it is
+// not empty. Returns XFS_ERR_IO if the request failed (os->response tells
+// why); on success os->response is 200, with the listing in out_entries, or
+// 304. Only touches os, so it may be called from the prefetch threads.
+static int16_t https_dir_fetch(httpc_options_t* os, const char* url, const char* etag,
+    struct https_dir_fetch_t* fetch, struct xfs_handle_https_dir_entry_t*** out_entries, uint8_t* out_entry_count)
+{
+    memset(fetch, 0, sizeof(*fetch));
+    fetch->max_age = -1;
+
+    // Revalidate what we have, if the server gave us an ETag for it
+    char if_none_match[HTTPS_ETAG_MAX + 16];
+    char* headers[] = { if_none_match };
+    if (etag[0])
+    {
+        snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s", etag);
+        os->argc = 1;
+        os->argv = headers;
+    }
+
+    // Allocate buffer and fetch index.txt
+    const size_t buffer_size = 2048;
+    char* buffer = (char*)libspectrum_malloc(buffer_size);
+    if (!buffer)
+    {
+        os->argc = 0;
+        os->argv = NULL;
+        return XFS_ERR_NOMEM;
+    }
+
+    size_t length = buffer_size;
+    os->field = https_dir_fetch_field;
+    os->context = fetch;
+
+    const int result = httpc_get_buffer(os, url, buffer, &length);
+
+    os->context = NULL;
+    os->field = NULL;
+    os->argc = 0;
+    os->argv = NULL;
+
+    if (result != HTTPC_OK)
+    {
+        XFS_DEBUG("https: fetch_index '%s' failed: httpc_get_buffer error\n", url);
+        libspectrum_free(buffer);
+        return XFS_ERR_IO;
+    }
+
+    if (os->response == 304)
+    {
+        XFS_DEBUG("https: fetch_index '%s' not modified\n", url);
+        libspectrum_free(buffer);
+        return XFS_ERR_OK;
+    }
+
+    XFS_DEBUG("https: fetch_index received %zu bytes\n", length);
+
+    const int16_t parse_result = https_parse_index_entries(buffer, length, out_entries, out_entry_count);
+
+    // Free buffer now that parsing is complete
+    libspectrum_free(buffer);
+
+    if (parse_result == XFS_ERR_OK)
+    {
+        XFS_DEBUG("https: fetch_index parsed %d entries successfully\n", *out_entry_count);
+    }
+
+    return parse_result;
+}
+
+// Store the result of a successful https_dir_fetch(), taking ownership of
+// entries unless the response was 304
+static void https_dir_cache_update(struct https_dir_cache_entry_t* cache_entry, int response,
+    const struct https_dir_fetch_t* fetch, struct xfs_handle_https_dir_entry_t** entries, uint8_t entry_count)
+{
+    cache_entry->expires = time(NULL) + (fetch->max_age >= 0 ? fetch->max_age : HTTPS_DIR_CACHE_TTL);
+    cache_entry->persist = !fetch->no_store;
+
+    if (response != 304)
+    {
+        strcpy(cache_entry->etag, fetch->etag);
+        https_dir_cache_set_entries(cache_entry, entries, entry_count);
+    }
+
+    https_dir_cache_save(cache_entry);
+}
+
+// Build the URL of the index.txt of dir_path on a mount
+static int16_t https_dir_index_url(const struct xfs_engine_mount_t* engine, const char* dir_path,
+    char* url, size_t url_size)
+{
+    struct https_engine_mount_data_t* mount_data = get_mount_data(engine);
+    if (!mount_data || mount_data->url[0] == '\0')
+    {
+        XFS_DEBUG("https: fetch_index failed: not mounted\n");
+        return XFS_ERR_IO;
+    }
+
+    // Build index.txt path
+    char index_path[256];
+    if (dir_path && dir_path[0] != '\0')
+    {
+        if (dir_path[strlen(dir_path) - 1] == '/')
+        {
+            snprintf(index_path, sizeof(index_path), "%sindex.txt", dir_path);
+        }
+        else
+        {
+            snprintf(index_path, sizeof(index_path), "%s/index.txt", dir_path);
+        }
+    }
+    else
+    {
+        strcpy(index_path, "/index.txt");
+    }
+
+    // Build full URL
+    if (build_https_url(mount_data->url, index_path, url, url_size) != 0)
+    {
+        XFS_DEBUG("https: fetch_index failed: invalid URL\n");
+        return XFS_ERR_INVAL;
+    }
+
+    return XFS_ERR_OK;
+}
+
+// Directory prefetch
+//
+// After a directory is opened, the listings of its subdirectories are
+// fetched by a few background threads, so that the stat() and opendir()
+// calls a file browser makes next find them in the cache. The threads only
+// ever touch their job; results are merged into the cache by the XFS worker
+// thread, which owns it, whenever it next looks a directory up.
+
+// Number of prefetch threads; fewer than HTTP_POOL_PER_HOST, so that requests
+// made for the Z80 always get a connection straight away
+#define HTTPS_PREFETCH_THREADS 2
+// Maximum listings waiting to be fetched or merged
+#define HTTPS_PREFETCH_JOBS 32
+// Upper limit on the spectranet_prefetch setting
+#define HTTPS_PREFETCH_MAX_DEPTH 3
+
+enum https_prefetch_state_t
+{
+    HTTPS_PREFETCH_FREE = 0,
+    HTTPS_PREFETCH_QUEUED,
+    HTTPS_PREFETCH_RUNNING,
+    HTTPS_PREFETCH_DONE,
+};
+
+struct https_prefetch_job_t
+{
+    enum https_prefetch_state_t state;
+    char url[HTTPS_DIR_URL_MAX];
+    char etag[HTTPS_ETAG_MAX];           // Of the stale listing being revalidated, if any
+    uint8_t depth;                       // Levels still to prefetch below this one
+    uint32_t sequence;                   // Jobs are started in the order they were queued
+
+    // Set by the prefetch thread
+    int16_t result;
+    int response;
+    struct https_dir_fetch_t fetch;
+    struct xfs_handle_https_dir_entry_t** dir_entries;
+    uint8_t dir_entries_count;
+};
+
+static struct https_prefetch_job_t https_prefetch_jobs[HTTPS_PREFETCH_JOBS];
+static uint32_t https_prefetch_sequence = 0;
+static pthread_t https_prefetch_threads[HTTPS_PREFETCH_THREADS];
+static pthread_mutex_t https_prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t https_prefetch_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t https_prefetch_done = PTHREAD_COND_INITIALIZER;
+static uint8_t https_prefetch_running = 0;
+static uint8_t https_prefetch_stop = 0;
+
+// Socket functions for the prefetch threads, copied from tls_sck while it is idle
+static httpc_options_t https_prefetch_options;
+
+static void https_free_entries(struct xfs_handle_https_dir_entry_t** entries, uint8_t count)
+{
+    if (!entries)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        libspectrum_free(entries[i]);
+    }
+    libspectrum_free(entries);
+}
+
+static struct https_prefetch_job_t* https_prefetch_find_locked(const char* url)
+{
+    for (int i = 0; i < HTTPS_PREFETCH_JOBS; i++)
+    {
+        struct https_prefetch_job_t* job = &https_prefetch_jobs[i];
+        if (job->state != HTTPS_PREFETCH_FREE && strcmp(job->url, url) == 0)
+        {
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+// Queue the listings of the subdirectories in entries, the listing at
+// parent_url, to be fetched with depth levels below them. Those fresh in the
+// cache are skipped if check_cache is set; only the XFS worker thread may do
+// that.
+static void https_prefetch_queue_locked(const char* parent_url,
+    struct xfs_handle_https_dir_entry_t* const* entries, uint8_t entry_count, uint8_t depth, int check_cache)
+{
+    // The children's index.txt URLs all start with the parent's minus "index.txt"
+    const size_t prefix_length = strlen(parent_url) - strlen("index.txt");
+    const time_t now = time(NULL);
+    int queued = 0;
+
+    for (uint8_t i = 0; i < entry_count; i++)
+    {
+        if (!entries[i]->is_dir)
+        {
+            continue;
+        }
+
+        char url[HTTPS_DIR_URL_MAX];
+        const int written = snprintf(url, sizeof(url), "%.*s%s/index.txt",
+            (int)prefix_length, parent_url, entries[i]->name);
+        if (written < 0 || written >= (int)sizeof(url) || https_prefetch_find_locked(url))
+        {
+            continue;
+        }
+
+        const struct https_dir_cache_entry_t* child = check_cache ? https_dir_cache_lookup(url) : NULL;
+        if (child && child->expires > now)
+        {
+            continue;
+        }
+
+        struct https_prefetch_job_t* job = NULL;
+        for (int j = 0; j < HTTPS_PREFETCH_JOBS && !job; j++)
+        {
+            if (https_prefetch_jobs[j].state == HTTPS_PREFETCH_FREE)
+            {
+                job = &https_prefetch_jobs[j];
+            }
+        }
+        if (!job)
+        {
+            break;
+        }
+
+        memset(job, 0, sizeof(*job));
+        job->state = HTTPS_PREFETCH_QUEUED;
+        strcpy(job->url, url);
+        if (child)
+        {
+            strcpy(job->etag, child->etag);
+        }
+        job->depth = depth - 1;
+        job->sequence = https_prefetch_sequence++;
+        queued++;
+    }
+
+    if (queued)
     {
-        return NULL;
+        pthread_cond_broadcast(&https_prefetch_queued);
     }
-
-    memcpy(dst, src, sizeof(struct xfs_handle_https_dir_entry_t));
-    return dst;
 }
 
-// Put directory entries into cache
-static void https_cache_put_entries(const struct xfs_engine_mount_t* engine, const char* dir_path,
-    struct xfs_handle_https_dir_entry_t** entries, uint8_t count)
+static void* https_prefetch_thread(void* arg)
 {
-    if (!entries || count == 0)
+    (void)arg;
+
+    pthread_mutex_lock(&https_prefetch_mutex);
+
+    while (!https_prefetch_stop)
     {
-        return;
-    }
+        struct https_prefetch_job_t* job = NULL;
+        for (int i = 0; i < HTTPS_PREFETCH_JOBS; i++)
+        {
+            struct https_prefetch_job_t* candidate = &https_prefetch_jobs[i];
+            if (candidate->state == HTTPS_PREFETCH_QUEUED &&
+                (!job || (int32_t)(candidate->sequence - job->sequence) < 0))
+            {
+                job = candidate;
+            }
+        }
 
-    struct https_engine_mount_data_t* mount_data = get_mount_data(engine);
+        if (!job)
+        {
+            pthread_cond_wait(&https_prefetch_queued, &https_prefetch_mutex);
+            continue;
+        }
 
-    int cache_idx = -1;
+        // A running job is never freed or changed by anyone else
+        job->state = HTTPS_PREFETCH_RUNNING;
+        pthread_mutex_unlock(&https_prefetch_mutex);
 
-    {
-      for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
-      {
-          if (!mount_data->https_dir_cache[i].in_use)
-          {
-              cache_idx = i;
-              break;
-          }
-      }
-    }
+        httpc_options_t os = https_prefetch_options;
+        XFS_DEBUG("https: prefetching '%s'\n", job->url);
+        job->result = https_dir_fetch(&os, job->url, job->etag, &job->fetch,
+            &job->dir_entries, &job->dir_entries_count);
+        job->response = os.response;
 
-    // If cache is full, use next_cache slot and cycle to next
-    if (cache_idx == -1)
-    {
-        cache_idx = mount_data->next_cache;
-        mount_data->next_cache = (mount_data->next_cache + 1) % HTTPS_DIR_CACHE_SIZE;
-    }
+        pthread_mutex_lock(&https_prefetch_mutex);
+        job->state = HTTPS_PREFETCH_DONE;
+        pthread_cond_broadcast(&https_prefetch_done);
 
-    // If cache slot was in use, free old entries
-    if (mount_data->https_dir_cache[cache_idx].in_use)
-    {
-        if (mount_data->https_dir_cache[cache_idx].dir_entries)
+        // Carry on down without waiting for the listing to be merged
+        if (job->result == XFS_ERR_OK && job->response != 304 && job->depth)
         {
-            https_cache_free_entries(&mount_data->https_dir_cache[cache_idx]);
+            https_prefetch_queue_locked(job->url, job->dir_entries, job->dir_entries_count, job->depth, 0);
         }
     }
 
-    // Copy path
-    size_t path_len = strlen(dir_path);
-    if (path_len >= HTTPS_CACHE_PATH_MAX)
-    {
-        path_len = HTTPS_CACHE_PATH_MAX - 1;
-    }
-    memcpy(mount_data->https_dir_cache[cache_idx].path, dir_path, path_len);
-    mount_data->https_dir_cache[cache_idx].path[path_len] = '\0';
+    pthread_mutex_unlock(&https_prefetch_mutex);
 
-    // Allocate array of pointers
-    mount_data->https_dir_cache[cache_idx].dir_entries = (struct xfs_handle_https_dir_entry_t**)libspectrum_malloc(
-        count * sizeof(struct xfs_handle_https_dir_entry_t*));
+    return NULL;
+}
 
-    if (!mount_data->https_dir_cache[cache_idx].dir_entries)
+static int https_prefetch_start(void)
+{
+    if (https_prefetch_running)
     {
-        mount_data->https_dir_cache[cache_idx].in_use = 0;
-        return;
+        return 0;
     }
 
-    // Copy all entries
-    int dir_entries_count = 0;
-    for (int i = 0; i < count; i++)
+    https_prefetch_options = tls_sck;
+    https_prefetch_options.field = NULL;
+    https_prefetch_options.context = NULL;
+    https_prefetch_options.state = NULL;
+    https_prefetch_options.argc = 0;
+    https_prefetch_options.argv = NULL;
+
+    https_prefetch_stop = 0;
+    for (int i = 0; i < HTTPS_PREFETCH_THREADS; i++)
     {
-        if (entries[i])
+        if (pthread_create(&https_prefetch_threads[i], NULL, https_prefetch_thread, NULL) != 0)
         {
-            struct xfs_handle_https_dir_entry_t* cached_entry = https_cache_copy_entry(entries[i]);
-            if (cached_entry)
+            XFS_DEBUG("https: can't create prefetch thread\n");
+
+            pthread_mutex_lock(&https_prefetch_mutex);
+            https_prefetch_stop = 1;
+            pthread_cond_broadcast(&https_prefetch_queued);
+            pthread_mutex_unlock(&https_prefetch_mutex);
+
+            while (i--)
             {
-                mount_data->https_dir_cache[cache_idx].dir_entries[dir_entries_count] = cached_entry;
-                dir_entries_count++;
+                pthread_join(https_prefetch_threads[i], NULL);
             }
+            return -1;
         }
     }
 
-    mount_data->https_dir_cache[cache_idx].dir_entries_count = dir_entries_count;
-    mount_data->https_dir_cache[cache_idx].in_use = 1;
-
-    XFS_DEBUG("https: cache_put cached %d entries for path '%s' at slot %d\n",
-        dir_entries_count, dir_path, cache_idx);
+    https_prefetch_running = 1;
+    return 0;
 }
 
-// Put directory entries into cache (stores pointer directly, no copying)
-static void https_cache_store_entries(const struct xfs_engine_mount_t* engine,
-    const char* dir_path, struct xfs_handle_https_dir_entry_t** entries, const uint8_t count)
+// Stop the threads and drop every job, waiting for those being fetched
+static void https_prefetch_end(void)
 {
-    if (!entries || count == 0)
+    if (!https_prefetch_running)
     {
         return;
     }
 
-    struct https_engine_mount_data_t* mount_data = get_mount_data(engine);
-    
-    // Find first unused cache slot
-    int cache_idx = -1;
+    pthread_mutex_lock(&https_prefetch_mutex);
+    https_prefetch_stop = 1;
+    pthread_cond_broadcast(&https_prefetch_queued);
+    pthread_mutex_unlock(&https_prefetch_mutex);
 
-    for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
-    {
-        if (!mount_data->https_dir_cache[i].in_use)
-        {
-            cache_idx = i;
-            break;
-        }
-    }
-    
-    // If cache is full, use next_cache slot and cycle to next
-    if (cache_idx == -1)
-    {
-        cache_idx = mount_data->next_cache;
-        mount_data->next_cache = (mount_data->next_cache + 1) % HTTPS_DIR_CACHE_SIZE;
-    }
-    
-    // If cache slot was in use, free old entries
-    if (mount_data->https_dir_cache[cache_idx].in_use)
+    for (int i = 0; i < HTTPS_PREFETCH_THREADS; i++)
     {
-        https_cache_free_entries(&mount_data->https_dir_cache[cache_idx]);
+        pthread_join(https_prefetch_threads[i], NULL);
     }
-    
-    // Copy path
-    strncpy(mount_data->https_dir_cache[cache_idx].path, dir_path, HTTPS_CACHE_PATH_MAX);
-    
-    // Store entries pointer directly (no copying)
-    mount_data->https_dir_cache[cache_idx].dir_entries = entries;
-    mount_data->https_dir_cache[cache_idx].dir_entries_count = count;
-    mount_data->https_dir_cache[cache_idx].in_use = 1;
-    
-    XFS_DEBUG("https: cache_store stored %d entries for path '%s' at slot %d\n", 
-              count, dir_path, cache_idx);
-}
+    https_prefetch_running = 0;
 
-// Callback function for httpc_get to write downloaded data to buffer
-static int write_buffer_callback(void *param, unsigned char *buf, size_t length, size_t position, size_t content_length)
-{
-    XFS_DEBUG("https: write_buffer_callback ENTRY param=%p buf=%p length=%zu position=%zu content_length=%zu\n",
-              param, (void*)buf, length, position, content_length);
-    
-    struct https_buffer_info_t* buffer_info = (struct https_buffer_info_t*)param;
-    
-    // If we know the content length, pre-allocate buffer
-    if (content_length > 0 && buffer_info->capacity == 0)
+    for (int i = 0; i < HTTPS_PREFETCH_JOBS; i++)
     {
-        buffer_info->capacity = content_length;
-        buffer_info->data = libspectrum_malloc(content_length);
-        if (!buffer_info->data)
+        struct https_prefetch_job_t* job = &https_prefetch_jobs[i];
+        if (job->state == HTTPS_PREFETCH_DONE)
         {
-            XFS_DEBUG("https: write_buffer_callback [ERROR] failed to allocate buffer of size %zu\n", content_length);
-            return -1;
+            https_free_entries(job->dir_entries, job->dir_entries_count);
         }
-        buffer_info->size = 0;
+        memset(job, 0, sizeof(*job));
     }
-    
-    // Grow buffer if needed (if content_length was unknown)
-    if (position + length > buffer_info->capacity)
+}
+
+// Move the listings fetched by the prefetch threads into the cache
+static void https_prefetch_merge_locked(void)
+{
+    for (int i = 0; i < HTTPS_PREFETCH_JOBS; i++)
     {
-        size_t new_capacity = buffer_info->capacity;
-        if (new_capacity == 0)
+        struct https_prefetch_job_t* job = &https_prefetch_jobs[i];
+        if (job->state != HTTPS_PREFETCH_DONE)
         {
-            new_capacity = 4096; // Start with 4KB
+            continue;
         }
-        
-        // Double capacity until it's large enough
-        while (new_capacity < position + length)
+
+        struct https_dir_cache_entry_t* cache_entry = https_dir_cache_lookup(job->url);
+
+        if (job->result == XFS_ERR_OK && job->response == 304)
         {
-            new_capacity *= 2;
+            // Only good for the listing it revalidated
+            if (cache_entry && strcmp(cache_entry->etag, job->etag) == 0)
+            {
+                https_dir_cache_update(cache_entry, job->response, &job->fetch, NULL, 0);
+                if (job->depth)
+                {
+                    https_prefetch_queue_locked(cache_entry->url, cache_entry->dir_entries,
+                        cache_entry->dir_entries_count, job->depth, 1);
+                }
+            }
         }
-        
-        void* new_data = libspectrum_realloc(buffer_info->data, new_capacity);
-        if (!new_data)
+        else if (job->result == XFS_ERR_OK)
         {
-            XFS_DEBUG("https: write_buffer_callback [ERROR] failed to reallocate buffer to size %zu\n", new_capacity);
-            return -1;
+            if (!cache_entry)
+            {
+                // Prefetched listings are the first to go if they are never used
+                cache_entry = https_dir_cache_new(job->url);
+                cache_entry->last_used = 0;
+            }
+            https_dir_cache_update(cache_entry, job->response, &job->fetch,
+                job->dir_entries, job->dir_entries_count);
+            job->dir_entries = NULL;
         }
-        
-        buffer_info->data = new_data;
-        buffer_info->capacity = new_capacity;
-    }
-    
-    // Copy data to buffer
-    memcpy((unsigned char*)buffer_info->data + position, buf, length);
-    
-    // Update size if this extends the buffer
-    if (position + length > buffer_info->size)
-    {
-        buffer_info->size = position + length;
+
+        // Failures are left to be reported when the directory is really used
+        https_free_entries(job->dir_entries, job->dir_entries_count);
+        job->state = HTTPS_PREFETCH_FREE;
     }
-    
-    return (int)length;
 }
 
-static int parse_index_line_to_entry(const char* line, struct xfs_handle_https_dir_entry_t* entry);
-static int https_parse_index_txt(const char* buffer, const size_t buffer_len,
-    struct xfs_handle_https_dir_entry_t** entries,
-    const uint8_t max_entries);
-
-// Fetch and parse index.txt for a directory
-// Fetches all entries, allocates and returns entries array in out_entries, returns entry count
-static int16_t https_fetch_and_parse_index(const struct xfs_engine_mount_t* engine, const char* dir_path,
-    struct xfs_handle_https_dir_entry_t*** out_entries, uint8_t* out_entry_count)
+// Called before url is fetched for the Z80: merge what has been prefetched,
+// and wait for url itself if it is being fetched right now
+static void https_prefetch_wait(const char* url)
 {
-    struct https_engine_mount_data_t* mount_data = get_mount_data(engine);
-    if (!mount_data || mount_data->url[0] == '\0')
+    if (!https_prefetch_running)
     {
-        XFS_DEBUG("https: fetch_index failed: not mounted\n");
-        return XFS_ERR_IO;
+        return;
     }
 
-    // Build index.txt path
-    char index_path[256];
-    if (dir_path)
+    pthread_mutex_lock(&https_prefetch_mutex);
+
+    struct https_prefetch_job_t* job;
+    while ((job = https_prefetch_find_locked(url)) && job->state != HTTPS_PREFETCH_DONE)
     {
-        if (dir_path[strlen(dir_path) - 1] == '/')
-        {
-            snprintf(index_path, sizeof(index_path), "%sindex.txt", dir_path);
-        }
-        else
+        if (job->state == HTTPS_PREFETCH_QUEUED)
         {
-            snprintf(index_path, sizeof(index_path), "%s/index.txt", dir_path);
+            // Not started yet; the caller fetches it instead
+            job->state = HTTPS_PREFETCH_FREE;
+            break;
         }
-    }
-    else
-    {
-        strcpy(index_path, "/");
+        pthread_cond_wait(&https_prefetch_done, &https_prefetch_mutex);
     }
 
-    // Build full URL
-    char url[512];
-    if (build_https_url(mount_data->url, index_path, url, sizeof(url)) != 0)
-    {
-        XFS_DEBUG("https: fetch_index failed: invalid URL\n");
-        return XFS_ERR_INVAL;
-    }
+    https_prefetch_merge_locked();
 
-    XFS_DEBUG("https: fetch_index fetching from '%s'\n", url);
+    pthread_mutex_unlock(&https_prefetch_mutex);
+}
 
-    // Allocate buffer and fetch index.txt
-    const size_t buffer_size = 2048;
-    char* buffer = (char*)libspectrum_malloc(buffer_size);
-    if (!buffer)
+// Start prefetching the subdirectories of a directory that has just been
+// opened, as deep as the spectranet_prefetch setting says
+static void https_prefetch_children(const struct https_dir_cache_entry_t* cache_entry)
+{
+    int depth = settings_current.spectranet_prefetch;
+    if (depth <= 0)
     {
-        return XFS_ERR_NOMEM;
+        return;
     }
-
-    size_t length = buffer_size;
-    if (httpc_get_buffer(&tls_sck, url, buffer, &length) != HTTPC_OK)
+    if (depth > HTTPS_PREFETCH_MAX_DEPTH)
     {
-        XFS_DEBUG("https: fetch_index failed: httpc_get_buffer error\n");
-        libspectrum_free(buffer);
-        return XFS_ERR_NOENT;
+        depth = HTTPS_PREFETCH_MAX_DEPTH;
     }
 
-    XFS_DEBUG("https: fetch_index received %zu bytes\n", length);
-
-    // First pass: count entries (max 128)
-    int entry_count = https_parse_index_txt(buffer, length, NULL, 0);
-    if (entry_count < 0)
+    if (https_prefetch_start() != 0)
     {
-        XFS_DEBUG("https: fetch_index failed: parse error\n");
-        libspectrum_free(buffer);
-        return XFS_ERR_IO;
+        return;
     }
 
-    // Limit to 128 entries
-    if (entry_count > 128)
+    pthread_mutex_lock(&https_prefetch_mutex);
+    https_prefetch_queue_locked(cache_entry->url, cache_entry->dir_entries, cache_entry->dir_entries_count,
+        (uint8_t)depth, 1);
+    pthread_mutex_unlock(&https_prefetch_mutex);
+}
+
+// Return the listing of a directory, fetching or revalidating index.txt as
+// needed. The returned entry belongs to the cache.
+static int16_t https_dir_cache_get(const struct xfs_engine_mount_t* engine, const char* dir_path,
+    struct https_dir_cache_entry_t** out_cache_entry)
+{
+    char url[HTTPS_DIR_URL_MAX];
+    const int16_t url_result = https_dir_index_url(engine, dir_path, url, sizeof(url));
+    if (url_result != XFS_ERR_OK)
     {
-        entry_count = 128;
+        return url_result;
     }
 
-    XFS_DEBUG("https: fetch_index found %d entries\n", entry_count);
+    https_dir_cache_init();
+    https_prefetch_wait(url);
 
-    if (entry_count == 0)
+    struct https_dir_cache_entry_t* cache_entry = https_dir_cache_find(url);
+    if (!cache_entry)
     {
-        XFS_DEBUG("https: fetch_index empty directory\n");
-        libspectrum_free(buffer);
-        *out_entries = NULL;
-        *out_entry_count = 0;
-        return XFS_ERR_OK; // Empty directory
+        cache_entry = https_dir_cache_new(url);
+        https_dir_cache_load(cache_entry);
     }
 
-    // Allocate array of pointers
-    struct xfs_handle_https_dir_entry_t** entries = (struct xfs_handle_https_dir_entry_t**)libspectrum_malloc(entry_count *
-    sizeof(struct xfs_handle_https_dir_entry_t*));
-
-    if (!entries)
+    if (cache_entry->expires > time(NULL))
     {
-        XFS_DEBUG("https: fetch_index failed: no memory for entries array\n");
-        libspectrum_free(buffer);
-        return XFS_ERR_NOMEM;
+        XFS_DEBUG("https: fetch_index '%s' fresh in cache\n", url);
+        *out_cache_entry = cache_entry;
+        return XFS_ERR_OK;
     }
 
-    // Second pass: parse entries
-    const int parsed_count = https_parse_index_txt(buffer, length, entries, entry_count);
+    XFS_DEBUG("https: fetch_index fetching from '%s'\n", url);
 
-    if (parsed_count < 0)
+    struct https_dir_fetch_t fetch;
+    struct xfs_handle_https_dir_entry_t** entries = NULL;
+    uint8_t entry_count = 0;
+    const int16_t result = https_dir_fetch(&tls_sck, url, cache_entry->etag, &fetch, &entries, &entry_count);
+
+    if (result == XFS_ERR_IO)
     {
-        // Free already allocated entries
-        for (int i = 0; i < entry_count; i++)
+        // Keep browsing a stale listing while the server is unreachable
+        if (tls_sck.response != 404 && (cache_entry->dir_entries || cache_entry->etag[0]))
         {
-            if (entries[i])
-            {
-                libspectrum_free(entries[i]);
-            }
+            XFS_DEBUG("https: fetch_index using stale listing of '%s'\n", url);
+            *out_cache_entry = cache_entry;
+            return XFS_ERR_OK;
         }
-        libspectrum_free(entries);
-        libspectrum_free(buffer);
-        return XFS_ERR_NOMEM;
+
+        https_dir_cache_evict(cache_entry);
+        return XFS_ERR_NOENT;
     }
 
-    // Free buffer now that parsing is complete
-    libspectrum_free(buffer);
+    if (result != XFS_ERR_OK)
+    {
+        https_dir_cache_evict(cache_entry);
+        return result;
+    }
 
-    *out_entries = entries;
-    *out_entry_count = (uint8_t)parsed_count;
+    https_dir_cache_update(cache_entry, tls_sck.response, &fetch, entries, entry_count);
 
-    XFS_DEBUG("https: fetch_index parsed %d entries successfully\n", parsed_count);
+    *out_cache_entry = cache_entry;
     return XFS_ERR_OK;
 }
 
-
 // Mount HTTPS filesystem
 static int16_t https_mount(const struct xfs_engine_t* engine, const char* hostname, const char* path, struct xfs_engine_mount_t* out_mount)
 {
@@ -560,9 +1150,6 @@ static int16_t https_mount(const struct xfs_engine_t* engine, const char* hostna
     }
     memset(mount_data, 0, sizeof(struct https_engine_mount_data_t));
 
-    // Initialize cache rotation index
-    mount_data->next_cache = 0;
-
     // Handle empty path by treating it as root "/"
     const char* normalized_path = path;
     const size_t path_len = strlen(path);
@@ -681,16 +1268,8 @@ static void https_unmount(const struct xfs_engine_t* engine, struct xfs_engine_m
         return;
     }
     
-    // Free all cache entries
-    for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
-    {
-        if (mount_data->https_dir_cache[i].in_use)
-        {
-            https_cache_free_entries(&mount_data->https_dir_cache[i]);
-            mount_data->https_dir_cache[i].in_use = 0;
-        }
-    }
-    
+    // Directory listings stay cached for the next mount of the same server
+
     // Clear hostname
     mount_data->url[0] = '\0';
     XFS_DEBUG("https: unmount complete\n");
@@ -699,7 +1278,7 @@ static void https_unmount(const struct xfs_engine_t* engine, struct xfs_engine_m
     libspectrum_free(mount_data);
 }
 
-// Open file - download to memory buffer
+// Open file - blocks are fetched on demand by https_read()
 static int16_t https_open(const struct xfs_engine_mount_t* engine, struct xfs_handle_t* handle, const char* path, int flags)
 {
     XFS_DEBUG("https: open path='%s' flags=0x%04x\n", path ? path : "(null)", flags);
@@ -730,29 +1309,19 @@ static int16_t https_open(const struct xfs_engine_mount_t* engine, struct xfs_ha
     }
     memset(https_handle, 0, sizeof(struct xfs_handle_https_file_t));
 
-    // Initialize buffer info for download callback
-    struct https_buffer_info_t buffer_info = {0};
-    
-    // Download file using httpc_get
-    XFS_DEBUG("https: open downloading from URL...\n");
-    if (httpc_get(&tls_sck, url, write_buffer_callback, &buffer_info) != HTTPC_OK)
+    const int16_t result = https_cache_open(url, &https_handle->entity);
+    if (result != XFS_ERR_OK)
     {
-        XFS_DEBUG("https: open failed: httpc_get error\n");
-        if (buffer_info.data)
-        {
-            libspectrum_free(buffer_info.data);
-        }
+        XFS_DEBUG("https: open failed: cache open error %d\n", result);
         libspectrum_free(https_handle);
-        return XFS_ERR_IO;
+        return result;
     }
     
-    XFS_DEBUG("https: open download complete, size=%zu\n", buffer_info.size);
-    
-    // Store buffer pointer and size
-    https_handle->data = buffer_info.data;
-    https_handle->size = buffer_info.size;
+    https_handle->size = https_cache_size(https_handle->entity);
     https_handle->pos = 0;
 
+    XFS_DEBUG("https: open size=%zu\n", https_handle->size);
+
     handle->type = XFS_HANDLE_TYPE_FILE;
     handle->data = https_handle;
 
@@ -760,29 +1329,41 @@ static int16_t https_open(const struct xfs_engine_mount_t* engine, struct xfs_ha
     return XFS_ERR_OK;
 }
 
-// Read from memory buffer
+// Read through the block cache
 static int16_t https_read(const struct xfs_engine_mount_t* engine, struct xfs_handle_t* handle, void* buffer, uint16_t size)
 {
     (void)engine;
     struct xfs_handle_https_file_t* https_handle = get_https_file_handle(handle);
+    const uint8_t size_known = https_cache_size_known(https_handle->entity);
+
+    // The size may only be a lower bound until the end has been fetched
+    https_handle->size = https_cache_size(https_handle->entity);
 
     // Check if we're at end of file
-    if (https_handle->pos >= https_handle->size)
+    if (size_known && https_handle->pos >= https_handle->size)
     {
         XFS_DEBUG("https: read EOF\n");
         return 0;
     }
     
     // Calculate how much we can read
-    size_t remaining = https_handle->size - https_handle->pos;
-    size_t to_read = (size < remaining) ? size : remaining;
+    size_t to_read = size;
+    if (size_known && https_handle->size - https_handle->pos < to_read)
+    {
+        to_read = https_handle->size - https_handle->pos;
+    }
     
-    // Copy data from buffer
-    memcpy(buffer, (unsigned char*)https_handle->data + https_handle->pos, to_read);
-    https_handle->pos += to_read;
+    const int32_t bytes_read = https_cache_read(https_handle->entity, https_handle->pos, buffer, (uint16_t)to_read);
+    if (bytes_read < 0)
+    {
+        XFS_DEBUG("https: read failed: %ld\n", (long)bytes_read);
+        return (int16_t)bytes_read;
+    }
+    https_handle->pos += bytes_read;
+    https_handle->size = https_cache_size(https_handle->entity);
     
-    XFS_DEBUG("https: read size=%d bytes_read=%zu\n", size, to_read);
-    return (int16_t)to_read;
+    XFS_DEBUG("https: read size=%d bytes_read=%ld\n", size, (long)bytes_read);
+    return (int16_t)bytes_read;
 }
 
 // Write not supported
@@ -804,12 +1385,9 @@ static int16_t https_close(const struct xfs_engine_mount_t* engine, struct xfs_h
 
     struct xfs_handle_https_file_t* https_handle = get_https_file_handle(handle);
     
-    // Free buffer
-    if (https_handle->data)
-    {
-        libspectrum_free(https_handle->data);
-        https_handle->data = NULL;
-    }
+    // Blocks stay in the cache for the next open
+    https_cache_release(https_handle->entity);
+    https_handle->entity = NULL;
     
     // Free file handle
     libspectrum_free(https_handle);
@@ -846,8 +1424,9 @@ static int16_t https_lseek(const struct xfs_engine_mount_t* engine, struct xfs_h
         return XFS_ERR_INVAL;
     }
     
-    // Clamp to valid range
-    if (new_pos > https_handle->size)
+    // Clamp to valid range, if the end is known
+    https_handle->size = https_cache_size(https_handle->entity);
+    if (new_pos > https_handle->size && https_cache_size_known(https_handle->entity))
     {
         new_pos = https_handle->size;
     }
@@ -1063,7 +1642,21 @@ static int16_t https_opendir(const struct xfs_engine_mount_t* engine, struct xfs
 {
     XFS_DEBUG("https: opendir path='%s'\n", path ? path : "(null)");
 
-    uint8_t entry_count = 0;
+    struct https_dir_cache_entry_t* cache_entry = NULL;
+    const int16_t result = https_dir_cache_get(engine, path, &cache_entry);
+    
+    if (result != XFS_ERR_OK)
+    {
+        return result;
+    }
+
+    https_prefetch_children(cache_entry);
+    
+    if (cache_entry->dir_entries_count == 0)
+    {
+        // Empty directory
+        return XFS_ERR_OK;
+    }
 
     struct xfs_handle_https_dir_t* https_handle = libspectrum_malloc(sizeof(struct xfs_handle_https_dir_t));
     if (!https_handle)
@@ -1072,29 +1665,25 @@ static int16_t https_opendir(const struct xfs_engine_mount_t* engine, struct xfs
     }
     memset(https_handle, 0, sizeof(struct xfs_handle_https_dir_t));
 
-    const int16_t result = https_fetch_and_parse_index(engine, path, &https_handle->dir_entries, &entry_count);
-    
-    if (result != XFS_ERR_OK)
+    // The handle gets its own copy, as the cache may drop the listing while it is open
+    https_handle->dir_entries = (struct xfs_handle_https_dir_entry_t**)libspectrum_malloc(
+        cache_entry->dir_entries_count * sizeof(struct xfs_handle_https_dir_entry_t*));
+    if (!https_handle->dir_entries)
     {
         libspectrum_free(https_handle);
-        return result;
+        return XFS_ERR_NOMEM;
     }
-    
-    if (entry_count == 0)
+
+    for (uint8_t i = 0; i < cache_entry->dir_entries_count; i++)
     {
-        // Empty directory
-        libspectrum_free(https_handle);
-        return XFS_ERR_OK;
+        struct xfs_handle_https_dir_entry_t* entry = https_cache_copy_entry(cache_entry->dir_entries[i]);
+        if (entry)
+        {
+            https_handle->dir_entries[https_handle->dir_entries_count++] = entry;
+        }
     }
-
-    https_handle->dir_entries_count = entry_count;
     https_handle->dir_entries_pos = 0;
     
-    // Cache the directory entries using normalized directory path (same as stat() will use)
-    char cache_path[HTTPS_CACHE_PATH_MAX];
-    https_normalize_dir_path(path, cache_path);
-    https_cache_put_entries(engine, cache_path, https_handle->dir_entries, entry_count);
-    
     handle->data = https_handle;
     handle->type = XFS_HANDLE_TYPE_DIR;
     
@@ -1246,70 +1835,16 @@ static int16_t https_stat(const struct xfs_engine_mount_t* engine, const char* p
         entry_name[sizeof(entry_name) - 1] = '\0';
     }
     
-    // Try to find entry in cache first
-    const struct xfs_handle_https_dir_entry_t* cached_entry =
-        https_cache_find_entry(engine, dir_path, entry_name);
-
-    if (cached_entry)
-    {
-        XFS_DEBUG("https: stat found in cache: '%s' in '%s'\n", entry_name, dir_path);
-        memset(stat_info, 0, sizeof(*stat_info));
-        
-        if (cached_entry->is_dir)
-        {
-            stat_info->type = XFS_TYPE_DIR;
-            stat_info->size = 0;
-        }
-        else
-        {
-            stat_info->type = XFS_TYPE_REG;
-            stat_info->size = cached_entry->size;
-        }
-        
-        // Copy name
-        size_t name_len = strlen(cached_entry->name);
-        if (name_len >= sizeof(stat_info->name))
-        {
-            name_len = sizeof(stat_info->name) - 1;
-        }
-        memcpy(stat_info->name, cached_entry->name, name_len);
-        stat_info->name[name_len] = '\0';
-        
-        XFS_DEBUG("https: stat success from cache: type=%d size=%lu\n", 
-                  stat_info->type, (unsigned long)stat_info->size);
-
-        return XFS_ERR_OK;
-    }
-    
-    // Not in cache, fetch index.txt for the directory
-    struct xfs_handle_https_dir_entry_t** entries = NULL;
-    uint8_t entry_count = 0;
-    
-    const int16_t fetch_result = https_fetch_and_parse_index(engine, dir_path, &entries, &entry_count);
+    // Fetch (or find in the cache) the listing of the directory
+    struct https_dir_cache_entry_t* cache_entry = NULL;
+    const int16_t fetch_result = https_dir_cache_get(engine, dir_path, &cache_entry);
     
     if (fetch_result != XFS_ERR_OK)
     {
         return fetch_result;
     }
     
-    // Search for the entry in the fetched entries
-    const struct xfs_handle_https_dir_entry_t* found_entry = NULL;
-    for (uint8_t i = 0; i < entry_count; i++)
-    {
-        if (entries[i] && strcmp(entries[i]->name, entry_name) == 0)
-        {
-            found_entry = entries[i];
-            break;
-        }
-    }
-    
-    // Cache the directory entries for future use (transfer ownership to cache)
-    char cache_path[HTTPS_CACHE_PATH_MAX];
-    https_normalize_dir_path(dir_path, cache_path);
-    https_cache_store_entries(engine, cache_path, entries, entry_count);
-    // Ownership transferred to cache, entries will be freed when cache is evicted
-    entries = NULL;
-    entry_count = 0;
+    const struct xfs_handle_https_dir_entry_t* found_entry = https_dir_cache_find_name(cache_entry, entry_name);
     
     if (!found_entry)
     {
@@ -1408,14 +1943,9 @@ static void https_free_handle(const struct xfs_engine_mount_t* engine, struct xf
     {
         struct xfs_handle_https_file_t* https_handle = get_https_file_handle(handle);
 
-        // Free buffer if exists
         if (https_handle)
         {
-          if (https_handle->data)
-          {
-              libspectrum_free(https_handle->data);
-              https_handle->data = NULL;
-          }
+          https_cache_release(https_handle->entity);
 
           libspectrum_free(https_handle);
         }
@@ -1445,6 +1975,20 @@ static void https_free_handle(const struct xfs_engine_mount_t* engine, struct xf
     handle->data = NULL;
 }
 
+void https_dir_cache_free(void)
+{
+    https_prefetch_end();
+
+    for (int i = 0; i < HTTPS_DIR_CACHE_SIZE; i++)
+    {
+        if (https_dir_cache[i].in_use)
+        {
+            https_dir_cache_evict(&https_dir_cache[i]);
+        }
+    }
+    https_dir_cache_initialised = 0;
+}
+
 // HTTPS engine instance
 struct xfs_engine_t https_engine = {
     .user = NULL,
@@ -0,0 +1,776 @@
+#include "config.h"
+
+#include "xfs.h"
+#include "xfs_https_cache.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "libspectrum.h"
+#include "../http/httpc.h"
+#include "../http/http_sck.h"
+
+// Macro for XFS debug output (only prints if enabled)
+#define XFS_DEBUG(...) do { if (xfs_debug_is_enabled()) printf(__VA_ARGS__); } while(0)
+
+// Maximum number of cached blocks (4MB with 16K blocks)
+#define HTTPS_CACHE_BLOCKS 256
+// Hash buckets for block lookup (power of two)
+#define HTTPS_CACHE_BUCKETS 128
+// Maximum number of remote files remembered
+#define HTTPS_CACHE_ENTITIES 32
+// Seconds an entity is trusted before it is revalidated on open
+#define HTTPS_CACHE_TTL 60
+// Maximum number of consecutive missing blocks fetched by one request
+#define HTTPS_CACHE_FETCH_BLOCKS 4
+// Most blocks kept from one response, from the first one requested; a server
+// which ignores Range sends the whole file, and keeping all of a large one
+// would evict the blocks that were asked for
+#define HTTPS_CACHE_WINDOW_BLOCKS (HTTPS_CACHE_BLOCKS / 2)
+// Maximum length of a validator (ETag or Last-Modified)
+#define HTTPS_CACHE_VALIDATOR_MAX 64
+
+#define HTTPS_CACHE_NO_BLOCK 0xffff
+
+struct https_entity_t
+{
+    char url[256];
+    char validator[HTTPS_CACHE_VALIDATOR_MAX];
+    uint32_t id;                         // Changes whenever the remote file does
+    uint32_t size;                       // A lower bound if !size_known
+    uint8_t size_known;
+    uint8_t in_use;
+    uint16_t refs;                       // Open handles
+    time_t validated;                    // When the validator was last checked
+    uint32_t last_used;
+};
+
+struct https_block_t
+{
+    uint8_t* data;
+    uint32_t entity_id;                  // 0 if the slot is free
+    uint32_t index;
+    uint32_t filled;                     // Bytes of data received
+    uint16_t hash_next;
+    uint16_t lru_prev;
+    uint16_t lru_next;
+};
+
+static struct https_entity_t https_entities[HTTPS_CACHE_ENTITIES];
+static struct https_block_t https_blocks[HTTPS_CACHE_BLOCKS];
+static uint16_t https_buckets[HTTPS_CACHE_BUCKETS];
+static uint16_t https_lru_head = HTTPS_CACHE_NO_BLOCK;  // Most recently used
+static uint16_t https_lru_tail = HTTPS_CACHE_NO_BLOCK;  // Least recently used
+static uint8_t https_cache_initialised = 0;
+static uint32_t https_next_entity_id = 1;
+static uint32_t https_use_counter = 0;
+
+// State of the request in progress, filled in by the header and body callbacks
+struct https_fetch_t
+{
+    struct https_entity_t* entity;
+    uint32_t first;                      // Blocks [first, first + count) requested
+    uint32_t count;
+    uint32_t offset;                     // First byte requested
+    uint32_t received;                   // Bytes of body received
+    char validator[HTTPS_CACHE_VALIDATOR_MAX];
+    uint8_t has_etag;
+    uint32_t total;                      // From Content-Range
+    uint8_t total_known;
+    uint8_t checked;                     // Validator compared against entity
+};
+
+static struct https_fetch_t* https_fetch_current = NULL;
+
+static void https_cache_init(void)
+{
+    if (https_cache_initialised)
+    {
+        return;
+    }
+
+    memset(https_blocks, 0, sizeof(https_blocks));
+    for (int i = 0; i < HTTPS_CACHE_BUCKETS; i++)
+    {
+        https_buckets[i] = HTTPS_CACHE_NO_BLOCK;
+    }
+
+    // Every slot starts out on the LRU list, free slots naturally drift to the tail
+    for (int i = 0; i < HTTPS_CACHE_BLOCKS; i++)
+    {
+        https_blocks[i].hash_next = HTTPS_CACHE_NO_BLOCK;
+        https_blocks[i].lru_prev = i == 0 ? HTTPS_CACHE_NO_BLOCK : i - 1;
+        https_blocks[i].lru_next = i == HTTPS_CACHE_BLOCKS - 1 ? HTTPS_CACHE_NO_BLOCK : i + 1;
+    }
+    https_lru_head = 0;
+    https_lru_tail = HTTPS_CACHE_BLOCKS - 1;
+
+    https_cache_initialised = 1;
+}
+
+static inline uint16_t https_block_bucket(uint32_t entity_id, uint32_t index)
+{
+    return ((entity_id * 2654435761u) ^ (index * 40503u)) & (HTTPS_CACHE_BUCKETS - 1);
+}
+
+static void https_lru_unlink(uint16_t slot)
+{
+    struct https_block_t* block = &https_blocks[slot];
+
+    if (block->lru_prev != HTTPS_CACHE_NO_BLOCK)
+        https_blocks[block->lru_prev].lru_next = block->lru_next;
+    else
+        https_lru_head = block->lru_next;
+
+    if (block->lru_next != HTTPS_CACHE_NO_BLOCK)
+        https_blocks[block->lru_next].lru_prev = block->lru_prev;
+    else
+        https_lru_tail = block->lru_prev;
+}
+
+static void https_lru_touch(uint16_t slot)
+{
+    if (https_lru_head == slot)
+    {
+        return;
+    }
+
+    https_lru_unlink(slot);
+
+    struct https_block_t* block = &https_blocks[slot];
+    block->lru_prev = HTTPS_CACHE_NO_BLOCK;
+    block->lru_next = https_lru_head;
+    https_blocks[https_lru_head].lru_prev = slot;
+    https_lru_head = slot;
+}
+
+static uint16_t https_block_find(uint32_t entity_id, uint32_t index)
+{
+    uint16_t slot = https_buckets[https_block_bucket(entity_id, index)];
+
+    while (slot != HTTPS_CACHE_NO_BLOCK)
+    {
+        if (https_blocks[slot].entity_id == entity_id && https_blocks[slot].index == index)
+        {
+            return slot;
+        }
+        slot = https_blocks[slot].hash_next;
+    }
+
+    return HTTPS_CACHE_NO_BLOCK;
+}
+
+static void https_block_unhash(uint16_t slot)
+{
+    struct https_block_t* block = &https_blocks[slot];
+    uint16_t* link = &https_buckets[https_block_bucket(block->entity_id, block->index)];
+
+    while (*link != HTTPS_CACHE_NO_BLOCK)
+    {
+        if (*link == slot)
+        {
+            *link = block->hash_next;
+            break;
+        }
+        link = &https_blocks[*link].hash_next;
+    }
+
+    block->hash_next = HTTPS_CACHE_NO_BLOCK;
+    block->entity_id = 0;
+    block->filled = 0;
+}
+
+// Find the block, or recycle the least recently used slot for it
+static struct https_block_t* https_block_get(uint32_t entity_id, uint32_t index)
+{
+    uint16_t slot = https_block_find(entity_id, index);
+
+    if (slot == HTTPS_CACHE_NO_BLOCK)
+    {
+        slot = https_lru_tail;
+
+        struct https_block_t* block = &https_blocks[slot];
+        if (block->entity_id)
+        {
+            https_block_unhash(slot);
+        }
+
+        if (!block->data)
+        {
+            block->data = libspectrum_malloc(HTTPS_CACHE_BLOCK_SIZE);
+        }
+
+        block->entity_id = entity_id;
+        block->index = index;
+        block->filled = 0;
+
+        const uint16_t bucket = https_block_bucket(entity_id, index);
+        block->hash_next = https_buckets[bucket];
+        https_buckets[bucket] = slot;
+    }
+
+    https_lru_touch(slot);
+    return &https_blocks[slot];
+}
+
+static uint32_t https_block_length(const struct https_entity_t* entity, uint32_t index)
+{
+    const uint32_t start = index * HTTPS_CACHE_BLOCK_SIZE;
+
+    if (!entity->size_known)
+    {
+        return HTTPS_CACHE_BLOCK_SIZE;
+    }
+    if (start >= entity->size)
+    {
+        return 0;
+    }
+    return entity->size - start < HTTPS_CACHE_BLOCK_SIZE ? entity->size - start : HTTPS_CACHE_BLOCK_SIZE;
+}
+
+// Returns the block if it has been completely received
+static struct https_block_t* https_block_lookup(const struct https_entity_t* entity, uint32_t index)
+{
+    const uint16_t slot = https_block_find(entity->id, index);
+
+    if (slot == HTTPS_CACHE_NO_BLOCK || https_blocks[slot].filled < https_block_length(entity, index))
+    {
+        return NULL;
+    }
+
+    https_lru_touch(slot);
+    return &https_blocks[slot];
+}
+
+// Copy the value of a "Name: value" header field, without surrounding whitespace
+static void https_copy_field_value(const char* line, size_t name_len, char* out, size_t out_size)
+{
+    const char* value = line + name_len;
+    while (*value == ' ' || *value == '\t')
+        value++;
+
+    size_t len = strlen(value);
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t' || value[len - 1] == '\r'))
+        len--;
+
+    if (len >= out_size)
+        len = out_size - 1;
+
+    memcpy(out, value, len);
+    out[len] = '\0';
+}
+
+// Called by httpc for every response header field
+static int https_cache_field(httpc_options_t* os, const char* line)
+{
+    (void)os;
+    struct https_fetch_t* fetch = https_fetch_current;
+
+    if (!fetch)
+    {
+        return 0;
+    }
+
+    if (strncasecmp(line, "ETag:", 5) == 0)
+    {
+        https_copy_field_value(line, 5, fetch->validator, sizeof(fetch->validator));
+        fetch->has_etag = 1;
+    }
+    else if (strncasecmp(line, "Last-Modified:", 14) == 0 && !fetch->has_etag)
+    {
+        https_copy_field_value(line, 14, fetch->validator, sizeof(fetch->validator));
+    }
+    else if (strncasecmp(line, "Content-Range:", 14) == 0)
+    {
+        // Content-Range: bytes 0-16383/123456
+        const char* slash = strchr(line, '/');
+        if (slash && slash[1] != '*')
+        {
+            fetch->total = (uint32_t)strtoul(slash + 1, NULL, 10);
+            fetch->total_known = 1;
+        }
+    }
+
+    return 0;
+}
+
+// Headers are complete once the first piece of body arrives; if the remote
+// file changed give the entity a new identity before storing anything
+static void https_fetch_check_validator(struct https_fetch_t* fetch, size_t content_length)
+{
+    struct https_entity_t* entity = fetch->entity;
+
+    if (fetch->checked)
+    {
+        return;
+    }
+    fetch->checked = 1;
+
+    if (!entity->id || !fetch->validator[0] || strcmp(entity->validator, fetch->validator) != 0)
+    {
+        XFS_DEBUG("https: cache new version of '%s' (validator '%s')\n", entity->url, fetch->validator);
+        entity->id = https_next_entity_id++;
+        if (!https_next_entity_id)
+            https_next_entity_id = 1;
+        strcpy(entity->validator, fetch->validator);
+        entity->size = 0;
+        entity->size_known = 0;
+    }
+
+    if (tls_sck.response == 206)
+    {
+        if (fetch->total_known)
+        {
+            entity->size = fetch->total;
+            entity->size_known = 1;
+        }
+    }
+    else if (content_length > 0)
+    {
+        // The whole file is coming, whatever we asked for
+        entity->size = (uint32_t)content_length;
+        entity->size_known = 1;
+    }
+
+    entity->validated = time(NULL);
+}
+
+// Called by httpc with each piece of the response body
+static int https_cache_write_callback(void* param, unsigned char* buf, size_t length, size_t position, size_t content_length)
+{
+    struct https_fetch_t* fetch = (struct https_fetch_t*)param;
+    struct https_entity_t* entity = fetch->entity;
+
+    https_fetch_check_validator(fetch, content_length);
+
+    // A 200 response carries the whole file from the start
+    uint32_t offset = (uint32_t)position + (tls_sck.response == 206 ? fetch->offset : 0);
+
+    if (position + length > fetch->received)
+        fetch->received = (uint32_t)(position + length);
+
+    while (length > 0)
+    {
+        const uint32_t index = offset / HTTPS_CACHE_BLOCK_SIZE;
+        const uint32_t in_block = offset % HTTPS_CACHE_BLOCK_SIZE;
+        size_t chunk = HTTPS_CACHE_BLOCK_SIZE - in_block;
+        if (chunk > length)
+            chunk = length;
+
+        if (index >= fetch->first && index - fetch->first < HTTPS_CACHE_WINDOW_BLOCKS)
+        {
+            struct https_block_t* block = https_block_get(entity->id, index);
+            if (!block->data)
+            {
+                return -1;
+            }
+
+            // Blocks are only ever filled in order
+            if (in_block <= block->filled)
+            {
+                memcpy(block->data + in_block, buf, chunk);
+                if (in_block + chunk > block->filled)
+                    block->filled = in_block + chunk;
+            }
+        }
+
+        buf += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+// Work out what the response said about the size of the file, once the whole
+// body has arrived
+static void https_fetch_finish(struct https_fetch_t* fetch)
+{
+    struct https_entity_t* entity = fetch->entity;
+
+    // An empty body never reaches the write callback
+    https_fetch_check_validator(fetch, 0);
+
+    if (entity->size_known)
+    {
+        return;
+    }
+
+    if (tls_sck.response != 206)
+    {
+        // Chunked full download with no length: the size is whatever arrived
+        entity->size = fetch->received;
+        entity->size_known = 1;
+    }
+    else if (fetch->received < fetch->count * HTTPS_CACHE_BLOCK_SIZE)
+    {
+        // Content-Range: bytes a-b/* and less than was asked for, so the
+        // range ran into the end of the file
+        entity->size = fetch->offset + fetch->received;
+        entity->size_known = 1;
+    }
+    else if (fetch->offset + fetch->received > entity->size)
+    {
+        // The file is at least this long; reading past it fetches more
+        entity->size = fetch->offset + fetch->received;
+    }
+}
+
+// Fetch blocks [first, first + count) of the entity
+static int16_t https_cache_fetch(struct https_entity_t* entity, uint32_t first, uint32_t count)
+{
+    struct https_fetch_t fetch;
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.entity = entity;
+    fetch.first = first;
+    fetch.count = count;
+    fetch.offset = first * HTTPS_CACHE_BLOCK_SIZE;
+
+    char range[64];
+    snprintf(range, sizeof(range), "Range: bytes=%lu-%lu",
+        (unsigned long)fetch.offset, (unsigned long)(fetch.offset + count * HTTPS_CACHE_BLOCK_SIZE - 1));
+    char* headers[] = { range };
+
+    XFS_DEBUG("https: cache fetch '%s' %s\n", entity->url, range);
+
+    tls_sck.argc = 1;
+    tls_sck.argv = headers;
+    tls_sck.field = https_cache_field;
+    https_fetch_current = &fetch;
+
+    const int result = httpc_get(&tls_sck, entity->url, https_cache_write_callback, &fetch);
+
+    https_fetch_current = NULL;
+    tls_sck.field = NULL;
+    tls_sck.argv = NULL;
+    tls_sck.argc = 0;
+
+    if (result != HTTPC_OK && tls_sck.response == 416 && first == 0)
+    {
+        // Range Not Satisfiable for the first byte: the file is empty
+        https_fetch_check_validator(&fetch, 0);
+        entity->size = 0;
+        entity->size_known = 1;
+        return XFS_ERR_OK;
+    }
+
+    if (result != HTTPC_OK && tls_sck.response == 416 && !entity->size_known && fetch.offset == entity->size)
+    {
+        // The file ends exactly where the ranges fetched so far did
+        entity->size_known = 1;
+        return XFS_ERR_OK;
+    }
+
+    if (result != HTTPC_OK)
+    {
+        XFS_DEBUG("https: cache fetch failed (result=%d, response=%d)\n", result, tls_sck.response);
+        return tls_sck.response == 404 ? XFS_ERR_NOENT : XFS_ERR_IO;
+    }
+
+    https_fetch_finish(&fetch);
+
+    return XFS_ERR_OK;
+}
+
+static struct https_entity_t* https_entity_find(const char* url)
+{
+    for (int i = 0; i < HTTPS_CACHE_ENTITIES; i++)
+    {
+        if (https_entities[i].in_use && strcmp(https_entities[i].url, url) == 0)
+        {
+            return &https_entities[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Take a free entity slot, or forget the least recently used unopened file
+static struct https_entity_t* https_entity_new(const char* url)
+{
+    struct https_entity_t* victim = NULL;
+
+    for (int i = 0; i < HTTPS_CACHE_ENTITIES; i++)
+    {
+        struct https_entity_t* entity = &https_entities[i];
+        if (!entity->in_use)
+        {
+            victim = entity;
+            break;
+        }
+        if (!entity->refs && (!victim || entity->last_used < victim->last_used))
+        {
+            victim = entity;
+        }
+    }
+
+    if (!victim)
+    {
+        return NULL;
+    }
+
+    // Blocks of a forgotten entity can never be found again and age out of the LRU
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->url, url, sizeof(victim->url) - 1);
+    victim->in_use = 1;
+    return victim;
+}
+
+int16_t https_cache_open(const char* url, struct https_entity_t** out_entity)
+{
+    https_cache_init();
+
+    struct https_entity_t* entity = https_entity_find(url);
+    if (!entity)
+    {
+        entity = https_entity_new(url);
+        if (!entity)
+        {
+            return XFS_ERR_NOMEM;
+        }
+    }
+
+    entity->last_used = ++https_use_counter;
+
+    if (!entity->id || !entity->size_known || time(NULL) - entity->validated >= HTTPS_CACHE_TTL)
+    {
+        // Revalidate by fetching the first block, which is usually needed anyway
+        const int16_t result = https_cache_fetch(entity, 0, 1);
+        if (result != XFS_ERR_OK)
+        {
+            if (!entity->refs)
+                entity->in_use = 0;
+            return result;
+        }
+    }
+    else
+    {
+        XFS_DEBUG("https: cache reusing '%s' size=%lu\n", url, (unsigned long)entity->size);
+    }
+
+    entity->refs++;
+    *out_entity = entity;
+    return XFS_ERR_OK;
+}
+
+void https_cache_release(struct https_entity_t* entity)
+{
+    if (entity && entity->refs)
+    {
+        entity->refs--;
+    }
+}
+
+uint32_t https_cache_size(const struct https_entity_t* entity)
+{
+    return entity->size;
+}
+
+uint8_t https_cache_size_known(const struct https_entity_t* entity)
+{
+    return entity->size_known;
+}
+
+int32_t https_cache_read(struct https_entity_t* entity, uint32_t offset, void* buffer, uint16_t size)
+{
+    uint8_t* out = (uint8_t*)buffer;
+    int32_t done = 0;
+
+    entity->last_used = ++https_use_counter;
+
+    while (size > 0 && (offset < entity->size || !entity->size_known))
+    {
+        const uint32_t index = offset / HTTPS_CACHE_BLOCK_SIZE;
+        struct https_block_t* block = https_block_lookup(entity, index);
+
+        if (!block)
+        {
+            // Fetch this block and any missing ones straight after it
+            uint32_t count = 1;
+            const uint32_t last = entity->size_known ? (entity->size - 1) / HTTPS_CACHE_BLOCK_SIZE : UINT32_MAX;
+            while (count < HTTPS_CACHE_FETCH_BLOCKS && index + count <= last &&
+                   https_block_find(entity->id, index + count) == HTTPS_CACHE_NO_BLOCK)
+            {
+                count++;
+            }
+
+            const uint32_t id = entity->id;
+            const int16_t result = https_cache_fetch(entity, index, count);
+            if (result != XFS_ERR_OK)
+            {
+                return done ? done : result;
+            }
+
+            // The file changed underneath us; what was already read is stale
+            if (entity->id != id)
+            {
+                return XFS_ERR_IO;
+            }
+
+            // The file turned out to end before the offset
+            if (entity->size_known && offset >= entity->size)
+            {
+                break;
+            }
+
+            block = https_block_lookup(entity, index);
+            if (!block)
+            {
+                return done ? done : XFS_ERR_IO;
+            }
+        }
+
+        const uint32_t in_block = offset % HTTPS_CACHE_BLOCK_SIZE;
+        uint32_t chunk = block->filled - in_block;
+        if (chunk > size)
+            chunk = size;
+
+        memcpy(out, block->data + in_block, chunk);
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+        done += chunk;
+    }
+
+    return done;
+}
+
+void https_cache_free(void)
+{
+    for (int i = 0; i < HTTPS_CACHE_BLOCKS; i++)
+    {
+        libspectrum_free(https_blocks[i].data);
+    }
+    memset(https_entities, 0, sizeof(https_entities));
+    https_cache_initialised = 0;
+}
+
+// Deliver a response body to the write callback in pieces, as httpc does
+static int https_cache_test_body(struct https_fetch_t* fetch, uint32_t base, uint32_t length, size_t content_length)
+{
+    unsigned char piece[4096];
+
+    for (uint32_t position = 0; position < length; position += sizeof(piece))
+    {
+        const uint32_t chunk = length - position < sizeof(piece) ? length - position : sizeof(piece);
+        for (uint32_t i = 0; i < chunk; i++)
+            piece[i] = (unsigned char)((base + position + i) * 7 + ((base + position + i) >> 14));
+
+        if (https_cache_write_callback(fetch, piece, chunk, position, content_length))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int https_cache_test_data(const uint8_t* data, uint32_t offset, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] != (uint8_t)((offset + i) * 7 + ((offset + i) >> 14)))
+            return 1;
+    }
+
+    return 0;
+}
+
+int https_cache_unittest(void)
+{
+    const int saved_response = tls_sck.response;
+    struct https_fetch_t fetch;
+    struct https_entity_t* entity;
+    uint8_t buffer[256];
+    int r = 0;
+
+    https_cache_init();
+
+    // A server which ignores Range and sends all 6MB of the file with a 200
+    // must not push the requested blocks out of the cache
+    const uint32_t large = 6 * 1024 * 1024;
+    const uint32_t first = 10;
+    entity = https_entity_new("https://unittest/large");
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.entity = entity;
+    fetch.first = first;
+    fetch.count = HTTPS_CACHE_FETCH_BLOCKS;
+    fetch.offset = first * HTTPS_CACHE_BLOCK_SIZE;
+    tls_sck.response = 200;
+
+    if (https_cache_test_body(&fetch, 0, large, large))
+    {
+        printf("%s:%d: write callback failed\n", __FILE__, __LINE__);
+        r++;
+    }
+    https_fetch_finish(&fetch);
+
+    if (!entity->size_known || entity->size != large)
+    {
+        printf("%s:%d: size %lu, expected %lu\n", __FILE__, __LINE__, (unsigned long)entity->size, (unsigned long)large);
+        r++;
+    }
+
+    for (uint32_t index = first; index < first + HTTPS_CACHE_FETCH_BLOCKS; index++)
+    {
+        if (!https_block_lookup(entity, index))
+        {
+            printf("%s:%d: requested block %lu evicted\n", __FILE__, __LINE__, (unsigned long)index);
+            r++;
+        }
+    }
+
+    const uint32_t offset = first * HTTPS_CACHE_BLOCK_SIZE + 100;
+    if (https_cache_read(entity, offset, buffer, sizeof(buffer)) != sizeof(buffer) ||
+        https_cache_test_data(buffer, offset, sizeof(buffer)))
+    {
+        printf("%s:%d: read after a full download failed\n", __FILE__, __LINE__);
+        r++;
+    }
+
+    // 206 with "Content-Range: bytes a-b/*" for a range not at the start: the
+    // size is only a lower bound until a range comes back short
+    entity = https_entity_new("https://unittest/unknown");
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.entity = entity;
+    fetch.first = 2;
+    fetch.count = HTTPS_CACHE_FETCH_BLOCKS;
+    fetch.offset = 2 * HTTPS_CACHE_BLOCK_SIZE;
+    tls_sck.response = 206;
+    https_fetch_current = &fetch;
+    https_cache_field(&tls_sck, "Content-Range: bytes 32768-98303/*");
+    https_fetch_current = NULL;
+
+    https_cache_test_body(&fetch, fetch.offset, HTTPS_CACHE_FETCH_BLOCKS * HTTPS_CACHE_BLOCK_SIZE, 0);
+    https_fetch_finish(&fetch);
+
+    if (entity->size_known || entity->size != 6 * HTTPS_CACHE_BLOCK_SIZE)
+    {
+        printf("%s:%d: size %lu (%s), expected a lower bound of %lu\n", __FILE__, __LINE__, (unsigned long)entity->size,
+            entity->size_known ? "known" : "lower bound", (unsigned long)(6 * HTTPS_CACHE_BLOCK_SIZE));
+        r++;
+    }
+
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.entity = entity;
+    fetch.first = 6;
+    fetch.count = HTTPS_CACHE_FETCH_BLOCKS;
+    fetch.offset = 6 * HTTPS_CACHE_BLOCK_SIZE;
+    fetch.checked = 1;
+
+    https_cache_test_body(&fetch, fetch.offset, 1000, 0);
+    https_fetch_finish(&fetch);
+
+    if (!entity->size_known || entity->size != 6 * HTTPS_CACHE_BLOCK_SIZE + 1000)
+    {
+        printf("%s:%d: size %lu, expected %lu\n", __FILE__, __LINE__, (unsigned long)entity->size,
+            (unsigned long)(6 * HTTPS_CACHE_BLOCK_SIZE + 1000));
+        r++;
+    }
+
+    tls_sck.response = saved_response;
+    https_cache_free();
+
+    return r;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Block cache for files served by the https engine.
+//
+// Files are fetched lazily in HTTPS_CACHE_BLOCK_SIZE blocks using HTTP Range
+// requests, and blocks are kept in a single LRU shared across handles and
+// mounts. Each remote file is an "entity" keyed by its URL; when the server's
+// validator (ETag, or Last-Modified if there is no ETag) changes the entity
+// gets a new identity so that blocks of the old version are never returned.
+
+#define HTTPS_CACHE_BLOCK_SIZE 16384
+
+struct https_entity_t;
+
+// Look up (or fetch the first block of) the file at url. Entities validated
+// less than HTTPS_CACHE_TTL seconds ago are reused without any network access.
+int16_t https_cache_open(const char* url, struct https_entity_t** out_entity);
+
+// Drop a reference obtained from https_cache_open()
+void https_cache_release(struct https_entity_t* entity);
+
+// Size of the file in bytes; only a lower bound until https_cache_size_known()
+// (a server may answer a range request without giving the total size)
+uint32_t https_cache_size(const struct https_entity_t* entity);
+uint8_t https_cache_size_known(const struct https_entity_t* entity);
+
+// Read up to size bytes at offset, fetching any missing blocks
+// Returns number of bytes read, or an XFS_ERR_* code
+int32_t https_cache_read(struct https_entity_t* entity, uint32_t offset, void* buffer, uint16_t size);
+
+// Free every entity and block
+void https_cache_free(void);
+
+int https_cache_unittest(void);
@@ -2,6 +2,8 @@
 
 #include "xfs.h"
 #include "xfs_engines.h"
+#include "xfs_https_cache.h"
+#include "../http/http_sck.h"
 #include "config.h"
 #include "xfs_worker.h"
 #ifdef WIN32
@@ -9,6 +11,7 @@
 #define mkdir(path, mode) _mkdir(path)
 #endif
 
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -17,12 +20,47 @@
 #include <sys/stat.h>
 
 #include "libspectrum.h"
+#include "event.h"
+#include "fuse.h"
 #include "memory_pages.h"
+#include "spectrum.h"
 #include "ui/ui.h"
 #include "compat.h"
 
 volatile struct xfs_registers_t xfs_registers = {};
 
+// Commands are executed on a background thread so that slow engines (e.g.
+// https) never stall the emulation; the Z80 sees XFS_STATUS_BUSY until the
+// result is published back into xfs_registers from the main thread.
+#define XFS_JOB_QUEUE_SIZE (4)
+
+// How often (in tstates) the main thread checks for completed commands
+#define XFS_POLL_TSTATES (3500)
+
+struct xfs_job_t
+{
+    struct xfs_registers_t registers;
+    // Bytes of the workspace written by the command
+    uint16_t workspace_length;
+};
+
+static struct xfs_job_t xfs_jobs[XFS_JOB_QUEUE_SIZE];
+
+// Monotonic job counters: jobs in [published, completed) are waiting to be
+// published, jobs in [completed, submitted) are waiting to be executed
+static unsigned int xfs_jobs_submitted = 0;
+static unsigned int xfs_jobs_completed = 0;
+static unsigned int xfs_jobs_published = 0;
+
+static pthread_t xfs_thread;
+static pthread_mutex_t xfs_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xfs_jobs_pending = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t xfs_jobs_done = PTHREAD_COND_INITIALIZER;
+static bool xfs_thread_running = false;
+static bool xfs_stop_thread = false;
+
+static int xfs_poll_event;
+
 // XFS debug logging control
 static bool xfs_debug_enabled = true;
 
@@ -41,7 +79,137 @@ bool xfs_debug_is_enabled(void)
 }
 
 // XFS base directory path
-char xfs_base_path[512];
+char xfs_base_path[XFS_BASE_PATH_MAX];
+
+static void* xfs_worker_thread(void* arg GCC_UNUSED)
+{
+    pthread_mutex_lock(&xfs_jobs_mutex);
+
+    while (!xfs_stop_thread)
+    {
+        if (xfs_jobs_completed == xfs_jobs_submitted)
+        {
+            pthread_cond_wait(&xfs_jobs_pending, &xfs_jobs_mutex);
+            continue;
+        }
+
+        struct xfs_job_t* job = &xfs_jobs[xfs_jobs_completed % XFS_JOB_QUEUE_SIZE];
+
+        // The engines and handles are only ever touched from this thread
+        // (or with the queue drained), so run the command unlocked
+        pthread_mutex_unlock(&xfs_jobs_mutex);
+        const uint8_t command = job->registers.command;
+        xfs_handle_command(&job->registers);
+
+        // A read only produces what it returns, which is usually much less
+        // than the whole workspace
+        job->workspace_length = sizeof(job->registers.workspace);
+        if (command == XFS_CMD_READ && job->registers.result < job->workspace_length)
+        {
+            job->workspace_length = job->registers.result > 0 ? job->registers.result : 0;
+        }
+        pthread_mutex_lock(&xfs_jobs_mutex);
+
+        xfs_jobs_completed++;
+        pthread_cond_broadcast(&xfs_jobs_done);
+    }
+
+    pthread_mutex_unlock(&xfs_jobs_mutex);
+
+    return NULL;
+}
+
+// Copy the results of completed commands into the registers seen by the Z80
+static void xfs_poll(libspectrum_dword last_tstates, int type GCC_UNUSED, void* user_data GCC_UNUSED)
+{
+    bool pending;
+
+    pthread_mutex_lock(&xfs_jobs_mutex);
+
+    while (xfs_jobs_published != xfs_jobs_completed)
+    {
+        const struct xfs_job_t* job = &xfs_jobs[xfs_jobs_published % XFS_JOB_QUEUE_SIZE];
+        const struct xfs_registers_t* results = &job->registers;
+
+        // Only the fields written by the command handlers are copied back;
+        // the Z80 may be using the rest of the page while the command runs
+        memcpy((uint8_t*)xfs_registers.workspace, results->workspace, job->workspace_length);
+        xfs_registers.file_handle = results->file_handle;
+        xfs_registers.result = results->result;
+        xfs_registers.status = results->status;
+
+        xfs_jobs_published++;
+    }
+
+    pending = (xfs_jobs_published != xfs_jobs_submitted);
+
+    pthread_cond_broadcast(&xfs_jobs_done);
+    pthread_mutex_unlock(&xfs_jobs_mutex);
+
+    if (pending)
+    {
+        event_add(last_tstates + XFS_POLL_TSTATES, xfs_poll_event);
+    }
+}
+
+static void xfs_submit_command(void)
+{
+    bool idle;
+
+    pthread_mutex_lock(&xfs_jobs_mutex);
+
+    // The queue only fills if the Z80 issues commands without waiting for
+    // the previous ones; just wait for the worker to catch up
+    while (xfs_jobs_submitted - xfs_jobs_published == XFS_JOB_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&xfs_jobs_mutex);
+        xfs_poll(tstates, xfs_poll_event, NULL);
+        pthread_mutex_lock(&xfs_jobs_mutex);
+        if (xfs_jobs_submitted - xfs_jobs_published == XFS_JOB_QUEUE_SIZE)
+        {
+            pthread_cond_wait(&xfs_jobs_done, &xfs_jobs_mutex);
+        }
+    }
+
+    idle = (xfs_jobs_published == xfs_jobs_submitted);
+
+    memcpy(&xfs_jobs[xfs_jobs_submitted % XFS_JOB_QUEUE_SIZE].registers,
+        (const uint8_t*)&xfs_registers, sizeof(struct xfs_registers_t));
+    xfs_jobs_submitted++;
+
+    xfs_registers.command = 0;
+    xfs_registers.result = 0;
+    xfs_registers.status = XFS_STATUS_BUSY;
+
+    pthread_cond_signal(&xfs_jobs_pending);
+    pthread_mutex_unlock(&xfs_jobs_mutex);
+
+    if (idle)
+    {
+        event_add(tstates + XFS_POLL_TSTATES, xfs_poll_event);
+    }
+}
+
+// Wait for any running command to finish and discard everything else
+static void xfs_drain_jobs(void)
+{
+    pthread_mutex_lock(&xfs_jobs_mutex);
+
+    if (xfs_jobs_submitted != xfs_jobs_completed)
+    {
+        // Only the command currently being executed (if any) is kept
+        xfs_jobs_submitted = xfs_jobs_completed + 1;
+        while (xfs_jobs_completed != xfs_jobs_submitted)
+        {
+            pthread_cond_wait(&xfs_jobs_done, &xfs_jobs_mutex);
+        }
+    }
+    xfs_jobs_published = xfs_jobs_completed;
+
+    pthread_mutex_unlock(&xfs_jobs_mutex);
+
+    event_remove_type(xfs_poll_event);
+}
 
 void xfs_init()
 {
@@ -57,12 +225,48 @@ void xfs_init()
         ui_error( UI_ERROR_WARNING, "xfs: failed to create xfs directory: %s\n", strerror(errno) );
     }
     
+    xfs_poll_event = event_register(xfs_poll, "XFS command completion");
+
+    xfs_stop_thread = false;
+    const int error = pthread_create(&xfs_thread, NULL, xfs_worker_thread, NULL);
+    if (error)
+    {
+        ui_error( UI_ERROR_ERROR, "xfs: error %d creating thread", error );
+        fuse_abort();
+    }
+    xfs_thread_running = true;
+
     XFS_DEBUG("xfs: initialized with base path: %s\n", xfs_base_path[0] != '\0' ? xfs_base_path : "(null)");
 }
 
+void xfs_end(void)
+{
+    if (!xfs_thread_running)
+        return;
+
+    xfs_drain_jobs();
+
+    pthread_mutex_lock(&xfs_jobs_mutex);
+    xfs_stop_thread = true;
+    pthread_cond_signal(&xfs_jobs_pending);
+    pthread_mutex_unlock(&xfs_jobs_mutex);
+
+    pthread_join(xfs_thread, NULL);
+    xfs_thread_running = false;
+
+    xfs_free();
+    https_cache_free();
+    https_dir_cache_free();
+    http_pool_free();
+}
+
 void xfs_reset(void)
 {
     XFS_DEBUG("xfs: reset - cleaning up all mounts and handles\n");
+
+    // The worker must not be inside an engine while it is being torn down
+    xfs_drain_jobs();
+    xfs_registers.status = XFS_STATUS_IDLE;
     
     // Call xfs_free() from xfs.c to clean up all resources
     xfs_free();
@@ -83,9 +287,9 @@ void xfs_write( memory_page *page GCC_UNUSED, libspectrum_word address, libspect
     uint8_t *registers = (uint8_t*)&xfs_registers;
     registers[offset] = b;
     
-    if (offset == 0)
+    if (offset == 0 && b)
     {
-        // Command register written - process command via dispatcher
-        xfs_handle_command((struct xfs_registers_t*)&xfs_registers);
+        // Command register written - queue the command for the worker thread
+        xfs_submit_command();
     }
 }
@@ -9,10 +9,14 @@
 extern volatile struct xfs_registers_t xfs_registers;
 
 // XFS base directory path (used by xfs_fs.c)
-extern char xfs_base_path[];
+#define XFS_BASE_PATH_MAX 512
+extern char xfs_base_path[XFS_BASE_PATH_MAX];
 
 void xfs_init();
 
+// Stop the worker thread and release all mounts and handles
+void xfs_end(void);
+
 // Fuse-specific memory access functions
 libspectrum_byte xfs_read( memory_page *page GCC_UNUSED, libspectrum_word address );
 void xfs_write( memory_page *page GCC_UNUSED, libspectrum_word address, libspectrum_byte b );
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -26,12 +27,39 @@
 #include "../security/tls.h"
 #include "../nic/dns_resolver.h"
 
+// Connection pool limits
+#define HTTP_POOL_MAX_IDLE 8          // idle connections kept across all hosts
+#define HTTP_POOL_PER_HOST 4          // connections open to one host at once
+#define HTTP_POOL_IDLE_TIMEOUT 15.0   // seconds an idle connection is kept for
+
+// Every scheme/host/port we've connected to
+typedef struct http_pool_host_t {
+    char domain[256];
+    unsigned short port;
+    int use_ssl;
+    int active;                       // connections currently handed out
+    struct http_pool_host_t *next;
+} http_pool_host_t;
+
 // Socket structure for httpc
 typedef struct {
     compat_socket_t fd;
     tls_socket_t *tls;
+    http_pool_host_t *host;
+    double idle_since;                // when it was last returned to the pool
 } fuse_http_socket_t;
 
+// Connections kept alive after a complete response, oldest first. Shared by
+// every caller and protected by http_pool_mutex
+static pthread_mutex_t http_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_pool_released = PTHREAD_COND_INITIALIZER;
+static http_pool_host_t *http_pool_hosts = NULL;
+static fuse_http_socket_t *http_pool_idle[HTTP_POOL_MAX_IDLE];
+static int http_pool_idle_count = 0;
+
+static unsigned long http_pool_opened = 0;
+static unsigned long http_pool_reused = 0;
+
 void* malloc_allocator(void *arena, void *ptr, size_t oldsz, size_t newsz)
 {
     (void)arena;
@@ -52,17 +80,110 @@ void* malloc_allocator(void *arena, void *ptr, size_t oldsz, size_t newsz)
     return NULL;
 }
 
-int sck_http_open(httpc_options_t *os, void **socket_out, void *opts, const char *domain, const unsigned short port, int use_ssl)
+static void http_socket_free(fuse_http_socket_t *sock)
+{
+    if (sock->tls)
+    {
+        tls_close(sock->tls);
+        tls_socket_free(sock->tls);
+        sock->tls = NULL;
+    }
+
+    if (sock->fd != compat_socket_invalid)
+    {
+        compat_socket_close(sock->fd);
+        sock->fd = compat_socket_invalid;
+    }
+
+    libspectrum_free(sock);
+}
+
+// Find (or add) the pool entry for a host; called with http_pool_mutex held
+static http_pool_host_t* http_pool_host(const char *domain, unsigned short port, int use_ssl)
+{
+    http_pool_host_t *host;
+
+    for (host = http_pool_hosts; host; host = host->next)
+    {
+        if (host->port == port && host->use_ssl == use_ssl && !strcmp(host->domain, domain))
+            return host;
+    }
+
+    host = libspectrum_new0(http_pool_host_t, 1);
+    snprintf(host->domain, sizeof(host->domain), "%s", domain);
+    host->port = port;
+    host->use_ssl = use_ssl;
+    host->next = http_pool_hosts;
+    http_pool_hosts = host;
+
+    return host;
+}
+
+static void http_pool_remove_idle(int index)
+{
+    memmove(&http_pool_idle[index], &http_pool_idle[index + 1],
+            (http_pool_idle_count - index - 1) * sizeof(http_pool_idle[0]));
+    http_pool_idle_count--;
+}
+
+// An idle connection is only any good if the server hasn't closed it (or
+// sent anything unexpected) while it sat in the pool
+static int http_socket_is_alive(fuse_http_socket_t *sock)
+{
+    fd_set readfds;
+    struct timeval timeout = { 0, 0 };
+
+    if (sock->tls && (sock->tls->has_pending_data || mbedtls_ssl_get_bytes_avail(&sock->tls->ssl)))
+        return 0;
+
+    FD_ZERO(&readfds);
+    FD_SET(sock->fd, &readfds);
+
+    return select(sock->fd + 1, &readfds, NULL, NULL, &timeout) == 0;
+}
+
+// Take an idle connection to host, if there is a usable one; called with
+// http_pool_mutex held
+static fuse_http_socket_t* http_pool_take(http_pool_host_t *host)
+{
+    double now = compat_timer_get_time();
+    int i;
+
+    for (i = http_pool_idle_count - 1; i >= 0; i--)
+    {
+        fuse_http_socket_t *sock = http_pool_idle[i];
+
+        if (now - sock->idle_since >= HTTP_POOL_IDLE_TIMEOUT)
+        {
+            http_pool_remove_idle(i);
+            http_socket_free(sock);
+        }
+        else if (sock->host == host)
+        {
+            http_pool_remove_idle(i);
+            if (http_socket_is_alive(sock))
+                return sock;
+            http_socket_free(sock);
+        }
+    }
+
+    return NULL;
+}
+
+// Give back a connection's slot for its host; called with http_pool_mutex held
+static void http_pool_release(fuse_http_socket_t *sock)
+{
+    sock->host->active--;
+    pthread_cond_broadcast(&http_pool_released);
+}
+
+static int sck_http_connect(fuse_http_socket_t *sock, const char *domain, const unsigned short port, int use_ssl)
 {
-    (void)os;
-    (void)opts;
-    
     struct addrinfo hints;
     struct addrinfo *result = NULL;
     int ret;
     compat_socket_t fd = compat_socket_invalid;
     tls_socket_t *tls = NULL;
-    fuse_http_socket_t *sock = NULL;
 
     // Resolve hostname
     memset(&hints, 0, sizeof(hints));
@@ -127,18 +248,59 @@ int sck_http_open(httpc_options_t *os, void **socket_out, void *opts, const char
         }
     }
 
+    sock->fd = fd;
+    sock->tls = tls;
+
+    return HTTPC_OK;
+}
+
+int sck_http_open(httpc_options_t *os, void **socket_out, void *opts, const char *domain, const unsigned short port, int use_ssl)
+{
+    (void)os;
+    (void)opts;
+
+    http_pool_host_t *host;
+    fuse_http_socket_t *sock;
+
+    pthread_mutex_lock(&http_pool_mutex);
+
+    // Wait for a slot on this host, then prefer a kept connection
+    host = http_pool_host(domain, port, use_ssl);
+    while (host->active >= HTTP_POOL_PER_HOST)
+        pthread_cond_wait(&http_pool_released, &http_pool_mutex);
+    host->active++;
+
+    sock = http_pool_take(host);
+    if (sock)
+    {
+        http_pool_reused++;
+        pthread_mutex_unlock(&http_pool_mutex);
+        *socket_out = sock;
+        return HTTPC_REUSE;
+    }
+
+    pthread_mutex_unlock(&http_pool_mutex);
+
     // Allocate socket structure
     sock = libspectrum_malloc(sizeof(fuse_http_socket_t));
-    if (!sock)
+    sock->fd = compat_socket_invalid;
+    sock->tls = NULL;
+    sock->host = host;
+    sock->idle_since = 0;
+
+    if (sck_http_connect(sock, domain, port, use_ssl) != HTTPC_OK)
     {
-        if (tls)
-            tls_socket_free(tls);
-        compat_socket_close(fd);
+        pthread_mutex_lock(&http_pool_mutex);
+        http_pool_release(sock);
+        pthread_mutex_unlock(&http_pool_mutex);
+        libspectrum_free(sock);
         return HTTPC_ERROR;
     }
 
-    sock->fd = fd;
-    sock->tls = tls;
+    pthread_mutex_lock(&http_pool_mutex);
+    http_pool_opened++;
+    pthread_mutex_unlock(&http_pool_mutex);
+
     *socket_out = sock;
 
     return HTTPC_OK;
@@ -153,21 +315,82 @@ int sck_http_close(httpc_options_t *os, void *socket)
 
     fuse_http_socket_t *sock = (fuse_http_socket_t*)socket;
 
-    if (sock->tls)
+    pthread_mutex_lock(&http_pool_mutex);
+    http_pool_release(sock);
+    pthread_mutex_unlock(&http_pool_mutex);
+
+    http_socket_free(sock);
+    return HTTPC_OK;
+}
+
+// Called by httpc instead of close once a response has been read in full
+// from a connection the server agreed to keep alive
+int sck_http_keep(httpc_options_t *os, void *socket)
+{
+    (void)os;
+
+    if (!socket)
+        return HTTPC_OK;
+
+    fuse_http_socket_t *sock = (fuse_http_socket_t*)socket;
+    fuse_http_socket_t *evicted = NULL;
+
+    pthread_mutex_lock(&http_pool_mutex);
+
+    http_pool_release(sock);
+
+    if (http_pool_idle_count == HTTP_POOL_MAX_IDLE)
     {
-        tls_close(sock->tls);
-        tls_socket_free(sock->tls);
-        sock->tls = NULL;
+        evicted = http_pool_idle[0];
+        http_pool_remove_idle(0);
     }
 
-    if (sock->fd != compat_socket_invalid)
+    sock->idle_since = compat_timer_get_time();
+    http_pool_idle[http_pool_idle_count++] = sock;
+
+    pthread_mutex_unlock(&http_pool_mutex);
+
+    if (evicted)
+        http_socket_free(evicted);
+
+    return HTTPC_OK;
+}
+
+void http_pool_stats(unsigned long *opened, unsigned long *reused)
+{
+    pthread_mutex_lock(&http_pool_mutex);
+    *opened = http_pool_opened;
+    *reused = http_pool_reused;
+    pthread_mutex_unlock(&http_pool_mutex);
+}
+
+void http_pool_free(void)
+{
+    http_pool_host_t *host, *next, *kept = NULL;
+
+    pthread_mutex_lock(&http_pool_mutex);
+
+    while (http_pool_idle_count)
     {
-        compat_socket_close(sock->fd);
-        sock->fd = compat_socket_invalid;
+        http_socket_free(http_pool_idle[http_pool_idle_count - 1]);
+        http_pool_idle_count--;
     }
 
-    libspectrum_free(sock);
-    return HTTPC_OK;
+    // Hosts are only freed once nothing can be using them
+    for (host = http_pool_hosts; host; host = next)
+    {
+        next = host->next;
+        if (host->active)
+        {
+            host->next = kept;
+            kept = host;
+            continue;
+        }
+        libspectrum_free(host);
+    }
+    http_pool_hosts = kept;
+
+    pthread_mutex_unlock(&http_pool_mutex);
 }
 
 int sck_http_read(httpc_options_t *os, void *socket, unsigned char *buf, size_t *length)
@@ -280,10 +503,11 @@ httpc_options_t tls_sck = {
     .allocator = malloc_allocator,
     .open = sck_http_open,
     .close = sck_http_close,
+    .keep = sck_http_keep,
     .read = sck_http_read,
     .write = sck_http_write,
     .sleep = sck_http_sleep,
     .time = sck_http_time,
     .logger = sck_http_logger,
-    .flags = HTTPC_OPT_LOGGING_ON
+    .flags = HTTPC_OPT_LOGGING_ON | HTTPC_OPT_KEEP_ALIVE
 };
@@ -3,3 +3,12 @@
 #include "httpc.h"
 
 extern httpc_options_t tls_sck;
+
+// Connections to each scheme/host/port are kept alive between requests and
+// reused, with at most a few in use per host at once
+
+// Number of connections opened, and requests which reused a kept one
+void http_pool_stats(unsigned long *opened, unsigned long *reused);
+
+// Close every idle connection
+void http_pool_free(void);
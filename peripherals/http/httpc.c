@@ -111,6 +111,7 @@ struct httpc {
 		 length_set    :1, /* has length been set on a PUT/POST? */
 		 open          :1, /* is the file handle open? */
 		 keep_alive    :1, /* does the server support keep-alive? */
+		 pooled        :1, /* was the connection handed back by 'open' for reuse? */
 		 progress      :1; /* are we making progress? */
 };
 
@@ -161,6 +162,11 @@ static int httpc_is_reuse(httpc_t *h) {
 	return !!(h->os->flags & HTTPC_OPT_REUSE);
 }
 
+static int httpc_is_keep_alive(httpc_t *h) {
+	assert(h);
+	return !!(h->os->flags & HTTPC_OPT_KEEP_ALIVE) && h->os->keep;
+}
+
 #ifdef __GNUC__
 static int httpc_log_fmt(httpc_t *h, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 static int httpc_log_line(httpc_t *h, const char *type, int die, int ret, const unsigned line, const char *fmt, ...) __attribute__ ((format (printf, 6, 7)));
@@ -585,6 +591,14 @@ static const char *httpc_case_insensitive_search(const char *haystack, const cha
 	return NULL;
 }
 
+static int httpc_has_custom_range(httpc_t *h) { /* caller asked for a specific range; do not resume with our own */
+	const char field[] = "Range:";
+	for (int i = 0; i < h->os->argc; i++)
+		if (httpc_case_insensitive_compare(field, h->os->argv[i], sizeof (field) - 1) == 0)
+			return 1;
+	return 0;
+}
+
 static int httpc_request_send_header(httpc_t *h, httpc_buffer_t *b0, int op) {
 	assert(h);
 	assert(b0);
@@ -610,7 +624,7 @@ static int httpc_request_send_header(httpc_t *h, httpc_buffer_t *b0, int op) {
 		goto fail;
 	if (httpc_buffer_add_string(h, b0, "\r\n") < 0)
 		goto fail;
-	if (op == HTTPC_GET && !(h->os->flags & HTTPC_OPT_HTTP_1_0) && h->position && h->accept_ranges) {
+	if (op == HTTPC_GET && !(h->os->flags & HTTPC_OPT_HTTP_1_0) && h->position && h->accept_ranges && !httpc_has_custom_range(h)) {
 		char range[64 + 1] = { 0, };
 		if (httpc_buffer_add_string(h, b0, "Range: bytes=") < 0)
 			goto fail;
@@ -638,7 +652,7 @@ static int httpc_request_send_header(httpc_t *h, httpc_buffer_t *b0, int op) {
 		}
 	}
 
-	if (httpc_is_reuse(h)) {
+	if (httpc_is_reuse(h) || httpc_is_keep_alive(h)) {
 		if (httpc_buffer_add_string(h, b0, "Connection: keep-alive\r\n") < 0)
 			goto fail;
 	} else {
@@ -717,6 +731,8 @@ static int httpc_parse_response_field(httpc_t *h, char *line, size_t length) {
 	if (length == 0)
 		return HTTPC_OK;
 	line[length - 1] = '\0';
+	if (h->os->field && h->os->field(h->os, line) < 0)
+		return error(h, "field callback failed: %s", line);
 
 #define X_MACRO_FIELDS \
 	X("Transfer-Encoding:", FLD_TRANSFER_ENCODING) \
@@ -875,6 +891,7 @@ static int httpc_parse_response_header_start_line(httpc_t *h, char *line, const
 	if (!httpc_case_insensitive_compare(line, v1_0, sizeof (v1_0) - 1)) {
 		h->v1 = 1;
 		h->v2 = 0;
+		h->keep_alive = 0; /* unless the server says otherwise */
 		i += sizeof (v1_0) - 1;
 	} else if (!httpc_case_insensitive_compare(line, v1_1, sizeof (v1_1) - 1)) {
 		h->v1 = 1;
@@ -1000,8 +1017,10 @@ static int httpc_parse_response_body_identity(httpc_t *h, httpc_buffer_t *b0) {
 		size_t length = b0->allocated;
 		if (httpc_network_read(h, b0->buffer, &length) < 0)
 			return error(h, "read error");
-		if (length == 0)
+		if (length == 0) {
+			h->keep_alive = 0; /* the body was delimited by the connection closing */
 			break;
+		}
 		if ((h->position + length) < h->position)
 			return fatal(h, "overflow in length");
 		if (httpc_execute_rcv_callback(h, b0->buffer, length) < 0)
@@ -1035,8 +1054,18 @@ static int httpc_parse_response_body_chunked(httpc_t *h, httpc_buffer_t *b0) {
 		httpc_length_t length = 0;
 		if (httpc_string_to_number((char*)b0->buffer, &length, nl, 16) < 0)
 			return error(h, "number format error: %s", b0->buffer);
-		if (length == 0)
+		if (length == 0) {
+			for (;;) { /* discard any trailer and the final empty line, so the connection can be reused */
+				nl = b0->allocated;
+				if (httpc_read_until_line_end(h, b0, &nl) < 0) {
+					h->keep_alive = 0;
+					break;
+				}
+				if (nl == 0)
+					break;
+			}
 			return info(h, "chunked done");
+		}
 
 		b0->used = 0;
 		for (size_t i = 0, l = 0; i < length; i += l) {
@@ -1184,7 +1213,7 @@ next_state:
 		h->open     = 0;
 		h->progress = 0;
 		os->response = 0;
-		if (os->flags & ~(HTTPC_OPT_LOGGING_ON | HTTPC_OPT_HTTP_1_0 | HTTPC_OPT_NON_BLOCKING | HTTPC_OPT_REUSE)) {
+		if (os->flags & ~(HTTPC_OPT_LOGGING_ON | HTTPC_OPT_HTTP_1_0 | HTTPC_OPT_NON_BLOCKING | HTTPC_OPT_REUSE | HTTPC_OPT_KEEP_ALIVE)) {
 			h->status = fatal(h, "unknown option provided %u", os->flags);
 			next      = SM_DONE;
 		}
@@ -1211,7 +1240,8 @@ next_state:
 		if (h->open) /* reuse connection */
 			break;
 		const int y = os->open(os, &h->socket, os->socketopts, h->domain, h->port, h->use_ssl);
-		if (y == HTTPC_OK)
+		h->pooled = y == HTTPC_REUSE;
+		if (y == HTTPC_OK || y == HTTPC_REUSE)
 			h->open = 1;
 		else if (y == HTTPC_YIELD)
 			next = SM_OPEN;
@@ -1261,7 +1291,7 @@ next_state:
 	}
 	case SM_RCVB:
 		next = SM_DONE;
-		if (op == HTTPC_GET) {
+		if (op == HTTPC_GET && os->response != 204 && os->response != 304) { /* these never have a body */
 			const httpc_length_t pos = h->position;
 			h->progress = 0;
 			const int r = httpc_parse_response_body(h);
@@ -1293,6 +1323,12 @@ next_state:
 			}
 		}
 
+		if (h->pooled && !os->response) { /* a kept connection the server had closed; retry at once */
+			info(h, "kept connection closed by server, reconnecting");
+			h->pooled = 0;
+			next = SM_OPEN;
+			break;
+		}
 		if (h->retries >= h->retries_max) {
 			h->status = HTTPC_ERROR;
 			next      = SM_DONE;
@@ -1327,7 +1363,8 @@ next_state:
 				h->state = next; /* !! */
 				return HTTPC_REUSE; /* !! */
 			}
-			if (os->close(os, h->socket) == HTTPC_YIELD) {
+			const int keep = httpc_is_keep_alive(h) && !httpc_is_dead(h) && h->status == HTTPC_OK && h->keep_alive;
+			if ((keep ? os->keep(os, h->socket) : os->close(os, h->socket)) == HTTPC_YIELD) {
 				/* stay in the same state */
 				break; /* !! */
 			} else { /* do not care about errors -- only yield */
@@ -25,6 +25,7 @@ enum {
 	HTTPC_OPT_LOGGING_ON   = 1u << 1, /* turn logging on, if compiled in */
 	HTTPC_OPT_NON_BLOCKING = 1u << 2, /* turn on non-blocking mode, library will return HTTPC_YIELD instead of blocking */
 	HTTPC_OPT_REUSE        = 1u << 3, /* turn on connection reuse */
+	HTTPC_OPT_KEEP_ALIVE   = 1u << 4, /* ask for keep-alive, hand finished connections to 'keep' instead of 'close' */
 };
 
 typedef int (*httpc_callback)(void *param, unsigned char *buf, size_t length, size_t position, size_t content_length);
@@ -42,6 +43,8 @@ struct httpc_options { /* Note that get/put/etcetera functions can *write* to th
 	int (*sleep)(httpc_options_t *os, unsigned long milliseconds );
 	int (*time)(httpc_options_t *os, unsigned long *millisecond);
 	int (*logger)(httpc_options_t *os, void *file, const char *fmt, va_list ap);
+	int (*field)(httpc_options_t *os, const char *line); /* optional; called with each response header field */
+	int (*keep)(httpc_options_t *os, void *socket); /* optional; with HTTPC_OPT_KEEP_ALIVE, called instead of close when the connection can take another request */
 
 	void *arena       /* passed to allocator */,
 	     *logfile,    /* passed to logger */
@@ -84,7 +87,9 @@ HTTPC_API int httpc_tests(httpc_options_t *a);
 
 /* You provide these functions and populate 'httpc_options_t' with them when porting to a new platform 
  * (i.e. Not Unix or Windows) - return negative on failure, zero (HTTPC_OK) on success, and for 
- * open/close/read/write return HTTPC_YIELD if you want the client to yield to its' caller. */
+ * open/close/read/write return HTTPC_YIELD if you want the client to yield to its' caller. 'open'
+ * may return HTTPC_REUSE if it handed back a connection previously given to 'keep'; if that turns
+ * out to have been closed by the server the request is retried at once on a new connection. */
 HTTPC_API extern int httpc_open(httpc_options_t *a, void **socket, void *socketopts, const char *domain, unsigned short port, int use_ssl);
 HTTPC_API extern int httpc_close(httpc_options_t *a, void *socket);
 HTTPC_API extern int httpc_read(httpc_options_t *a, void *socket, unsigned char *buf, size_t *length);
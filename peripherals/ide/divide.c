@@ -32,6 +32,7 @@
 #include "ide.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "periph.h"
 #include "settings.h"
@@ -304,14 +305,16 @@ divide_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_divide_paged( snap, divxxx_get_active( divide_state ) );
   libspectrum_snap_set_divide_control( snap, divxxx_get_control( divide_state ) );
 
-  buffer = libspectrum_new( libspectrum_byte, DIVIDE_PAGE_LENGTH );
+  if( memory_snapshot_contents ) {
+    buffer = libspectrum_new( libspectrum_byte, DIVIDE_PAGE_LENGTH );
 
-  memcpy( buffer, divxxx_get_eprom( divide_state ), DIVIDE_PAGE_LENGTH );
-  libspectrum_snap_set_divide_eprom( snap, 0, buffer );
+    memcpy( buffer, divxxx_get_eprom( divide_state ), DIVIDE_PAGE_LENGTH );
+    libspectrum_snap_set_divide_eprom( snap, 0, buffer );
+  }
 
   libspectrum_snap_set_divide_pages( snap, DIVIDE_PAGES );
 
-  for( i = 0; i < DIVIDE_PAGES; i++ ) {
+  for( i = 0; i < DIVIDE_PAGES && memory_snapshot_contents; i++ ) {
 
     buffer = libspectrum_new( libspectrum_byte, DIVIDE_PAGE_LENGTH );
 
@@ -32,6 +32,7 @@
 #include "ide.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "periph.h"
 #include "settings.h"
@@ -336,14 +337,16 @@ divmmc_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_divmmc_paged( snap, divxxx_get_active( divmmc_state ) );
   libspectrum_snap_set_divmmc_control( snap, divxxx_get_control( divmmc_state ) );
 
-  buffer = libspectrum_new( libspectrum_byte, DIVMMC_PAGE_LENGTH );
+  if( memory_snapshot_contents ) {
+    buffer = libspectrum_new( libspectrum_byte, DIVMMC_PAGE_LENGTH );
 
-  memcpy( buffer, divxxx_get_eprom( divmmc_state ), DIVMMC_PAGE_LENGTH );
-  libspectrum_snap_set_divmmc_eprom( snap, 0, buffer );
+    memcpy( buffer, divxxx_get_eprom( divmmc_state ), DIVMMC_PAGE_LENGTH );
+    libspectrum_snap_set_divmmc_eprom( snap, 0, buffer );
+  }
 
   libspectrum_snap_set_divmmc_pages( snap, DIVMMC_PAGES );
 
-  for( i = 0; i < DIVMMC_PAGES; i++ ) {
+  for( i = 0; i < DIVMMC_PAGES && memory_snapshot_contents; i++ ) {
 
     buffer = libspectrum_new( libspectrum_byte, DIVMMC_PAGE_LENGTH );
 
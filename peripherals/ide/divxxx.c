@@ -77,7 +77,7 @@ divxxx_alloc( const char *eprom_source_name, size_t ram_page_count,
     const int *enabled, const int *write_protect )
 {
   size_t i, j;
-  divxxx_t *divxxx = libspectrum_new( divxxx_t, 1 );
+  divxxx_t *divxxx = libspectrum_new0( divxxx_t, 1 );
 
   divxxx->control = 0;
   divxxx->active = 0;
@@ -100,7 +100,7 @@ divxxx_alloc( const char *eprom_source_name, size_t ram_page_count,
     libspectrum_new( memory_page*, divxxx->ram_page_count );
   for( i = 0; i < divxxx->ram_page_count; i++ ) {
     divxxx->memory_map_ram[i] =
-      libspectrum_new( memory_page, MEMORY_PAGES_IN_8K );
+      libspectrum_new0( memory_page, MEMORY_PAGES_IN_8K );
     for( j = 0; j < MEMORY_PAGES_IN_8K; j++ ) {
       memory_page *page = &divxxx->memory_map_ram[i][j];
       page->source = divxxx->ram_memory_source;
@@ -546,7 +546,7 @@ zxatasp_to_snapshot( libspectrum_snap *snap )
 
   libspectrum_snap_set_zxatasp_pages( snap, ZXATASP_PAGES );
 
-  for( i = 0; i < ZXATASP_PAGES; i++ ) {
+  for( i = 0; i < ZXATASP_PAGES && memory_snapshot_contents; i++ ) {
 
     buffer = libspectrum_new( libspectrum_byte, ZXATASP_PAGE_LENGTH );
 
@@ -324,7 +324,7 @@ zxcf_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_zxcf_memctl( snap, last_memctl );
   libspectrum_snap_set_zxcf_pages( snap, ZXCF_PAGES );
 
-  for( i = 0; i < ZXCF_PAGES; i++ ) {
+  for( i = 0; i < ZXCF_PAGES && memory_snapshot_contents; i++ ) {
 
     buffer = libspectrum_new( libspectrum_byte, ZXCF_PAGE_LENGTH );
 
@@ -36,6 +36,7 @@
 #include "event.h"
 #include "infrastructure/startup_manager.h"
 #include "memory.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "multiface.h"
 #include "options.h"
@@ -670,11 +671,14 @@ multiface_to_snapshot( libspectrum_snap *snap )
     libspectrum_snap_set_multiface_red_button_disabled( snap, 1 );
   }
 
+  libspectrum_snap_set_multiface_ram_length( snap, 0, MULTIFACE_RAM_SIZE );
+
+  if( !memory_snapshot_contents ) return;
+
   buffer = libspectrum_new( libspectrum_byte, MULTIFACE_RAM_SIZE );
   for( i = 0; i < MEMORY_PAGES_IN_8K; i++ )
     memcpy( buffer + i * MEMORY_PAGE_SIZE,
             multiface_memory_map_romcs_ram[i].page, MEMORY_PAGE_SIZE );
 
   libspectrum_snap_set_multiface_ram( snap, 0, buffer );
-  libspectrum_snap_set_multiface_ram_length( snap, 0, MULTIFACE_RAM_SIZE );
 }
@@ -26,7 +26,9 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -37,6 +39,11 @@
 #include "w5100.h"
 #include "w5100_internals.h"
 
+#ifdef W5100_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 enum w5100_registers {
   W5100_MR = 0x000,
 
@@ -84,6 +91,178 @@ nic_w5100_reset( nic_w5100_t *self )
     nic_w5100_socket_reset( &self->socket[i] );
 }
 
+#ifdef W5100_USE_EPOLL
+
+void
+nic_w5100_wake( nic_w5100_t *self, nic_w5100_socket_t *socket )
+{
+  uint64_t one = 1;
+
+  pthread_mutex_lock( &self->wake_lock );
+  self->wake_sockets |= 1 << socket->id;
+  pthread_mutex_unlock( &self->wake_lock );
+
+  if( write( self->wake_fd, &one, sizeof( one ) ) == -1 )
+    nic_w5100_debug( "w5100: error %d waking io thread\n", errno );
+}
+
+/* Sockets stay registered for both directions for as long as their file
+   descriptor is open; closing it removes the registration */
+void
+nic_w5100_register_socket( nic_w5100_t *self, nic_w5100_socket_t *socket )
+{
+  struct epoll_event event;
+
+  socket->io_readable = socket->io_writable = 0;
+
+  /* Edge-triggered readiness needs non-blocking sockets.
+     Note: compat_socket_blocking_mode( fd, 1 ) sets O_NONBLOCK */
+  compat_socket_blocking_mode( socket->fd, 1 );
+
+  memset( &event, 0, sizeof( event ) );
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = socket;
+
+  if( epoll_ctl( self->epoll_fd, EPOLL_CTL_ADD, socket->fd, &event ) == -1 )
+    nic_w5100_error( UI_ERROR_ERROR,
+                     "w5100: failed to register socket %d; errno %d: %s\n",
+                     socket->id, errno, strerror( errno ) );
+}
+
+static void*
+w5100_io_thread( void *arg )
+{
+  nic_w5100_t *self = arg;
+  double deadlines[4] = { 0, 0, 0, 0 };
+  int i;
+
+  while( !self->stop_io_thread ) {
+    struct epoll_event events[8];
+    int socket_events[4] = { 0, 0, 0, 0 };
+    int timeout = -1;
+    unsigned int wake_sockets = 0;
+    double deadline = 0;
+    int active;
+
+    for( i = 0; i < 4; i++ )
+      if( deadlines[i] && ( !deadline || deadlines[i] < deadline ) )
+        deadline = deadlines[i];
+
+    /* Wake up in time to time out any connection still in progress */
+    if( deadline ) {
+      double wait = deadline - compat_timer_get_time();
+      timeout = wait > 0 ? wait * 1000 + 1 : 0;
+    }
+
+    nic_w5100_debug( "w5100: io thread epoll_wait\n" );
+
+    active = epoll_wait( self->epoll_fd, events, ARRAY_SIZE( events ),
+                         timeout );
+
+    nic_w5100_debug( "w5100: io thread wake; %d active\n", active );
+
+    if( active == -1 ) {
+      if( errno != EINTR )
+        nic_w5100_debug( "w5100: epoll_wait returned unexpected errno %d: %s\n",
+                         errno, strerror( errno ) );
+      continue;
+    }
+
+    for( i = 0; i < active; i++ ) {
+      nic_w5100_socket_t *socket = events[i].data.ptr;
+      int flags = 0;
+
+      if( !socket ) {
+        uint64_t count;
+        if( read( self->wake_fd, &count, sizeof( count ) ) == -1 )
+          nic_w5100_debug( "w5100: error %d reading wakeup\n", errno );
+        pthread_mutex_lock( &self->wake_lock );
+        wake_sockets |= self->wake_sockets;
+        self->wake_sockets = 0;
+        pthread_mutex_unlock( &self->wake_lock );
+        continue;
+      }
+
+      if( events[i].events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+        flags |= W5100_IO_READ;
+      if( events[i].events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+        flags |= W5100_IO_WRITE;
+      if( events[i].events & EPOLLERR )
+        flags |= W5100_IO_ERROR;
+
+      socket_events[ socket->id ] |= flags;
+    }
+
+    /* Only look at the sockets something has happened to, unless it's time
+       to check for connection timeouts */
+    if( deadline && compat_timer_get_time() >= deadline )
+      wake_sockets = 0x0f;
+
+    for( i = 0; i < 4; i++ ) {
+      if( socket_events[i] || ( wake_sockets & ( 1 << i ) ) ) {
+        deadlines[i] = 0;
+        nic_w5100_socket_process_events( self, &self->socket[i],
+                                         socket_events[i], &deadlines[i] );
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static void
+w5100_io_init( nic_w5100_t *self )
+{
+  struct epoll_event event;
+
+  self->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  self->wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  if( self->epoll_fd == -1 || self->wake_fd == -1 ) {
+    ui_error( UI_ERROR_ERROR, "w5100: error %d creating epoll instance",
+              errno );
+    fuse_abort();
+  }
+
+  pthread_mutex_init( &self->wake_lock, NULL );
+  self->wake_sockets = 0;
+
+  memset( &event, 0, sizeof( event ) );
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl( self->epoll_fd, EPOLL_CTL_ADD, self->wake_fd, &event );
+}
+
+static void
+w5100_io_wake_thread( nic_w5100_t *self )
+{
+  uint64_t one = 1;
+  if( write( self->wake_fd, &one, sizeof( one ) ) == -1 )
+    nic_w5100_debug( "w5100: error %d waking io thread\n", errno );
+}
+
+static void
+w5100_io_end( nic_w5100_t *self )
+{
+  close( self->wake_fd );
+  close( self->epoll_fd );
+  pthread_mutex_destroy( &self->wake_lock );
+}
+
+#else                           /* #ifdef W5100_USE_EPOLL */
+
+void
+nic_w5100_wake( nic_w5100_t *self, nic_w5100_socket_t *socket GCC_UNUSED )
+{
+  compat_socket_selfpipe_wake( self->selfpipe );
+}
+
+void
+nic_w5100_register_socket( nic_w5100_t *self GCC_UNUSED,
+                           nic_w5100_socket_t *socket GCC_UNUSED )
+{
+  /* select() needs no registration */
+}
+
 static void*
 w5100_io_thread( void *arg )
 {
@@ -91,20 +270,32 @@ w5100_io_thread( void *arg )
   int i;
 
   while( !self->stop_io_thread ) {
-    fd_set readfds, writefds;
+    fd_set readfds, writefds, exceptfds;
     int active;
     compat_socket_t selfpipe_socket =
       compat_socket_selfpipe_get_read_fd( self->selfpipe );
     int max_fd = selfpipe_socket;
+    double deadline = 0;
+    struct timeval timeout, *timeoutp = NULL;
 
     FD_ZERO( &readfds );
     FD_ZERO( &writefds );
+    FD_ZERO( &exceptfds );
 
     FD_SET( selfpipe_socket, &readfds );
 
       for( i = 0; i < 4; i++ )
         nic_w5100_socket_add_to_sets( self, &self->socket[i], &readfds, &writefds,
-          &max_fd );
+          &exceptfds, &max_fd, &deadline );
+
+    /* Wake up in time to time out any connection still in progress */
+    if( deadline ) {
+      double wait = deadline - compat_timer_get_time();
+      if( wait < 0 ) wait = 0;
+      timeout.tv_sec = wait;
+      timeout.tv_usec = ( wait - timeout.tv_sec ) * 1000000;
+      timeoutp = &timeout;
+    }
 
     /* Note that if a socket is closed between when we added it to the sets
        above and when we call select() below, it will cause the select to fail
@@ -114,7 +305,7 @@ w5100_io_thread( void *arg )
 
     nic_w5100_debug( "w5100: io thread select\n" );
 
-    active = select( max_fd + 1, &readfds, &writefds, NULL, NULL );
+    active = select( max_fd + 1, &readfds, &writefds, &exceptfds, timeoutp );
 
     nic_w5100_debug( "w5100: io thread wake; %d active\n", active );
 
@@ -125,7 +316,8 @@ w5100_io_thread( void *arg )
       }
 
       for( i = 0; i < 4; i++ )
-        nic_w5100_socket_process_io( self, &self->socket[i], readfds, writefds );
+        nic_w5100_socket_process_io( self, &self->socket[i], readfds, writefds,
+                                     exceptfds );
     }
     else if( compat_socket_get_error() == compat_socket_EBADF ) {
       /* Do nothing - just loop again */
@@ -140,6 +332,26 @@ w5100_io_thread( void *arg )
   return NULL;
 }
 
+static void
+w5100_io_init( nic_w5100_t *self )
+{
+  self->selfpipe = compat_socket_selfpipe_alloc();
+}
+
+static void
+w5100_io_wake_thread( nic_w5100_t *self )
+{
+  compat_socket_selfpipe_wake( self->selfpipe );
+}
+
+static void
+w5100_io_end( nic_w5100_t *self )
+{
+  compat_socket_selfpipe_free( self->selfpipe );
+}
+
+#endif                          /* #ifdef W5100_USE_EPOLL */
+
 nic_w5100_t*
 nic_w5100_alloc( void )
 {
@@ -151,7 +363,7 @@ nic_w5100_alloc( void )
 
   self = libspectrum_new( nic_w5100_t, 1 );
 
-  self->selfpipe = compat_socket_selfpipe_alloc();
+  w5100_io_init( self );
 
   for( i = 0; i < 4; i++ )
     nic_w5100_socket_init( &self->socket[i], i );
@@ -176,14 +388,14 @@ nic_w5100_free( nic_w5100_t *self )
 
   if( self ) {
     self->stop_io_thread = 1;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    w5100_io_wake_thread( self );
 
     pthread_join( self->thread, NULL );
 
     for( i = 0; i < 4; i++ )
       nic_w5100_socket_end( &self->socket[i] );
 
-    compat_socket_selfpipe_free( self->selfpipe );
+    w5100_io_end( self );
 
     compat_socket_networking_end();
 
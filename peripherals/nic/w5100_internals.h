@@ -35,6 +35,16 @@
 
 #include "../security/tls.h"
 
+/* On Linux, the I/O thread waits with epoll rather than select() */
+#if defined( HAVE_SYS_EPOLL_H ) && defined( HAVE_SYS_EVENTFD_H )
+#define W5100_USE_EPOLL 1
+#endif
+
+/* Directions of I/O a socket can be ready for */
+#define W5100_IO_READ  ( 1 << 0 )
+#define W5100_IO_WRITE ( 1 << 1 )
+#define W5100_IO_ERROR ( 1 << 2 )
+
 typedef enum w5100_socket_mode {
   W5100_SOCKET_MODE_CLOSED = 0x00,
   W5100_SOCKET_MODE_TCP,
@@ -49,12 +59,21 @@ typedef enum w5100_socket_state {
 
   W5100_SOCKET_STATE_INIT = 0x13,
   W5100_SOCKET_STATE_LISTEN,
+  W5100_SOCKET_STATE_SYNSENT,
   W5100_SOCKET_STATE_ESTABLISHED = 0x17,
   W5100_SOCKET_STATE_CLOSE_WAIT = 0x1c,
 
   W5100_SOCKET_STATE_UDP = 0x22,
 } w5100_socket_state;
 
+/* Progress of an outgoing TCP connection on the host side. The guest sees
+   SOCK_SYNSENT until we reach W5100_SOCKET_CONNECT_ESTABLISHED */
+typedef enum w5100_socket_connect_phase {
+  W5100_SOCKET_CONNECT_ESTABLISHED = 0,
+  W5100_SOCKET_CONNECT_SYN_SENT,    /* Waiting for connect() to complete */
+  W5100_SOCKET_CONNECT_HANDSHAKING, /* Waiting for the TLS handshake */
+} w5100_socket_connect_phase;
+
 enum w5100_socket_registers {
   W5100_SOCKET_MR = 0x00,
   W5100_SOCKET_CR,
@@ -118,10 +137,18 @@ typedef struct nic_w5100_socket_t {
 
   compat_socket_t fd;       /* Socket file descriptor */
   tls_socket_t *tls_socket; /* TLS socket wrapper (NULL if not using TLS) */
+  w5100_socket_connect_phase connect_phase;
+  int tls_want_write;       /* True if the handshake is waiting to write */
+  double connect_deadline;  /* When a connection attempt times out */
   int bind_count;           /* Number of writes to the Sn_PORTx registers we've received */
   int socket_bound;         /* True once we've bound the socket to a port */
   int write_pending;        /* True if we're waiting to write data on this socket */
 
+  /* With epoll, readiness is reported only when it changes, so we remember
+     it until a read or write would block */
+  int io_readable;
+  int io_writable;
+
   int last_send;            /* The value of Sn_TX_WR when the SEND command was last sent */
   int datagram_lengths[0x20]; /* The lengths of datagrams to be sent */
   int datagram_count;
@@ -145,9 +172,22 @@ struct nic_w5100_t {
 
   pthread_t thread;         /* Thread for doing I/O */
   sig_atomic_t stop_io_thread; /* Flag to stop I/O thread */
+#ifdef W5100_USE_EPOLL
+  int epoll_fd;             /* Persistent registrations for all sockets */
+  int wake_fd;              /* eventfd for waking I/O thread */
+  pthread_mutex_t wake_lock;
+  unsigned int wake_sockets; /* Sockets the I/O thread was woken for */
+#else
   compat_socket_selfpipe_t *selfpipe; /* Device for waking I/O thread */
+#endif
 };
 
+/* Ask the I/O thread to look at a socket again */
+void nic_w5100_wake( nic_w5100_t *self, nic_w5100_socket_t *socket );
+
+/* Called whenever a socket gets a new host file descriptor */
+void nic_w5100_register_socket( nic_w5100_t *self, nic_w5100_socket_t *socket );
+
 void nic_w5100_socket_init( nic_w5100_socket_t *socket, int which );
 void nic_w5100_socket_end( nic_w5100_socket_t *socket );
 
@@ -160,9 +200,11 @@ libspectrum_byte nic_w5100_socket_read_rx_buffer( nic_w5100_t *self, libspectrum
 void nic_w5100_socket_write_tx_buffer( nic_w5100_t *self, libspectrum_word reg, libspectrum_byte b );
 
 void nic_w5100_socket_add_to_sets( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_set *readfds,
-  fd_set *writefds, int *max_fd );
+  fd_set *writefds, fd_set *exceptfds, int *max_fd, double *deadline );
 void nic_w5100_socket_process_io( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_set readfds,
-  fd_set writefds );
+  fd_set writefds, fd_set exceptfds );
+void nic_w5100_socket_process_events( nic_w5100_t *self, nic_w5100_socket_t *socket,
+  int events, double *deadline );
 
 /* Debug routines */
 
@@ -47,6 +47,10 @@
 #include "../security/tls.h"
 #include "dns_resolver.h"
 
+/* Roughly how long the W5100 retries a SYN for with the default RTR and
+   RCR values before giving up with a timeout */
+#define W5100_CONNECT_TIMEOUT 30
+
 enum w5100_socket_command {
   W5100_SOCKET_COMMAND_OPEN = 1 << 0,
   W5100_SOCKET_COMMAND_LISTEN = 1 << 1,
@@ -62,10 +66,15 @@ w5100_socket_init_common( nic_w5100_socket_t *socket )
 {
   socket->fd = compat_socket_invalid;
   socket->tls_socket = NULL;
+  socket->connect_phase = W5100_SOCKET_CONNECT_ESTABLISHED;
+  socket->tls_want_write = 0;
+  socket->connect_deadline = 0;
   socket->bind_count = 0;
   socket->socket_bound = 0;
   socket->ok_for_io = 0;
   socket->write_pending = 0;
+  socket->io_readable = 0;
+  socket->io_writable = 0;
 }
 
 void
@@ -183,7 +192,7 @@ w5100_write_socket_mr( nic_w5100_socket_t *socket, libspectrum_byte b )
 }
 
 static void
-w5100_socket_open( nic_w5100_socket_t *socket_obj )
+w5100_socket_open( nic_w5100_t *self, nic_w5100_socket_t *socket_obj )
 {
   if( ( socket_obj->mode == W5100_SOCKET_MODE_UDP ||
       socket_obj->mode == W5100_SOCKET_MODE_TCP ) &&
@@ -220,6 +229,8 @@ w5100_socket_open( nic_w5100_socket_t *socket_obj )
     }
 #endif
 
+    nic_w5100_register_socket( self, socket_obj );
+
     socket_obj->state = final_state;
 
     nic_w5100_debug( "w5100: opened %s fd %d for socket %d\n", description, socket_obj->fd, socket_obj->id );
@@ -275,16 +286,46 @@ w5100_socket_listen( nic_w5100_t *self, nic_w5100_socket_t *socket )
 
     nic_w5100_debug( "w5100: listening on socket %d\n", socket->id );
 
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
+  }
+}
+
+/* Give up on an outgoing connection, as the W5100 does when its
+   retransmissions time out */
+static void
+w5100_socket_connect_failed( nic_w5100_socket_t *socket )
+{
+  if( socket->tls_socket ) {
+    tls_socket_free( socket->tls_socket );
+    socket->tls_socket = NULL;
   }
+
+  socket->connect_phase = W5100_SOCKET_CONNECT_ESTABLISHED;
+  socket->ir |= 1 << 3;
+  socket->state = W5100_SOCKET_STATE_CLOSED;
+}
+
+static void
+w5100_socket_connect_established( nic_w5100_socket_t *socket )
+{
+  socket->connect_phase = W5100_SOCKET_CONNECT_ESTABLISHED;
+  socket->ir |= 1 << 0;
+  socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+
+  nic_w5100_debug( "w5100: connected socket %d%s\n", socket->id,
+                   socket->tls_socket && socket->tls_socket->resumed ?
+                   " (resumed TLS session)" : "" );
 }
 
+/* The connection is made in the background by the I/O thread; until it
+   and any TLS handshake complete the guest sees SOCK_SYNSENT */
 static void
 w5100_socket_connect( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   if( socket->state == W5100_SOCKET_STATE_INIT ) {
     struct sockaddr_in sa;
     uint16_t port;
+    int error;
     
     if( !socket->socket_bound )
       if( w5100_socket_bind_port( self, socket ) )
@@ -306,45 +347,42 @@ w5100_socket_connect( nic_w5100_t *self, nic_w5100_socket_t *socket )
       if( !socket->tls_socket ) {
         nic_w5100_error( UI_ERROR_ERROR,
           "w5100: failed to allocate TLS socket for socket %d\n", socket->id );
-        socket->ir |= 1 << 3;
-        socket->state = W5100_SOCKET_STATE_CLOSED;
+        w5100_socket_connect_failed( socket );
         return;
       }
     }
 
-    if( connect( socket->fd, (struct sockaddr*)&sa, sizeof(sa) ) == -1 ) {
+    /* Note: compat_socket_blocking_mode( fd, 1 ) sets O_NONBLOCK */
+    if( compat_socket_blocking_mode( socket->fd, 1 ) ) {
+      nic_w5100_error( UI_ERROR_ERROR,
+        "w5100: failed to make socket %d non-blocking; errno %d: %s\n",
+        socket->id, compat_socket_get_error(), compat_socket_get_strerror() );
+      w5100_socket_connect_failed( socket );
+      return;
+    }
+
+    if( connect( socket->fd, (struct sockaddr*)&sa, sizeof(sa) ) == -1 &&
+        ( error = compat_socket_get_error() ) != COMPAT_EINPROGRESS &&
+        error != COMPAT_EWOULDBLOCK ) {
       nic_w5100_error( UI_ERROR_ERROR,
         "w5100: failed to connect socket %d to 0x%08x:0x%04x; errno %d: %s\n",
         socket->id, ntohl(sa.sin_addr.s_addr), ntohs(sa.sin_port),
         compat_socket_get_error(), compat_socket_get_strerror() );
-
-      if( socket->tls_socket ) {
-        tls_socket_free( socket->tls_socket );
-        socket->tls_socket = NULL;
-      }
-
-      socket->ir |= 1 << 3;
-      socket->state = W5100_SOCKET_STATE_CLOSED;
+      w5100_socket_connect_failed( socket );
       return;
     }
 
-    /* Perform TLS handshake if TLS socket was allocated (blocking) */
-    if( socket->tls_socket ) {
-      int ret = tls_connect( socket->tls_socket );
-      if( ret != 0 ) {
-        nic_w5100_error( UI_ERROR_ERROR,
-          "w5100: TLS handshake failed for socket %d: %d\n", socket->id, ret );
-        tls_socket_free( socket->tls_socket );
-        socket->tls_socket = NULL;
-        socket->ir |= 1 << 3;
-        socket->state = W5100_SOCKET_STATE_CLOSED;
-        return;
-      }
-      /* Handshake completed successfully */
-    }
-
-    socket->ir |= 1 << 0;
-    socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+    nic_w5100_debug( "w5100: connecting socket %d to 0x%08x:0x%04x\n",
+                     socket->id, ntohl(sa.sin_addr.s_addr), port );
+
+    /* An unconnected socket is reported as writable (and hung up) as soon
+       as it is registered; forget that so only the connection's own
+       readiness is seen */
+    socket->io_readable = socket->io_writable = 0;
+    socket->connect_phase = W5100_SOCKET_CONNECT_SYN_SENT;
+    socket->connect_deadline = compat_timer_get_time() + W5100_CONNECT_TIMEOUT;
+    socket->state = W5100_SOCKET_STATE_SYNSENT;
+    nic_w5100_wake( self, socket );
   }
 }
 
@@ -355,7 +393,7 @@ w5100_socket_discon( nic_w5100_t *self, nic_w5100_socket_t *socket )
     socket->state == W5100_SOCKET_STATE_CLOSE_WAIT ) {
     socket->ir |= 1 << 1;
     socket->state = W5100_SOCKET_STATE_CLOSED;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
 
     nic_w5100_debug( "w5100: disconnected socket %d\n", socket->id );
   }
@@ -375,7 +413,7 @@ w5100_socket_close( nic_w5100_t *self, nic_w5100_socket_t *socket )
     socket->socket_bound = 0;
     socket->ok_for_io = 0;
     socket->state = W5100_SOCKET_STATE_CLOSED;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
     nic_w5100_debug( "w5100: closed socket %d\n", socket->id );
   }
 }
@@ -393,11 +431,11 @@ w5100_socket_send( nic_w5100_t *self, nic_w5100_socket_t *socket )
       socket->tx_wr - socket->last_send;
     socket->last_send = socket->tx_wr;
     socket->write_pending = 1;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
   }
   else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
     socket->write_pending = 1;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
   }
 }
 
@@ -410,7 +448,7 @@ w5100_socket_recv( nic_w5100_t *self, nic_w5100_socket_t *socket )
     socket->old_rx_rd = socket->rx_rd;
     if( socket->rx_rsr != 0 )
       socket->ir |= 1 << 2;
-    compat_socket_selfpipe_wake( self->selfpipe );
+    nic_w5100_wake( self, socket );
   }
 }
 
@@ -421,7 +459,7 @@ w5100_write_socket_cr( nic_w5100_t *self, nic_w5100_socket_t *socket, libspectru
 
   switch( b ) {
     case W5100_SOCKET_COMMAND_OPEN:
-      w5100_socket_open( socket );
+      w5100_socket_open( self, socket );
       break;
     case W5100_SOCKET_COMMAND_LISTEN:
       w5100_socket_listen( self, socket );
@@ -458,7 +496,7 @@ w5100_write_socket_port( nic_w5100_t *self, nic_w5100_socket_t *socket, int whic
         socket->bind_count = 0;
         return;
       }
-      compat_socket_selfpipe_wake( self->selfpipe );
+      nic_w5100_wake( self, socket );
     }
     socket->bind_count = 0;
   }
@@ -605,35 +643,63 @@ nic_w5100_socket_write_tx_buffer( nic_w5100_t *self, libspectrum_word reg, libsp
   socket->tx_buffer[offset] = b;
 }
 
+/* Work out which directions the socket is waiting for I/O in */
+static void
+w5100_socket_wants( nic_w5100_socket_t *socket, int *read, int *write )
+{
+  /* We can process a UDP read if we're in a UDP state and there are at least
+     9 bytes free in our buffer (8 byte UDP header and 1 byte of actual
+     data). */
+  int udp_read = socket->state == W5100_SOCKET_STATE_UDP &&
+    0x800 - socket->rx_rsr >= 9;
+  /* We can process a TCP read if we're in the established state and have
+     any room in our buffer (no header necessary for TCP). */
+  int tcp_read = socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
+    0x800 - socket->rx_rsr >= 1;
+
+  int tcp_listen = socket->state == W5100_SOCKET_STATE_LISTEN;
+
+  /* While connecting, wait for connect() to complete (reported as
+     writability, or as an exception on Windows if it fails) and then for
+     whatever the TLS handshake needs next */
+  int syn_sent = socket->state == W5100_SOCKET_STATE_SYNSENT &&
+    socket->connect_phase == W5100_SOCKET_CONNECT_SYN_SENT;
+  int handshaking = socket->state == W5100_SOCKET_STATE_SYNSENT &&
+    socket->connect_phase == W5100_SOCKET_CONNECT_HANDSHAKING;
+
+  *read = udp_read || tcp_read || tcp_listen ||
+    ( handshaking && !socket->tls_want_write );
+  *write = socket->write_pending || syn_sent ||
+    ( handshaking && socket->tls_want_write );
+}
+
 void
 nic_w5100_socket_add_to_sets( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_set *readfds,
-  fd_set *writefds, int *max_fd )
+  fd_set *writefds, fd_set *exceptfds, int *max_fd, double *deadline )
 {
   w5100_socket_acquire_lock( socket );
 
   if( socket->fd != compat_socket_invalid ) {
-    /* We can process a UDP read if we're in a UDP state and there are at least
-       9 bytes free in our buffer (8 byte UDP header and 1 byte of actual
-       data). */
-    int udp_read = socket->state == W5100_SOCKET_STATE_UDP &&
-      0x800 - socket->rx_rsr >= 9;
-    /* We can process a TCP read if we're in the established state and have
-       any room in our buffer (no header necessary for TCP). */
-    int tcp_read = socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
-      0x800 - socket->rx_rsr >= 1;
-
-    int tcp_listen = socket->state == W5100_SOCKET_STATE_LISTEN;
+    int read, write;
+
+    w5100_socket_wants( socket, &read, &write );
 
     socket->ok_for_io = 1;
 
-    if( udp_read || tcp_read || tcp_listen ) {
+    if( socket->state == W5100_SOCKET_STATE_SYNSENT ) {
+      FD_SET( socket->fd, exceptfds );
+      if( !*deadline || socket->connect_deadline < *deadline )
+        *deadline = socket->connect_deadline;
+    }
+
+    if( read ) {
       FD_SET( socket->fd, readfds );
       if( socket->fd > *max_fd )
         *max_fd = socket->fd;
       nic_w5100_debug( "w5100: checking for read on socket %d with fd %d; max fd %d\n", socket->id, socket->fd, *max_fd );
     }
 
-    if( socket->write_pending ) {
+    if( write ) {
       FD_SET( socket->fd, writefds );
       if( socket->fd > *max_fd )
         *max_fd = socket->fd;
@@ -644,8 +710,16 @@ nic_w5100_socket_add_to_sets( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_
   w5100_socket_release_lock( socket );
 }
 
-static void
-w5100_socket_process_accept( nic_w5100_socket_t *socket )
+/* Did the last socket call fail only because it would have blocked? */
+static int
+w5100_socket_would_block( void )
+{
+  int error = compat_socket_get_error();
+  return error == COMPAT_EWOULDBLOCK || error == COMPAT_EINPROGRESS;
+}
+
+static int
+w5100_socket_process_accept( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   struct sockaddr_in sa;
   socklen_t sa_length = sizeof(sa);
@@ -658,7 +732,7 @@ w5100_socket_process_accept( nic_w5100_socket_t *socket )
     nic_w5100_debug( "w5100: error from accept on socket %d; errno %d: %s\n",
                      socket->id, compat_socket_get_error(),
                      compat_socket_get_strerror() );
-    return;
+    return 1;
   }
 
   nic_w5100_debug( "w5100: accepted connection from %s:%d on socket %d\n", inet_ntoa(sa.sin_addr), ntohs(sa.sin_port), socket->id );
@@ -667,10 +741,14 @@ w5100_socket_process_accept( nic_w5100_socket_t *socket )
     nic_w5100_debug( "w5100: error attempting to close fd %d for socket %d\n", socket->fd, socket->id );
 
   socket->fd = new_fd;
+  nic_w5100_register_socket( self, socket );
   socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+
+  return 0;
 }
 
-static void
+/* Returns non-zero if there is nothing more to read for now */
+static int
 w5100_socket_process_read( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   libspectrum_byte buffer[0x800];
@@ -699,7 +777,7 @@ w5100_socket_process_read( nic_w5100_t *self, nic_w5100_socket_t *socket )
       bytes_read = tls_read( socket->tls_socket, buffer, bytes_free );
       /* Check if there's more data available and wake the I/O thread */
       if( bytes_read > 0 && socket->tls_socket->has_pending_data ) {
-        compat_socket_selfpipe_wake( self->selfpipe );
+        nic_w5100_wake( self, socket );
       }
     }
     else {
@@ -734,6 +812,11 @@ w5100_socket_process_read( nic_w5100_t *self, nic_w5100_socket_t *socket )
       memcpy( socket->rx_buffer, buffer + first_chunk, bytes_read - first_chunk );
     }
   }
+  else if( bytes_read == 0 && socket->tls_socket &&
+           socket->tls_socket->would_block ) {
+    /* Only part of a TLS record has arrived so far */
+    return 1;
+  }
   else if( bytes_read == 0 ) {  /* TCP */
     socket->state = W5100_SOCKET_STATE_CLOSE_WAIT;
     nic_w5100_debug( "w5100: EOF on %s socket %d; errno %d: %s\n",
@@ -741,13 +824,18 @@ w5100_socket_process_read( nic_w5100_t *self, nic_w5100_socket_t *socket )
                      compat_socket_get_strerror() );
   }
   else {
-    nic_w5100_debug( "w5100: error %d reading from %s socket %d: %s\n",
-                     compat_socket_get_error(), description, socket->id,
-                     compat_socket_get_strerror() );
+    if( !w5100_socket_would_block() )
+      nic_w5100_debug( "w5100: error %d reading from %s socket %d: %s\n",
+                       compat_socket_get_error(), description, socket->id,
+                       compat_socket_get_strerror() );
+    return 1;
   }
+
+  return 0;
 }
 
-static void
+/* Returns non-zero if the socket can't take any more data for now */
+static int
 w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
 {
   ssize_t bytes_sent;
@@ -790,13 +878,19 @@ w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
   }
   else if( bytes_sent != -1 )
     nic_w5100_debug( "w5100: didn't manage to send full datagram to UDP socket %d?\n", socket->id );
-  else
-    nic_w5100_debug( "w5100: error %d writing to UDP socket %d: %s\n",
-                     compat_socket_get_error(), socket->id,
-                     compat_socket_get_strerror() );
+  else {
+    if( !w5100_socket_would_block() )
+      nic_w5100_debug( "w5100: error %d writing to UDP socket %d: %s\n",
+                       compat_socket_get_error(), socket->id,
+                       compat_socket_get_strerror() );
+    return 1;
+  }
+
+  return 0;
 }
 
-static void
+/* Returns non-zero if the socket can't take any more data for now */
+static int
 w5100_socket_process_tcp_write( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   ssize_t bytes_sent;
@@ -830,75 +924,229 @@ w5100_socket_process_tcp_write( nic_w5100_t *self, nic_w5100_socket_t *socket )
   }
   else if( bytes_sent == 0 ) {
     /* TLS would block, keep write_pending set */
+    return 1;
   }
-  else
-    nic_w5100_debug( "w5100: error %d writing to TCP socket %d: %s\n",
-                     compat_socket_get_error(), socket->id,
-                     compat_socket_get_strerror() );
+  else {
+    if( !w5100_socket_would_block() )
+      nic_w5100_debug( "w5100: error %d writing to TCP socket %d: %s\n",
+                       compat_socket_get_error(), socket->id,
+                       compat_socket_get_strerror() );
+    return 1;
+  }
+
+  return 0;
 }
 
-void
-nic_w5100_socket_process_io( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_set readfds,
-  fd_set writefds )
+/* Check whether a non-blocking connect() has completed successfully.
+   Returns 0 if it has, 1 if it is still in progress and -1 if it failed */
+static int
+w5100_socket_process_connect( nic_w5100_socket_t *socket )
 {
-  w5100_socket_acquire_lock( socket );
+  struct sockaddr_in peer;
+  int error = 0;
+  socklen_t length = sizeof( error );
 
-  /* Process only if we're an open socket, and we haven't been closed and
-     re-opened since the select() started */
-  if( socket->fd != compat_socket_invalid && socket->ok_for_io ) {
-    /* Handle TLS handshake if needed */
-    if( socket->tls_socket && !socket->tls_socket->handshake_complete ) {
-      int ret = tls_connect( socket->tls_socket );
-      if( ret == 0 ) {
-        /* Handshake complete */
-        socket->tls_socket->handshake_complete = 1;
-        socket->write_pending = 0;
-        socket->ir |= 1 << 0;
-      }
-      else if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ) {
-        /* Handshake needs more I/O, will be retried on next select */
-        socket->write_pending = 1;
+  if( getsockopt( socket->fd, SOL_SOCKET, SO_ERROR, (char*)&error,
+                  &length ) == -1 )
+    error = compat_socket_get_error();
+
+  if( error ) {
+    nic_w5100_error( UI_ERROR_ERROR,
+                     "w5100: failed to connect socket %d; errno %d: %s\n",
+                     socket->id, error, strerror( error ) );
+    w5100_socket_connect_failed( socket );
+    return -1;
+  }
+
+  /* SO_ERROR is also 0 while the connection is still being made, so make
+     sure there really is a peer */
+  length = sizeof( peer );
+  if( getpeername( socket->fd, (struct sockaddr*)&peer, &length ) == -1 ) {
+    error = compat_socket_get_error();
+    if( error == COMPAT_ENOTCONN ) return 1;
+
+    nic_w5100_error( UI_ERROR_ERROR,
+                     "w5100: failed to connect socket %d; errno %d: %s\n",
+                     socket->id, error, compat_socket_get_strerror() );
+    w5100_socket_connect_failed( socket );
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+w5100_socket_process_handshake( nic_w5100_socket_t *socket )
+{
+  int ret = tls_handshake( socket->tls_socket );
+
+  if( ret == 0 ) {
+    w5100_socket_connect_established( socket );
+  }
+  else if( ret == MBEDTLS_ERR_SSL_WANT_READ ||
+           ret == MBEDTLS_ERR_SSL_WANT_WRITE ) {
+    socket->tls_want_write = ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  else {
+    nic_w5100_error( UI_ERROR_ERROR,
+      "w5100: TLS handshake failed for socket %d: %d\n", socket->id, ret );
+    w5100_socket_connect_failed( socket );
+  }
+}
+
+/* Do whatever I/O the socket is ready for. Returns the W5100_IO_* flags
+   for the directions which would now block */
+static int
+w5100_socket_do_io( nic_w5100_t *self, nic_w5100_socket_t *socket,
+                    int readable, int writable, int exception )
+{
+  int blocked = 0;
+
+  if( socket->state == W5100_SOCKET_STATE_SYNSENT ) {
+    int ready = readable || writable || exception;
+    int connect_result = -1;
+
+    if( ready && socket->connect_phase == W5100_SOCKET_CONNECT_SYN_SENT )
+      connect_result = w5100_socket_process_connect( socket );
+
+    if( connect_result == 1 ) {
+      /* Not connected yet: wait for the next readiness event */
+      blocked = W5100_IO_READ | W5100_IO_WRITE;
+    }
+    else if( connect_result == 0 ) {
+      if( socket->tls_socket ) {
+        /* Start the handshake straight away; the ClientHello will fit
+           into an empty send buffer */
+        socket->connect_phase = W5100_SOCKET_CONNECT_HANDSHAKING;
+        w5100_socket_process_handshake( socket );
       }
       else {
-        /* Handshake failed */
-        nic_w5100_error( UI_ERROR_ERROR,
-          "w5100: TLS handshake failed for socket %d: %d\n", socket->id, ret );
-        tls_socket_free( socket->tls_socket );
-        socket->tls_socket = NULL;
-        socket->ir |= 1 << 3;
-        socket->state = W5100_SOCKET_STATE_CLOSED;
+        w5100_socket_connect_established( socket );
       }
     }
-
-    if( FD_ISSET( socket->fd, &readfds ) ) {
-      if( socket->state == W5100_SOCKET_STATE_LISTEN )
-        w5100_socket_process_accept( socket );
-      else
-        w5100_socket_process_read( self, socket );
+    else if( ready &&
+             socket->connect_phase == W5100_SOCKET_CONNECT_HANDSHAKING ) {
+      w5100_socket_process_handshake( socket );
     }
 
-    if( FD_ISSET( socket->fd, &writefds ) ) {
-      if( socket->state == W5100_SOCKET_STATE_UDP ) {
-        w5100_socket_process_udp_write( socket );
+    if( socket->state == W5100_SOCKET_STATE_SYNSENT ) {
+      if( compat_timer_get_time() >= socket->connect_deadline ) {
+        nic_w5100_debug( "w5100: connection timed out on socket %d\n",
+                         socket->id );
+        w5100_socket_connect_failed( socket );
       }
-      else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
-        w5100_socket_process_tcp_write( self, socket );
+      else if( socket->connect_phase == W5100_SOCKET_CONNECT_HANDSHAKING ) {
+        blocked = socket->tls_want_write ? W5100_IO_WRITE : W5100_IO_READ;
       }
     }
 
-    /* Check for pending TLS data and try to read it immediately */
-    if( socket->tls_socket && socket->tls_socket->handshake_complete &&
-        socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
-        socket->tls_socket->has_pending_data &&
-        0x800 - socket->rx_rsr >= 1 ) {
-      /* More data available in TLS buffer, try to read it */
-      w5100_socket_process_read( self, socket );
-      /* If still has pending data, wake I/O thread for next iteration */
-      if( socket->tls_socket && socket->tls_socket->has_pending_data ) {
-        compat_socket_selfpipe_wake( self->selfpipe );
-      }
+    /* Don't treat the readiness which completed the connection as data */
+    return blocked;
+  }
+
+  if( readable ) {
+    if( socket->state == W5100_SOCKET_STATE_LISTEN ) {
+      if( w5100_socket_process_accept( self, socket ) )
+        blocked |= W5100_IO_READ;
+    }
+    else if( w5100_socket_process_read( self, socket ) ) {
+      blocked |= W5100_IO_READ;
     }
   }
 
+  if( writable ) {
+    if( socket->state == W5100_SOCKET_STATE_UDP ) {
+      if( w5100_socket_process_udp_write( socket ) )
+        blocked |= W5100_IO_WRITE;
+    }
+    else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
+      if( w5100_socket_process_tcp_write( self, socket ) )
+        blocked |= W5100_IO_WRITE;
+    }
+  }
+
+  /* Check for pending TLS data and try to read it immediately */
+  if( socket->tls_socket && socket->tls_socket->handshake_complete &&
+      socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
+      socket->tls_socket->has_pending_data &&
+      0x800 - socket->rx_rsr >= 1 ) {
+    /* More data available in TLS buffer, try to read it */
+    w5100_socket_process_read( self, socket );
+    /* If still has pending data, wake I/O thread for next iteration */
+    if( socket->tls_socket && socket->tls_socket->has_pending_data ) {
+      nic_w5100_wake( self, socket );
+    }
+  }
+
+  return blocked;
+}
+
+void
+nic_w5100_socket_process_io( nic_w5100_t *self, nic_w5100_socket_t *socket, fd_set readfds,
+  fd_set writefds, fd_set exceptfds )
+{
+  w5100_socket_acquire_lock( socket );
+
+  /* Process only if we're an open socket, and we haven't been closed and
+     re-opened since the select() started */
+  if( socket->fd != compat_socket_invalid && socket->ok_for_io ) {
+    w5100_socket_do_io( self, socket, FD_ISSET( socket->fd, &readfds ),
+                        FD_ISSET( socket->fd, &writefds ),
+                        FD_ISSET( socket->fd, &exceptfds ) );
+  }
+
+  w5100_socket_release_lock( socket );
+}
+
+void
+nic_w5100_socket_process_events( nic_w5100_t *self, nic_w5100_socket_t *socket,
+  int events, double *deadline )
+{
+  int passes;
+
+  w5100_socket_acquire_lock( socket );
+
+  /* Readiness is only reported when it changes, so remember it until an
+     operation tells us it has gone away again */
+  if( events & W5100_IO_READ ) socket->io_readable = 1;
+  if( events & W5100_IO_WRITE ) socket->io_writable = 1;
+
+  /* Keep going while there is I/O we're both waiting for and able to do;
+     the limit stops a persistently failing socket starving the others */
+  for( passes = 0;
+       socket->fd != compat_socket_invalid && passes < 16;
+       passes++ ) {
+    int read, write, readable, writable, blocked;
+
+    w5100_socket_wants( socket, &read, &write );
+
+    readable = read && ( socket->io_readable ||
+                         ( socket->tls_socket &&
+                           socket->tls_socket->has_pending_data ) );
+    writable = write && socket->io_writable;
+
+    if( !readable && !writable &&
+        socket->state != W5100_SOCKET_STATE_SYNSENT )
+      break;
+
+    blocked = w5100_socket_do_io( self, socket, readable, writable,
+                                  events & W5100_IO_ERROR );
+
+    if( blocked & W5100_IO_READ ) socket->io_readable = 0;
+    if( blocked & W5100_IO_WRITE ) socket->io_writable = 0;
+
+    /* Nothing changed while connecting: wait for the next event */
+    if( socket->state == W5100_SOCKET_STATE_SYNSENT &&
+        ( blocked || ( !readable && !writable ) ) )
+      break;
+
+    events &= ~W5100_IO_ERROR;
+  }
+
+  if( socket->fd != compat_socket_invalid &&
+      socket->state == W5100_SOCKET_STATE_SYNSENT &&
+      ( !*deadline || socket->connect_deadline < *deadline ) )
+    *deadline = socket->connect_deadline;
+
   w5100_socket_release_lock( socket );
 }
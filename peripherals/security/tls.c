@@ -1,5 +1,7 @@
 #include "config.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -30,6 +32,30 @@
 #include "compat.h"
 #include "tls.h"
 
+/* Number of hosts we keep a session for */
+#define TLS_SESSION_CACHE_SIZE 16
+
+typedef struct tls_session_entry_t {
+  char hostname[ TLS_HOSTNAME_LENGTH ];
+  mbedtls_ssl_session session;
+  unsigned long last_used;   /* For least recently used replacement */
+  int valid;
+} tls_session_entry_t;
+
+/* Everything below is shared between the emulation, W5100 and xfs threads
+   and protected by tls_mutex */
+static pthread_mutex_t tls_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Configuration shared by every connection; mbedTLS only reads it once
+   it has been set up */
+static mbedtls_ssl_config tls_conf;
+static int tls_conf_ready = 0;
+
+static tls_session_entry_t tls_sessions[ TLS_SESSION_CACHE_SIZE ];
+static unsigned long tls_session_clock = 0;
+
+static tls_stats_t tls_stats;
+
 /* Custom BIO read callback */
 static int
 tls_bio_read( void *ctx, unsigned char *buf, size_t len )
@@ -106,6 +132,130 @@ tls_rng( void *ctx, unsigned char *buf, size_t len )
   return 0;
 }
 
+/* Set up the shared configuration; called with tls_mutex held */
+static int
+tls_conf_init( void )
+{
+  int ret;
+
+  if( tls_conf_ready )
+    return 0;
+
+  mbedtls_ssl_config_init( &tls_conf );
+
+  /* Configure SSL */
+  ret = mbedtls_ssl_config_defaults( &tls_conf,
+                                     MBEDTLS_SSL_IS_CLIENT,
+                                     MBEDTLS_SSL_TRANSPORT_STREAM,
+                                     MBEDTLS_SSL_PRESET_DEFAULT );
+  if( ret != 0 ) {
+    ui_error( UI_ERROR_ERROR, "tls: failed to configure SSL defaults: %d\n", ret );
+    mbedtls_ssl_config_free( &tls_conf );
+    return ret;
+  }
+
+  /* Disable certificate verification for now */
+  mbedtls_ssl_conf_authmode( &tls_conf, MBEDTLS_SSL_VERIFY_NONE );
+
+  /* Set RNG callback using platform RNG */
+  mbedtls_ssl_conf_rng( &tls_conf, tls_rng, NULL );
+
+  tls_conf_ready = 1;
+
+  return 0;
+}
+
+/* Find the cached session for hostname; called with tls_mutex held */
+static tls_session_entry_t*
+tls_session_find( const char *hostname )
+{
+  size_t i;
+
+  for( i = 0; i < TLS_SESSION_CACHE_SIZE; i++ )
+    if( tls_sessions[i].valid &&
+        !strcmp( tls_sessions[i].hostname, hostname ) )
+      return &tls_sessions[i];
+
+  return NULL;
+}
+
+/* Offer the last session negotiated with this host, if any */
+static void
+tls_session_offer( tls_socket_t *tls )
+{
+  tls_session_entry_t *entry = tls_session_find( tls->hostname );
+  if( !entry )
+    return;
+
+  if( mbedtls_ssl_set_session( &tls->ssl, &entry->session ) == 0 ) {
+    tls->offered_id_len =
+      mbedtls_ssl_session_get_id_len( &entry->session );
+    memcpy( tls->offered_id, mbedtls_ssl_session_get_id( &entry->session ),
+            tls->offered_id_len );
+    entry->last_used = ++tls_session_clock;
+  }
+}
+
+/* Remember the session from a completed handshake and count whether the
+   server let us resume the one we offered: it does so by echoing back its
+   session ID */
+static void
+tls_session_store( tls_socket_t *tls )
+{
+  mbedtls_ssl_session session;
+  tls_session_entry_t *entry;
+  size_t i;
+
+  mbedtls_ssl_session_init( &session );
+
+  if( mbedtls_ssl_get_session( &tls->ssl, &session ) != 0 ) {
+    mbedtls_ssl_session_free( &session );
+    pthread_mutex_lock( &tls_mutex );
+    tls_stats.full_handshakes++;
+    pthread_mutex_unlock( &tls_mutex );
+    return;
+  }
+
+  tls->resumed = tls->offered_id_len &&
+    mbedtls_ssl_session_get_id_len( &session ) == tls->offered_id_len &&
+    !memcmp( mbedtls_ssl_session_get_id( &session ), tls->offered_id,
+             tls->offered_id_len );
+
+  pthread_mutex_lock( &tls_mutex );
+
+  if( tls->resumed )
+    tls_stats.resumed_handshakes++;
+  else
+    tls_stats.full_handshakes++;
+
+  /* Servers which don't give a session ID can't resume it */
+  if( !*tls->hostname || !mbedtls_ssl_session_get_id_len( &session ) ) {
+    pthread_mutex_unlock( &tls_mutex );
+    mbedtls_ssl_session_free( &session );
+    return;
+  }
+
+  entry = tls_session_find( tls->hostname );
+  if( !entry ) {
+    entry = &tls_sessions[0];
+    for( i = 1; i < TLS_SESSION_CACHE_SIZE && entry->valid; i++ )
+      if( !tls_sessions[i].valid ||
+          tls_sessions[i].last_used < entry->last_used )
+        entry = &tls_sessions[i];
+  }
+
+  if( entry->valid )
+    mbedtls_ssl_session_free( &entry->session );
+
+  /* The cache takes ownership of the session */
+  snprintf( entry->hostname, sizeof( entry->hostname ), "%s", tls->hostname );
+  entry->session = session;
+  entry->last_used = ++tls_session_clock;
+  entry->valid = 1;
+
+  pthread_mutex_unlock( &tls_mutex );
+}
+
 tls_socket_t*
 tls_socket_alloc( compat_socket_t fd, const char *hostname )
 {
@@ -119,38 +269,40 @@ tls_socket_alloc( compat_socket_t fd, const char *hostname )
   tls->fd = fd;
   tls->handshake_complete = 0;
   tls->has_pending_data = 0;
+  tls->would_block = 0;
+  tls->resumed = 0;
+  tls->offered_id_len = 0;
+  snprintf( tls->hostname, sizeof( tls->hostname ), "%s",
+            hostname ? hostname : "" );
 
   mbedtls_ssl_init( &tls->ssl );
-  mbedtls_ssl_config_init( &tls->conf );
 
-  /* Configure SSL */
-  ret = mbedtls_ssl_config_defaults( &tls->conf,
-                                     MBEDTLS_SSL_IS_CLIENT,
-                                     MBEDTLS_SSL_TRANSPORT_STREAM,
-                                     MBEDTLS_SSL_PRESET_DEFAULT );
+  pthread_mutex_lock( &tls_mutex );
+
+  ret = tls_conf_init();
   if( ret != 0 ) {
-    ui_error( UI_ERROR_ERROR, "tls: failed to configure SSL defaults: %d\n", ret );
+    pthread_mutex_unlock( &tls_mutex );
     tls_socket_free( tls );
     return NULL;
   }
 
-  /* Disable certificate verification for now */
-  mbedtls_ssl_conf_authmode( &tls->conf, MBEDTLS_SSL_VERIFY_NONE );
-
-  /* Set RNG callback using platform RNG */
-  mbedtls_ssl_conf_rng( &tls->conf, tls_rng, NULL );
-
   /* Set up SSL context */
-  ret = mbedtls_ssl_setup( &tls->ssl, &tls->conf );
+  ret = mbedtls_ssl_setup( &tls->ssl, &tls_conf );
   if( ret != 0 ) {
+    pthread_mutex_unlock( &tls_mutex );
     ui_error( UI_ERROR_ERROR, "tls: failed to setup SSL context: %d\n", ret );
     tls_socket_free( tls );
     return NULL;
   }
 
+  if( *tls->hostname )
+    tls_session_offer( tls );
+
+  pthread_mutex_unlock( &tls_mutex );
+
   /* Set hostname for SNI (Server Name Indication) */
-  if( hostname && *hostname ) {
-    ret = mbedtls_ssl_set_hostname( &tls->ssl, hostname );
+  if( *tls->hostname ) {
+    ret = mbedtls_ssl_set_hostname( &tls->ssl, tls->hostname );
     if( ret != 0 ) {
       ui_error( UI_ERROR_ERROR, "tls: failed to set hostname for SNI: %d\n", ret );
       /* Continue anyway - SNI is optional */
@@ -170,11 +322,67 @@ tls_socket_free( tls_socket_t *tls )
     return;
 
   mbedtls_ssl_free( &tls->ssl );
-  mbedtls_ssl_config_free( &tls->conf );
 
   libspectrum_free( tls );
 }
 
+void
+tls_get_stats( tls_stats_t *stats )
+{
+  pthread_mutex_lock( &tls_mutex );
+  *stats = tls_stats;
+  pthread_mutex_unlock( &tls_mutex );
+}
+
+void
+tls_end( void )
+{
+  size_t i;
+
+  pthread_mutex_lock( &tls_mutex );
+
+  for( i = 0; i < TLS_SESSION_CACHE_SIZE; i++ ) {
+    if( tls_sessions[i].valid ) {
+      mbedtls_ssl_session_free( &tls_sessions[i].session );
+      tls_sessions[i].valid = 0;
+    }
+  }
+
+  if( tls_conf_ready ) {
+    mbedtls_ssl_config_free( &tls_conf );
+    tls_conf_ready = 0;
+  }
+
+  pthread_mutex_unlock( &tls_mutex );
+}
+
+int
+tls_handshake( tls_socket_t *tls )
+{
+  int ret;
+
+  if( !tls )
+    return -1;
+
+  if( tls->handshake_complete )
+    return 0;
+
+  ret = mbedtls_ssl_handshake( &tls->ssl );
+
+  if( ret == 0 ) {
+    tls->handshake_complete = 1;
+    tls_session_store( tls );
+  }
+  else if( ret != MBEDTLS_ERR_SSL_WANT_READ &&
+           ret != MBEDTLS_ERR_SSL_WANT_WRITE ) {
+    char error_buf[256];
+    mbedtls_strerror( ret, error_buf, sizeof(error_buf) );
+    ui_error( UI_ERROR_ERROR, "tls: handshake failed: %d (%s)\n", ret, error_buf );
+  }
+
+  return ret;
+}
+
 int
 tls_connect( tls_socket_t *tls )
 {
@@ -187,66 +395,43 @@ tls_connect( tls_socket_t *tls )
   if( tls->handshake_complete )
     return 0;
 
-  /* Make socket blocking for handshake */
-  /* Note: compat_socket_blocking_mode( fd, 1 ) makes it blocking */
+  /* Make socket non-blocking for handshake */
+  /* Note: compat_socket_blocking_mode( fd, 1 ) sets O_NONBLOCK */
   blocking_result = compat_socket_blocking_mode( tls->fd, 1 );
   if( blocking_result != 0 ) {
     ui_error( UI_ERROR_ERROR, "tls: failed to set socket blocking mode\n" );
     return -1;
   }
 
-  /* Perform blocking handshake - loop until complete or error */
-  do {
-    ret = mbedtls_ssl_handshake( &tls->ssl );
-    
-    if( ret == 0 ) {
-      tls->handshake_complete = 1;
-      break;
-    }
-    else if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ) {
-      /* With blocking socket, this shouldn't happen, but handle it anyway */
-      /* Wait for socket to become ready */
-      fd_set readfds, writefds;
-      struct timeval timeout;
-      int select_ret;
-      
-      FD_ZERO( &readfds );
-      FD_ZERO( &writefds );
-      
-      if( ret == MBEDTLS_ERR_SSL_WANT_READ )
-        FD_SET( tls->fd, &readfds );
-      else
-        FD_SET( tls->fd, &writefds );
-      
-      timeout.tv_sec = 30; /* 30 second timeout */
-      timeout.tv_usec = 0;
-      
-      select_ret = select( tls->fd + 1, &readfds, &writefds, NULL, &timeout );
-      if( select_ret <= 0 ) {
-        /* Timeout or error */
-        ret = -1;
-        break;
-      }
-      /* Continue loop to retry handshake */
-    }
-    else {
-      /* Handshake failed */
-      char error_buf[256];
-      mbedtls_strerror( ret, error_buf, sizeof(error_buf) );
-      ui_error( UI_ERROR_ERROR, "tls: handshake failed: %d (%s)\n", ret, error_buf );
+  /* Step the handshake until complete or error, waiting for the socket
+     whenever mbedTLS needs more I/O */
+  while( ( ret = tls_handshake( tls ) ) == MBEDTLS_ERR_SSL_WANT_READ ||
+         ret == MBEDTLS_ERR_SSL_WANT_WRITE ) {
+    fd_set readfds, writefds;
+    struct timeval timeout;
+
+    FD_ZERO( &readfds );
+    FD_ZERO( &writefds );
+
+    if( ret == MBEDTLS_ERR_SSL_WANT_READ )
+      FD_SET( tls->fd, &readfds );
+    else
+      FD_SET( tls->fd, &writefds );
+
+    timeout.tv_sec = 30; /* 30 second timeout */
+    timeout.tv_usec = 0;
+
+    if( select( tls->fd + 1, &readfds, &writefds, NULL, &timeout ) <= 0 ) {
+      /* Timeout or error */
+      ret = -1;
       break;
     }
-  } while( ret != 0 && ( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ) );
+  }
 
-  /* Restore socket to non-blocking mode */
+  /* Restore socket to its previous mode */
   compat_socket_blocking_mode( tls->fd, 0 );
 
-  if( ret == 0 ) {
-    return 0;
-  }
-  else {
-    return ret;
-  }
+  return ret;
 }
 
 ssize_t
@@ -261,6 +446,7 @@ tls_read( tls_socket_t *tls, void *buf, size_t len )
     len = INT_MAX;
 
   ret = mbedtls_ssl_read( &tls->ssl, (unsigned char*)buf, len );
+  tls->would_block = 0;
   
   if( ret > 0 ) {
     /* Check if there's more data available */
@@ -272,6 +458,7 @@ tls_read( tls_socket_t *tls, void *buf, size_t len )
   }
   else if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ) {
     tls->has_pending_data = 0;
+    tls->would_block = 1;
     return 0; /* Would block */
   }
   else if( ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ) {
@@ -26,21 +26,40 @@
 #include <mbedtls/ssl.h>
 #include <mbedtls/error.h>
 
+#define TLS_HOSTNAME_LENGTH 256
+
 typedef struct tls_socket_t {
   mbedtls_ssl_context ssl;           /* SSL context */
-  mbedtls_ssl_config conf;            /* SSL configuration */
   compat_socket_t fd;                 /* Underlying POSIX socket */
   int handshake_complete;             /* Flag for handshake status */
   int has_pending_data;               /* Flag indicating more data available after read */
+  int would_block;                    /* Flag set when the last read returned 0 because it would block */
+  int resumed;                        /* True if the handshake resumed a cached session */
+  char hostname[ TLS_HOSTNAME_LENGTH ]; /* SNI hostname, or empty */
+  unsigned char offered_id[32];       /* ID of the session we offered to resume */
+  size_t offered_id_len;
 } tls_socket_t;
 
+typedef struct tls_stats_t {
+  unsigned long full_handshakes;
+  unsigned long resumed_handshakes;
+} tls_stats_t;
+
 /* Allocate and initialize a TLS socket from a POSIX socket */
-/* hostname can be NULL, IP address string, or hostname for SNI */
+/* hostname can be NULL, IP address string, or hostname for SNI. All
+   sockets share one configuration, and the last session negotiated with
+   each hostname is offered for resumption */
 tls_socket_t* tls_socket_alloc( compat_socket_t fd, const char *hostname );
 
 /* Free TLS socket and cleanup mbedTLS contexts */
 void tls_socket_free( tls_socket_t *tls );
 
+/* Perform one step of the TLS handshake on a non-blocking socket. Returns
+   0 once complete, MBEDTLS_ERR_SSL_WANT_READ or MBEDTLS_ERR_SSL_WANT_WRITE
+   if it should be called again when the socket is ready, or another
+   mbedTLS error if the handshake failed */
+int tls_handshake( tls_socket_t *tls );
+
 /* Perform blocking TLS handshake (called after connect) */
 int tls_connect( tls_socket_t *tls );
 
@@ -53,5 +72,11 @@ ssize_t tls_write( tls_socket_t *tls, const void *buf, size_t len );
 /* Close TLS connection gracefully */
 void tls_close( tls_socket_t *tls );
 
+/* Get the number of full and resumed handshakes completed so far */
+void tls_get_stats( tls_stats_t *stats );
+
+/* Free the shared configuration and session cache */
+void tls_end( void );
+
 #endif                          /* #ifndef FUSE_TLS_H */
 
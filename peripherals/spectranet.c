@@ -28,6 +28,7 @@
 
 #include "compat.h"
 #include "debugger/debugger.h"
+#include "event.h"
 #include "flash/am29f010.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
@@ -54,6 +55,8 @@
 
 #ifdef BUILD_SPECTRANET
 
+#include "peripherals/security/tls.h"
+
 #define SPECTRANET_PAGES 256
 #define SPECTRANET_PAGE_LENGTH 0x1000
 
@@ -80,9 +83,6 @@ static flash_am29f010_t *flash_rom;
 int spectranet_available = 0;
 int spectranet_paged;
 int spectranet_paged_via_io;
-int spectranet_w5100_paged_a = 0, spectranet_w5100_paged_b = 0;
-int spectranet_xfs_paged_a = 0, spectranet_xfs_paged_b = 0;
-int spectranet_spectranext_config_paged_a = 0, spectranet_spectranext_config_paged_b = 0;
 
 /* Whether the programmable trap is active */
 int spectranet_programmable_trap_active;
@@ -102,6 +102,25 @@ static int spectranet_source;
 static const char * const event_type_string = "spectranet";
 static int page_event, unpage_event;
 
+static libspectrum_byte spectranet_w5100_read( memory_page *page,
+                                               libspectrum_word address );
+static void spectranet_w5100_write( memory_page *page,
+                                    libspectrum_word address,
+                                    libspectrum_byte b );
+static libspectrum_byte spectranet_xfs_read( memory_page *page,
+                                             libspectrum_word address );
+static void spectranet_xfs_write( memory_page *page, libspectrum_word address,
+                                  libspectrum_byte b );
+static libspectrum_byte
+spectranet_spectranext_config_read( memory_page *page,
+                                    libspectrum_word address );
+static void spectranet_spectranext_config_write( memory_page *page,
+                                                 libspectrum_word address,
+                                                 libspectrum_byte b );
+static void spectranet_flash_write( memory_page *page,
+                                    libspectrum_word address,
+                                    libspectrum_byte b );
+
 void
 spectranet_page( int via_io )
 {
@@ -151,27 +170,10 @@ static void
 spectranet_map_page( int dest, int source )
 {
   int i;
-  int w5100_page = source >= 0x40 && source < 0x48;
-  int xfs_page = (source == XFS_SPECTRANET_PAGE);
-  int spectranext_config_page = (source == SPECTRANEXT_CONTROLLER_PAGE);
 
   for( i = 0; i < MEMORY_PAGES_IN_4K; i++ )
     spectranet_current_map[dest * MEMORY_PAGES_IN_4K + i] =
       spectranet_full_map[source * MEMORY_PAGES_IN_4K + i];
-
-  switch( dest )
-  {
-    case 1: 
-      spectranet_w5100_paged_a = w5100_page;
-      spectranet_xfs_paged_a = xfs_page;
-      spectranet_spectranext_config_paged_a = spectranext_config_page;
-      break;
-    case 2: 
-      spectranet_w5100_paged_b = w5100_page;
-      spectranet_xfs_paged_b = xfs_page;
-      spectranet_spectranext_config_paged_b = spectranext_config_page;
-      break;
-  }
 }
 
 static void
@@ -223,6 +225,19 @@ spectranet_memory_map( void )
   memory_map_romcs_full( spectranet_current_map );
 }
 
+/* Pass accesses to one of the 4K pages to I/O handlers */
+static void
+spectranet_map_io( int source, memory_read_fn read, memory_write_fn write )
+{
+  int i;
+
+  for( i = 0; i < MEMORY_PAGES_IN_4K; i++ ) {
+    memory_page *page = &spectranet_full_map[ source * MEMORY_PAGES_IN_4K + i ];
+    page->read = read;
+    page->write = write;
+  }
+}
+
 static void
 spectranet_activate( void )
 {
@@ -258,13 +273,23 @@ spectranet_activate( void )
       for( j = 0; j < MEMORY_PAGES_IN_4K; j++ ) {
         memory_page *page = &spectranet_full_map[base + j];
         page->page = rom + (i * MEMORY_PAGES_IN_4K + j) * MEMORY_PAGE_SIZE;
+        page->write = spectranet_flash_write;
       }
     }
 
     flash_am29f010_init( flash_rom, rom );
 
-    /* Pages 0x40 to 0x47 are the W5100 registers - handled in readbyte()
-       and writebyte() */
+    /* Pages 0x40 to 0x47 are the W5100 registers, followed by the
+       Spectranext controller and the XFS interface */
+    for( i = 0; i < SPECTRANET_BUFFER_LENGTH / SPECTRANET_PAGE_LENGTH; i++ )
+      spectranet_map_io( SPECTRANET_BUFFER_BASE + i, spectranet_w5100_read,
+                         spectranet_w5100_write );
+
+    spectranet_map_io( SPECTRANEXT_CONTROLLER_PAGE,
+                       spectranet_spectranext_config_read,
+                       spectranet_spectranext_config_write );
+    spectranet_map_io( XFS_SPECTRANET_PAGE, spectranet_xfs_read,
+                       spectranet_xfs_write );
 
     /* Pages 0xc0 to 0xff are the RAM */
     ram = memory_pool_allocate_persistent( SPECTRANET_RAM_LENGTH, 1 );
@@ -332,12 +357,14 @@ spectranet_from_snapshot( libspectrum_snap *snap )
     nic_w5100_from_snapshot( w5100,
       libspectrum_snap_spectranet_w5100( snap, 0 ) );
 
-    memcpy(
-      spectranet_full_map[SPECTRANET_ROM_BASE * MEMORY_PAGES_IN_4K].page,
-      libspectrum_snap_spectranet_flash( snap, 0 ), SPECTRANET_ROM_LENGTH );
-    memcpy(
-      spectranet_full_map[SPECTRANET_RAM_BASE * MEMORY_PAGES_IN_4K].page,
-      libspectrum_snap_spectranet_ram( snap, 0 ), SPECTRANET_RAM_LENGTH );
+    if( libspectrum_snap_spectranet_flash( snap, 0 ) )
+      memcpy(
+        spectranet_full_map[SPECTRANET_ROM_BASE * MEMORY_PAGES_IN_4K].page,
+        libspectrum_snap_spectranet_flash( snap, 0 ), SPECTRANET_ROM_LENGTH );
+    if( libspectrum_snap_spectranet_ram( snap, 0 ) )
+      memcpy(
+        spectranet_full_map[SPECTRANET_RAM_BASE * MEMORY_PAGES_IN_4K].page,
+        libspectrum_snap_spectranet_ram( snap, 0 ), SPECTRANET_RAM_LENGTH );
   }
 }
 
@@ -373,6 +400,8 @@ spectranet_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_spectranet_w5100( snap, 0,
     nic_w5100_to_snapshot( w5100 ) );
 
+  if( !memory_snapshot_contents ) return;
+
   snap_buffer = libspectrum_new( libspectrum_byte, SPECTRANET_ROM_LENGTH );
 
   src = spectranet_full_map[SPECTRANET_ROM_BASE * MEMORY_PAGES_IN_4K].page;
@@ -428,6 +457,9 @@ spectranet_trap( libspectrum_word port, libspectrum_byte data )
       (spectranet_programmable_trap & 0xff00) | data;
 
   trap_write_msb = !trap_write_msb;
+
+  /* Make the Z80 core pick up the new trap address */
+  event_add( tstates, event_type_null );
 }
 
 static libspectrum_byte
@@ -454,7 +486,12 @@ spectranet_control_write( libspectrum_word port, libspectrum_byte data )
   else if( spectranet_paged_via_io )
     spectranet_unpage();
 
-  spectranet_programmable_trap_active = data & 0x08;
+  if( spectranet_programmable_trap_active != ( data & 0x08 ) ) {
+    spectranet_programmable_trap_active = data & 0x08;
+
+    /* Make the Z80 core pick up the change */
+    event_add( tstates, event_type_null );
+  }
 }
 
 static const periph_port_t spectranet_ports[] = {
@@ -493,8 +530,10 @@ spectranet_init( void *context )
 static void
 spectranet_end( void )
 {
+  xfs_end();
   nic_w5100_free( w5100 );
   flash_am29f010_free( flash_rom );
+  tls_end();
 }
 
 void
@@ -502,6 +541,7 @@ spectranet_register_startup( void )
 {
   startup_manager_module dependencies[] = {
     STARTUP_MANAGER_MODULE_DEBUGGER,
+    STARTUP_MANAGER_MODULE_EVENT,
     STARTUP_MANAGER_MODULE_MEMORY,
     STARTUP_MANAGER_MODULE_SETUID,
   };
@@ -519,44 +559,44 @@ get_w5100_register( memory_page *page, libspectrum_word address )
 }
 
 
-libspectrum_byte
+static libspectrum_byte
 spectranet_w5100_read( memory_page *page, libspectrum_word address )
 {
   return nic_w5100_read( w5100, get_w5100_register( page, address ) );
 }
 
-void
+static void
 spectranet_w5100_write( memory_page *page, libspectrum_word address, libspectrum_byte b )
 {
   address &= 0xfff;
   nic_w5100_write( w5100, get_w5100_register( page, address ), b );
 }
 
-libspectrum_byte
+static libspectrum_byte
 spectranet_xfs_read( memory_page *page, libspectrum_word address )
 {
   return xfs_read( page, address );
 }
 
-void
+static void
 spectranet_xfs_write( memory_page *page, libspectrum_word address, libspectrum_byte b )
 {
   xfs_write( page, address, b );
 }
 
-libspectrum_byte
+static libspectrum_byte
 spectranet_spectranext_config_read( memory_page *page, libspectrum_word address )
 {
   return spectranext_config_read( page, address );
 }
 
-void
+static void
 spectranet_spectranext_config_write( memory_page *page, libspectrum_word address, libspectrum_byte b )
 {
   spectranext_config_write( page, address, b );
 }
 
-void
+static void
 spectranet_flash_rom_write( libspectrum_word address, libspectrum_byte b )
 {
   int pageb_page = spectranet_current_map[2 * MEMORY_PAGES_IN_4K].page_num;
@@ -570,6 +610,18 @@ spectranet_flash_rom_write( libspectrum_word address, libspectrum_byte b )
   }
 }
 
+/* Writes to the flash ROM are seen by the flash chip; the ROM data itself
+   changes only if writable ROMs are enabled */
+static void
+spectranet_flash_write( memory_page *page, libspectrum_word address,
+                        libspectrum_byte b )
+{
+  spectranet_flash_rom_write( address, b );
+
+  if( settings_current.writable_roms )
+    page->page[ address & MEMORY_PAGE_SIZE_MASK ] = b;
+}
+
 libspectrum_byte*
 spectranet_get_config_page( void )
 {
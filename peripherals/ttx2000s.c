@@ -76,6 +76,10 @@ static void ttx2000s_write( libspectrum_word port, libspectrum_byte val );
 static void ttx2000s_change_channel( int channel );
 static void ttx2000s_reset( int hard_reset );
 static void ttx2000s_memory_map( void );
+static libspectrum_byte ttx2000s_sram_read( memory_page *page,
+                                            libspectrum_word address );
+static void ttx2000s_sram_write( memory_page *page, libspectrum_word address,
+                                 libspectrum_byte b );
 
 static int field_event;
 static void ttx2000s_field_event( libspectrum_dword last_tstates, int event,
@@ -224,6 +228,8 @@ ttx2000s_reset( int hard_reset GCC_UNUSED )
     page->page = &ttx2000s_ram[ i * MEMORY_PAGE_SIZE ];
     page->offset = i * MEMORY_PAGE_SIZE;
     page->writable = 1;
+    page->read = ttx2000s_sram_read;
+    page->write = ttx2000s_sram_write;
   }
 
   ttx2000s_paged = 1;
@@ -255,16 +261,17 @@ ttx2000s_write( libspectrum_word port GCC_UNUSED, libspectrum_byte val )
     ttx2000s_page();
 }
 
-libspectrum_byte
-ttx2000s_sram_read( libspectrum_word address )
+static libspectrum_byte
+ttx2000s_sram_read( memory_page *page GCC_UNUSED, libspectrum_word address )
 {
   /* reading from SRAM affects internal counter */
   ttx2000s_line_counter = ( address >> 6 ) & 0xF;
   return ttx2000s_ram[ address & 0x3FF ]; /* actual read from SRAM */
 }
 
-void
-ttx2000s_sram_write( libspectrum_word address, libspectrum_byte b )
+static void
+ttx2000s_sram_write( memory_page *page GCC_UNUSED, libspectrum_word address,
+                     libspectrum_byte b )
 {
   /* writing to SRAM affects internal counter */
   ttx2000s_line_counter = ( address >> 6 ) & 0xF;
@@ -442,17 +449,6 @@ ttx2000s_register_startup( void )
 {
 }
 
-libspectrum_byte
-ttx2000s_sram_read( libspectrum_word address )
-{
-  return 0xff;
-}
-
-void
-ttx2000s_sram_write( libspectrum_word address, libspectrum_byte b )
-{
-}
-
 #endif /* #ifdef BUILD_TTX2000S */
 
 int
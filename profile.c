@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,14 +31,89 @@
 
 #include "event.h"
 #include "infrastructure/startup_manager.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "profile.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 
+/* Samples are keyed by where the instruction was fetched from (memory
+   source, page and offset within the page) rather than by its address, so
+   that code in paged memory isn't mixed up with whatever else is mapped at
+   the same address. CALLs, RSTs and interrupts push a frame onto a shadow
+   call stack and RETs pop it, building a calling context tree from which
+   both callgrind and folded stack output can be produced */
+
+/* The largest page we profile */
+#define PROFILE_PAGE_SIZE 0x4000
+
+/* How deep the shadow call stack can get */
+#define PROFILE_STACK_DEPTH 1024
+
+/* The costs of each instruction in one page of one memory source */
+typedef struct profile_block_t {
+  int source, page;
+  libspectrum_qword tstates[ PROFILE_PAGE_SIZE ];
+  libspectrum_dword instructions[ PROFILE_PAGE_SIZE ];
+  libspectrum_word address[ PROFILE_PAGE_SIZE ]; /* Where last seen */
+} profile_block_t;
+
+/* Locations are ( block index << 14 ) | offset */
+#define LOCATION( block, offset ) ( ( (block) << 14 ) | (offset) )
+#define LOCATION_BLOCK( location ) ( (location) >> 14 )
+#define LOCATION_OFFSET( location ) ( (location) & ( PROFILE_PAGE_SIZE - 1 ) )
+
+/* A node in the calling context tree: one function called from one call
+   site via one particular chain of calls */
+typedef struct profile_node_t {
+  libspectrum_dword callsite, callee;
+  struct profile_node_t *parent, *child, *sibling;
+  libspectrum_qword self_tstates, self_instructions;
+  libspectrum_qword calls, inclusive_tstates, inclusive_instructions;
+} profile_node_t;
+
+typedef struct profile_frame_t {
+  libspectrum_word sp;		/* Where the return address is */
+  profile_node_t *node;
+  libspectrum_qword start_tstates, start_instructions;
+} profile_frame_t;
+
+typedef enum profile_opcode_type {
+  PROFILE_OPCODE_OTHER,
+  PROFILE_OPCODE_CALL,		/* CALL, CALL cc and RST */
+  PROFILE_OPCODE_RET,		/* RET, RET cc, RETI and RETN */
+  PROFILE_OPCODE_ED,		/* Depends on the next byte */
+} profile_opcode_type;
+
 int profile_active = 0;
 
-static int total_tstates[ 0x10000 ];
+static profile_block_t **blocks = NULL;
+static size_t block_count = 0;
+
+/* Which block is mapped in each 2Kb chunk of the Z80's address space */
+static int chunk_source[ MEMORY_PAGES_IN_64K ];
+static int chunk_page[ MEMORY_PAGES_IN_64K ];
+static size_t chunk_block[ MEMORY_PAGES_IN_64K ];
+
+static libspectrum_byte opcode_type[ 0x100 ];
+
+static profile_node_t root;
+static profile_node_t *current_node;
+
+static profile_frame_t stack[ PROFILE_STACK_DEPTH ];
+static size_t stack_depth;
+
+/* Running totals */
+static libspectrum_qword total_tstates, total_instructions;
+
+/* The instruction being executed */
+static int have_last;
+static size_t last_block;
+static libspectrum_word last_offset;
+static profile_opcode_type last_type;
+static libspectrum_word last_sp;
+static int interrupt_taken;
+
 static libspectrum_word profile_last_pc;
 static libspectrum_dword profile_last_tstates;
 
@@ -56,8 +132,19 @@ static module_info_t profile_module_info = {
 static int
 profile_init( void *context )
 {
+  size_t i;
+
   module_register( &profile_module_info );
 
+  for( i = 0xc0; i <= 0xf8; i += 8 ) {
+    opcode_type[ i     ] = PROFILE_OPCODE_RET;	/* RET cc */
+    opcode_type[ i + 4 ] = PROFILE_OPCODE_CALL;	/* CALL cc */
+    opcode_type[ i + 7 ] = PROFILE_OPCODE_CALL;	/* RST */
+  }
+  opcode_type[ 0xc9 ] = PROFILE_OPCODE_RET;
+  opcode_type[ 0xcd ] = PROFILE_OPCODE_CALL;
+  opcode_type[ 0xed ] = PROFILE_OPCODE_ED;
+
   return 0;
 }
 
@@ -70,9 +157,62 @@ profile_register_startup( void )
                             NULL );
 }
 
+static void
+free_children( profile_node_t *node )
+{
+  profile_node_t *child, *next;
+
+  for( child = node->child; child; child = next ) {
+    next = child->sibling;
+    free_children( child );
+    libspectrum_free( child );
+  }
+
+  node->child = NULL;
+}
+
+static void
+profile_free( void )
+{
+  size_t i;
+
+  for( i = 0; i < block_count; i++ ) libspectrum_free( blocks[i] );
+  libspectrum_free( blocks );
+  blocks = NULL;
+  block_count = 0;
+
+  free_children( &root );
+}
+
+/* Close every frame on the shadow stack, counting each as a completed
+   call */
+static void
+unwind( size_t depth )
+{
+  while( stack_depth > depth ) {
+    profile_frame_t *frame = &stack[ --stack_depth ];
+
+    frame->node->calls++;
+    frame->node->inclusive_tstates += total_tstates - frame->start_tstates;
+    frame->node->inclusive_instructions +=
+      total_instructions - frame->start_instructions;
+  }
+
+  current_node = stack_depth ? stack[ stack_depth - 1 ].node : &root;
+}
+
 static void
 init_profiling_counters( void )
 {
+  size_t i;
+
+  unwind( 0 );
+
+  for( i = 0; i < MEMORY_PAGES_IN_64K; i++ ) chunk_source[i] = -1;
+
+  have_last = 0;
+  interrupt_taken = 0;
+
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
 }
@@ -80,7 +220,13 @@ init_profiling_counters( void )
 void
 profile_start( void )
 {
-  memset( total_tstates, 0, sizeof( total_tstates ) );
+  profile_free();
+
+  memset( &root, 0, sizeof( root ) );
+  root.callsite = root.callee = -1;
+  current_node = &root;
+  stack_depth = 0;
+  total_tstates = total_instructions = 0;
 
   profile_active = 1;
   init_profiling_counters();
@@ -93,15 +239,130 @@ profile_start( void )
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 1 );
 }
 
+static size_t
+find_block( int source, int page )
+{
+  profile_block_t *block;
+  size_t i;
+
+  for( i = 0; i < block_count; i++ )
+    if( blocks[i]->source == source && blocks[i]->page == page ) return i;
+
+  block = libspectrum_new0( profile_block_t, 1 );
+  block->source = source;
+  block->page = page;
+
+  blocks = libspectrum_renew( profile_block_t*, blocks, block_count + 1 );
+  blocks[ block_count ] = block;
+
+  return block_count++;
+}
+
+static void
+call( libspectrum_dword callee )
+{
+  libspectrum_dword callsite = LOCATION( last_block, last_offset );
+  profile_node_t *node, **link;
+  profile_frame_t *frame;
+
+  /* Frames at or below the new return address are dead, eg because the
+     stack pointer has been reset */
+  while( stack_depth && stack[ stack_depth - 1 ].sp <= z80.sp.w )
+    unwind( stack_depth - 1 );
+
+  if( stack_depth == PROFILE_STACK_DEPTH ) return;
+
+  /* Find this call in the tree, moving it to the front of its siblings */
+  for( link = &current_node->child; *link; link = &(*link)->sibling )
+    if( (*link)->callee == callee && (*link)->callsite == callsite ) break;
+
+  node = *link;
+  if( node ) {
+    *link = node->sibling;
+  } else {
+    node = libspectrum_new0( profile_node_t, 1 );
+    node->callsite = callsite;
+    node->callee = callee;
+    node->parent = current_node;
+  }
+  node->sibling = current_node->child;
+  current_node->child = node;
+
+  frame = &stack[ stack_depth++ ];
+  frame->sp = z80.sp.w;
+  frame->node = node;
+  frame->start_tstates = total_tstates;
+  frame->start_instructions = total_instructions;
+
+  current_node = node;
+}
+
 void
 profile_map( libspectrum_word pc )
 {
-  total_tstates[ profile_last_pc ] += tstates - profile_last_tstates;
+  libspectrum_dword delta = tstates - profile_last_tstates;
+  memory_page *mapping = &memory_map_read[ pc >> MEMORY_PAGE_SIZE_LOGARITHM ];
+  size_t chunk = pc >> MEMORY_PAGE_SIZE_LOGARITHM, block;
+  libspectrum_word offset;
+  libspectrum_byte opcode;
+
+  /* Charge the previous instruction */
+  if( have_last ) {
+    blocks[ last_block ]->tstates[ last_offset ] += delta;
+    blocks[ last_block ]->instructions[ last_offset ]++;
+  }
+  total_tstates += delta; total_instructions++;
+  current_node->self_tstates += delta; current_node->self_instructions++;
+
+  /* And find where this one lives */
+  if( mapping->source != chunk_source[ chunk ] ||
+      mapping->page_num != chunk_page[ chunk ] ) {
+    chunk_source[ chunk ] = mapping->source;
+    chunk_page[ chunk ] = mapping->page_num;
+    chunk_block[ chunk ] = find_block( mapping->source, mapping->page_num );
+  }
+  block = chunk_block[ chunk ];
+  offset = ( mapping->offset + ( pc & MEMORY_PAGE_SIZE_MASK ) ) &
+           ( PROFILE_PAGE_SIZE - 1 );
+  blocks[ block ]->address[ offset ] = pc;
+
+  /* Did the previous instruction call or return? */
+  if( have_last ) {
+    if( interrupt_taken ||
+        ( last_type == PROFILE_OPCODE_CALL &&
+          z80.sp.w == (libspectrum_word)( last_sp - 2 ) ) ) {
+      call( LOCATION( block, offset ) );
+    } else if( last_type == PROFILE_OPCODE_RET &&
+               z80.sp.w == (libspectrum_word)( last_sp + 2 ) ) {
+      while( stack_depth && stack[ stack_depth - 1 ].sp < z80.sp.w )
+        unwind( stack_depth - 1 );
+    }
+  }
+  interrupt_taken = 0;
+
+  opcode = readbyte_internal( pc );
+  last_type = opcode_type[ opcode ];
+  if( last_type == PROFILE_OPCODE_ED ) {
+    opcode = readbyte_internal( pc + 1 );
+    last_type = ( opcode & 0xc7 ) == 0x45 ? PROFILE_OPCODE_RET :
+                                            PROFILE_OPCODE_OTHER;
+  }
+
+  have_last = 1;
+  last_block = block;
+  last_offset = offset;
+  last_sp = z80.sp.w;
 
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
 }
 
+void
+profile_interrupt( void )
+{
+  interrupt_taken = 1;
+}
+
 void
 profile_frame( libspectrum_dword frame_length )
 {
@@ -116,11 +377,203 @@ profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
   init_profiling_counters();
 }
 
+static void
+location_name( char *buffer, size_t length, libspectrum_dword location )
+{
+  profile_block_t *block = blocks[ LOCATION_BLOCK( location ) ];
+
+  snprintf( buffer, length, "0x%04x %s %d",
+            block->address[ LOCATION_OFFSET( location ) ],
+            memory_source_description( block->source ), block->page );
+}
+
+/* The flat map: one line per instruction */
+static void
+write_map( FILE *f )
+{
+  size_t i, j;
+
+  for( i = 0; i < block_count; i++ ) {
+    profile_block_t *block = blocks[i];
+
+    for( j = 0; j < PROFILE_PAGE_SIZE; j++ ) {
+
+      if( !block->instructions[j] ) continue;
+
+      fprintf( f, "0x%04x,%lu,%s,%d,0x%04lx\n", block->address[j],
+               (unsigned long)block->tstates[j],
+               memory_source_description( block->source ), block->page,
+               (unsigned long)j );
+
+    }
+  }
+}
+
+/* Folded stacks, as used by flame graph tools */
+static void
+write_folded_node( FILE *f, profile_node_t *node, char *path, size_t length )
+{
+  profile_node_t *child;
+  size_t used = strlen( path );
+
+  if( node != &root ) {
+    char name[64];
+
+    location_name( name, sizeof( name ), node->callee );
+    snprintf( path + used, length - used, ";%s", name );
+  }
+
+  if( node->self_tstates )
+    fprintf( f, "%s %lu\n", path, (unsigned long)node->self_tstates );
+
+  for( child = node->child; child; child = child->sibling )
+    write_folded_node( f, child, path, length );
+
+  path[ used ] = '\0';
+}
+
+static void
+write_folded( FILE *f )
+{
+  char path[ 64 * 64 ];
+
+  /* Stacks deeper than this are truncated */
+  strcpy( path, "[top]" );
+  write_folded_node( f, &root, path, sizeof( path ) );
+}
+
+/* Callgrind output: each instruction is charged to the nearest function
+   entry point before it in the same page, and every call site gets the
+   inclusive cost of the calls made from it */
+typedef struct profile_arc_t {
+  libspectrum_dword callsite, callee;
+  libspectrum_qword calls, tstates, instructions;
+} profile_arc_t;
+
+static void
+collect_arcs( profile_node_t *node, GArray *arcs, libspectrum_byte **entries )
+{
+  profile_node_t *child;
+  size_t i;
+
+  for( child = node->child; child; child = child->sibling ) {
+    size_t block = LOCATION_BLOCK( child->callee );
+
+    entries[ block ][ LOCATION_OFFSET( child->callee ) ] = 1;
+
+    for( i = 0; i < arcs->len; i++ ) {
+      profile_arc_t *arc = &g_array_index( arcs, profile_arc_t, i );
+      if( arc->callsite == child->callsite && arc->callee == child->callee ) {
+        arc->calls += child->calls;
+        arc->tstates += child->inclusive_tstates;
+        arc->instructions += child->inclusive_instructions;
+        break;
+      }
+    }
+
+    if( i == arcs->len ) {
+      profile_arc_t arc;
+      arc.callsite = child->callsite; arc.callee = child->callee;
+      arc.calls = child->calls;
+      arc.tstates = child->inclusive_tstates;
+      arc.instructions = child->inclusive_instructions;
+      g_array_append_val( arcs, arc );
+    }
+
+    collect_arcs( child, arcs, entries );
+  }
+}
+
+static void
+write_callgrind( FILE *f )
+{
+  libspectrum_byte **entries;
+  GArray *arcs;
+  size_t i, j, k;
+  char name[64];
+
+  entries = libspectrum_new( libspectrum_byte*, block_count );
+  for( i = 0; i < block_count; i++ )
+    entries[i] = libspectrum_new0( libspectrum_byte, PROFILE_PAGE_SIZE );
+
+  arcs = g_array_new( FALSE, FALSE, sizeof( profile_arc_t ) );
+  collect_arcs( &root, arcs, entries );
+
+  fprintf( f, "# callgrind format\nversion: 1\ncreator: Fuse\n" );
+  fprintf( f, "positions: instr\nevents: Tstates Instructions\n" );
+  fprintf( f, "summary: %lu %lu\n\n", (unsigned long)total_tstates,
+           (unsigned long)total_instructions );
+
+  for( i = 0; i < block_count; i++ ) {
+    profile_block_t *block = blocks[i];
+
+    int in_function = 0;
+
+    fprintf( f, "ob=%s %d\n", memory_source_description( block->source ),
+             block->page );
+
+    for( j = 0; j < PROFILE_PAGE_SIZE; j++ ) {
+
+      if( entries[i][j] ) {
+        location_name( name, sizeof( name ), LOCATION( i, j ) );
+        fprintf( f, "fn=%s\n", name );
+        in_function = 1;
+      }
+
+      if( !block->instructions[j] ) continue;
+
+      /* Code before the first known entry point in the page */
+      if( !in_function ) {
+        fprintf( f, "fn=%s %d\n", memory_source_description( block->source ),
+                 block->page );
+        in_function = 1;
+      }
+
+      fprintf( f, "0x%04x %lu %lu\n", block->address[j],
+               (unsigned long)block->tstates[j],
+               (unsigned long)block->instructions[j] );
+
+      for( k = 0; k < arcs->len; k++ ) {
+        profile_arc_t *arc = &g_array_index( arcs, profile_arc_t, k );
+        profile_block_t *callee;
+
+        if( arc->callsite != LOCATION( i, j ) ) continue;
+
+        callee = blocks[ LOCATION_BLOCK( arc->callee ) ];
+        location_name( name, sizeof( name ), arc->callee );
+        fprintf( f, "cob=%s %d\ncfn=%s\n",
+                 memory_source_description( callee->source ), callee->page,
+                 name );
+        fprintf( f, "calls=%lu 0x%04x\n", (unsigned long)arc->calls,
+                 callee->address[ LOCATION_OFFSET( arc->callee ) ] );
+        fprintf( f, "0x%04x %lu %lu\n", block->address[j],
+                 (unsigned long)arc->tstates,
+                 (unsigned long)arc->instructions );
+      }
+    }
+
+    fprintf( f, "\n" );
+  }
+
+  g_array_free( arcs, TRUE );
+  for( i = 0; i < block_count; i++ ) libspectrum_free( entries[i] );
+  libspectrum_free( entries );
+}
+
+static int
+has_suffix( const char *filename, const char *suffix )
+{
+  size_t length = strlen( filename ), suffix_length = strlen( suffix );
+
+  return length >= suffix_length &&
+         !strcmp( filename + length - suffix_length, suffix );
+}
+
 void
 profile_finish( const char *filename )
 {
+  const char *basename;
   FILE *f;
-  size_t i;
 
   f = fopen( filename, "w" );
   if( !f ) {
@@ -129,16 +582,25 @@ profile_finish( const char *filename )
     return;
   }
 
-  for( i = 0; i < 0x10000; i++ ) {
-
-    if( !total_tstates[ i ] ) continue;
+  /* Anything still on the shadow stack is charged up to now */
+  unwind( 0 );
 
-    fprintf( f, "0x%04lx,%d\n", (unsigned long)i, total_tstates[ i ] );
+  basename = strrchr( filename, '/' );
+  basename = basename ? basename + 1 : filename;
 
+  if( has_suffix( filename, ".folded" ) ) {
+    write_folded( f );
+  } else if( has_suffix( filename, ".callgrind" ) ||
+             !strncmp( basename, "callgrind.out", 13 ) ) {
+    write_callgrind( f );
+  } else {
+    write_map( f );
   }
 
   fclose( f );
 
+  profile_free();
+
   profile_active = 0;
 
   /* Again, schedule an event to ensure this change is picked up by
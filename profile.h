@@ -29,6 +29,11 @@ extern int profile_active;
 void profile_register_startup( void );
 void profile_start( void );
 void profile_map( libspectrum_word pc );
+
+/* Tell the profiler that the Z80 has just accepted an interrupt, so the
+   next instruction is the start of a handler */
+void profile_interrupt( void );
+
 void profile_frame( libspectrum_dword frame_length );
 void profile_finish( const char *filename );
 
@@ -0,0 +1,345 @@
+/* rewind.c: Frame-by-frame rewind buffer
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include "libspectrum.h"
+
+#include "infrastructure/startup_manager.h"
+#include "memory_pages.h"
+#include "rewind.h"
+#include "rzx.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "spectrum.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+
+/* At the start of every frame, the state of everything other than the
+   memory is stored as a snap, along with the 2Kb chunks of 'normal' RAM which
+   have been written to during the previous frame. The oldest frame always has
+   every chunk, so the RAM for any frame can be rebuilt from its own chunks and
+   those of the frames before it, in the same way as the RZX autosaves.
+
+   Peripheral RAM and flash (Spectranet, DivIDE and so on) is not stored at
+   all: copying it every frame would cost far more than the 'normal' RAM, so
+   rewinding leaves it as it is */
+#define REWIND_RAM_PAGES 64
+#define REWIND_CHUNKS ( REWIND_RAM_PAGES * MEMORY_PAGES_IN_16K )
+
+/* libspectrum doesn't say how big a libspectrum_snap is, so this is a
+   rough guess at the structure itself, leaving out any buffers it holds */
+#define REWIND_SNAP_STRUCT_SIZE 8192
+
+/* How often to update the statusbar, in frames */
+#define REWIND_STATUS_INTERVAL 50
+
+typedef struct rewind_frame_t {
+  libspectrum_snap *snap;	/* Everything but the memory */
+  size_t snap_size;		/* Bytes held by `snap', roughly */
+  libspectrum_byte *chunks[ REWIND_CHUNKS ]; /* NULL if not written to */
+  size_t chunk_count;
+} rewind_frame_t;
+
+/* A circular buffer of `depth' frames, the oldest at frames[ first ] */
+static rewind_frame_t **frames = NULL;
+static size_t depth = 0, first = 0, count = 0;
+
+/* How many chunks, and how many bytes of snap, are held by all the
+   frames */
+static size_t chunk_total = 0;
+static size_t snap_total = 0;
+
+/* How long has been spent recording frames since the last statusbar
+   update */
+static double time_spent = 0;
+static size_t frames_timed = 0;
+
+static rewind_frame_t*
+frame_at( size_t i )
+{
+  return frames[ ( first + i ) % depth ];
+}
+
+/* The memory held by a snap taken without RAM: the structure itself and
+   the custom ROMs and cartridges which are still stored in it */
+static size_t
+snap_size( libspectrum_snap *snap )
+{
+  size_t size = REWIND_SNAP_STRUCT_SIZE;
+  size_t i;
+
+  if( libspectrum_snap_custom_rom( snap ) ) {
+    for( i = 0; i < libspectrum_snap_custom_rom_pages( snap ); i++ )
+      size += libspectrum_snap_rom_length( snap, i );
+  }
+
+  for( i = 0; i < 256; i++ ) {
+    if( libspectrum_snap_slt( snap, i ) )
+      size += libspectrum_snap_slt_length( snap, i );
+  }
+  if( libspectrum_snap_slt_screen( snap ) ) size += 6912;
+
+  for( i = 0; i < 8; i++ ) {
+    if( libspectrum_snap_exrom_cart( snap, i ) ) size += 0x2000;
+    if( libspectrum_snap_dock_cart( snap, i ) ) size += 0x2000;
+  }
+
+  if( libspectrum_snap_beta_rom( snap, 0 ) ) size += 0x4000;
+  if( libspectrum_snap_opus_rom( snap, 0 ) ) size += 0x2000;
+  if( libspectrum_snap_plusd_rom( snap, 0 ) ) size += 0x2000;
+  if( libspectrum_snap_didaktik80_rom( snap, 0 ) ) size += 0x3800;
+  if( libspectrum_snap_interface2_rom( snap, 0 ) ) size += 0x4000;
+  if( libspectrum_snap_disciple_rom( snap, 0 ) )
+    size += libspectrum_snap_disciple_rom_length( snap, 0 );
+  if( libspectrum_snap_interface1_rom( snap, 0 ) )
+    size += libspectrum_snap_interface1_rom_length( snap, 0 );
+  if( libspectrum_snap_usource_rom( snap, 0 ) )
+    size += libspectrum_snap_usource_rom_length( snap, 0 );
+
+  return size;
+}
+
+static void
+frame_free( rewind_frame_t *frame )
+{
+  size_t i;
+
+  for( i = 0; i < REWIND_CHUNKS; i++ ) libspectrum_free( frame->chunks[i] );
+  chunk_total -= frame->chunk_count;
+
+  snap_total -= frame->snap_size;
+  libspectrum_snap_free( frame->snap );
+  libspectrum_free( frame );
+}
+
+void
+rewind_clear( void )
+{
+  size_t i;
+
+  for( i = 0; i < count; i++ ) frame_free( frame_at( i ) );
+  first = count = 0;
+
+  /* The next frame recorded must be complete */
+  memory_ram_dirty_all( MEMORY_RAM_DIRTY_REWIND );
+}
+
+/* Drop the oldest frame, handing on any chunk the next frame doesn't have so
+   that it becomes complete */
+static void
+drop_oldest( void )
+{
+  rewind_frame_t *oldest = frame_at( 0 ), *next;
+  size_t i;
+
+  if( count > 1 ) {
+    next = frame_at( 1 );
+
+    for( i = 0; i < REWIND_CHUNKS; i++ ) {
+      if( oldest->chunks[i] && !next->chunks[i] ) {
+        next->chunks[i] = oldest->chunks[i];
+        oldest->chunks[i] = NULL;
+        oldest->chunk_count--; next->chunk_count++;
+      }
+    }
+  }
+
+  frame_free( oldest );
+
+  first = ( first + 1 ) % depth;
+  count--;
+}
+
+static void
+resize( size_t new_depth )
+{
+  rewind_clear();
+
+  libspectrum_free( frames );
+  frames = new_depth ? libspectrum_new( rewind_frame_t*, new_depth ) : NULL;
+  depth = new_depth;
+}
+
+static void
+update_statusbar( void )
+{
+  ui_statusbar_update_rewind(
+    count, chunk_total * MEMORY_PAGE_SIZE + snap_total +
+           count * sizeof( rewind_frame_t ),
+    frames_timed ? time_spent * 1000000 / frames_timed : 0
+  );
+
+  time_spent = 0;
+  frames_timed = 0;
+}
+
+void
+rewind_frame( void )
+{
+  rewind_frame_t *frame;
+  double start;
+  size_t i, j;
+
+  if( settings_current.rewind_frames < 0 ) settings_current.rewind_frames = 0;
+
+  if( (size_t)settings_current.rewind_frames != depth ) {
+    resize( settings_current.rewind_frames );
+    update_statusbar();
+  }
+
+  /* Nothing can be rewound during RZX playback, so don't spend time
+     recording it; the dirty flags keep accumulating, so the next frame
+     recorded is still correct */
+  if( !depth || rzx_playback ) return;
+
+  start = timer_get_time();
+
+  if( count == depth ) drop_oldest();
+
+  frame = libspectrum_new0( rewind_frame_t, 1 );
+
+  frame->snap = libspectrum_snap_alloc();
+  snapshot_copy_to_without_memory( frame->snap );
+  frame->snap_size = snap_size( frame->snap );
+
+  for( i = 0; i < REWIND_RAM_PAGES; i++ ) {
+    for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
+      size_t chunk = i * MEMORY_PAGES_IN_16K + j;
+      if( !( memory_ram_dirty[ chunk ] & MEMORY_RAM_DIRTY_REWIND ) ) continue;
+
+      frame->chunks[ chunk ] = libspectrum_new( libspectrum_byte,
+                                                MEMORY_PAGE_SIZE );
+      memcpy( frame->chunks[ chunk ], &RAM[i][ j * MEMORY_PAGE_SIZE ],
+              MEMORY_PAGE_SIZE );
+      frame->chunk_count++;
+    }
+  }
+
+  memory_ram_dirty_clear( MEMORY_RAM_DIRTY_REWIND );
+
+  frames[ ( first + count ) % depth ] = frame;
+  count++;
+  chunk_total += frame->chunk_count;
+  snap_total += frame->snap_size;
+
+  time_spent += timer_get_time() - start;
+  if( ++frames_timed == REWIND_STATUS_INTERVAL ) update_statusbar();
+}
+
+size_t
+rewind_frame_count( void )
+{
+  return count;
+}
+
+int
+rewind_step_back( size_t n )
+{
+  static libspectrum_byte *latest[ REWIND_CHUNKS ];
+  rewind_frame_t *target;
+  size_t i, j, index;
+  int error;
+
+  if( rzx_recording || rzx_playback ) {
+    ui_error( UI_ERROR_ERROR,
+              "Can't rewind during RZX recording or playback; use rollback" );
+    return 1;
+  }
+
+  if( n == 0 || n > count ) {
+    ui_error( UI_ERROR_INFO, "Can only rewind %lu frames",
+              (unsigned long)count );
+    return 1;
+  }
+
+  index = count - n;
+  target = frame_at( index );
+
+  memset( latest, 0, sizeof( latest ) );
+
+  for( i = 0; i <= index; i++ ) {
+    rewind_frame_t *frame = frame_at( i );
+
+    for( j = 0; j < REWIND_CHUNKS; j++ )
+      if( frame->chunks[j] ) latest[j] = frame->chunks[j];
+  }
+
+  for( i = 0; i < REWIND_RAM_PAGES; i++ ) {
+    libspectrum_byte *page = libspectrum_new0( libspectrum_byte, 0x4000 );
+
+    for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
+      libspectrum_byte *chunk = latest[ i * MEMORY_PAGES_IN_16K + j ];
+      if( chunk )
+        memcpy( page + j * MEMORY_PAGE_SIZE, chunk, MEMORY_PAGE_SIZE );
+    }
+
+    libspectrum_snap_set_pages( target->snap, i, page );
+  }
+
+  error = snapshot_copy_from( target->snap );
+
+  /* The RAM now differs from that of the frame before the target in exactly
+     the target's chunks, so those are what the next frame must store */
+  memory_ram_dirty_clear( MEMORY_RAM_DIRTY_REWIND );
+  for( i = 0; i < REWIND_CHUNKS; i++ )
+    if( target->chunks[i] ) memory_ram_dirty[i] |= MEMORY_RAM_DIRTY_REWIND;
+
+  /* The machine is now in the target's state, so the target is dropped too:
+     rewinding again goes back to the frame before it */
+  while( count > index ) {
+    count--;
+    frame_free( frame_at( count ) );
+  }
+
+  update_statusbar();
+
+  if( error ) {
+    rewind_clear();
+    return error;
+  }
+
+  return 0;
+}
+
+int
+rewind_step_back_all( void )
+{
+  return rewind_step_back( count );
+}
+
+static void
+rewind_end( void )
+{
+  resize( 0 );
+}
+
+void
+rewind_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_MEMORY,
+    STARTUP_MANAGER_MODULE_SETUID,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_REWIND, dependencies,
+                            ARRAY_SIZE( dependencies ), NULL, NULL,
+                            rewind_end );
+}
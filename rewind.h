@@ -0,0 +1,44 @@
+/* rewind.h: Frame-by-frame rewind buffer
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_REWIND_H
+#define FUSE_REWIND_H
+
+#include <stddef.h>
+
+void rewind_register_startup( void );
+
+/* Record the machine's state; called at the start of every frame */
+void rewind_frame( void );
+
+/* The number of frames which can currently be stepped back */
+size_t rewind_frame_count( void );
+
+/* Go back to the state at the start of the frame `frames' - 1 frames before
+   the current one, discarding everything recorded after it; so rewinding
+   by one frame returns to the start of the current frame */
+int rewind_step_back( size_t frames );
+
+/* Go back as far as the buffer allows */
+int rewind_step_back_all( void );
+
+/* Discard everything recorded */
+void rewind_clear( void );
+
+#endif			/* #ifndef FUSE_REWIND_H */
@@ -38,6 +38,7 @@
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "movie.h"
 #include "peripherals/ula.h"
 #include "rzx.h"
@@ -104,6 +105,22 @@ static const float SPEED_TOLERANCE = 5;
 /* How often will we create an autosave file */
 static const size_t AUTOSAVE_INTERVAL = 5 * 50;
 
+/* Autosaves are stored incrementally: the RAM is taken out of the snap
+   added to the RZX, and only the 2Kb chunks written to since the previous
+   autosave are kept here. The oldest autosave always has every chunk, so
+   any autosave can be rebuilt from its own chunks and those before it. The
+   snaps are made whole again on rollback and before the RZX is written */
+#define AUTOSAVE_RAM_PAGES 64
+#define AUTOSAVE_CHUNKS ( AUTOSAVE_RAM_PAGES * MEMORY_PAGES_IN_16K )
+
+typedef struct autosave_delta_t {
+  libspectrum_snap *snap;	/* The autosave in the RZX */
+  libspectrum_byte *chunks[ AUTOSAVE_CHUNKS ]; /* NULL if not written to */
+} autosave_delta_t;
+
+/* Oldest first */
+static GSList *autosave_deltas;
+
 /* Debugger events */
 static const char * const event_type_string = "rzx";
 static const char * const end_event_detail_string = "end";
@@ -111,6 +128,9 @@ static const char * const end_event_detail_string = "end";
 int end_event;
 
 static int start_playback( libspectrum_rzx *from_rzx );
+static void autosave_delta_add( libspectrum_snap *snap );
+static void autosave_delta_rebuild_all( void );
+static void autosave_delta_free_all( void );
 static void start_recording( libspectrum_rzx *to_rzx, int competition_mode );
 static int recording_frame( void );
 static int playback_frame( void );
@@ -154,6 +174,8 @@ rzx_add_snap( libspectrum_rzx *to_rzx, int automatic )
     return error;
   }
 
+  if( automatic ) autosave_delta_add( snap );
+
   return 0;
 }
 
@@ -198,6 +220,10 @@ int rzx_stop_recording( void )
   /* Embed final snapshot */
   if( !rzx_competition_mode ) rzx_add_snap( rzx, 0 );
 
+  /* The autosaves are written out in full */
+  autosave_delta_rebuild_all();
+  autosave_delta_free_all();
+
   libspectrum_free( rzx_in_bytes );
   rzx_in_bytes = NULL;
   rzx_in_allocated = 0;
@@ -423,6 +449,10 @@ start_recording( libspectrum_rzx *to_rzx, int competition_mode )
   rzx_in_count = 0;
   autosave_frame_count = 0;
 
+  /* The first autosave has to be complete */
+  autosave_delta_free_all();
+  memory_ram_dirty_all( MEMORY_RAM_DIRTY_RZX );
+
   rzx_recording = 1;
 
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 1 );
@@ -549,6 +579,184 @@ int rzx_frame( void )
   return 0;
 }
 
+static GSList*
+autosave_delta_find( libspectrum_snap *snap )
+{
+  GSList *link;
+
+  for( link = autosave_deltas; link; link = link->next )
+    if( ( (autosave_delta_t*)link->data )->snap == snap ) return link;
+
+  return NULL;
+}
+
+static void
+autosave_delta_free( autosave_delta_t *delta )
+{
+  size_t i;
+
+  for( i = 0; i < AUTOSAVE_CHUNKS; i++ ) libspectrum_free( delta->chunks[i] );
+  libspectrum_free( delta );
+}
+
+static void
+autosave_delta_free_all( void )
+{
+  GSList *link;
+
+  for( link = autosave_deltas; link; link = link->next )
+    autosave_delta_free( link->data );
+
+  g_slist_free( autosave_deltas );
+  autosave_deltas = NULL;
+}
+
+/* Move the RAM out of a freshly made autosave, keeping the chunks written
+   to since the last one */
+static void
+autosave_delta_add( libspectrum_snap *snap )
+{
+  autosave_delta_t *delta = libspectrum_new0( autosave_delta_t, 1 );
+  size_t i, j;
+
+  delta->snap = snap;
+
+  for( i = 0; i < AUTOSAVE_RAM_PAGES; i++ ) {
+    libspectrum_byte *page = libspectrum_snap_pages( snap, i );
+    if( !page ) continue;
+
+    for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
+      size_t chunk = i * MEMORY_PAGES_IN_16K + j;
+      if( !( memory_ram_dirty[ chunk ] & MEMORY_RAM_DIRTY_RZX ) ) continue;
+
+      delta->chunks[ chunk ] = libspectrum_new( libspectrum_byte,
+                                                MEMORY_PAGE_SIZE );
+      memcpy( delta->chunks[ chunk ], page + j * MEMORY_PAGE_SIZE,
+              MEMORY_PAGE_SIZE );
+    }
+
+    libspectrum_free( page );
+    libspectrum_snap_set_pages( snap, i, NULL );
+  }
+
+  memory_ram_dirty_clear( MEMORY_RAM_DIRTY_RZX );
+
+  autosave_deltas = g_slist_append( autosave_deltas, delta );
+}
+
+/* Give the snap of the autosave at `link' its RAM back */
+static void
+autosave_delta_rebuild( GSList *link )
+{
+  static libspectrum_byte *latest[ AUTOSAVE_CHUNKS ];
+  autosave_delta_t *delta = link->data;
+  GSList *l;
+  size_t i, j;
+
+  memset( latest, 0, sizeof( latest ) );
+
+  for( l = autosave_deltas; l; l = l->next ) {
+    autosave_delta_t *earlier = l->data;
+
+    for( i = 0; i < AUTOSAVE_CHUNKS; i++ )
+      if( earlier->chunks[i] ) latest[i] = earlier->chunks[i];
+
+    if( l == link ) break;
+  }
+
+  for( i = 0; i < AUTOSAVE_RAM_PAGES; i++ ) {
+    libspectrum_byte *page = NULL;
+
+    for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
+      libspectrum_byte *chunk = latest[ i * MEMORY_PAGES_IN_16K + j ];
+      if( !chunk ) continue;
+
+      if( !page ) page = libspectrum_new0( libspectrum_byte, 0x4000 );
+      memcpy( page + j * MEMORY_PAGE_SIZE, chunk, MEMORY_PAGE_SIZE );
+    }
+
+    if( page ) {
+      libspectrum_free( libspectrum_snap_pages( delta->snap, i ) );
+      libspectrum_snap_set_pages( delta->snap, i, page );
+    }
+  }
+}
+
+static void
+autosave_delta_rebuild_all( void )
+{
+  GSList *link;
+
+  for( link = autosave_deltas; link; link = link->next )
+    autosave_delta_rebuild( link );
+}
+
+/* Take the RAM out of a rebuilt autosave again */
+static void
+autosave_delta_strip( libspectrum_snap *snap )
+{
+  size_t i;
+
+  for( i = 0; i < AUTOSAVE_RAM_PAGES; i++ ) {
+    libspectrum_free( libspectrum_snap_pages( snap, i ) );
+    libspectrum_snap_set_pages( snap, i, NULL );
+  }
+}
+
+/* Called before an autosave is deleted from the RZX: anything it has which
+   the next one doesn't is still needed to rebuild that one */
+static void
+autosave_delta_remove( libspectrum_snap *snap )
+{
+  GSList *link = autosave_delta_find( snap );
+  autosave_delta_t *delta, *next;
+  size_t i;
+
+  if( !link ) return;
+
+  delta = link->data;
+  next = link->next ? link->next->data : NULL;
+
+  for( i = 0; i < AUTOSAVE_CHUNKS; i++ ) {
+    if( !delta->chunks[i] ) continue;
+
+    if( next && !next->chunks[i] ) {
+      next->chunks[i] = delta->chunks[i];
+      delta->chunks[i] = NULL;
+    } else if( !next ) {
+      /* This was the latest autosave, so the next one must save the chunk */
+      memory_ram_dirty[i] |= MEMORY_RAM_DIRTY_RZX;
+    }
+  }
+
+  autosave_deltas = g_slist_remove( autosave_deltas, delta );
+  autosave_delta_free( delta );
+}
+
+/* Forget the autosaves which a rollback has deleted from the RZX */
+static void
+autosave_delta_rolled_back( void )
+{
+  libspectrum_rzx_iterator it;
+  GSList *kept = NULL, *link;
+
+  for( it = libspectrum_rzx_iterator_begin( rzx );
+       it;
+       it = libspectrum_rzx_iterator_next( it ) ) {
+    if( libspectrum_rzx_iterator_get_type( it ) ==
+          LIBSPECTRUM_RZX_SNAPSHOT_BLOCK ) {
+      link = autosave_delta_find( libspectrum_rzx_iterator_get_snap( it ) );
+      if( link ) kept = g_slist_append( kept, link->data );
+    }
+  }
+
+  for( link = autosave_deltas; link; link = link->next )
+    if( !g_slist_find( kept, link->data ) ) autosave_delta_free( link->data );
+
+  g_slist_free( autosave_deltas );
+  autosave_deltas = kept;
+}
+
 typedef struct prune_info_t {
   libspectrum_rzx_iterator it;
   size_t frames;
@@ -598,9 +806,11 @@ autosave_prune( void )
           save1.frames == 60 * 50 ||
 	  save1.frames == 300 * 50   ) &&
 	save2.frames < 2 * save1.frames
-      )
+      ) {
+      autosave_delta_remove( libspectrum_rzx_iterator_get_snap( save1.it ) );
       /* FIXME: could possibly merge adjacent IRBs here */
       libspectrum_rzx_iterator_delete( rzx, save1.it );
+    }
   }
 
   g_array_free( autosaves, TRUE );
@@ -811,9 +1021,22 @@ get_rollback_list( libspectrum_rzx *from_rzx )
 static int
 start_after_rollback( libspectrum_snap *snap )
 {
+  GSList *link;
   int error;
 
+  autosave_delta_rolled_back();
+
+  link = autosave_delta_find( snap );
+  if( link ) autosave_delta_rebuild( link );
+
   error = snapshot_copy_from( snap );
+
+  if( link ) {
+    autosave_delta_strip( snap );
+    /* The RAM is now exactly as stored for this autosave */
+    if( !error ) memory_ram_dirty_clear( MEMORY_RAM_DIRTY_RZX );
+  }
+
   if( error ) return error;
 
   libspectrum_rzx_start_input( rzx, tstates );
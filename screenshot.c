@@ -32,6 +32,7 @@
 #include "display.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "peripherals/scld.h"
 #include "screenshot.h"
 #include "settings.h"
@@ -578,6 +579,16 @@ convert_hires_to_lores( libspectrum_byte high, libspectrum_byte low )
   return ret.byte;
 }
 
+/* The screen loaders write to RAM[] directly, bypassing the memory map */
+static void
+screen_mark_dirty( void )
+{
+  libspectrum_word offset;
+
+  for( offset = 0; offset < 0x4000; offset += MEMORY_PAGE_SIZE )
+    memory_ram_dirty_mark( memory_current_screen, offset );
+}
+
 int
 screenshot_scr_read( const char *filename )
 {
@@ -657,6 +668,7 @@ screenshot_scr_read( const char *filename )
 
   utils_close_file( &screen );
 
+  screen_mark_dirty();
   display_refresh_all();
 
   return error;
@@ -700,6 +712,7 @@ screenshot_mlt_read( const char *filename )
 
   utils_close_file( &screen );
 
+  screen_mark_dirty();
   display_refresh_all();
 
   return error;
@@ -176,3 +176,19 @@ snapshot_copy_to( libspectrum_snap *snap )
 
   return 0;
 }
+
+/* As snapshot_copy_to(), but leaving the pages of the 'normal' RAM unset
+   for callers which track the RAM themselves. Peripheral RAM and flash,
+   and any ROM which a reset would reload unchanged, are left out too; they
+   survive snapshot_copy_from() as they are */
+int
+snapshot_copy_to_without_memory( libspectrum_snap *snap )
+{
+  int error;
+
+  memory_snapshot_contents = 0;
+  error = snapshot_copy_to( snap );
+  memory_snapshot_contents = 1;
+
+  return error;
+}
@@ -36,5 +36,6 @@ int snapshot_copy_from( libspectrum_snap *snap );
 
 int snapshot_write( const char *filename );
 int snapshot_copy_to( libspectrum_snap *snap );
+int snapshot_copy_to_without_memory( libspectrum_snap *snap );
 
 #endif
@@ -28,6 +28,9 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
@@ -125,6 +128,41 @@ sound_get_effective_processor_speed( void )
            settings_current.emulation_speed;
 }
 
+/* The shortest latency the fifo based drivers will aim for, in ms */
+#define SOUND_LATENCY_MIN 5
+
+/* How many samples the fifo based drivers should aim to keep buffered */
+int
+sound_latency_samples( int freq )
+{
+  int latency = settings_current.sound_latency;
+
+  if( latency < SOUND_LATENCY_MIN ) latency = SOUND_LATENCY_MIN;
+
+  return (long)freq * latency / 1000;
+}
+
+/* Generate `ratio' times as many samples per frame as normal, by telling
+   the Blip_Buffers the Spectrum is running at a slightly different speed */
+void
+sound_set_rate_adjustment( double ratio )
+{
+  long rate;
+
+  if( !sound_enabled ) return;
+
+  if( ratio < 1 - SOUND_RATE_ADJUSTMENT_MAX )
+    ratio = 1 - SOUND_RATE_ADJUSTMENT_MAX;
+  else if( ratio > 1 + SOUND_RATE_ADJUSTMENT_MAX )
+    ratio = 1 + SOUND_RATE_ADJUSTMENT_MAX;
+
+  rate = sound_get_effective_processor_speed() / ratio + 0.5;
+
+  blip_buffer_set_clock_rate( left_buf, rate );
+  if( sound_stereo_ay != SOUND_STEREO_AY_NONE )
+    blip_buffer_set_clock_rate( right_buf, rate );
+}
+
 static int
 sound_init_blip( Blip_Buffer **buf, Blip_Synth **synth )
 {
@@ -321,8 +359,10 @@ sound_init( const char *device )
   hz = ( float )sound_get_effective_processor_speed() /
                 machine_current->timings.tstates_per_frame;
 
-  /* Size of audio data we will get from running a single Spectrum frame */
-  sound_framesiz = ( float )settings_current.sound_freq / hz;
+  /* Size of audio data we will get from running a single Spectrum frame,
+     allowing for the fifo based drivers speeding up sound generation */
+  sound_framesiz = ( float )settings_current.sound_freq / hz *
+                   ( 1 + SOUND_RATE_ADJUSTMENT_MAX );
   sound_framesiz++;
 
   samples = libspectrum_new0( blip_sample_t, sound_framesiz * sound_channels );
@@ -420,206 +460,495 @@ ay_do_tone( int level, unsigned int tone_count, int *var, int chan )
    master clock by 2 to drive the AY */
 #define AY_CLOCK_RATIO 2
 
+/* The tone counters advance by this much every tick, and the noise and
+   envelope counters by one. ay_advance() relies on these */
+#define AY_TONE_COUNT ( AY_CLOCK_DIVISOR >> 3 )
+
+static int ay_rng = 1;
+static int ay_noise_toggle = 0;
+static int ay_env_first = 1, ay_env_rev = 0, ay_env_counter = 15;
+
+/* If set, the AY output is hashed into ay_capture_hash rather than being
+   sent to the synths; used by the unit tests and benchmarks */
+static int ay_capture = 0;
+static libspectrum_dword ay_capture_hash;
+
 static void
-sound_ay_overlay( void )
+ay_output( int chan, libspectrum_dword at, int level )
 {
-  static int rng = 1;
-  static int noise_toggle = 0;
-  static int env_first = 1, env_rev = 0, env_counter = 15;
-  int tone_level[3];
+  Blip_Synth *synth, *synth_r;
+
+  if( ay_capture ) {
+    ay_capture_hash = ( ay_capture_hash ^ at ) * 16777619;
+    ay_capture_hash = ( ay_capture_hash ^ chan ) * 16777619;
+    ay_capture_hash = ( ay_capture_hash ^ level ) * 16777619;
+    return;
+  }
+
+  switch( chan ) {
+  case 0: synth = ay_a_synth; synth_r = ay_a_synth_r; break;
+  case 1: synth = ay_b_synth; synth_r = ay_b_synth_r; break;
+  default: synth = ay_c_synth; synth_r = ay_c_synth_r; break;
+  }
+
+  blip_synth_update( synth, at, level );
+  if( synth_r ) blip_synth_update( synth_r, at, level );
+}
+
+static void
+ay_register_write( int reg, int val )
+{
+  int r;
+
+  sound_ay_registers[ reg ] = val;
+
+  /* fix things as needed for some register changes */
+  switch ( reg ) {
+  case 0: case 1: case 2: case 3: case 4: case 5:
+    r = reg >> 1;
+    /* a zero-len period is the same as 1 */
+    ay_tone_period[r] = ( sound_ay_registers[ reg & ~1 ] |
+                          ( sound_ay_registers[ reg | 1 ] & 15 ) << 8 );
+    if( !ay_tone_period[r] )
+      ay_tone_period[r]++;
+
+    /* important to get this right, otherwise e.g. Ghouls 'n' Ghosts
+     * has really scratchy, horrible-sounding vibrato.
+     */
+    if( ay_tone_tick[r] >= ay_tone_period[r] * 2 )
+      ay_tone_tick[r] %= ay_tone_period[r] * 2;
+    break;
+  case 6:
+    ay_noise_tick = 0;
+    ay_noise_period = ( sound_ay_registers[ reg ] & 31 );
+    break;
+  case 11: case 12:
+    ay_env_period =
+      sound_ay_registers[11] | ( sound_ay_registers[12] << 8 );
+    break;
+  case 13:
+    ay_env_internal_tick = ay_env_tick = ay_env_cycles = 0;
+    ay_env_first = 1;
+    ay_env_rev = 0;
+    ay_env_counter = ( sound_ay_registers[13] & AY_ENV_ATTACK ) ? 0 : 15;
+    break;
+  }
+}
+
+/* One 1/16th-of-period step of the envelope */
+static void
+ay_env_step( int envshape )
+{
+  /* do a 1/16th-of-period incr/decr if needed */
+  if( ay_env_first ||
+      ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
+    if( ay_env_rev )
+      ay_env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+    else
+      ay_env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+    if( ay_env_counter < 0 )
+      ay_env_counter = 0;
+    if( ay_env_counter > 15 )
+      ay_env_counter = 15;
+  }
+
+  ay_env_internal_tick++;
+  while( ay_env_internal_tick >= 16 ) {
+    ay_env_internal_tick -= 16;
+
+    /* end of cycle */
+    if( !( envshape & AY_ENV_CONT ) )
+      ay_env_counter = 0;
+    else {
+      if( envshape & AY_ENV_HOLD ) {
+        if( ay_env_first && ( envshape & AY_ENV_ALT ) )
+          ay_env_counter = ( ay_env_counter ? 0 : 15 );
+      } else {
+        /* non-hold */
+        if( envshape & AY_ENV_ALT )
+          ay_env_rev = !ay_env_rev;
+        else
+          ay_env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
+      }
+    }
+
+    ay_env_first = 0;
+  }
+}
+
+/* Once the first cycle is over, an envelope which doesn't repeat holds
+   its level until register 13 is next written */
+static int
+ay_env_is_static( int envshape )
+{
+  return !ay_env_first &&
+    ( !( envshape & AY_ENV_CONT ) || ( envshape & AY_ENV_HOLD ) );
+}
+
+static void
+ay_noise_step( void )
+{
+  if( ( ay_rng & 1 ) ^ ( ( ay_rng & 2 ) ? 1 : 0 ) )
+    ay_noise_toggle = !ay_noise_toggle;
+
+  /* rng is 17-bit shift reg, bit 0 is output.
+   * input is bit 0 xor bit 3.
+   */
+  if( ay_rng & 1 ) {
+    ay_rng ^= 0x24000;
+  }
+  ay_rng >>= 1;
+}
+
+/* Run one AY tick at time f */
+static void
+ay_tick( libspectrum_dword f, int *last_chan )
+{
+  int tone_level[3], chan[3];
   int mixer, envshape;
   int g, level;
-  libspectrum_dword f;
-  struct ay_change_tag *change_ptr = ay_change;
-  int changes_left = ay_change_count;
-  int reg, r;
-  int chan1, chan2, chan3;
-  int last_chan1 = 0, last_chan2 = 0, last_chan3 = 0;
   unsigned int tone_count, noise_count;
 
-  /* If no AY chip, don't produce any AY sound (!) */
-  if( !( periph_is_active( PERIPH_TYPE_FULLER) ||
-         periph_is_active( PERIPH_TYPE_MELODIK ) ||
-         machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY ) )
-    return;
+  /* the tone level if no enveloping is being used */
+  for( g = 0; g < 3; g++ )
+    tone_level[g] = ay_tone_levels[ sound_ay_registers[ 8 + g ] & 15 ];
 
-  for( f = 0; f < machine_current->timings.tstates_per_frame;
-       f+= AY_CLOCK_DIVISOR * AY_CLOCK_RATIO ) {
-    /* update ay registers. */
-    while( changes_left && f >= change_ptr->tstates ) {
-      sound_ay_registers[ reg = change_ptr->reg ] = change_ptr->val;
-      change_ptr++;
-      changes_left--;
+  /* envelope */
+  envshape = sound_ay_registers[13];
+  level = ay_tone_levels[ ay_env_counter ];
 
-      /* fix things as needed for some register changes */
-      switch ( reg ) {
-      case 0: case 1: case 2: case 3: case 4: case 5:
-        r = reg >> 1;
-        /* a zero-len period is the same as 1 */
-        ay_tone_period[r] = ( sound_ay_registers[ reg & ~1 ] |
-                              ( sound_ay_registers[ reg | 1 ] & 15 ) << 8 );
-        if( !ay_tone_period[r] )
-          ay_tone_period[r]++;
-
-        /* important to get this right, otherwise e.g. Ghouls 'n' Ghosts
-         * has really scratchy, horrible-sounding vibrato.
-         */
-        if( ay_tone_tick[r] >= ay_tone_period[r] * 2 )
-          ay_tone_tick[r] %= ay_tone_period[r] * 2;
-        break;
-      case 6:
-        ay_noise_tick = 0;
-        ay_noise_period = ( sound_ay_registers[ reg ] & 31 );
-        break;
-      case 11: case 12:
-        ay_env_period =
-          sound_ay_registers[11] | ( sound_ay_registers[12] << 8 );
-        break;
-      case 13:
-        ay_env_internal_tick = ay_env_tick = ay_env_cycles = 0;
-        env_first = 1;
-        env_rev = 0;
-        env_counter = ( sound_ay_registers[13] & AY_ENV_ATTACK ) ? 0 : 15;
+  for( g = 0; g < 3; g++ )
+    if( sound_ay_registers[ 8 + g ] & 16 )
+      tone_level[g] = level;
+
+  /* envelope output counter gets incr'd every 16 AY cycles. */
+  ay_env_cycles += AY_CLOCK_DIVISOR;
+  noise_count = 0;
+  while( ay_env_cycles >= 16 ) {
+    ay_env_cycles -= 16;
+    noise_count++;
+    ay_env_tick++;
+    while( ay_env_tick >= ay_env_period ) {
+      ay_env_tick -= ay_env_period;
+
+      ay_env_step( envshape );
+
+      /* don't keep trying if period is zero */
+      if( !ay_env_period )
         break;
-      }
     }
+  }
 
-    /* the tone level if no enveloping is being used */
-    for( g = 0; g < 3; g++ )
-      tone_level[g] = ay_tone_levels[ sound_ay_registers[ 8 + g ] & 15 ];
-
-    /* envelope */
-    envshape = sound_ay_registers[13];
-    level = ay_tone_levels[ env_counter ];
-
-    for( g = 0; g < 3; g++ )
-      if( sound_ay_registers[ 8 + g ] & 16 )
-        tone_level[g] = level;
-
-    /* envelope output counter gets incr'd every 16 AY cycles. */
-    ay_env_cycles += AY_CLOCK_DIVISOR;
-    noise_count = 0;
-    while( ay_env_cycles >= 16 ) {
-      ay_env_cycles -= 16;
-      noise_count++;
-      ay_env_tick++;
-      while( ay_env_tick >= ay_env_period ) {
-        ay_env_tick -= ay_env_period;
-
-        /* do a 1/16th-of-period incr/decr if needed */
-        if( env_first ||
-            ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
-          if( env_rev )
-            env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          else
-            env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          if( env_counter < 0 )
-            env_counter = 0;
-          if( env_counter > 15 )
-            env_counter = 15;
-        }
-
-        ay_env_internal_tick++;
-        while( ay_env_internal_tick >= 16 ) {
-          ay_env_internal_tick -= 16;
-
-          /* end of cycle */
-          if( !( envshape & AY_ENV_CONT ) )
-            env_counter = 0;
-          else {
-            if( envshape & AY_ENV_HOLD ) {
-              if( env_first && ( envshape & AY_ENV_ALT ) )
-                env_counter = ( env_counter ? 0 : 15 );
-            } else {
-              /* non-hold */
-              if( envshape & AY_ENV_ALT )
-                env_rev = !env_rev;
-              else
-                env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
-            }
-          }
-
-          env_first = 0;
-        }
-
-        /* don't keep trying if period is zero */
-        if( !ay_env_period )
-          break;
-      }
-    }
+  /* generate tone+noise... or neither.
+   * (if no tone/noise is selected, the chip just shoves the
+   * level out unmodified. This is used by some sample-playing
+   * stuff.)
+   */
+  mixer = sound_ay_registers[7];
 
-    /* generate tone+noise... or neither.
-     * (if no tone/noise is selected, the chip just shoves the
-     * level out unmodified. This is used by some sample-playing
-     * stuff.)
-     */
-    chan1 = tone_level[0];
-    chan2 = tone_level[1];
-    chan3 = tone_level[2];
-    mixer = sound_ay_registers[7];
-
-    ay_tone_cycles += AY_CLOCK_DIVISOR;
-    tone_count = ay_tone_cycles >> 3;
-    ay_tone_cycles &= 7;
-
-    if( ( mixer & 1 ) == 0 ) {
-      level = chan1;
-      ay_do_tone( level, tone_count, &chan1, 0 );
+  ay_tone_cycles += AY_CLOCK_DIVISOR;
+  tone_count = ay_tone_cycles >> 3;
+  ay_tone_cycles &= 7;
+
+  for( g = 0; g < 3; g++ ) {
+    chan[g] = tone_level[g];
+
+    if( ( mixer & ( 1 << g ) ) == 0 ) {
+      level = chan[g];
+      ay_do_tone( level, tone_count, &chan[g], g );
     }
-    if( ( mixer & 0x08 ) == 0 && noise_toggle )
-      chan1 = 0;
+    if( ( mixer & ( 0x08 << g ) ) == 0 && ay_noise_toggle )
+      chan[g] = 0;
+  }
 
-    if( ( mixer & 2 ) == 0 ) {
-      level = chan2;
-      ay_do_tone( level, tone_count, &chan2, 1 );
+  for( g = 0; g < 3; g++ ) {
+    if( last_chan[g] != chan[g] ) {
+      ay_output( g, f, chan[g] );
+      last_chan[g] = chan[g];
     }
-    if( ( mixer & 0x10 ) == 0 && noise_toggle )
-      chan2 = 0;
+  }
+
+  /* update noise RNG/filter */
+  ay_noise_tick += noise_count;
+  while( ay_noise_tick >= ay_noise_period ) {
+    ay_noise_tick -= ay_noise_period;
 
-    if( ( mixer & 4 ) == 0 ) {
-      level = chan3;
-      ay_do_tone( level, tone_count, &chan3, 2 );
+    ay_noise_step();
+
+    /* don't keep trying if period is zero */
+    if( !ay_noise_period )
+      break;
+  }
+}
+
+/* How many ticks after the one just run are certain to produce the same
+   output, up to a maximum of limit? If the envelope or noise stepped
+   during that tick the next one may differ; otherwise only the channels
+   which are audible need to be considered: the next tick at which an
+   audible tone flips, or the tick after the envelope or noise next
+   steps, must be run in full */
+static libspectrum_dword
+ay_quiet_ticks( libspectrum_dword limit, const int *last_chan )
+{
+  int mixer = sound_ay_registers[7];
+  int envshape = sound_ay_registers[13];
+  int env_used = 0, noise_used = 0;
+  libspectrum_dword ticks;
+  unsigned int period, tick;
+  int g, vol, level, chan;
+
+  for( g = 0; g < 3 && limit; g++ ) {
+    vol = sound_ay_registers[ 8 + g ];
+
+    if( vol & 16 ) {
+      env_used = 1;
+      level = ay_tone_levels[ ay_env_counter ];
+    } else {
+      level = ay_tone_levels[ vol & 15 ];
     }
-    if( ( mixer & 0x20 ) == 0 && noise_toggle )
-      chan3 = 0;
 
-    if( last_chan1 != chan1 ) {
-      blip_synth_update( ay_a_synth, f, chan1 );
-      if( ay_a_synth_r ) blip_synth_update( ay_a_synth_r, f, chan1 );
-      last_chan1 = chan1;
+    chan = level;
+    if( ( mixer & ( 1 << g ) ) == 0 && !ay_tone_high[g] ) chan = 0;
+    if( ( mixer & ( 0x08 << g ) ) == 0 && ay_noise_toggle ) chan = 0;
+    if( chan != last_chan[g] ) return 0;
+
+    if( !level ) continue;
+
+    if( ( mixer & ( 1 << g ) ) == 0 ) {
+      period = ay_tone_period[g]; tick = ay_tone_tick[g];
+      ticks = tick >= period ? 1 :
+        ( period - tick + AY_TONE_COUNT - 1 ) / AY_TONE_COUNT;
+      if( ticks - 1 < limit ) limit = ticks - 1;
     }
-    if( last_chan2 != chan2 ) {
-      blip_synth_update( ay_b_synth, f, chan2 );
-      if( ay_b_synth_r ) blip_synth_update( ay_b_synth_r, f, chan2 );
-      last_chan2 = chan2;
+
+    if( ( mixer & ( 0x08 << g ) ) == 0 ) noise_used = 1;
+  }
+
+  if( env_used && !ay_env_is_static( envshape ) ) {
+    ticks = ( !ay_env_period || ay_env_tick + 1 >= ay_env_period ) ? 1 :
+            ay_env_period - ay_env_tick;
+    if( ticks < limit ) limit = ticks;
+  }
+
+  if( noise_used ) {
+    ticks = ( !ay_noise_period || ay_noise_tick + 1 >= ay_noise_period ) ?
+            1 : ay_noise_period - ay_noise_tick;
+    if( ticks < limit ) limit = ticks;
+  }
+
+  return limit;
+}
+
+static void
+ay_tone_advance( int chan, libspectrum_dword ticks )
+{
+  unsigned int period = ay_tone_period[ chan ];
+  libspectrum_dword toggles;
+
+  /* If the period was just reduced, the counter runs down by at most one
+     period per tick until it is back in range */
+  while( ticks && period > AY_TONE_COUNT &&
+         ay_tone_tick[ chan ] >= period ) {
+    ay_tone_tick[ chan ] += AY_TONE_COUNT - period;
+    ay_tone_high[ chan ] = !ay_tone_high[ chan ];
+    ticks--;
+  }
+
+  if( period <= AY_TONE_COUNT ) {
+    /* Flips every tick */
+    toggles = ticks;
+    ay_tone_tick[ chan ] += ticks * ( AY_TONE_COUNT - period );
+  } else {
+    ay_tone_tick[ chan ] += ticks * AY_TONE_COUNT;
+    toggles = ay_tone_tick[ chan ] / period;
+    ay_tone_tick[ chan ] %= period;
+  }
+
+  if( toggles & 1 ) ay_tone_high[ chan ] = !ay_tone_high[ chan ];
+}
+
+/* Bring the generators forward by the given number of quiet ticks,
+   exactly as running ay_tick() that many times would */
+static void
+ay_advance( libspectrum_dword ticks )
+{
+  int mixer = sound_ay_registers[7];
+  int envshape = sound_ay_registers[13];
+  libspectrum_dword steps;
+  int g;
+
+  for( g = 0; g < 3; g++ )
+    if( ( mixer & ( 1 << g ) ) == 0 )
+      ay_tone_advance( g, ticks );
+
+  if( ay_env_period ) {
+    ay_env_tick += ticks;
+    steps = ay_env_tick / ay_env_period;
+    ay_env_tick %= ay_env_period;
+  } else {
+    ay_env_tick += ticks;
+    steps = ticks;
+  }
+
+  /* A repeating envelope is back where it started every two cycles */
+  if( !ay_env_first && ( envshape & AY_ENV_CONT ) &&
+      !( envshape & AY_ENV_HOLD ) )
+    steps %= 32;
+
+  while( steps-- && !ay_env_is_static( envshape ) )
+    ay_env_step( envshape );
+
+  if( ay_noise_period ) {
+    ay_noise_tick += ticks;
+    steps = ay_noise_tick / ay_noise_period;
+    ay_noise_tick %= ay_noise_period;
+  } else {
+    ay_noise_tick += ticks;
+    steps = ticks;
+  }
+
+  while( steps-- )
+    ay_noise_step();
+}
+
+/* Render the AY output for a frame. Unless every_tick is set, runs of
+   ticks over which the output can't change are skipped in one go */
+static void
+ay_render( libspectrum_dword frame_length, int every_tick )
+{
+  const libspectrum_dword tick_length = AY_CLOCK_DIVISOR * AY_CLOCK_RATIO;
+  struct ay_change_tag *change_ptr = ay_change;
+  int changes_left = ay_change_count;
+  int last_chan[3] = { 0, 0, 0 };
+  libspectrum_dword f, next, ticks;
+
+  for( f = 0; f < frame_length; f += tick_length ) {
+    /* update ay registers. */
+    while( changes_left && f >= change_ptr->tstates ) {
+      ay_register_write( change_ptr->reg, change_ptr->val );
+      change_ptr++;
+      changes_left--;
     }
-    if( last_chan3 != chan3 ) {
-      blip_synth_update( ay_c_synth, f, chan3 );
-      if( ay_c_synth_r ) blip_synth_update( ay_c_synth_r, f, chan3 );
-      last_chan3 = chan3;
+
+    ay_tick( f, last_chan );
+
+    if( every_tick ) continue;
+
+    /* Skip to the tick before the next register change or the end of
+       the frame, or the next change in the output if that's sooner */
+    next = frame_length;
+    if( changes_left && change_ptr->tstates < next )
+      next = change_ptr->tstates;
+
+    ticks = ay_quiet_ticks( ( next - f - 1 ) / tick_length, last_chan );
+    if( ticks ) {
+      ay_advance( ticks );
+      f += ticks * tick_length;
     }
+  }
+}
+
+static void
+sound_ay_overlay( void )
+{
+  /* If no AY chip, don't produce any AY sound (!) */
+  if( !( periph_is_active( PERIPH_TYPE_FULLER) ||
+         periph_is_active( PERIPH_TYPE_MELODIK ) ||
+         machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY ) )
+    return;
+
+  ay_render( machine_current->timings.tstates_per_frame, 0 );
+}
+
+/* Render frames of pseudo-random AY register writes, returning a hash of
+   the output. Style 0 writes random values to random registers, style 1
+   is more like a typical tune and style 2 is mostly silence */
+libspectrum_dword
+sound_ay_render_test( int style, int frames, int every_tick )
+{
+  const libspectrum_dword frame_length = 70908;
+  static const int mixers[] = { 0x38, 0x3e, 0x30, 0x36, 0x08, 0x3f };
+  libspectrum_dword seed = 1 + style;
+  int frame, i, reg, val;
+
+#define AY_TEST_RAND() ( seed = seed * 1103515245 + 12345, seed >> 16 )
+
+  sound_ay_init();
+  memset( sound_ay_registers, 0, sizeof( sound_ay_registers ) );
+  ay_rng = 1; ay_noise_toggle = 0;
+  ay_env_first = 1; ay_env_rev = 0; ay_env_counter = 15;
+
+  ay_capture = 1;
+  ay_capture_hash = 2166136261UL;
 
-    /* update noise RNG/filter */
-    ay_noise_tick += noise_count;
-    while( ay_noise_tick >= ay_noise_period ) {
-      ay_noise_tick -= ay_noise_period;
+  for( frame = 0; frame < frames; frame++ ) {
+    ay_change_count = 0;
 
-      if( ( rng & 1 ) ^ ( ( rng & 2 ) ? 1 : 0 ) )
-        noise_toggle = !noise_toggle;
+    switch( style ) {
 
-      /* rng is 17-bit shift reg, bit 0 is output.
-       * input is bit 0 xor bit 3.
-       */
-      if( rng & 1 ) {
-        rng ^= 0x24000;
+    case 0:
+      for( i = 0; i < 30; i++ ) {
+        reg = AY_TEST_RAND() % 14;
+        if( reg == 13 && AY_TEST_RAND() % 4 ) continue;
+        val = AY_TEST_RAND() & 0xff;
+        sound_ay_write( reg, val, i * ( frame_length / 30 ) +
+                                  AY_TEST_RAND() % ( frame_length / 30 ) );
       }
-      rng >>= 1;
+      break;
+
+    case 1:
+      for( reg = 0; reg < 6; reg += 2 ) {
+        i = 50 + AY_TEST_RAND() % 1000;
+        sound_ay_write( reg, i & 0xff, reg * 10 );
+        sound_ay_write( reg + 1, i >> 8, reg * 10 + 5 );
+      }
+      sound_ay_write( 6, AY_TEST_RAND() % 32, 100 );
+      sound_ay_write( 7, mixers[ AY_TEST_RAND() % 5 ], 110 );
+      for( reg = 8; reg < 11; reg++ )
+        sound_ay_write( reg, AY_TEST_RAND() % 20, 120 + reg );
+      if( frame % 50 == 0 ) {
+        i = 100 + AY_TEST_RAND() % 3000;
+        sound_ay_write( 11, i & 0xff, 140 );
+        sound_ay_write( 12, i >> 8, 150 );
+        sound_ay_write( 13, AY_TEST_RAND() % 16, 160 );
+      }
+      break;
+
+    default:
+      sound_ay_write( 7, mixers[5], 0 );
+      sound_ay_write( 8 + frame % 3, frame % 7 ? 0 : 15, 1000 );
+      break;
 
-      /* don't keep trying if period is zero */
-      if( !ay_noise_period )
-        break;
     }
+
+    ay_render( frame_length, every_tick );
   }
+
+#undef AY_TEST_RAND
+
+  ay_capture = 0;
+  sound_ay_reset();
+
+  return ay_capture_hash;
+}
+
+int
+sound_ay_unittest( void )
+{
+  libspectrum_dword every_tick, incremental;
+  int style, r = 0;
+
+  for( style = 0; style < 3; style++ ) {
+    every_tick = sound_ay_render_test( style, 200, 1 );
+    incremental = sound_ay_render_test( style, 200, 0 );
+    if( every_tick != incremental ) {
+      printf( "%s: AY test %d: output hash %08x, expected %08x\n",
+              fuse_progname, style, incremental, every_tick );
+      r++;
+    }
+  }
+
+  return r;
 }
 
 /* don't make the change immediately; record it for later,
@@ -35,12 +35,24 @@ void sound_unpause( void );
 void sound_end( void );
 void sound_ay_write( int reg, int val, libspectrum_dword now );
 void sound_ay_reset( void );
+
+/* For the unit tests and benchmarks */
+libspectrum_dword sound_ay_render_test( int style, int frames,
+                                        int every_tick );
+int sound_ay_unittest( void );
 void sound_specdrum_write( libspectrum_word port, libspectrum_byte val );
 void sound_covox_write( libspectrum_word port, libspectrum_byte val );
 void sound_frame( void );
 void sound_beeper( libspectrum_dword at_tstates, int on );
 libspectrum_dword sound_get_effective_processor_speed( void );
 
+/* For the fifo based drivers, which lock sound generation to the sound
+   device's clock by adjusting the sample rate by up to this fraction */
+#define SOUND_RATE_ADJUSTMENT_MAX 0.005
+
+int sound_latency_samples( int freq );
+void sound_set_rate_adjustment( double ratio );
+
 extern int sound_enabled;
 extern int sound_framesiz;
 
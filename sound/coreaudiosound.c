@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <AssertMacros.h>
@@ -33,9 +34,6 @@
 
 sfifo_t sound_fifo;
 
-/* Number of Spectrum frames audio latency to use */
-#define NUM_FRAMES 2
-
 static
 OSStatus coreaudiowrite( void *inRefCon,
                          AudioUnitRenderActionFlags *ioActionFlags,
@@ -115,7 +113,7 @@ sound_lowlevel_init( const char *dev, int *freqptr, int *stereoptr )
   AudioDeviceID device = kAudioObjectUnknown; /* the default device */
   int error;
   float hz;
-  int sound_framesiz;
+  int sound_framesiz, latency;
 
   if( get_default_output_device(&device) ) return 1;
   if( get_default_sample_rate( device, &deviceFormat.mSampleRate ) ) return 1;
@@ -200,10 +198,14 @@ sound_lowlevel_init( const char *dev, int *freqptr, int *stereoptr )
   if( hz > 100.0 ) hz = 100.0;
   sound_framesiz = deviceFormat.mSampleRate / hz;
 
-  if( ( error = sfifo_init( &sound_fifo, NUM_FRAMES
+  /* Room for twice the latency we're aiming for plus a frame, so the
+     rate control in the timer has some headroom either side of its
+     target */
+  latency = sound_latency_samples( deviceFormat.mSampleRate );
+
+  if( ( error = sfifo_init( &sound_fifo, ( 2 * latency + sound_framesiz )
                                          * deviceFormat.mBytesPerFrame
-                                         * deviceFormat.mChannelsPerFrame
-                                         * sound_framesiz + 1 ) ) ) {
+                                         + 1 ) ) ) {
     ui_error( UI_ERROR_ERROR, "Problem initialising sound fifo: %s",
               strerror ( error ) );
     return 1;
@@ -242,28 +244,38 @@ sound_lowlevel_end( void )
   sfifo_close( &sound_fifo );
 }
 
-/* Copy data to fifo */
+/* Copy data straight into the fifo, a whole sample at a time so that the
+   reader never sees part of one */
 void
 sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 {
-  int i = 0;
+  const libspectrum_signed_byte *bytes = (libspectrum_signed_byte*)data;
+  int sample_size = sound_stereo_ay != SOUND_STEREO_AY_NONE ? 4 : 2;
+  void *space;
+  int n;
 
   /* Convert to bytes */
-  libspectrum_signed_byte* bytes = (libspectrum_signed_byte*)data;
   len <<= 1;
 
   while( len ) {
-    if( ( i = sfifo_write( &sound_fifo, bytes, len ) ) < 0 ) {
+    n = len;
+    space = sfifo_write_reserve( &sound_fifo, &n );
+    if( !space ) {
+      ui_error( UI_ERROR_ERROR, "Couldn't write sound fifo: %s",
+                strerror( ENODEV ) );
       break;
-    } else if( !i ) {
+    }
+
+    n -= n % sample_size;
+    if( !n ) {
       usleep( 10000 );
+      continue;
     }
-    bytes += i;
-    len -= i;
-  }
-  if( i < 0 ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't write sound fifo: %s",
-              strerror( i ) );
+
+    memcpy( space, bytes, n );
+    sfifo_write_commit( &sound_fifo, n );
+    bytes += n;
+    len -= n;
   }
 
   if( !audio_output_started ) {
@@ -280,10 +292,6 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
   }
 }
 
-#ifndef MIN
-#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
-#endif
-
 /* This is the audio processing callback. */
 OSStatus coreaudiowrite( void *inRefCon,
                          AudioUnitRenderActionFlags *ioActionFlags,
@@ -296,22 +304,12 @@ OSStatus coreaudiowrite( void *inRefCon,
   int len = deviceFormat.mBytesPerFrame * inNumberFrames;
   uint8_t* out = ioData->mBuffers[0].mData;
 
-  /* Try to only read an even number of bytes so as not to fragment a sample */
-  len = MIN( len, sfifo_used( &sound_fifo ) );
-  len &= sound_stereo_ay != SOUND_STEREO_AY_NONE ? 0xfffc : 0xfffe;
-
-  /* Read input_size bytes from fifo into sound stream */
-  while( ( f = sfifo_read( &sound_fifo, out, len ) ) > 0 ) {
-    out += f;
-    len -= f;
-  }
+  /* The fifo only ever holds whole samples, so this can't split one */
+  f = sfifo_read( &sound_fifo, out, len );
+  if( f < 0 ) f = 0;
 
   /* If we ran out of sound, make do with silence :( */
-  if( f < 0 ) {
-    for( f=0; f<len; f++ ) {
-      *out++ = 0;
-    }
-  }
+  memset( out + f, 0, len - f );
 
   return noErr;
 }
@@ -40,19 +40,27 @@ static void sdlwrite( void *userdata, Uint8 *stream, int len );
 
 sfifo_t sound_fifo;
 
-/* Number of Spectrum frames audio latency to use */
-#define NUM_FRAMES 2
-
 /* Records sound writer status information */
 static int audio_output_started;
 
+/* How many samples to ask SDL to play at a time: a frame's worth, but no
+   more than half the latency we're aiming for so that the fifo doesn't run
+   dry while the device is waiting to ask for more */
+static Uint16
+device_samples( int freq, float hz )
+{
+  int samples = freq / hz, latency = sound_latency_samples( freq ) / 2;
+
+  return samples < latency ? samples : latency;
+}
+
 int
 sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 {
   SDL_AudioSpec requested, received;
   int error;
   float hz;
-  int sound_framesiz;
+  int sound_framesiz, latency;
 
 #ifndef __MORPHOS__    
   /* I'd rather just use setenv, but Windows doesn't have it */
@@ -92,7 +100,7 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
      downgraded by the OS as being a hog too (unlimited Hz limits playback
      speed to about 2000% on my Mac, 100Hz allows up to 5000% for me) */
   if( hz > 100.0 ) hz = 100.0;
-  sound_framesiz = *freqptr / hz;
+  sound_framesiz = device_samples( *freqptr, hz );
 #ifdef __FreeBSD__
   requested.samples = pow( 2.0, floor( log2( sound_framesiz ) ) );
 #else			/* #ifdef __FreeBSD__ */
@@ -114,8 +122,7 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     SDL_CloseAudio();
 
     requested.freq = *freqptr;
-    sound_framesiz = *freqptr / hz;
-    requested.samples = sound_framesiz;
+    requested.samples = device_samples( *freqptr, hz );
 
     if( SDL_OpenAudio( &requested, NULL ) < 0 ) {
       settings_current.sound = 0;
@@ -127,12 +134,15 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     *stereoptr = received.channels == 1 ? 0 : 1;
   }
 
+  /* Room for twice the latency we're aiming for plus a frame, so the
+     rate control in the timer has some headroom either side of its
+     target */
   sound_framesiz = *freqptr / hz;
-  sound_framesiz <<= 1;
+  latency = sound_latency_samples( *freqptr );
 
-  if( ( error = sfifo_init( &sound_fifo, NUM_FRAMES
-                                         * received.channels
-                                         * sound_framesiz + 1 ) ) ) {
+  if( ( error = sfifo_init( &sound_fifo, ( 2 * latency + sound_framesiz )
+                                         * received.channels * 2
+                                         + 1 ) ) ) {
     ui_error( UI_ERROR_ERROR, "Problem initialising sound fifo: %s",
               strerror ( error ) );
     return 1;
@@ -155,28 +165,38 @@ sound_lowlevel_end( void )
   sfifo_close( &sound_fifo );
 }
 
-/* Copy data to fifo */
+/* Copy data straight into the fifo, a whole sample at a time so that the
+   reader never sees part of one */
 void
 sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 {
-  int i = 0;
+  const libspectrum_signed_byte *bytes = (libspectrum_signed_byte*)data;
+  int sample_size = sound_stereo_ay != SOUND_STEREO_AY_NONE ? 4 : 2;
+  void *space;
+  int n;
 
   /* Convert to bytes */
-  libspectrum_signed_byte* bytes = (libspectrum_signed_byte*)data;
   len <<= 1;
 
   while( len ) {
-    if( ( i = sfifo_write( &sound_fifo, bytes, len ) ) < 0 ) {
+    n = len;
+    space = sfifo_write_reserve( &sound_fifo, &n );
+    if( !space ) {
+      ui_error( UI_ERROR_ERROR, "Couldn't write sound fifo: %s",
+                strerror( ENODEV ) );
       break;
-    } else if (!i) {
-      SDL_Delay(10);
     }
-    bytes += i;
-    len -= i;
-  }
-  if( i < 0 ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't write sound fifo: %s",
-              strerror( i ) );
+
+    n -= n % sample_size;
+    if( !n ) {
+      SDL_Delay( 10 );
+      continue;
+    }
+
+    memcpy( space, bytes, n );
+    sfifo_write_commit( &sound_fifo, n );
+    bytes += n;
+    len -= n;
   }
 
   if( !audio_output_started ) {
@@ -185,25 +205,12 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
   }
 }
 
-#ifndef MIN
-#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
-#endif
-
 /* Write len samples from fifo into stream */
 void
 sdlwrite( void *userdata, Uint8 *stream, int len )
 {
-  int f;
-
-  /* Try to only read an even number of bytes so as not to fragment a sample */
-  len = MIN( len, sfifo_used( &sound_fifo ) );
-  len &= sound_stereo_ay ? 0xfffc : 0xfffe;
-
-  /* Read input_size bytes from fifo into sound stream */
-  while( ( f = sfifo_read( &sound_fifo, stream, len ) ) > 0 ) {
-    stream += f;
-    len -= f;
-  }
+  /* The fifo only ever holds whole samples, so this can't split one */
+  sfifo_read( &sound_fifo, stream, len );
 
   /* If we ran out of sound, do nothing else as SDL has prefilled
      the output buffer with silence :( */
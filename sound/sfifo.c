@@ -9,6 +9,8 @@
  * Modifications by Philip Kendall (c) 2007
  * This modified version is released under the GNU GENERAL PUBLIC LICENSE
  * version 2, or any later version
+
+ * C11 atomics, zero-copy access and statistics (c) 2026 Fuse contributors
 -----------------------------------------------------------
 TODO:
 	* Is there a way to avoid losing one byte of buffer
@@ -20,17 +22,8 @@ TODO:
 
 #include "config.h"
 
-#ifdef __KERNEL__
-#	include	<linux/string.h>
-#	include	<asm/uaccess.h>
-#	include	<linux/malloc.h>
-#	define	malloc(x)	kmalloc(x, GFP_KERNEL)
-#	define	free(x, y)	kfree_s(x, y)
-#else
-#	include	<string.h>
-#	include	<stdlib.h>
-#	define	free(x, y)	free(x)
-#endif
+#include <string.h>
+#include <stdlib.h>
 
 #include "sfifo.h"
 
@@ -45,6 +38,17 @@ TODO:
 #endif
 
 
+/*
+ * Add one to an overrun or underrun count; only ever called by
+ * the side which owns the count
+ */
+static void count_event(sfifo_atomic_t *counter)
+{
+	unsigned int n = SFIFO_LOAD(*counter, relaxed);
+
+	SFIFO_STORE(*counter, (n + 1) & 0x7fffffff, relaxed);
+}
+
 /*
  * Alloc buffer, init FIFO etc...
  */
@@ -73,6 +77,8 @@ int sfifo_init(sfifo_t *f, int size)
 	if( 0 == (f->buffer = malloc(f->size)) )
 		return -ENOMEM;
 
+	sfifo_reset_stats(f);
+
 	return 0;
 }
 
@@ -82,93 +88,139 @@ int sfifo_init(sfifo_t *f, int size)
 void sfifo_close(sfifo_t *f)
 {
 	if(f->buffer)
-		free(f->buffer, f->size);
+		free(f->buffer);
 }
 
 /*
- * Empty FIFO buffer
+ * Empty FIFO buffer; neither side may be using it
  */
 void sfifo_flush(sfifo_t *f)
 {
 	/* Reset positions */
-	f->readpos = 0;
-	f->writepos = 0;
+	SFIFO_STORE(f->readpos, 0, relaxed);
+	SFIFO_STORE(f->writepos, 0, release);
 }
 
 /*
- * Write bytes to a FIFO
- * Return number of bytes written, or an error code
+ * Contiguous free space at the write position
  */
-int sfifo_write(sfifo_t *f, const void *_buf, int len)
+void *sfifo_write_reserve(sfifo_t *f, int *len)
 {
-	int total;
-	int i;
-	const char *buf = (const char *)_buf;
+	int writepos = SFIFO_LOAD(f->writepos, relaxed);
+	int space = f->size - 1 -
+		((writepos - SFIFO_LOAD(f->readpos, acquire)) &
+		 SFIFO_SIZEMASK(f));
 
 	if(!f->buffer)
-		return -ENODEV;	/* No buffer! */
+	{
+		*len = 0;
+		return NULL;
+	}
+
+	if(*len > space)
+		*len = space;
+	if(*len > f->size - writepos)
+		*len = f->size - writepos;
+
+	if(*len && !space)
+		count_event(&f->overruns);
+
+	return f->buffer + writepos;
+}
 
-	/* total = len = min(space, len) */
-	total = sfifo_space(f);
-	DBG(printf("sfifo_space() = %d\n",total));
-	if(len > total)
-		len = total;
-	else
-		total = len;
+/*
+ * Pass on len bytes written at the pointer from
+ * sfifo_write_reserve()
+ */
+void sfifo_write_commit(sfifo_t *f, int len)
+{
+	int writepos = (SFIFO_LOAD(f->writepos, relaxed) + len) &
+		SFIFO_SIZEMASK(f);
+	int used = (writepos - SFIFO_LOAD(f->readpos, relaxed)) &
+		SFIFO_SIZEMASK(f);
+
+	SFIFO_STORE(f->writepos, writepos, release);
+
+	if(used > SFIFO_LOAD(f->max_used, relaxed))
+		SFIFO_STORE(f->max_used, used, relaxed);
+}
+
+/*
+ * Contiguous data at the read position
+ */
+const void *sfifo_read_reserve(sfifo_t *f, int *len)
+{
+	int readpos = SFIFO_LOAD(f->readpos, relaxed);
+	int used = (SFIFO_LOAD(f->writepos, acquire) - readpos) &
+		SFIFO_SIZEMASK(f);
 
-	i = f->writepos;
-	if(i + len > f->size)
+	if(!f->buffer)
 	{
-		memcpy(f->buffer + i, buf, f->size - i);
-		buf += f->size - i;
-		len -= f->size - i;
-		i = 0;
+		*len = 0;
+		return NULL;
 	}
-	memcpy(f->buffer + i, buf, len);
-	f->writepos = i + len;
 
-	return total;
+	if(*len && !used)
+		count_event(&f->underruns);
+
+	if(*len > used)
+		*len = used;
+	if(*len > f->size - readpos)
+		*len = f->size - readpos;
+
+	return f->buffer + readpos;
+}
+
+/*
+ * Hand back len bytes read at the pointer from
+ * sfifo_read_reserve()
+ */
+void sfifo_read_commit(sfifo_t *f, int len)
+{
+	int readpos = (SFIFO_LOAD(f->readpos, relaxed) + len) &
+		SFIFO_SIZEMASK(f);
+	int used = (SFIFO_LOAD(f->writepos, relaxed) - readpos) &
+		SFIFO_SIZEMASK(f);
+
+	SFIFO_STORE(f->readpos, readpos, release);
+
+	if(used < SFIFO_LOAD(f->min_used, relaxed))
+		SFIFO_STORE(f->min_used, used, relaxed);
 }
 
-#ifdef __KERNEL__
 /*
- * Write bytes to a FIFO from a user space buffer
+ * Write bytes to a FIFO
  * Return number of bytes written, or an error code
  */
-int sfifo_write_user(sfifo_t *f, const void *buf, int len)
+int sfifo_write(sfifo_t *f, const void *_buf, int len)
 {
-	int total;
-	int i;
+	int total = 0;
+	int n;
+	void *space;
+	const char *buf = (const char *)_buf;
 
 	if(!f->buffer)
 		return -ENODEV;	/* No buffer! */
 
-	/* total = len = min(space, len) */
-	total = sfifo_space(f);
-	if(len > total)
-		len = total;
-	else
-		total = len;
+	DBG(printf("sfifo_space() = %d\n",sfifo_space(f)));
 
-	i = f->writepos;
-	if(i + len > f->size)
+	/* Twice if the space wraps round, and once more to count
+	   an overrun if it runs out */
+	while(len)
 	{
-		if(f->size - i)
-		{
-			if(copy_from_user(f->buffer + i, buf, f->size - i))
-				return -EFAULT;
-			buf += f->size - i;
-			len -= f->size - i;
-		}
-		i = 0;
+		n = len;
+		space = sfifo_write_reserve(f, &n);
+		if(!n)
+			break;
+		memcpy(space, buf, n);
+		sfifo_write_commit(f, n);
+		buf += n;
+		len -= n;
+		total += n;
 	}
-	if(copy_from_user(f->buffer + i, buf, len))
-		return -EFAULT;
-	f->writepos = i + len;
 
 	return total;
 }
-#endif
 
 /*
  * Read bytes from a FIFO
@@ -176,74 +228,54 @@ int sfifo_write_user(sfifo_t *f, const void *buf, int len)
  */
 int sfifo_read(sfifo_t *f, void *_buf, int len)
 {
-	int total;
-	int i;
+	int total = 0;
+	int n;
+	const void *data;
 	char *buf = (char *)_buf;
 
 	if(!f->buffer)
 		return -ENODEV;	/* No buffer! */
 
-	/* total = len = min(used, len) */
-	total = sfifo_used(f);
-	DBG(printf("sfifo_used() = %d\n",total));
-	if(len > total)
-		len = total;
-	else
-		total = len;
+	DBG(printf("sfifo_used() = %d\n",sfifo_used(f)));
 
-	i = f->readpos;
-	if(i + len > f->size)
+	/* Twice if the data wraps round, and once more to count
+	   an underrun if it runs out */
+	while(len)
 	{
-		memcpy(buf, f->buffer + i, f->size - i);
-		buf += f->size - i;
-		len -= f->size - i;
-		i = 0;
+		n = len;
+		data = sfifo_read_reserve(f, &n);
+		if(!n)
+			break;
+		memcpy(buf, data, n);
+		sfifo_read_commit(f, n);
+		buf += n;
+		len -= n;
+		total += n;
 	}
-	memcpy(buf, f->buffer + i, len);
-	f->readpos = i + len;
 
 	return total;
 }
 
-#ifdef __KERNEL__
 /*
- * Read bytes from a FIFO into a user space buffer
- * Return number of bytes read, or an error code
+ * Fill levels and counts since the last reset; each is only
+ * approximate if either side is running
  */
-int sfifo_read_user(sfifo_t *f, void *buf, int len)
+void sfifo_get_stats(sfifo_t *f, sfifo_stats_t *stats)
 {
-	int total;
-	int i;
-
-	if(!f->buffer)
-		return -ENODEV;	/* No buffer! */
-
-	/* total = len = min(used, len) */
-	total = sfifo_used(f);
-	if(len > total)
-		len = total;
-	else
-		total = len;
-
-	i = f->readpos;
-	if(i + len > f->size)
-	{
-		if(f->size - i)
-		{
-			if(copy_to_user(buf, f->buffer + i, f->size - i))
-				return -EFAULT;
-			buf += f->size - i;
-			len -= f->size - i;
-		}
-		i = 0;
-	}
-	if(copy_to_user(buf, f->buffer + i, len))
-		return -EFAULT;
-	f->readpos = i + len;
+	stats->used = sfifo_used(f);
+	stats->min_used = SFIFO_LOAD(f->min_used, relaxed);
+	stats->max_used = SFIFO_LOAD(f->max_used, relaxed);
+	stats->underruns = SFIFO_LOAD(f->underruns, relaxed);
+	stats->overruns = SFIFO_LOAD(f->overruns, relaxed);
+}
 
-	return total;
+void sfifo_reset_stats(sfifo_t *f)
+{
+	SFIFO_STORE(f->min_used, f->size, relaxed);
+	SFIFO_STORE(f->max_used, 0, relaxed);
+	SFIFO_STORE(f->underruns, 0, relaxed);
+	SFIFO_STORE(f->overruns, 0, relaxed);
 }
-#endif
 
 #ifdef _SFIFO_TEST_
 void *sender(void *arg)
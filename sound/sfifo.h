@@ -41,33 +41,76 @@ extern "C" {
 
 #include <errno.h>
 
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#endif
+
 /*------------------------------------------------
 	"Private" stuff
 ------------------------------------------------*/
 /*
- * Porting note:
- *	Reads and writes of a variable of this type in memory
- *	must be *atomic*! 'int' is *not* atomic on all platforms.
- *	A safe type should be used, and  sfifo should limit the
- *	maximum buffer size accordingly.
+ * The read position is only written by the reader, and the
+ * write position only by the writer. The reader takes the
+ * write position with acquire ordering and releases the read
+ * position once it has finished with the data, and the writer
+ * the other way round, so each side always sees the other's
+ * data complete.
+ *
+ * Without C11 atomics, this falls back to the original
+ * assumption that reads and writes of an int are atomic and
+ * not reordered, which holds on x86 but not everywhere.
  */
-typedef int sfifo_atomic_t;
-#ifdef __TURBOC__
-#	define	SFIFO_MAX_BUFFER_SIZE	0x7fff
-#else /* Kludge: Assume 32 bit platform */
-#	define	SFIFO_MAX_BUFFER_SIZE	0x7fffffff
+#ifdef HAVE_STDATOMIC_H
+typedef atomic_int sfifo_atomic_t;
+#	define	SFIFO_LOAD(x, order)	\
+		atomic_load_explicit(&(x), memory_order_##order)
+#	define	SFIFO_STORE(x, v, order)	\
+		atomic_store_explicit(&(x), (v), memory_order_##order)
+#else
+typedef volatile int sfifo_atomic_t;
+#	define	SFIFO_LOAD(x, order)	(x)
+#	define	SFIFO_STORE(x, v, order)	((x) = (v))
 #endif
 
+#define	SFIFO_MAX_BUFFER_SIZE	0x7fffffff
+
+/*
+ * The reader's and writer's variables are kept on separate
+ * cache lines, so that the two threads don't keep taking the
+ * line from each other.
+ */
+#define	SFIFO_CACHE_LINE	64
+
 typedef struct sfifo_t
 {
+	/* Only changed by sfifo_init() */
 	char *buffer;
 	int size;			/* Number of bytes */
+	char pad0[SFIFO_CACHE_LINE];
+
+	/* Only written by the reader */
 	sfifo_atomic_t readpos;		/* Read position */
+	sfifo_atomic_t min_used;	/* Lowest fill level after a read */
+	sfifo_atomic_t underruns;	/* Reads which found it empty */
+	char pad1[SFIFO_CACHE_LINE];
+
+	/* Only written by the writer */
 	sfifo_atomic_t writepos;	/* Write position */
+	sfifo_atomic_t max_used;	/* Highest fill level after a write */
+	sfifo_atomic_t overruns;	/* Writes which found it full */
+	char pad2[SFIFO_CACHE_LINE];
 } sfifo_t;
 
 #define SFIFO_SIZEMASK(x)	((x)->size - 1)
 
+/* Fill levels and how often each side has been held up */
+typedef struct sfifo_stats_t
+{
+	int used;
+	int min_used, max_used;		/* Since the last reset */
+	int underruns, overruns;	/* Since the last reset */
+} sfifo_stats_t;
+
 
 /*------------------------------------------------
 	API
@@ -77,20 +120,31 @@ void sfifo_close(sfifo_t *f);
 void sfifo_flush(sfifo_t *f);
 int sfifo_write(sfifo_t *f, const void *buf, int len);
 int sfifo_read(sfifo_t *f, void *buf, int len);
-#define sfifo_used(x)	(((x)->writepos - (x)->readpos) & SFIFO_SIZEMASK(x))
-#define sfifo_space(x)	((x)->size - 1 - sfifo_used(x))
 
+/*
+ * Zero-copy access. *len is set to how many of the *len bytes
+ * asked for can be written or read at the returned pointer,
+ * which may be fewer than are free or used if the buffer wraps;
+ * the matching commit then passes on that many bytes. A
+ * reserve which finds the FIFO full counts as an overrun, and
+ * one which finds it empty as an underrun; so do sfifo_write()
+ * and sfifo_read() calls which can't do everything asked.
+ */
+void *sfifo_write_reserve(sfifo_t *f, int *len);
+void sfifo_write_commit(sfifo_t *f, int len);
+const void *sfifo_read_reserve(sfifo_t *f, int *len);
+void sfifo_read_commit(sfifo_t *f, int len);
 
-/*------------------------------------------------
-	Linux kernel space interface
-------------------------------------------------*/
-#ifdef __KERNEL__
-int sfifo_write_user(sfifo_t *f, const void *buf, int len);
-int sfifo_read_user(sfifo_t *f, void *buf, int len);
-#else
-#	define	sfifo_write_user	sfifo_write
-#	define	sfifo_read_user		sfifo_read
-#endif
+void sfifo_get_stats(sfifo_t *f, sfifo_stats_t *stats);
+void sfifo_reset_stats(sfifo_t *f);
+
+static inline int sfifo_used(sfifo_t *f)
+{
+	return (SFIFO_LOAD(f->writepos, acquire) -
+		SFIFO_LOAD(f->readpos, acquire)) & SFIFO_SIZEMASK(f);
+}
+
+#define sfifo_space(x)	((x)->size - 1 - sfifo_used(x))
 
 #ifdef __cplusplus
 };
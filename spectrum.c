@@ -40,6 +40,7 @@
 #include "phantom_typist.h"
 #include "psg.h"
 #include "profile.h"
+#include "rewind.h"
 #include "rzx.h"
 #include "settings.h"
 #include "sound.h"
@@ -96,6 +97,7 @@ spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
   psg_frame();
   spectrum_frame();
   z80_interrupt();
+  rewind_frame();
   ui_joystick_poll();
   timer_estimate_speed();
   debugger_add_time_events();
@@ -103,8 +105,9 @@ spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
   ui_error_frame();
 }
 
-static libspectrum_dword
-get_frame_count( void )
+/* The number of frames emulated since the last reset */
+libspectrum_dword
+spectrum_frame_count( void )
 {
   return frames_since_reset;
 }
@@ -118,7 +121,7 @@ spectrum_init( void *context )
   module_register( &module_info );
 
   debugger_system_variable_register( debugger_type_string,
-      frame_count_name, get_frame_count, NULL );
+      frame_count_name, spectrum_frame_count, NULL );
 
   return 0;
 }
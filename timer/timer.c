@@ -33,7 +33,10 @@
 #include "timer.h"
 #include "ui/ui.h"
 
-static void timer_frame_callback_sound( libspectrum_dword last_tstates );
+static int timer_frame_callback_sound( libspectrum_dword last_tstates );
+#ifdef SOUND_FIFO
+static void timer_sound_fifo_init( void );
+#endif                          /* #ifdef SOUND_FIFO */
 
 /*
  * Routines for estimating emulation speed
@@ -117,6 +120,10 @@ timer_init( void *context )
 
   event_add( 0, timer_event );
 
+#ifdef SOUND_FIFO
+  timer_sound_fifo_init();
+#endif                          /* #ifdef SOUND_FIFO */
+
   return timer_estimate_reset();
 }
 
@@ -130,6 +137,9 @@ void
 timer_register_startup( void )
 {
   startup_manager_module dependencies[] = {
+#ifdef SOUND_FIFO
+    STARTUP_MANAGER_MODULE_DEBUGGER,
+#endif                          /* #ifdef SOUND_FIFO */
     STARTUP_MANAGER_MODULE_EVENT,
     STARTUP_MANAGER_MODULE_SETUID,
   };
@@ -141,36 +151,118 @@ timer_register_startup( void )
 #ifdef SOUND_FIFO
 
 /* Callback-style sound based timer */
+#include "debugger/debugger.h"
 #include "sound/sfifo.h"
 
 extern sfifo_t sound_fifo;
 
+/* The emulation is paced by the wall clock as when sound is off, and the
+   rate at which sound is generated is nudged up or down by a fraction of a
+   percent to keep the fifo filled to the requested latency; this locks the
+   sound to the device's clock without the fifo ever having to fill up.
+   The integral term takes out the steady offset a purely proportional
+   control would leave when the two clocks differ */
+
+/* How many timer events the fifo fill is averaged over */
+#define RATE_CONTROL_SMOOTHING 8
+
+/* How many timer events the integral term takes to respond to an error */
+#define RATE_CONTROL_INTEGRAL 100
+
+/* The average fifo fill, in bytes, and the integral term of the control */
+static double average_fill, rate_integral;
+
+static const char * const debugger_type_string = "sound";
+static const char * const latency_detail_string = "latency";
+static const char * const underruns_detail_string = "underruns";
+
+static int
+sound_bytes_per_sample( void )
+{
+  return sound_stereo_ay != SOUND_STEREO_AY_NONE ? 4 : 2;
+}
+
+static libspectrum_dword
+get_latency( void )
+{
+  if( !sound_enabled || !settings_current.sound ) return 0;
+
+  return average_fill * 1000 /
+         ( (double)settings_current.sound_freq * sound_bytes_per_sample() ) +
+         0.5;
+}
+
+static libspectrum_dword
+get_underruns( void )
+{
+  sfifo_stats_t stats;
+
+  if( !sound_enabled || !settings_current.sound ) return 0;
+
+  sfifo_get_stats( &sound_fifo, &stats );
+  return stats.underruns;
+}
+
 static void
-timer_frame_callback_sound( libspectrum_dword last_tstates )
+timer_sound_fifo_init( void )
 {
-  for(;;) {
+  debugger_system_variable_register(
+    debugger_type_string, latency_detail_string, get_latency, NULL );
+  debugger_system_variable_register(
+    debugger_type_string, underruns_detail_string, get_underruns, NULL );
+}
 
-    /* Sleep while fifo is full */
-    if( sfifo_space( &sound_fifo ) < sound_framesiz ) {
-      timer_sleep( TEN_MS );
-    } else {
-      break;
-    }
+static int
+timer_frame_callback_sound( libspectrum_dword last_tstates GCC_UNUSED )
+{
+  int bytes_per_sample = sound_bytes_per_sample();
+  double target, error, adjustment, current_time;
+  int waited = 0;
+
+  /* If the fifo can't take another frame, we're well ahead of the sound
+     device: wait for it to catch up, without then trying to make up the
+     time spent waiting */
+  while( sfifo_space( &sound_fifo ) < sound_framesiz * bytes_per_sample ) {
+    timer_sleep( TEN_MS );
+    waited = 1;
+  }
 
+  if( waited ) {
+    current_time = timer_get_time(); if( current_time < 0 ) return 1;
+    start_time = current_time;
   }
 
-  event_add( last_tstates + machine_current->timings.tstates_per_frame,
-             timer_event );
+  average_fill += ( sfifo_used( &sound_fifo ) - average_fill ) /
+                  RATE_CONTROL_SMOOTHING;
+
+  target = sound_latency_samples( settings_current.sound_freq ) *
+           bytes_per_sample;
+  error = ( target - average_fill ) / target;
+  if( error < -1 ) error = -1; else if( error > 1 ) error = 1;
+
+  rate_integral += error / RATE_CONTROL_INTEGRAL;
+  if( rate_integral < -1 ) rate_integral = -1;
+  else if( rate_integral > 1 ) rate_integral = 1;
+
+  adjustment = error + rate_integral;
+  if( adjustment < -1 ) adjustment = -1;
+  else if( adjustment > 1 ) adjustment = 1;
+
+  sound_set_rate_adjustment( 1 + adjustment * SOUND_RATE_ADJUSTMENT_MAX );
+
+  return 0;
 }
 
 #else                           /* #ifdef SOUND_FIFO */
 
 /* Blocking socket-style sound based timer */
-static void
+static int
 timer_frame_callback_sound( libspectrum_dword last_tstates )
 {
   event_add( last_tstates + machine_current->timings.tstates_per_frame,
              timer_event );
+
+  return 1;
 }
   
 #endif                          /* #ifdef SOUND_FIFO */
@@ -206,14 +298,14 @@ timer_frame( libspectrum_dword last_tstates, int event GCC_UNUSED,
   double current_time, difference;
   long tstates;
 
-  if( sound_enabled && settings_current.sound ) {
-    timer_frame_callback_sound( last_tstates );
+  if( sound_enabled && settings_current.sound &&
+      timer_frame_callback_sound( last_tstates ) )
     return;
-  }
 
-  /* If we're fastloading, just schedule another check in a frame's time
-     and do nothing else */
-  if( settings_current.fastload && timer_fastloading_active() ) {
+  /* If we're fastloading or running batch jobs, just schedule another
+     check in a frame's time and do nothing else */
+  if( settings_current.batch ||
+      ( settings_current.fastload && timer_fastloading_active() ) ) {
 
     libspectrum_dword next_check_time =
       last_tstates + machine_current->timings.tstates_per_frame;
@@ -96,6 +96,10 @@ ui_confirm_save( const char *format, ... )
   char message[ MESSAGE_MAX_LENGTH ];
   ui_confirm_save_t confirm;
 
+  /* Nobody is there to answer during a batch run, and modified media is
+     discarded between jobs */
+  if( settings_current.batch ) return UI_CONFIRM_SAVE_DONTSAVE;
+
   va_start( ap, format );
 
   vsnprintf( message, MESSAGE_MAX_LENGTH, format, ap );
@@ -47,6 +47,7 @@ static GtkWidget
   *pause_status,	/* Is emulation paused (via the menu option)? */
   *tape_status,		/* Is the tape running? */
   *speed_status,	/* How fast are we running? */
+  *rewind_status,	/* How much is in the rewind buffer? */
   *machine_name;	/* What machine is being emulated? */
 
 int
@@ -90,6 +91,9 @@ gtkstatusbar_create( GtkBox *parent )
   separator = gtk_separator_new( GTK_ORIENTATION_VERTICAL );
   gtk_box_pack_end( GTK_BOX( status_bar ), separator, FALSE, FALSE, 0 );
 
+  rewind_status = gtk_label_new( NULL );
+  gtk_box_pack_end( GTK_BOX( status_bar ), rewind_status, FALSE, FALSE, 0 );
+
   tape_status = gtk_image_new_from_pixbuf( pixbuf_tape_inactive );
   gtk_box_pack_end( GTK_BOX( status_bar ), tape_status, FALSE, FALSE, 0 );
 
@@ -221,3 +225,21 @@ ui_statusbar_update_speed( float speed )
 
   return 0;
 }
+
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  char buffer[64];
+
+  if( !frames ) {
+    gtk_label_set_text( GTK_LABEL( rewind_status ), NULL );
+    return 0;
+  }
+
+  snprintf( buffer, 64, "Rewind %lu frames, %lu KB, %.0f us/frame",
+            (unsigned long)frames, (unsigned long)( bytes / 1024 ),
+            frame_time );
+  gtk_label_set_text( GTK_LABEL( rewind_status ), buffer );
+
+  return 0;
+}
@@ -190,6 +190,13 @@ ui_statusbar_update_speed( float speed )
   return 0;
 }
 
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  /* No error */
+  return 0;
+}
+
 int
 ui_tape_browser_update( ui_tape_browser_update_type change,
     libspectrum_tape_block *block )
@@ -29,6 +29,10 @@
 
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif				/* #ifdef HAVE_PTHREAD */
+
 #include "libspectrum.h"
 
 #include "scaler.h"
@@ -74,9 +78,9 @@ static void expand_dotmatrix( int *x, int *y, int *w, int *h,
    in the same order as scaler.h:scaler_type */
 static const struct scaler_info available_scalers[] = {
 
-  { "Timex Half (smoothed)", "half", SCALER_FLAGS_NONE,	       0.5,
+  { "Timex Half (smoothed)", "half", SCALER_FLAGS_NO_BANDS,   0.5,
     scaler_Half_16,       scaler_Half_32,       NULL                },
-  { "Timex Half (skipping)", "halfskip", SCALER_FLAGS_NONE,    0.5,
+  { "Timex Half (skipping)", "halfskip", SCALER_FLAGS_NO_BANDS, 0.5,
     scaler_HalfSkip_16,   scaler_HalfSkip_32,   NULL                },
   { "Normal",	       "normal",     SCALER_FLAGS_NONE,	       1.0, 
     scaler_Normal1x_16,   scaler_Normal1x_32,   NULL                },
@@ -102,11 +106,11 @@ static const struct scaler_info available_scalers[] = {
     scaler_TV3x_16,       scaler_TV3x_32,       NULL                },
   { "TV 4x",	       "tv4x",	     SCALER_FLAGS_NONE,        4.0,
     scaler_TV4x_16,       scaler_TV4x_32,       NULL                },
-  { "Timex TV",	       "timextv",    SCALER_FLAGS_NONE,        1.0, 
+  { "Timex TV",	       "timextv",    SCALER_FLAGS_NO_BANDS,    1.0, 
     scaler_TimexTV_16,    scaler_TimexTV_32,    NULL                },
   { "Dot Matrix",      "dotmatrix",  SCALER_FLAGS_EXPAND,      2.0,
     scaler_DotMatrix_16,  scaler_DotMatrix_32,  expand_dotmatrix    },
-  { "Timex 1.5x",      "timex15x",   SCALER_FLAGS_NONE,        1.5,
+  { "Timex 1.5x",      "timex15x",   SCALER_FLAGS_NO_BANDS,    1.5,
     scaler_Timex1_5x_16,  scaler_Timex1_5x_32,  NULL                },
   { "Timex 2x",        "timex2x",    SCALER_FLAGS_NONE,        2.0,
     scaler_Normal2x_16,  scaler_Normal2x_32,    NULL                },
@@ -131,6 +135,30 @@ ScalerProc *scaler_proc16, *scaler_proc32;
 scaler_flags_t scaler_flags;
 scaler_expand_fn *scaler_expander;
 
+/* The scaler which the banded scalers below split up */
+static ScalerProc *band_proc16, *band_proc32;
+static float band_scaling_factor;
+
+static void
+scaler_banded16( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+		 libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+		 int width, int height )
+{
+  scaler_run_bands( band_proc16, band_scaling_factor,
+		    settings_current.scaler_threads, srcPtr, srcPitch,
+		    dstPtr, dstPitch, width, height );
+}
+
+static void
+scaler_banded32( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+		 libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+		 int width, int height )
+{
+  scaler_run_bands( band_proc32, band_scaling_factor,
+		    settings_current.scaler_threads, srcPtr, srcPitch,
+		    dstPtr, dstPitch, width, height );
+}
+
 int
 scaler_select_scaler( scaler_type scaler )
 {
@@ -149,6 +177,16 @@ scaler_select_scaler( scaler_type scaler )
   scaler_flags = scaler_get_flags( current_scaler );
   scaler_expander = scaler_get_expander( current_scaler );
 
+  /* Always go via the banded versions where possible, so the number of
+     threads can be changed without selecting the scaler again */
+  if( !( scaler_flags & SCALER_FLAGS_NO_BANDS ) ) {
+    band_proc16 = scaler_proc16;
+    band_proc32 = scaler_proc32;
+    band_scaling_factor = scaler_get_scaling_factor( current_scaler );
+    scaler_proc16 = scaler_banded16;
+    scaler_proc32 = scaler_banded32;
+  }
+
   return uidisplay_hotswap_gfx_mode();
 }
 
@@ -204,7 +242,24 @@ scaler_get_proc16( scaler_type scaler )
 ScalerProc*
 scaler_get_proc32( scaler_type scaler )
 {
-  return available_scalers[scaler].scaler32;
+  static int simd_checked = 0;
+  static scaler_simd_type simd;
+
+  if( !simd_checked ) {
+    simd = scaler_simd_best();
+    simd_checked = 1;
+  }
+
+  return scaler_get_proc32_simd( scaler, simd );
+}
+
+ScalerProc*
+scaler_get_proc32_simd( scaler_type scaler, scaler_simd_type simd )
+{
+  ScalerProc *proc = scaler_simd_proc32( available_scalers[scaler].scaler32,
+                                         simd );
+
+  return proc ? proc : available_scalers[scaler].scaler32;
 }
 
 scaler_flags_t
@@ -225,6 +280,207 @@ scaler_get_expander( scaler_type scaler )
   return available_scalers[scaler].expander;
 }
 
+/* Splitting an area into bands */
+
+/* The most threads which will be used */
+#define SCALER_MAX_THREADS 16
+
+/* Bands start on a multiple of this many rows, as the Dot Matrix pattern
+   depends on the row within the area; and are at least this many rows high,
+   so that the time spent handing them out doesn't outweigh that saved */
+#define SCALER_BAND_ALIGN 4
+#define SCALER_BAND_MIN_HEIGHT 16
+
+typedef struct scaler_band_job {
+  ScalerProc *proc;
+  float scaling_factor;
+  const libspectrum_byte *srcPtr;
+  libspectrum_dword srcPitch;
+  libspectrum_byte *dstPtr;
+  libspectrum_dword dstPitch;
+  int width, height;
+  int band_height, bands;
+} scaler_band_job;
+
+static void
+run_band( const scaler_band_job *job, int band )
+{
+  int y = band * job->band_height;
+  int height = job->height - y;
+
+  if( height > job->band_height ) height = job->band_height;
+
+  job->proc( job->srcPtr + y * job->srcPitch, job->srcPitch,
+	     job->dstPtr + (size_t)( y * job->scaling_factor ) * job->dstPitch,
+	     job->dstPitch, job->width, height );
+}
+
+#ifdef HAVE_PTHREAD
+
+/* The worker threads. The thread which calls scaler_run_bands() also
+   does bands, so there is one fewer of these than the number of threads */
+static pthread_t band_threads[ SCALER_MAX_THREADS - 1 ];
+static int band_thread_count = 0;
+
+static pthread_mutex_t band_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t band_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t band_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* The job being done, if any, the next of its bands to start and how many
+   have been finished; all protected by band_mutex */
+static const scaler_band_job *band_job = NULL;
+static int band_next, bands_done;
+static unsigned long band_generation = 0;
+static int band_threads_exit = 0;
+
+/* Do bands from the current job until there are none left to start;
+   called with band_mutex held */
+static void
+take_bands( void )
+{
+  while( band_job && band_next < band_job->bands ) {
+    const scaler_band_job *job = band_job;
+    int band = band_next++;
+
+    pthread_mutex_unlock( &band_mutex );
+    run_band( job, band );
+    pthread_mutex_lock( &band_mutex );
+
+    if( ++bands_done == job->bands ) pthread_cond_signal( &band_done_cond );
+  }
+}
+
+static void*
+band_thread( void *arg GCC_UNUSED )
+{
+  unsigned long generation;
+
+  pthread_mutex_lock( &band_mutex );
+
+  generation = band_generation;
+
+  while( 1 ) {
+    while( !band_threads_exit && band_generation == generation )
+      pthread_cond_wait( &band_start_cond, &band_mutex );
+    if( band_threads_exit ) break;
+
+    generation = band_generation;
+    take_bands();
+  }
+
+  pthread_mutex_unlock( &band_mutex );
+
+  return NULL;
+}
+
+static void
+band_threads_stop( void )
+{
+  int i;
+
+  if( !band_thread_count ) return;
+
+  pthread_mutex_lock( &band_mutex );
+  band_threads_exit = 1;
+  pthread_cond_broadcast( &band_start_cond );
+  pthread_mutex_unlock( &band_mutex );
+
+  for( i = 0; i < band_thread_count; i++ )
+    pthread_join( band_threads[i], NULL );
+
+  band_thread_count = 0;
+  band_threads_exit = 0;
+}
+
+static void
+band_threads_start( int count )
+{
+  while( band_thread_count < count ) {
+    if( pthread_create( &band_threads[ band_thread_count ], NULL,
+			band_thread, NULL ) ) {
+      /* Carry on with the threads we have; the calling thread will do any
+	 bands they don't */
+      ui_error( UI_ERROR_WARNING, "couldn't start scaler thread" );
+      break;
+    }
+    band_thread_count++;
+  }
+}
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
+void
+scaler_run_bands( ScalerProc *proc, float scaling_factor, int threads,
+		  const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+		  libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+		  int width, int height )
+{
+  scaler_band_job job;
+#ifdef HAVE_PTHREAD
+  static int threads_wanted = 1;
+#else				/* #ifdef HAVE_PTHREAD */
+  int i;
+#endif				/* #ifdef HAVE_PTHREAD */
+
+  if( threads > SCALER_MAX_THREADS ) threads = SCALER_MAX_THREADS;
+  if( threads < 1 ) threads = 1;
+
+  job.proc = proc; job.scaling_factor = scaling_factor;
+  job.srcPtr = srcPtr; job.srcPitch = srcPitch;
+  job.dstPtr = dstPtr; job.dstPitch = dstPitch;
+  job.width = width; job.height = height;
+
+  job.band_height = ( height + threads - 1 ) / threads;
+  job.band_height = ( job.band_height + SCALER_BAND_ALIGN - 1 ) /
+		    SCALER_BAND_ALIGN * SCALER_BAND_ALIGN;
+  if( job.band_height < SCALER_BAND_MIN_HEIGHT )
+    job.band_height = SCALER_BAND_MIN_HEIGHT;
+  job.bands = ( height + job.band_height - 1 ) / job.band_height;
+
+  if( job.bands <= 1 ) {
+    proc( srcPtr, srcPitch, dstPtr, dstPitch, width, height );
+    return;
+  }
+
+#ifdef HAVE_PTHREAD
+
+  if( threads != threads_wanted ) {
+    band_threads_stop();
+    band_threads_start( threads - 1 );
+    threads_wanted = threads;
+  }
+
+  pthread_mutex_lock( &band_mutex );
+
+  band_job = &job;
+  band_next = bands_done = 0;
+  band_generation++;
+  pthread_cond_broadcast( &band_start_cond );
+
+  take_bands();
+  while( bands_done < job.bands )
+    pthread_cond_wait( &band_done_cond, &band_mutex );
+
+  band_job = NULL;
+
+  pthread_mutex_unlock( &band_mutex );
+
+#else				/* #ifdef HAVE_PTHREAD */
+
+  /* No threads to split the work between, so just do the bands in turn */
+  for( i = 0; i < job.bands; i++ ) run_band( &job, i );
+
+#endif				/* #ifdef HAVE_PTHREAD */
+}
+
+void
+scaler_end( void )
+{
+#ifdef HAVE_PTHREAD
+  band_threads_stop();
+#endif				/* #ifdef HAVE_PTHREAD */
+}
+
 /* The expansion functions */
 
 /* Clip after expansion */
@@ -60,6 +60,8 @@ typedef enum scaler_type {
 typedef enum scaler_flags_t {
   SCALER_FLAGS_NONE        = 0,
   SCALER_FLAGS_EXPAND      = 1 << 0,
+  SCALER_FLAGS_NO_BANDS    = 1 << 1,	/* Output depends on the area's
+					   height, so can't be split */
 } scaler_flags_t;
 
 typedef void ScalerProc( const libspectrum_byte *srcPtr,
@@ -93,4 +95,6 @@ scaler_expand_fn* scaler_get_expander( scaler_type scaler );
 
 int scaler_select_bitformat( libspectrum_dword BitFormat );
 
+void scaler_end( void );
+
 #endif
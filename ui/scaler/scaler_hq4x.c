@@ -339,7 +339,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -375,7 +375,7 @@
     *qN3 = HQ4X_PIXEL13_10;
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
-    if(  HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if(  HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -401,7 +401,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_70;
     *qN3 = HQ4X_PIXEL13_60;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -421,7 +421,7 @@
   case 10:
   case 138:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -579,7 +579,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -615,7 +615,7 @@
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -639,7 +639,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_70;
     *qN3 = HQ4X_PIXEL13_60;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -658,7 +658,7 @@
   case 11:
   case 139:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -685,7 +685,7 @@
   case 19:
   case 51:
   {
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q = HQ4X_PIXEL00_81;
       *q1 = HQ4X_PIXEL01_31;
       *q2 = HQ4X_PIXEL02_10;
@@ -717,7 +717,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -748,7 +748,7 @@
     *q = HQ4X_PIXEL00_20;
     *q1 = HQ4X_PIXEL01_60;
     *q2 = HQ4X_PIXEL02_81;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *q3 = HQ4X_PIXEL03_81;
       *qN3 = HQ4X_PIXEL13_31;
       *qNN2 = HQ4X_PIXEL22_30;
@@ -785,7 +785,7 @@
     *qN3 = HQ4X_PIXEL13_10;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN = HQ4X_PIXEL30_82;
@@ -813,7 +813,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_70;
     *qN3 = HQ4X_PIXEL13_60;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -835,7 +835,7 @@
   case 73:
   case 77:
   {
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *q = HQ4X_PIXEL00_82;
       *qN = HQ4X_PIXEL10_32;
       *qNN = HQ4X_PIXEL20_10;
@@ -865,7 +865,7 @@
   case 42:
   case 170:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -895,7 +895,7 @@
   case 14:
   case 142:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *q2 = HQ4X_PIXEL02_32;
@@ -1085,7 +1085,7 @@
   case 26:
   case 31:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -1094,7 +1094,7 @@
       *q1 = HQ4X_PIXEL01_50;
       *qN = HQ4X_PIXEL10_50;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -1120,7 +1120,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -1135,7 +1135,7 @@
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -1159,7 +1159,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -1170,7 +1170,7 @@
     }
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -1184,7 +1184,7 @@
   case 74:
   case 107:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -1198,7 +1198,7 @@
     *qN1 = HQ4X_PIXEL11_0;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_61;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -1216,7 +1216,7 @@
   }
   case 27:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -1244,7 +1244,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -1279,7 +1279,7 @@
     *qNN = HQ4X_PIXEL20_10;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -1302,7 +1302,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_61;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -1322,7 +1322,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -1357,7 +1357,7 @@
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -1380,7 +1380,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -1398,7 +1398,7 @@
   }
   case 75:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -1664,7 +1664,7 @@
   }
   case 58:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -1675,7 +1675,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -1700,7 +1700,7 @@
   {
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -1715,7 +1715,7 @@
     *qN1 = HQ4X_PIXEL11_31;
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -1740,7 +1740,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_31;
     *qN3 = HQ4X_PIXEL13_31;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -1751,7 +1751,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -1766,7 +1766,7 @@
   }
   case 202:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -1781,7 +1781,7 @@
     *q3 = HQ4X_PIXEL03_80;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_61;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -1800,7 +1800,7 @@
   }
   case 78:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -1815,7 +1815,7 @@
     *q3 = HQ4X_PIXEL03_82;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -1834,7 +1834,7 @@
   }
   case 154:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -1845,7 +1845,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -1870,7 +1870,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -1885,7 +1885,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -1910,7 +1910,7 @@
     *qN1 = HQ4X_PIXEL11_32;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -1921,7 +1921,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -1936,7 +1936,7 @@
   }
   case 90:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -1947,7 +1947,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -1958,7 +1958,7 @@
       *qN2 = HQ4X_PIXEL12_0;
       *qN3 = HQ4X_PIXEL13_12;
     }
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -1969,7 +1969,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -1985,7 +1985,7 @@
   case 55:
   case 23:
   {
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q = HQ4X_PIXEL00_81;
       *q1 = HQ4X_PIXEL01_31;
       *q2 = HQ4X_PIXEL02_0;
@@ -2017,7 +2017,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN2 = HQ4X_PIXEL12_0;
@@ -2048,7 +2048,7 @@
     *q = HQ4X_PIXEL00_20;
     *q1 = HQ4X_PIXEL01_60;
     *q2 = HQ4X_PIXEL02_81;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *q3 = HQ4X_PIXEL03_81;
       *qN3 = HQ4X_PIXEL13_31;
       *qNN2 = HQ4X_PIXEL22_0;
@@ -2085,7 +2085,7 @@
     *qN3 = HQ4X_PIXEL13_10;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_0;
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN = HQ4X_PIXEL30_82;
@@ -2113,7 +2113,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_70;
     *qN3 = HQ4X_PIXEL13_60;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNN1 = HQ4X_PIXEL21_0;
       *qNNN = HQ4X_PIXEL30_0;
@@ -2135,7 +2135,7 @@
   case 109:
   case 105:
   {
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *q = HQ4X_PIXEL00_82;
       *qN = HQ4X_PIXEL10_32;
       *qNN = HQ4X_PIXEL20_0;
@@ -2165,7 +2165,7 @@
   case 171:
   case 43:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -2195,7 +2195,7 @@
   case 143:
   case 15:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *q2 = HQ4X_PIXEL02_32;
@@ -2232,7 +2232,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_31;
     *qN3 = HQ4X_PIXEL13_31;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -2250,7 +2250,7 @@
   }
   case 203:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -2278,7 +2278,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -2313,7 +2313,7 @@
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -2330,7 +2330,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -2365,7 +2365,7 @@
     *qNN = HQ4X_PIXEL20_10;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -2388,7 +2388,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -2406,7 +2406,7 @@
   }
   case 155:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -2600,7 +2600,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_31;
     *qN3 = HQ4X_PIXEL13_31;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -2612,7 +2612,7 @@
       *qNNN1 = HQ4X_PIXEL31_11;
     }
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -2625,7 +2625,7 @@
   }
   case 158:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -2636,7 +2636,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -2658,7 +2658,7 @@
   }
   case 234:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -2673,7 +2673,7 @@
     *q3 = HQ4X_PIXEL03_80;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_61;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -2693,7 +2693,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -2709,7 +2709,7 @@
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -2724,7 +2724,7 @@
   }
   case 59:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -2733,7 +2733,7 @@
       *q1 = HQ4X_PIXEL01_50;
       *qN = HQ4X_PIXEL10_50;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -2765,7 +2765,7 @@
     *qN1 = HQ4X_PIXEL11_32;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -2775,7 +2775,7 @@
       *qNNN1 = HQ4X_PIXEL31_50;
     }
     *qNN1 = HQ4X_PIXEL21_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -2792,7 +2792,7 @@
   {
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -2806,7 +2806,7 @@
     *qN2 = HQ4X_PIXEL12_0;
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -2823,7 +2823,7 @@
   }
   case 79:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -2837,7 +2837,7 @@
     *qN1 = HQ4X_PIXEL11_0;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -2856,7 +2856,7 @@
   }
   case 122:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -2867,7 +2867,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -2878,7 +2878,7 @@
       *qN2 = HQ4X_PIXEL12_0;
       *qN3 = HQ4X_PIXEL13_12;
     }
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -2888,7 +2888,7 @@
       *qNNN1 = HQ4X_PIXEL31_50;
     }
     *qNN1 = HQ4X_PIXEL21_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -2903,7 +2903,7 @@
   }
   case 94:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -2914,7 +2914,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -2924,7 +2924,7 @@
       *qN3 = HQ4X_PIXEL13_50;
     }
     *qN2 = HQ4X_PIXEL12_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -2935,7 +2935,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -2950,7 +2950,7 @@
   }
   case 218:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -2961,7 +2961,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -2972,7 +2972,7 @@
       *qN2 = HQ4X_PIXEL12_0;
       *qN3 = HQ4X_PIXEL13_12;
     }
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -2984,7 +2984,7 @@
       *qNNN1 = HQ4X_PIXEL31_11;
     }
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -2997,7 +2997,7 @@
   }
   case 91:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -3006,7 +3006,7 @@
       *q1 = HQ4X_PIXEL01_50;
       *qN = HQ4X_PIXEL10_50;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -3018,7 +3018,7 @@
       *qN3 = HQ4X_PIXEL13_12;
     }
     *qN1 = HQ4X_PIXEL11_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -3029,7 +3029,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -3124,7 +3124,7 @@
   }
   case 186:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -3135,7 +3135,7 @@
       *qN = HQ4X_PIXEL10_11;
       *qN1 = HQ4X_PIXEL11_0;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -3160,7 +3160,7 @@
   {
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -3175,7 +3175,7 @@
     *qN1 = HQ4X_PIXEL11_31;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -3200,7 +3200,7 @@
     *qN1 = HQ4X_PIXEL11_32;
     *qN2 = HQ4X_PIXEL12_31;
     *qN3 = HQ4X_PIXEL13_31;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -3211,7 +3211,7 @@
       *qNNN = HQ4X_PIXEL30_20;
       *qNNN1 = HQ4X_PIXEL31_11;
     }
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -3226,7 +3226,7 @@
   }
   case 206:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -3241,7 +3241,7 @@
     *q3 = HQ4X_PIXEL03_82;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -3269,7 +3269,7 @@
     *qN1 = HQ4X_PIXEL11_32;
     *qN2 = HQ4X_PIXEL12_70;
     *qN3 = HQ4X_PIXEL13_60;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_10;
       *qNN1 = HQ4X_PIXEL21_30;
       *qNNN = HQ4X_PIXEL30_80;
@@ -3289,7 +3289,7 @@
   case 174:
   case 46:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_80;
       *q1 = HQ4X_PIXEL01_10;
       *qN = HQ4X_PIXEL10_10;
@@ -3319,7 +3319,7 @@
   {
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_10;
       *q3 = HQ4X_PIXEL03_80;
       *qN2 = HQ4X_PIXEL12_30;
@@ -3355,7 +3355,7 @@
     *qN3 = HQ4X_PIXEL13_31;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_30;
       *qNN3 = HQ4X_PIXEL23_10;
       *qNNN2 = HQ4X_PIXEL32_10;
@@ -3414,7 +3414,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -3426,7 +3426,7 @@
     *qN = HQ4X_PIXEL10_10;
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -3444,7 +3444,7 @@
   }
   case 219:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -3461,7 +3461,7 @@
     *qNN = HQ4X_PIXEL20_10;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -3476,7 +3476,7 @@
   }
   case 125:
   {
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *q = HQ4X_PIXEL00_82;
       *qN = HQ4X_PIXEL10_32;
       *qNN = HQ4X_PIXEL20_0;
@@ -3508,7 +3508,7 @@
     *q = HQ4X_PIXEL00_82;
     *q1 = HQ4X_PIXEL01_82;
     *q2 = HQ4X_PIXEL02_81;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *q3 = HQ4X_PIXEL03_81;
       *qN3 = HQ4X_PIXEL13_31;
       *qNN2 = HQ4X_PIXEL22_0;
@@ -3534,7 +3534,7 @@
   }
   case 207:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *q2 = HQ4X_PIXEL02_32;
@@ -3571,7 +3571,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNN1 = HQ4X_PIXEL21_0;
       *qNNN = HQ4X_PIXEL30_0;
@@ -3594,7 +3594,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN2 = HQ4X_PIXEL12_0;
@@ -3621,7 +3621,7 @@
   }
   case 187:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -3660,7 +3660,7 @@
     *qN3 = HQ4X_PIXEL13_10;
     *qNN = HQ4X_PIXEL20_82;
     *qNN1 = HQ4X_PIXEL21_32;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN2 = HQ4X_PIXEL22_0;
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN = HQ4X_PIXEL30_82;
@@ -3679,7 +3679,7 @@
   }
   case 119:
   {
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q = HQ4X_PIXEL00_81;
       *q1 = HQ4X_PIXEL01_31;
       *q2 = HQ4X_PIXEL02_0;
@@ -3721,7 +3721,7 @@
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_31;
     *qNN3 = HQ4X_PIXEL23_81;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
@@ -3734,7 +3734,7 @@
   case 175:
   case 47:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
@@ -3762,7 +3762,7 @@
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -3799,7 +3799,7 @@
     *qNNN = HQ4X_PIXEL30_82;
     *qNNN1 = HQ4X_PIXEL31_32;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -3816,7 +3816,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -3827,7 +3827,7 @@
     }
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -3840,7 +3840,7 @@
   }
   case 123:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -3854,7 +3854,7 @@
     *qN1 = HQ4X_PIXEL11_0;
     *qN2 = HQ4X_PIXEL12_30;
     *qN3 = HQ4X_PIXEL13_10;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -3872,7 +3872,7 @@
   }
   case 95:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -3881,7 +3881,7 @@
       *q1 = HQ4X_PIXEL01_50;
       *qN = HQ4X_PIXEL10_50;
     }
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -3906,7 +3906,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -3921,7 +3921,7 @@
     *qNN = HQ4X_PIXEL20_10;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -3944,7 +3944,7 @@
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_31;
     *qN3 = HQ4X_PIXEL13_31;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -3957,7 +3957,7 @@
     *qNN2 = HQ4X_PIXEL22_0;
     *qNN3 = HQ4X_PIXEL23_0;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -3977,7 +3977,7 @@
     *qNN = HQ4X_PIXEL20_0;
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -3986,7 +3986,7 @@
       *qNNN2 = HQ4X_PIXEL32_50;
       *qNNN3 = HQ4X_PIXEL33_50;
     }
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
@@ -3996,7 +3996,7 @@
   }
   case 235:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -4014,7 +4014,7 @@
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_31;
     *qNN3 = HQ4X_PIXEL23_81;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
@@ -4026,7 +4026,7 @@
   }
   case 111:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
@@ -4038,7 +4038,7 @@
     *qN1 = HQ4X_PIXEL11_0;
     *qN2 = HQ4X_PIXEL12_32;
     *qN3 = HQ4X_PIXEL13_82;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -4056,13 +4056,13 @@
   }
   case 63:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
     }
     *q1 = HQ4X_PIXEL01_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -4086,7 +4086,7 @@
   }
   case 159:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -4096,7 +4096,7 @@
       *qN = HQ4X_PIXEL10_50;
     }
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4119,7 +4119,7 @@
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4131,7 +4131,7 @@
     *qNN = HQ4X_PIXEL20_61;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -4148,7 +4148,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -4167,7 +4167,7 @@
     *qNNN = HQ4X_PIXEL30_82;
     *qNNN1 = HQ4X_PIXEL31_32;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -4178,7 +4178,7 @@
   {
     *q = HQ4X_PIXEL00_80;
     *q1 = HQ4X_PIXEL01_10;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -4190,7 +4190,7 @@
     *qN = HQ4X_PIXEL10_10;
     *qN1 = HQ4X_PIXEL11_30;
     *qN2 = HQ4X_PIXEL12_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -4203,7 +4203,7 @@
     *qNN2 = HQ4X_PIXEL22_0;
     *qNN3 = HQ4X_PIXEL23_0;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -4224,14 +4224,14 @@
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
     *qNN3 = HQ4X_PIXEL23_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
     }
     *qNNN1 = HQ4X_PIXEL31_0;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -4240,7 +4240,7 @@
   }
   case 251:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -4257,7 +4257,7 @@
     *qNN = HQ4X_PIXEL20_0;
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -4266,7 +4266,7 @@
       *qNNN2 = HQ4X_PIXEL32_50;
       *qNNN3 = HQ4X_PIXEL33_50;
     }
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
@@ -4276,7 +4276,7 @@
   }
   case 239:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
@@ -4292,7 +4292,7 @@
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_31;
     *qNN3 = HQ4X_PIXEL23_81;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
@@ -4304,13 +4304,13 @@
   }
   case 127:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
     }
     *q1 = HQ4X_PIXEL01_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q2 = HQ4X_PIXEL02_0;
       *q3 = HQ4X_PIXEL03_0;
       *qN3 = HQ4X_PIXEL13_0;
@@ -4322,7 +4322,7 @@
     *qN = HQ4X_PIXEL10_0;
     *qN1 = HQ4X_PIXEL11_0;
     *qN2 = HQ4X_PIXEL12_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNN = HQ4X_PIXEL20_0;
       *qNNN = HQ4X_PIXEL30_0;
       *qNNN1 = HQ4X_PIXEL31_0;
@@ -4340,14 +4340,14 @@
   }
   case 191:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
     }
     *q1 = HQ4X_PIXEL01_0;
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4368,7 +4368,7 @@
   }
   case 223:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
       *q1 = HQ4X_PIXEL01_0;
       *qN = HQ4X_PIXEL10_0;
@@ -4378,7 +4378,7 @@
       *qN = HQ4X_PIXEL10_50;
     }
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4389,7 +4389,7 @@
     *qNN = HQ4X_PIXEL20_10;
     *qNN1 = HQ4X_PIXEL21_30;
     *qNN2 = HQ4X_PIXEL22_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNN3 = HQ4X_PIXEL23_0;
       *qNNN2 = HQ4X_PIXEL32_0;
       *qNNN3 = HQ4X_PIXEL33_0;
@@ -4407,7 +4407,7 @@
     *q = HQ4X_PIXEL00_81;
     *q1 = HQ4X_PIXEL01_31;
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4423,7 +4423,7 @@
     *qNNN = HQ4X_PIXEL30_82;
     *qNNN1 = HQ4X_PIXEL31_32;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -4432,14 +4432,14 @@
   }
   case 255:
   {
-    if( HQ_YUVDIFF( y[4], u[4], v[4], y[2], u[2], v[2] ) ) {
+    if( HQ_DIFF_42 ) {
       *q = HQ4X_PIXEL00_0;
     } else {
       *q = HQ4X_PIXEL00_20;
     }
     *q1 = HQ4X_PIXEL01_0;
     *q2 = HQ4X_PIXEL02_0;
-    if( HQ_YUVDIFF( y[2], u[2], v[2], y[6], u[6], v[6] ) ) {
+    if( HQ_DIFF_26 ) {
       *q3 = HQ4X_PIXEL03_0;
     } else {
       *q3 = HQ4X_PIXEL03_20;
@@ -4452,14 +4452,14 @@
     *qNN1 = HQ4X_PIXEL21_0;
     *qNN2 = HQ4X_PIXEL22_0;
     *qNN3 = HQ4X_PIXEL23_0;
-    if( HQ_YUVDIFF( y[8], u[8], v[8], y[4], u[4], v[4] ) ) {
+    if( HQ_DIFF_84 ) {
       *qNNN = HQ4X_PIXEL30_0;
     } else {
       *qNNN = HQ4X_PIXEL30_20;
     }
     *qNNN1 = HQ4X_PIXEL31_0;
     *qNNN2 = HQ4X_PIXEL32_0;
-    if( HQ_YUVDIFF( y[6], u[6], v[6], y[8], u[8], v[8] ) ) {
+    if( HQ_DIFF_68 ) {
       *qNNN3 = HQ4X_PIXEL33_0;
     } else {
       *qNNN3 = HQ4X_PIXEL33_20;
@@ -68,4 +68,77 @@ DECLARE_SCALER(HQ2x);
 DECLARE_SCALER(HQ3x);
 DECLARE_SCALER(HQ4x);
 
+/* The instruction sets the SIMD scalers can use, in increasing order */
+typedef enum scaler_simd_type {
+  SCALER_SIMD_NONE,
+  SCALER_SIMD_SSE2,
+  SCALER_SIMD_AVX2,
+} scaler_simd_type;
+
+/* The best instruction set this CPU supports */
+scaler_simd_type scaler_simd_best( void );
+
+/* The version of a 32 bit scaler which uses `simd', or NULL if there
+   isn't one */
+ScalerProc* scaler_simd_proc32( ScalerProc *proc, scaler_simd_type simd );
+
+/* As scaler_get_proc32(), but using no more than `simd' */
+ScalerProc* scaler_get_proc32_simd( scaler_type scaler, scaler_simd_type simd );
+
+/* The HQ scalers work on strips at most this wide */
+#define SCALER_HQ_MAX_WIDTH 640
+
+/* The YUV values of a row of pixels, from the one before the start of the
+   strip to the one after its end */
+#define SCALER_HQ_ROW_SIZE ( SCALER_HQ_MAX_WIDTH + 2 )
+
+typedef struct scaler_hq_row {
+  libspectrum_signed_dword y[ SCALER_HQ_ROW_SIZE ];
+  libspectrum_signed_dword u[ SCALER_HQ_ROW_SIZE ];
+  libspectrum_signed_dword v[ SCALER_HQ_ROW_SIZE ];
+} scaler_hq_row;
+
+/* Fill in `row' from the `count' 32 bit pixels at `p' */
+typedef void scaler_hq_yuv_fn( const libspectrum_dword *p, int count,
+                               scaler_hq_row *row );
+
+/* Work out which of each pixel's neighbours differ from it: bits 0 to 7 of
+   flags[i] give the HQ pattern for pixel i, and bits 8 to 11 whether its
+   neighbours above and right, right and below, below and left and left and
+   above differ from each other */
+typedef void scaler_hq_flags_fn( const scaler_hq_row *prev,
+                                 const scaler_hq_row *cur,
+                                 const scaler_hq_row *next, int width,
+                                 int *flags );
+
+#define SCALER_HQ_DIFF_26 0x100
+#define SCALER_HQ_DIFF_68 0x200
+#define SCALER_HQ_DIFF_84 0x400
+#define SCALER_HQ_DIFF_42 0x800
+
+scaler_hq_yuv_fn scaler_hq_yuv_sse2, scaler_hq_yuv_avx2;
+scaler_hq_flags_fn scaler_hq_flags_sse2, scaler_hq_flags_avx2;
+
+#define DECLARE_SIMD_SCALER( name, simd ) \
+         extern void scaler_##name##_32_##simd( const libspectrum_byte *srcPtr, \
+                                                libspectrum_dword srcPitch, \
+                                                libspectrum_byte *dstPtr, \
+                                                libspectrum_dword dstPitch, \
+                                                int width, int height );
+
+DECLARE_SIMD_SCALER(HQ2x, sse2);
+DECLARE_SIMD_SCALER(HQ3x, sse2);
+DECLARE_SIMD_SCALER(HQ4x, sse2);
+DECLARE_SIMD_SCALER(HQ2x, avx2);
+DECLARE_SIMD_SCALER(HQ3x, avx2);
+DECLARE_SIMD_SCALER(HQ4x, avx2);
+
+/* Run a scaler over an area, split into horizontal bands which are
+   processed in parallel by `threads' threads */
+void scaler_run_bands( ScalerProc *proc, float scaling_factor, int threads,
+                       const libspectrum_byte *srcPtr,
+                       libspectrum_dword srcPitch,
+                       libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                       int width, int height );
+
 #endif				/* #ifndef FUSE_SCALER_INTERNALS_H */
@@ -2061,7 +2061,7 @@ FUNCTION( scaler_PalTV4x )( const libspectrum_byte *srcPtr,
 #define prevline (-nextlineSrc)
 #define nextline nextlineSrc
 #define MOVE_B_TO_A(A,B) \
-		w[A] = w[B]; y[A] = y[B]; u[A] = u[B]; v[A] = v[B];
+		w[A] = w[B];
 #define MOVE_P_RIGHT \
 	MOVE_B_TO_A(1,2) \
 	MOVE_B_TO_A(4,5) \
@@ -2070,22 +2070,90 @@ FUNCTION( scaler_PalTV4x )( const libspectrum_byte *srcPtr,
 	MOVE_B_TO_A(5,6) \
 	MOVE_B_TO_A(8,9)
 
-void
-FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
-                          libspectrum_dword srcPitch,
-                          libspectrum_byte *dstPtr,
-                          libspectrum_dword dstPitch,
-                          int width, int height )
+/* Which of a pixel's neighbours differ from each other, as worked out a
+   row at a time by hq_flags() or its SIMD versions */
+#define HQ_DIFF_26 ( *diff & SCALER_HQ_DIFF_26 )
+#define HQ_DIFF_68 ( *diff & SCALER_HQ_DIFF_68 )
+#define HQ_DIFF_84 ( *diff & SCALER_HQ_DIFF_84 )
+#define HQ_DIFF_42 ( *diff & SCALER_HQ_DIFF_42 )
+
+typedef void hq_yuv_fn( const scaler_data_type *p, int count,
+                        scaler_hq_row *row );
+
+static void
+FUNCTION( hq_yuv )( const scaler_data_type *p, int count, scaler_hq_row *row )
 {
-  int i, j, k, pattern;
+  libspectrum_byte r, g, b;
+  int i;
+
+  for( i = 0; i < count; i++ ) {
+#if SCALER_DATA_SIZE == 2
+    r = R_TO_R( p[i] );
+    g = G_TO_G( p[i] );
+    b = B_TO_B( p[i] );
+#else
+    r =   p[i] & redMask;
+    g = ( p[i] & greenMask ) >> 8;
+    b = ( p[i] & blueMask  ) >> 16;
+#endif
+    row->y[i] = RGB_TO_Y( r, g, b );
+    row->u[i] = RGB_TO_U( r, g, b );
+    row->v[i] = RGB_TO_V( r, g, b );
+  }
+}
+
+#define HQ_ROW_DIFF( a, i, b, j ) \
+  HQ_YUVDIFF( (a)->y[i], (a)->u[i], (a)->v[i], (b)->y[j], (b)->u[j], (b)->v[j] )
+
+static void
+hq_flags( const scaler_hq_row *prev, const scaler_hq_row *cur,
+          const scaler_hq_row *next, int width, int *flags )
+{
+  int i, f;
+
+  /* Pixel i is at i + 1 in the rows */
+  for( i = 0; i < width; i++ ) {
+    f = 0;
+    if( HQ_ROW_DIFF( cur, i + 1, prev, i     ) ) f |= 0x01;
+    if( HQ_ROW_DIFF( cur, i + 1, prev, i + 1 ) ) f |= 0x02;
+    if( HQ_ROW_DIFF( cur, i + 1, prev, i + 2 ) ) f |= 0x04;
+    if( HQ_ROW_DIFF( cur, i + 1, cur,  i     ) ) f |= 0x08;
+    if( HQ_ROW_DIFF( cur, i + 1, cur,  i + 2 ) ) f |= 0x10;
+    if( HQ_ROW_DIFF( cur, i + 1, next, i     ) ) f |= 0x20;
+    if( HQ_ROW_DIFF( cur, i + 1, next, i + 1 ) ) f |= 0x40;
+    if( HQ_ROW_DIFF( cur, i + 1, next, i + 2 ) ) f |= 0x80;
+    if( HQ_ROW_DIFF( prev, i + 1, cur, i + 2 ) ) f |= SCALER_HQ_DIFF_26;
+    if( HQ_ROW_DIFF( cur, i + 2, next, i + 1 ) ) f |= SCALER_HQ_DIFF_68;
+    if( HQ_ROW_DIFF( next, i + 1, cur, i     ) ) f |= SCALER_HQ_DIFF_84;
+    if( HQ_ROW_DIFF( cur, i, prev, i + 1     ) ) f |= SCALER_HQ_DIFF_42;
+    flags[i] = f;
+  }
+}
+
+/* Run an HQ scaler over strips no wider than it can handle */
+#define HQ_STRIPS( fn, scale, yuv, flags ) \
+  while( width > 0 ) { \
+    int strip = MIN( width, SCALER_HQ_MAX_WIDTH ); \
+    fn( srcPtr, srcPitch, dstPtr, dstPitch, strip, height, yuv, flags ); \
+    srcPtr += strip * sizeof( scaler_data_type ); \
+    dstPtr += strip * (scale) * sizeof( scaler_data_type ); \
+    width -= strip; \
+  }
+
+static inline void
+FUNCTION( hq2x )( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                  libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                  int width, int height, hq_yuv_fn *yuv,
+                  scaler_hq_flags_fn *flags_fn )
+{
+  int i, j, pattern, *diff;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
   const scaler_data_type *p, *p0 = (const scaler_data_type *)srcPtr;
   int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q, *q1, *qN, *qN1, *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
-  
-  libspectrum_byte  r, g, b;
-  libspectrum_signed_dword y[10], u[10], v[10];
+  scaler_hq_row rows[3];
+  int flags[ SCALER_HQ_MAX_WIDTH ];
 
   /*   +----+----+----+
        |    |    |    |
@@ -2097,7 +2165,14 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
        |    |    |    |
        | w7 | w8 | w9 |
        +----+----+----+ */
+  yuv( p0 + prevline - 1, width + 2, &rows[0] );
+  yuv( p0 - 1, width + 2, &rows[1] );
+
   for( j = 0; j < height; j++ ) {
+    yuv( p0 + nextline - 1, width + 2, &rows[ ( j + 2 ) % 3 ] );
+    flags_fn( &rows[ j % 3 ], &rows[ ( j + 1 ) % 3 ], &rows[ ( j + 2 ) % 3 ],
+              width, flags );
+
     p = p0;
     q = q0; q1 = q + 1;
     qN = q + nextlineDst; qN1 = qN + 1;
@@ -2110,31 +2185,8 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
     w[3] = *(p + prevline + 1);
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
-    for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
-    }
-
-    for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+    for( i = 0, diff = flags; i < width; i++, diff++ ) {
+      pattern = *diff & 0xff;
 
 #include "scaler_hq2x.c"
 
@@ -2145,20 +2197,6 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
       w[3] = *(p + prevline + 1);
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
-      for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
-      }
     }
     p0 += nextlineSrc;
     q0 += nextlineDst << 1;
@@ -2166,22 +2204,30 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
 }
 
 void
-FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
+FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
                           libspectrum_dword srcPitch,
                           libspectrum_byte *dstPtr,
                           libspectrum_dword dstPitch,
                           int width, int height )
 {
-  int i, j, k, pattern;
+  HQ_STRIPS( FUNCTION( hq2x ), 2, FUNCTION( hq_yuv ), hq_flags );
+}
+
+static inline void
+FUNCTION( hq3x )( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                  libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                  int width, int height, hq_yuv_fn *yuv,
+                  scaler_hq_flags_fn *flags_fn )
+{
+  int i, j, pattern, *diff;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
   const scaler_data_type *p, *p0 = (const scaler_data_type *)srcPtr;
   int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q, *qN, *qNN, *q1, *qN1, *qNN1, *q2, *qN2, *qNN2, 
 		   *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
-  
-  libspectrum_byte  r, g, b;
-  libspectrum_signed_dword y[10], u[10], v[10];
+  scaler_hq_row rows[3];
+  int flags[ SCALER_HQ_MAX_WIDTH ];
 
   /*   +----+----+----+
        |    |    |    |
@@ -2193,7 +2239,14 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
        |    |    |    |
        | w7 | w8 | w9 |
        +----+----+----+ */
+  yuv( p0 + prevline - 1, width + 2, &rows[0] );
+  yuv( p0 - 1, width + 2, &rows[1] );
+
   for( j = 0; j < height; j++ ) {
+    yuv( p0 + nextline - 1, width + 2, &rows[ ( j + 2 ) % 3 ] );
+    flags_fn( &rows[ j % 3 ], &rows[ ( j + 1 ) % 3 ], &rows[ ( j + 2 ) % 3 ],
+              width, flags );
+
     p = p0;
     q = q0;
     q1 = q + 1; q2 = q + 2;
@@ -2209,31 +2262,8 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
     w[3] = *(p + prevline + 1);
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
-    for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
-    }
-
-    for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+    for( i = 0, diff = flags; i < width; i++, diff++ ) {
+      pattern = *diff & 0xff;
 
 #include "scaler_hq3x.c"
 
@@ -2245,20 +2275,6 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
       w[3] = *(p + prevline + 1);
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
-      for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
-      }
     }
     p0 += nextlineSrc;
     q0 += ( nextlineDst << 1 ) + nextlineDst;
@@ -2266,13 +2282,22 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
 }
 
 void
-FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
+FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
                           libspectrum_dword srcPitch,
                           libspectrum_byte *dstPtr,
                           libspectrum_dword dstPitch,
                           int width, int height )
 {
-  int i, j, k, pattern;
+  HQ_STRIPS( FUNCTION( hq3x ), 3, FUNCTION( hq_yuv ), hq_flags );
+}
+
+static inline void
+FUNCTION( hq4x )( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                  libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                  int width, int height, hq_yuv_fn *yuv,
+                  scaler_hq_flags_fn *flags_fn )
+{
+  int i, j, pattern, *diff;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
   const scaler_data_type *p, *p0 = (const scaler_data_type *)srcPtr;
   int nextlineDst = dstPitch / sizeof( scaler_data_type );
@@ -2282,9 +2307,8 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
                    *q3, *qN3, *qNN3, *qNNN3,
                    *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
-
-  libspectrum_byte  r, g, b;
-  libspectrum_signed_dword y[10], u[10], v[10];
+  scaler_hq_row rows[3];
+  int flags[ SCALER_HQ_MAX_WIDTH ];
 
   /*   +----+----+----+
        |    |    |    |
@@ -2296,7 +2320,14 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
        |    |    |    |
        | w7 | w8 | w9 |
        +----+----+----+ */
+  yuv( p0 + prevline - 1, width + 2, &rows[0] );
+  yuv( p0 - 1, width + 2, &rows[1] );
+
   for( j = 0; j < height; j++ ) {
+    yuv( p0 + nextline - 1, width + 2, &rows[ ( j + 2 ) % 3 ] );
+    flags_fn( &rows[ j % 3 ], &rows[ ( j + 1 ) % 3 ], &rows[ ( j + 2 ) % 3 ],
+              width, flags );
+
     p = p0;
     q = q0;
     q1 = q + 1; q2 = q + 2; q3 = q + 3;
@@ -2313,31 +2344,8 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
     w[3] = *(p + prevline + 1);
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
-    for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
-    }
-
-    for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+    for( i = 0, diff = flags; i < width; i++, diff++ ) {
+      pattern = *diff & 0xff;
 
 #include "scaler_hq4x.c"
 
@@ -2350,22 +2358,42 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
       w[3] = *(p + prevline + 1);
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
-      for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
-      }
     }
     p0 += nextlineSrc;
     q0 += ( nextlineDst << 2 );
   }
 }
+
+void
+FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
+                          libspectrum_dword srcPitch,
+                          libspectrum_byte *dstPtr,
+                          libspectrum_dword dstPitch,
+                          int width, int height )
+{
+  HQ_STRIPS( FUNCTION( hq4x ), 4, FUNCTION( hq_yuv ), hq_flags );
+}
+
+#if SCALER_DATA_SIZE == 4 && defined( HAVE_SCALER_SIMD )
+
+/* The HQ scalers with the YUV conversion and neighbour comparisons done
+   by SIMD code */
+#define SIMD_HQ_SCALER( n, simd ) \
+void \
+scaler_HQ##n##x_32_##simd( const libspectrum_byte *srcPtr, \
+                           libspectrum_dword srcPitch, \
+                           libspectrum_byte *dstPtr, \
+                           libspectrum_dword dstPitch, \
+                           int width, int height ) \
+{ \
+  HQ_STRIPS( hq##n##x_32, n, scaler_hq_yuv_##simd, scaler_hq_flags_##simd ); \
+}
+
+SIMD_HQ_SCALER( 2, sse2 )
+SIMD_HQ_SCALER( 3, sse2 )
+SIMD_HQ_SCALER( 4, sse2 )
+SIMD_HQ_SCALER( 2, avx2 )
+SIMD_HQ_SCALER( 3, avx2 )
+SIMD_HQ_SCALER( 4, avx2 )
+
+#endif			/* #if SCALER_DATA_SIZE == 4 && defined( HAVE_SCALER_SIMD ) */
@@ -0,0 +1,514 @@
+/* scalers_simd.c: SSE2 and AVX2 versions of the 32 bit scalers
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#include "config.h"
+
+#include <stddef.h>
+
+#include "libspectrum.h"
+
+#ifdef HAVE_SCALER_SIMD
+#include <immintrin.h>
+#endif				/* #ifdef HAVE_SCALER_SIMD */
+
+#include "compat.h"
+#include "scaler.h"
+#include "scaler_internals.h"
+
+/* Every function here must give exactly the same output as the plain C
+   version of the scaler; the benchmarks check this. The instruction set is
+   chosen at run time, so each function is compiled for its own target
+   rather than the whole file being built with -msse2 or -mavx2 */
+
+#ifdef HAVE_SCALER_SIMD
+
+#define SSE2 __attribute__(( target( "sse2" ) ))
+#define AVX2 __attribute__(( target( "avx2" ) ))
+
+/* The scanline colour used by the TV scalers: each channel is 7/8 of its
+   original value and the padding byte is cleared */
+static inline SSE2 __m128i
+tv_darken_sse2( __m128i v )
+{
+  __m128i zero = _mm_setzero_si128(), seven = _mm_set1_epi16( 7 );
+  __m128i lo = _mm_unpacklo_epi8( v, zero ), hi = _mm_unpackhi_epi8( v, zero );
+
+  lo = _mm_srli_epi16( _mm_mullo_epi16( lo, seven ), 3 );
+  hi = _mm_srli_epi16( _mm_mullo_epi16( hi, seven ), 3 );
+
+  return _mm_and_si128( _mm_packus_epi16( lo, hi ),
+                        _mm_set1_epi32( 0x00ffffff ) );
+}
+
+static inline AVX2 __m256i
+tv_darken_avx2( __m256i v )
+{
+  __m256i zero = _mm256_setzero_si256(), seven = _mm256_set1_epi16( 7 );
+  __m256i lo = _mm256_unpacklo_epi8( v, zero );
+  __m256i hi = _mm256_unpackhi_epi8( v, zero );
+
+  lo = _mm256_srli_epi16( _mm256_mullo_epi16( lo, seven ), 3 );
+  hi = _mm256_srli_epi16( _mm256_mullo_epi16( hi, seven ), 3 );
+
+  return _mm256_and_si256( _mm256_packus_epi16( lo, hi ),
+                           _mm256_set1_epi32( 0x00ffffff ) );
+}
+
+static inline libspectrum_dword
+tv_darken( libspectrum_dword p )
+{
+  return ( ( ( ( p & 0x00ff00ff ) * 7 ) >> 3 ) & 0x00ff00ff ) |
+         ( ( ( ( p & 0x0000ff00 ) * 7 ) >> 3 ) & 0x0000ff00 );
+}
+
+/* Write each of 4 pixels `n' times */
+static inline SSE2 void
+repeat_sse2( libspectrum_dword *d, __m128i v, int n )
+{
+  switch( n ) {
+  case 2:
+    _mm_storeu_si128( (__m128i*)d,       _mm_unpacklo_epi32( v, v ) );
+    _mm_storeu_si128( (__m128i*)(d + 4), _mm_unpackhi_epi32( v, v ) );
+    break;
+  case 3:
+    _mm_storeu_si128( (__m128i*)d,
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 0, 0 ) ) );
+    _mm_storeu_si128( (__m128i*)(d + 4),
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 2, 1, 1 ) ) );
+    _mm_storeu_si128( (__m128i*)(d + 8),
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 3, 3, 3, 2 ) ) );
+    break;
+  case 4:
+    _mm_storeu_si128( (__m128i*)d,
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 0, 0, 0 ) ) );
+    _mm_storeu_si128( (__m128i*)(d + 4),
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+    _mm_storeu_si128( (__m128i*)(d + 8),
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 2, 2, 2 ) ) );
+    _mm_storeu_si128( (__m128i*)(d + 12),
+                      _mm_shuffle_epi32( v, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+    break;
+  }
+}
+
+/* Write each of 8 pixels 2 or 4 times */
+static inline AVX2 void
+repeat_avx2( libspectrum_dword *d, __m256i v, int n )
+{
+  int i;
+
+  for( i = 0; i < n; i++ ) {
+    /* The pixels which go in the i'th group of 8 outputs */
+    __m256i index = _mm256_setr_epi32(
+      ( i * 8 + 0 ) / n, ( i * 8 + 1 ) / n, ( i * 8 + 2 ) / n,
+      ( i * 8 + 3 ) / n, ( i * 8 + 4 ) / n, ( i * 8 + 5 ) / n,
+      ( i * 8 + 6 ) / n, ( i * 8 + 7 ) / n
+    );
+    _mm256_storeu_si256( (__m256i*)( d + i * 8 ),
+                         _mm256_permutevar8x32_epi32( v, index ) );
+  }
+}
+
+/* The Normal and TV scalers: each pixel is repeated `n' times across and
+   down, with the bottom half of the rows darkened for the TV scalers */
+static inline SSE2 void
+repeat_scaler_sse2( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                    libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                    int width, int height, int n, int tv )
+{
+  int i, k, light = tv ? n / 2 + n % 2 : n;
+
+  while( height-- ) {
+    const libspectrum_dword *s = (const libspectrum_dword*)srcPtr;
+
+    for( k = 0; k < n; k++ ) {
+      libspectrum_dword *d = (libspectrum_dword*)( dstPtr + k * dstPitch );
+
+      for( i = 0; i + 4 <= width; i += 4 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( s + i ) );
+        if( k >= light ) v = tv_darken_sse2( v );
+        repeat_sse2( d + i * n, v, n );
+      }
+
+      for( ; i < width; i++ ) {
+        libspectrum_dword p = k >= light ? tv_darken( s[i] ) : s[i];
+        int j;
+        for( j = 0; j < n; j++ ) d[ i * n + j ] = p;
+      }
+    }
+
+    srcPtr += srcPitch;
+    dstPtr += dstPitch * n;
+  }
+}
+
+static inline AVX2 void
+repeat_scaler_avx2( const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                    libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                    int width, int height, int n, int tv )
+{
+  int i, k, light = tv ? n / 2 + n % 2 : n;
+
+  while( height-- ) {
+    const libspectrum_dword *s = (const libspectrum_dword*)srcPtr;
+
+    for( k = 0; k < n; k++ ) {
+      libspectrum_dword *d = (libspectrum_dword*)( dstPtr + k * dstPitch );
+
+      for( i = 0; i + 8 <= width; i += 8 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)( s + i ) );
+        if( k >= light ) v = tv_darken_avx2( v );
+        repeat_avx2( d + i * n, v, n );
+      }
+
+      for( ; i < width; i++ ) {
+        libspectrum_dword p = k >= light ? tv_darken( s[i] ) : s[i];
+        int j;
+        for( j = 0; j < n; j++ ) d[ i * n + j ] = p;
+      }
+    }
+
+    srcPtr += srcPitch;
+    dstPtr += dstPitch * n;
+  }
+}
+
+#define REPEAT_SCALER( name, simd, n, tv ) \
+static simd void \
+scaler_##name##_32_##simd( const libspectrum_byte *srcPtr, \
+                           libspectrum_dword srcPitch, \
+                           libspectrum_byte *dstPtr, \
+                           libspectrum_dword dstPitch, \
+                           int width, int height ) \
+{ \
+  repeat_scaler_##simd( srcPtr, srcPitch, dstPtr, dstPitch, width, height, \
+                        n, tv ); \
+}
+
+#define sse2 SSE2
+#define avx2 AVX2
+
+REPEAT_SCALER( Normal2x, sse2, 2, 0 )
+REPEAT_SCALER( Normal3x, sse2, 3, 0 )
+REPEAT_SCALER( Normal4x, sse2, 4, 0 )
+REPEAT_SCALER( TV2x,     sse2, 2, 1 )
+REPEAT_SCALER( TV3x,     sse2, 3, 1 )
+REPEAT_SCALER( TV4x,     sse2, 4, 1 )
+REPEAT_SCALER( Normal2x, avx2, 2, 0 )
+REPEAT_SCALER( Normal4x, avx2, 4, 0 )
+REPEAT_SCALER( TV2x,     avx2, 2, 1 )
+REPEAT_SCALER( TV4x,     avx2, 4, 1 )
+
+#undef sse2
+#undef avx2
+
+/* The HQ scalers' YUV conversion, as RGB_TO_Y() etc in scalers.c. Each
+   sum is done as two pairs of 16 bit multiplies, (r, g) and (b, 1), with
+   the rounding constant as the multiplier for the 1 */
+
+static inline void
+hq_yuv_pixel( libspectrum_dword p, scaler_hq_row *row, int i )
+{
+  long r = p & 0xff, g = ( p >> 8 ) & 0xff, b = ( p >> 16 ) & 0xff;
+
+  row->y[i] = ( 2449L * r + 4809L * g +  934L * b + 1024 ) >> 11;
+  row->u[i] = ( 4096L * b - 1383L * r - 2713L * g + 1024 ) >> 11;
+  row->v[i] = ( 4096L * r - 3430L * g -  666L * b + 1024 ) >> 11;
+}
+
+#define PAIR( a, b ) ( (libspectrum_dword)(a) & 0xffff ) | ( (libspectrum_dword)(b) << 16 )
+
+SSE2 void
+scaler_hq_yuv_sse2( const libspectrum_dword *p, int count, scaler_hq_row *row )
+{
+  const __m128i byte = _mm_set1_epi32( 0xff ), one = _mm_set1_epi32( 0x10000 );
+  const __m128i y_rg = _mm_set1_epi32( PAIR( 2449, 4809 ) );
+  const __m128i y_b1 = _mm_set1_epi32( PAIR( 934, 1024 ) );
+  const __m128i u_rg = _mm_set1_epi32( PAIR( -1383, -2713 ) );
+  const __m128i u_b1 = _mm_set1_epi32( PAIR( 4096, 1024 ) );
+  const __m128i v_rg = _mm_set1_epi32( PAIR( 4096, -3430 ) );
+  const __m128i v_b1 = _mm_set1_epi32( PAIR( -666, 1024 ) );
+  int i;
+
+  for( i = 0; i + 4 <= count; i += 4 ) {
+    __m128i v = _mm_loadu_si128( (const __m128i*)( p + i ) );
+    __m128i rg = _mm_or_si128( _mm_and_si128( v, byte ),
+                   _mm_slli_epi32( _mm_and_si128( _mm_srli_epi32( v, 8 ),
+                                                  byte ), 16 ) );
+    __m128i b1 = _mm_or_si128( _mm_and_si128( _mm_srli_epi32( v, 16 ), byte ),
+                               one );
+
+    _mm_storeu_si128( (__m128i*)( row->y + i ), _mm_srai_epi32(
+      _mm_add_epi32( _mm_madd_epi16( rg, y_rg ), _mm_madd_epi16( b1, y_b1 ) ),
+      11 ) );
+    _mm_storeu_si128( (__m128i*)( row->u + i ), _mm_srai_epi32(
+      _mm_add_epi32( _mm_madd_epi16( rg, u_rg ), _mm_madd_epi16( b1, u_b1 ) ),
+      11 ) );
+    _mm_storeu_si128( (__m128i*)( row->v + i ), _mm_srai_epi32(
+      _mm_add_epi32( _mm_madd_epi16( rg, v_rg ), _mm_madd_epi16( b1, v_b1 ) ),
+      11 ) );
+  }
+
+  for( ; i < count; i++ ) hq_yuv_pixel( p[i], row, i );
+}
+
+AVX2 void
+scaler_hq_yuv_avx2( const libspectrum_dword *p, int count, scaler_hq_row *row )
+{
+  const __m256i byte = _mm256_set1_epi32( 0xff );
+  const __m256i one = _mm256_set1_epi32( 0x10000 );
+  const __m256i y_rg = _mm256_set1_epi32( PAIR( 2449, 4809 ) );
+  const __m256i y_b1 = _mm256_set1_epi32( PAIR( 934, 1024 ) );
+  const __m256i u_rg = _mm256_set1_epi32( PAIR( -1383, -2713 ) );
+  const __m256i u_b1 = _mm256_set1_epi32( PAIR( 4096, 1024 ) );
+  const __m256i v_rg = _mm256_set1_epi32( PAIR( 4096, -3430 ) );
+  const __m256i v_b1 = _mm256_set1_epi32( PAIR( -666, 1024 ) );
+  int i;
+
+  for( i = 0; i + 8 <= count; i += 8 ) {
+    __m256i v = _mm256_loadu_si256( (const __m256i*)( p + i ) );
+    __m256i rg = _mm256_or_si256( _mm256_and_si256( v, byte ),
+                   _mm256_slli_epi32( _mm256_and_si256(
+                     _mm256_srli_epi32( v, 8 ), byte ), 16 ) );
+    __m256i b1 = _mm256_or_si256(
+                   _mm256_and_si256( _mm256_srli_epi32( v, 16 ), byte ), one );
+
+    _mm256_storeu_si256( (__m256i*)( row->y + i ), _mm256_srai_epi32(
+      _mm256_add_epi32( _mm256_madd_epi16( rg, y_rg ),
+                        _mm256_madd_epi16( b1, y_b1 ) ), 11 ) );
+    _mm256_storeu_si256( (__m256i*)( row->u + i ), _mm256_srai_epi32(
+      _mm256_add_epi32( _mm256_madd_epi16( rg, u_rg ),
+                        _mm256_madd_epi16( b1, u_b1 ) ), 11 ) );
+    _mm256_storeu_si256( (__m256i*)( row->v + i ), _mm256_srai_epi32(
+      _mm256_add_epi32( _mm256_madd_epi16( rg, v_rg ),
+                        _mm256_madd_epi16( b1, v_b1 ) ), 11 ) );
+  }
+
+  for( ; i < count; i++ ) hq_yuv_pixel( p[i], row, i );
+}
+
+/* The HQ neighbour comparisons, as HQ_YUVDIFF() in scalers.c */
+
+#define HQ_TR_Y 0x30
+#define HQ_TR_U 0x07
+#define HQ_TR_V 0x06
+
+static inline int
+hq_diff( const scaler_hq_row *a, int i, const scaler_hq_row *b, int j )
+{
+  libspectrum_signed_dword dy = a->y[i] - b->y[j], du = a->u[i] - b->u[j],
+                           dv = a->v[i] - b->v[j];
+
+  return ( dy < 0 ? -dy : dy ) > HQ_TR_Y ||
+         ( du < 0 ? -du : du ) > HQ_TR_U ||
+         ( dv < 0 ? -dv : dv ) > HQ_TR_V;
+}
+
+static void
+hq_flags_pixel( const scaler_hq_row *prev, const scaler_hq_row *cur,
+                const scaler_hq_row *next, int i, int *flags )
+{
+  int f = 0;
+
+  if( hq_diff( cur, i + 1, prev, i     ) ) f |= 0x01;
+  if( hq_diff( cur, i + 1, prev, i + 1 ) ) f |= 0x02;
+  if( hq_diff( cur, i + 1, prev, i + 2 ) ) f |= 0x04;
+  if( hq_diff( cur, i + 1, cur,  i     ) ) f |= 0x08;
+  if( hq_diff( cur, i + 1, cur,  i + 2 ) ) f |= 0x10;
+  if( hq_diff( cur, i + 1, next, i     ) ) f |= 0x20;
+  if( hq_diff( cur, i + 1, next, i + 1 ) ) f |= 0x40;
+  if( hq_diff( cur, i + 1, next, i + 2 ) ) f |= 0x80;
+  if( hq_diff( prev, i + 1, cur, i + 2 ) ) f |= SCALER_HQ_DIFF_26;
+  if( hq_diff( cur, i + 2, next, i + 1 ) ) f |= SCALER_HQ_DIFF_68;
+  if( hq_diff( next, i + 1, cur, i     ) ) f |= SCALER_HQ_DIFF_84;
+  if( hq_diff( cur, i, prev, i + 1     ) ) f |= SCALER_HQ_DIFF_42;
+
+  flags[i] = f;
+}
+
+/* All ones in each lane where |a - b| > threshold */
+static inline SSE2 __m128i
+over_sse2( __m128i a, __m128i b, __m128i threshold )
+{
+  __m128i d = _mm_sub_epi32( a, b ), sign = _mm_srai_epi32( d, 31 );
+
+  return _mm_cmpgt_epi32( _mm_sub_epi32( _mm_xor_si128( d, sign ), sign ),
+                          threshold );
+}
+
+#define DIFF_SSE2( a, i, b, j, bit ) \
+  _mm_and_si128( _mm_set1_epi32( bit ), _mm_or_si128( _mm_or_si128( \
+    over_sse2( _mm_loadu_si128( (const __m128i*)( a->y + (i) ) ), \
+               _mm_loadu_si128( (const __m128i*)( b->y + (j) ) ), tr_y ), \
+    over_sse2( _mm_loadu_si128( (const __m128i*)( a->u + (i) ) ), \
+               _mm_loadu_si128( (const __m128i*)( b->u + (j) ) ), tr_u ) ), \
+    over_sse2( _mm_loadu_si128( (const __m128i*)( a->v + (i) ) ), \
+               _mm_loadu_si128( (const __m128i*)( b->v + (j) ) ), tr_v ) ) )
+
+SSE2 void
+scaler_hq_flags_sse2( const scaler_hq_row *prev, const scaler_hq_row *cur,
+                      const scaler_hq_row *next, int width, int *flags )
+{
+  const __m128i tr_y = _mm_set1_epi32( HQ_TR_Y );
+  const __m128i tr_u = _mm_set1_epi32( HQ_TR_U );
+  const __m128i tr_v = _mm_set1_epi32( HQ_TR_V );
+  int i;
+
+  for( i = 0; i + 4 <= width; i += 4 ) {
+    __m128i f;
+
+    f =                   DIFF_SSE2( cur, i + 1, prev, i,     0x01 );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, prev, i + 1, 0x02 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, prev, i + 2, 0x04 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, cur,  i,     0x08 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, cur,  i + 2, 0x10 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, next, i,     0x20 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, next, i + 1, 0x40 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 1, next, i + 2, 0x80 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( prev, i + 1, cur, i + 2,
+                                    SCALER_HQ_DIFF_26 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i + 2, next, i + 1,
+                                    SCALER_HQ_DIFF_68 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( next, i + 1, cur, i,
+                                    SCALER_HQ_DIFF_84 ) );
+    f = _mm_or_si128( f, DIFF_SSE2( cur, i, prev, i + 1,
+                                    SCALER_HQ_DIFF_42 ) );
+
+    _mm_storeu_si128( (__m128i*)( flags + i ), f );
+  }
+
+  for( ; i < width; i++ ) hq_flags_pixel( prev, cur, next, i, flags );
+}
+
+static inline AVX2 __m256i
+over_avx2( __m256i a, __m256i b, __m256i threshold )
+{
+  return _mm256_cmpgt_epi32( _mm256_abs_epi32( _mm256_sub_epi32( a, b ) ),
+                             threshold );
+}
+
+#define DIFF_AVX2( a, i, b, j, bit ) \
+  _mm256_and_si256( _mm256_set1_epi32( bit ), _mm256_or_si256( \
+    _mm256_or_si256( \
+      over_avx2( _mm256_loadu_si256( (const __m256i*)( a->y + (i) ) ), \
+                 _mm256_loadu_si256( (const __m256i*)( b->y + (j) ) ), \
+                 tr_y ), \
+      over_avx2( _mm256_loadu_si256( (const __m256i*)( a->u + (i) ) ), \
+                 _mm256_loadu_si256( (const __m256i*)( b->u + (j) ) ), \
+                 tr_u ) ), \
+    over_avx2( _mm256_loadu_si256( (const __m256i*)( a->v + (i) ) ), \
+               _mm256_loadu_si256( (const __m256i*)( b->v + (j) ) ), \
+               tr_v ) ) )
+
+AVX2 void
+scaler_hq_flags_avx2( const scaler_hq_row *prev, const scaler_hq_row *cur,
+                      const scaler_hq_row *next, int width, int *flags )
+{
+  const __m256i tr_y = _mm256_set1_epi32( HQ_TR_Y );
+  const __m256i tr_u = _mm256_set1_epi32( HQ_TR_U );
+  const __m256i tr_v = _mm256_set1_epi32( HQ_TR_V );
+  int i;
+
+  for( i = 0; i + 8 <= width; i += 8 ) {
+    __m256i f;
+
+    f =                      DIFF_AVX2( cur, i + 1, prev, i,     0x01 );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, prev, i + 1, 0x02 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, prev, i + 2, 0x04 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, cur,  i,     0x08 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, cur,  i + 2, 0x10 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, next, i,     0x20 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, next, i + 1, 0x40 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 1, next, i + 2, 0x80 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( prev, i + 1, cur, i + 2,
+                                       SCALER_HQ_DIFF_26 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i + 2, next, i + 1,
+                                       SCALER_HQ_DIFF_68 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( next, i + 1, cur, i,
+                                       SCALER_HQ_DIFF_84 ) );
+    f = _mm256_or_si256( f, DIFF_AVX2( cur, i, prev, i + 1,
+                                       SCALER_HQ_DIFF_42 ) );
+
+    _mm256_storeu_si256( (__m256i*)( flags + i ), f );
+  }
+
+  for( ; i < width; i++ ) hq_flags_pixel( prev, cur, next, i, flags );
+}
+
+/* The SIMD versions of each scaler; where there's no AVX2 version, the
+   SSE2 one is used */
+static const struct {
+  ScalerProc *scalar, *sse2, *avx2;
+} simd_scalers[] = {
+  { scaler_Normal2x_32, scaler_Normal2x_32_sse2, scaler_Normal2x_32_avx2 },
+  { scaler_Normal3x_32, scaler_Normal3x_32_sse2, scaler_Normal3x_32_sse2 },
+  { scaler_Normal4x_32, scaler_Normal4x_32_sse2, scaler_Normal4x_32_avx2 },
+  { scaler_TV2x_32,     scaler_TV2x_32_sse2,     scaler_TV2x_32_avx2     },
+  { scaler_TV3x_32,     scaler_TV3x_32_sse2,     scaler_TV3x_32_sse2     },
+  { scaler_TV4x_32,     scaler_TV4x_32_sse2,     scaler_TV4x_32_avx2     },
+  { scaler_HQ2x_32,     scaler_HQ2x_32_sse2,     scaler_HQ2x_32_avx2     },
+  { scaler_HQ3x_32,     scaler_HQ3x_32_sse2,     scaler_HQ3x_32_avx2     },
+  { scaler_HQ4x_32,     scaler_HQ4x_32_sse2,     scaler_HQ4x_32_avx2     },
+};
+
+scaler_simd_type
+scaler_simd_best( void )
+{
+  __builtin_cpu_init();
+
+  if( __builtin_cpu_supports( "avx2" ) ) return SCALER_SIMD_AVX2;
+  if( __builtin_cpu_supports( "sse2" ) ) return SCALER_SIMD_SSE2;
+
+  return SCALER_SIMD_NONE;
+}
+
+ScalerProc*
+scaler_simd_proc32( ScalerProc *proc, scaler_simd_type simd )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( simd_scalers ); i++ ) {
+    if( simd_scalers[i].scalar != proc ) continue;
+
+    switch( simd ) {
+    case SCALER_SIMD_NONE: return NULL;
+    case SCALER_SIMD_SSE2: return simd_scalers[i].sse2;
+    case SCALER_SIMD_AVX2: return simd_scalers[i].avx2;
+    }
+  }
+
+  return NULL;
+}
+
+#else				/* #ifdef HAVE_SCALER_SIMD */
+
+scaler_simd_type
+scaler_simd_best( void )
+{
+  return SCALER_SIMD_NONE;
+}
+
+ScalerProc*
+scaler_simd_proc32( ScalerProc *proc GCC_UNUSED,
+                    scaler_simd_type simd GCC_UNUSED )
+{
+  return NULL;
+}
+
+#endif				/* #ifdef HAVE_SCALER_SIMD */
@@ -169,6 +169,13 @@ ui_statusbar_update_speed( float speed )
   return 0;
 }
 
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  /* No statusbar to update */
+  return 0;
+}
+
 int
 ui_mouse_grab( int startup )
 {
@@ -273,6 +273,10 @@ typedef enum ui_statusbar_state {
 
 int ui_statusbar_update( ui_statusbar_item item, ui_statusbar_state state );
 int ui_statusbar_update_speed( float speed );
+/* `frames' frames in the rewind buffer, using `bytes' bytes, with
+   `frame_time' microseconds spent storing each frame */
+int ui_statusbar_update_rewind( size_t frames, size_t bytes,
+                                float frame_time );
 
 typedef enum ui_tape_browser_update_type {
 
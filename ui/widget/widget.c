@@ -712,6 +712,12 @@ ui_statusbar_update_speed( float speed )
 {
   return 0;
 }
+
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  return 0;
+}
 #endif
 #endif                          /* #ifndef UI_SDL */
 
@@ -56,6 +56,9 @@ int icons_part_width = 140; /* will be calculated dynamically later */
 int icons_part_height = 27;
 int icons_part_margin = 2;
 
+/* The rewind part is only shown while the rewind buffer holds frames */
+int rewind_part_width = 0;
+
 /* Status bar handle */
 HWND fuse_hStatusWindow;
 
@@ -139,7 +142,7 @@ ui_statusbar_update( ui_statusbar_item item, ui_statusbar_state state )
 
   icons_status[ item ] = state;
 
-  SendMessage( fuse_hStatusWindow, SB_SETTEXT, 1 | SBT_OWNERDRAW, 0 );
+  SendMessage( fuse_hStatusWindow, SB_SETTEXT, 2 | SBT_OWNERDRAW, 0 );
 
   return 0;
 }
@@ -150,7 +153,36 @@ ui_statusbar_update_speed( float speed )
   TCHAR buffer[8];
 
   _sntprintf( buffer, 8, "\t%3.0f%%", speed ); /* \t centers the text */
-  SendMessage( fuse_hStatusWindow, SB_SETTEXT, (WPARAM) 2,
+  SendMessage( fuse_hStatusWindow, SB_SETTEXT, (WPARAM) 3,
+               (LPARAM) buffer);
+
+  return 0;
+}
+
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  const int rewind_bar_width = 250;
+  TCHAR buffer[64];
+  int new_rewind_part_width;
+
+  if( frames ) {
+    _sntprintf( buffer, 64, "\tRewind %lu frames, %lu KB, %.0f us/frame",
+                (unsigned long)frames, (unsigned long)( bytes / 1024 ),
+                frame_time );
+    new_rewind_part_width = rewind_bar_width;
+  } else {
+    buffer[0] = '\0';
+    new_rewind_part_width = 0;
+  }
+
+  /* Resize rewind part if needed */
+  if( new_rewind_part_width != rewind_part_width ) {
+    rewind_part_width = new_rewind_part_width;
+    win32statusbar_resize( fuse_hWnd, 0, 0 );
+  }
+
+  SendMessage( fuse_hStatusWindow, SB_SETTEXT, (WPARAM) 1,
                (LPARAM) buffer);
 
   return 0;
@@ -272,7 +304,7 @@ win32statusbar_resize( HWND hWnd, WPARAM wParam GCC_UNUSED, LPARAM lParam )
   RECT rcClient;
 
   /* divide status bar */
-  int parts[3];
+  int parts[4];
 
   if( LOWORD( lParam ) > 0 ) {
     parts[0] = LOWORD( lParam );
@@ -282,8 +314,9 @@ win32statusbar_resize( HWND hWnd, WPARAM wParam GCC_UNUSED, LPARAM lParam )
     parts[0] = rcClient.right - rcClient.left;
   }
 
-  parts[0] = parts[0] - icons_part_width - speed_bar_width;
-  parts[1] = parts[0] + icons_part_width;  
-  parts[2] = parts[1] + speed_bar_width;
-  SendMessage( fuse_hStatusWindow, SB_SETPARTS, 3, ( LPARAM ) &parts );
+  parts[0] = parts[0] - rewind_part_width - icons_part_width - speed_bar_width;
+  parts[1] = parts[0] + rewind_part_width;
+  parts[2] = parts[1] + icons_part_width;
+  parts[3] = parts[2] + speed_bar_width;
+  SendMessage( fuse_hStatusWindow, SB_SETPARTS, 4, ( LPARAM ) &parts );
 }
@@ -1208,3 +1208,10 @@ ui_statusbar_update_speed( float speed )
 
   return 0;
 }
+
+int
+ui_statusbar_update_rewind( size_t frames, size_t bytes, float frame_time )
+{
+  /* No error */
+  return 0;
+}
@@ -0,0 +1,517 @@
+/* benchmark.c: Micro-benchmarks for the Fuse emulation core
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#include "libspectrum.h"
+
+#include "benchmark.h"
+#include "display.h"
+#include "event.h"
+#include "fuse.h"
+#include "machine.h"
+#include "memory_pages.h"
+#include "periph.h"
+#include "sound.h"
+#include "spectrum.h"
+#include "timer/timer.h"
+#include "ui/scaler/scaler.h"
+#include "ui/scaler/scaler_internals.h"
+#include "z80/z80.h"
+#include "z80/z80_macros.h"
+
+#ifdef BUILD_SPECTRANET
+#include "peripherals/fs/xfs.h"
+#include "peripherals/fs/xfs_worker.h"
+#endif			/* #ifdef BUILD_SPECTRANET */
+
+void
+benchmark_report( const char *name, double seconds, unsigned long iterations )
+{
+  printf( "%-40s %10lu iterations %9.3f s %10.1f ns/iteration\n", name,
+          iterations, seconds,
+          iterations ? seconds * 1e9 / iterations : 0.0 );
+}
+
+static unsigned long benchmark_event_count;
+
+static void
+benchmark_event_fn( libspectrum_dword event_tstates GCC_UNUSED,
+                    int type GCC_UNUSED, void *user_data GCC_UNUSED )
+{
+  benchmark_event_count++;
+}
+
+/* Measure the cost of adding and dispatching one event while `pending'
+   other events are waiting in the queue, including a frame rollover
+   every frame's worth of events */
+static void
+benchmark_event_queue( int type, size_t pending )
+{
+  const unsigned long iterations = 2000000;
+  const libspectrum_dword frame_length = 70000;
+  libspectrum_dword seed = 1;
+  unsigned long i;
+  double start;
+  size_t j;
+  char name[40];
+
+  event_reset();
+  benchmark_event_count = 0;
+  tstates = 0;
+
+  /* The pending events are all beyond the end of the frame so they never
+     run, as with e.g. a disk motor-off timeout */
+  for( j = 0; j < pending; j++ ) {
+    seed = seed * 1103515245 + 12345;
+    event_add( 0x40000000 + ( seed >> 8 ), type );
+  }
+
+  start = timer_get_time();
+
+  for( i = 0; i < iterations; i++ ) {
+    seed = seed * 1103515245 + 12345;
+    event_add( tstates + ( ( seed >> 16 ) & 0xff ), type );
+
+    tstates += 0x100;
+    event_do_events();
+
+    if( tstates >= frame_length ) {
+      tstates -= frame_length;
+      event_frame( frame_length );
+    }
+  }
+
+  snprintf( name, sizeof( name ), "event queue, %lu pending",
+            (unsigned long)pending );
+  benchmark_report( name, timer_get_time() - start, benchmark_event_count );
+
+  event_reset();
+}
+
+static int
+benchmark_events( void )
+{
+  int type;
+
+  type = event_register( benchmark_event_fn, "Benchmark" );
+
+  benchmark_event_queue( type, 10 );
+  benchmark_event_queue( type, 100 );
+  benchmark_event_queue( type, 1000 );
+
+  return 0;
+}
+
+/* A beeper and AY tight loop: the port accesses made by a typical 128K
+   music player, run through whatever peripherals are currently active */
+static int
+benchmark_port_io( void )
+{
+  const unsigned long iterations = 2000000;
+  unsigned long i;
+  libspectrum_byte b = 0;
+  double start;
+
+  start = timer_get_time();
+
+  for( i = 0; i < iterations; i++ ) {
+    writeport_internal( 0xfffd, i & 0x0f );
+    writeport_internal( 0xbffd, b );
+    b ^= readport_internal( 0xfffd );
+    writeport_internal( 0x00fe, b & 0x10 );
+    b ^= readport_internal( 0x7ffe );
+  }
+
+  benchmark_report( "port I/O, AY and beeper loop", timer_get_time() - start,
+                    iterations * 5 );
+
+  return 0;
+}
+
+/* Render AY output tick by tick and skipping the ticks at which the
+   output can't change */
+static int
+benchmark_ay( void )
+{
+  static const char * const styles[] = { "random writes", "tune", "silence" };
+  const int frames = 1000;
+  int style, every_tick;
+  double start;
+  char name[40];
+
+  for( style = 0; style < 3; style++ ) {
+    for( every_tick = 1; every_tick >= 0; every_tick-- ) {
+      start = timer_get_time();
+      sound_ay_render_test( style, frames, every_tick );
+      snprintf( name, sizeof( name ), "AY frame, %s, %s", styles[ style ],
+                every_tick ? "every tick" : "incremental" );
+      benchmark_report( name, timer_get_time() - start, frames );
+    }
+  }
+
+  return 0;
+}
+
+static libspectrum_dword
+benchmark_z80_clock( void )
+{
+  return ( (libspectrum_dword)z80.clockh << 16 ) | z80.clockl;
+}
+
+/* Run a program at 0x8000 for a number of frames with interrupts disabled,
+   through the given version of the main Z80 loop or, if type is
+   Z80_LOOP_COUNT, whichever one z80_do_opcodes() picks */
+static void
+benchmark_z80_program( const char *name, const libspectrum_byte *program,
+                       size_t length, z80_loop_type type )
+{
+  const int frames = 1000;
+  libspectrum_dword frame_length =
+    machine_current->timings.tstates_per_frame;
+  unsigned long instructions = 0;
+  double start;
+  size_t i;
+  int frame;
+
+  for( i = 0; i < length; i++ )
+    writebyte_internal( 0x8000 + i, program[i] );
+
+  PC = 0x8000; IFF1 = IFF2 = 0; z80.halted = 0;
+
+  start = timer_get_time();
+
+  for( frame = 0; frame < frames; frame++ ) {
+    libspectrum_dword clock = benchmark_z80_clock();
+
+    event_reset();
+    tstates = 0;
+    event_add( frame_length, event_type_null );
+
+    if( type == Z80_LOOP_COUNT ) {
+      z80_do_opcodes();
+    } else {
+      z80_do_opcodes_loop( type );
+    }
+
+    instructions += benchmark_z80_clock() - clock;
+  }
+
+  benchmark_report( name, timer_get_time() - start, instructions );
+
+  event_reset();
+  tstates = 0;
+}
+
+/* A loop of memory reads and arithmetic run through each version of the
+   main Z80 loop in turn, whether or not it would be chosen for the
+   current machine */
+static int
+benchmark_z80_loops( void )
+{
+  static const libspectrum_byte program[] = {
+    0xf3,			/* 0x8000: DI */
+    0x21, 0x00, 0x40,		/* 0x8001: LD HL,0x4000 */
+    0x06, 0x00,			/* 0x8004: LD B,0x00 */
+    0x7e,			/* 0x8006: LD A,(HL) */
+    0x23,			/* 0x8007: INC HL */
+    0x80,			/* 0x8008: ADD A,B */
+    0x10, 0xfb,			/* 0x8009: DJNZ 0x8006 */
+    0x18, 0xf3,			/* 0x800b: JR 0x8000 */
+  };
+  z80_loop_type type;
+  char name[40];
+
+  for( type = 0; type < Z80_LOOP_COUNT; type++ ) {
+    snprintf( name, sizeof( name ), "Z80 loop, %s", z80_loop_name( type ) );
+    benchmark_z80_program( name, program, sizeof( program ), type );
+  }
+
+  return 0;
+}
+
+/* Repeated LDIR screen clears, which are dominated by writebyte(); run
+   with e.g. --machine 128 --spectranet to see the cost of the memory
+   mapped peripherals */
+static int
+benchmark_memory_writes( void )
+{
+  static const libspectrum_byte program[] = {
+    0x21, 0x00, 0x40,		/* 0x8000: LD HL,0x4000 */
+    0x11, 0x01, 0x40,		/* 0x8003: LD DE,0x4001 */
+    0x01, 0xff, 0x1a,		/* 0x8006: LD BC,0x1aff */
+    0x36, 0x00,			/* 0x8009: LD (HL),0x00 */
+    0xed, 0xb0,			/* 0x800b: LDIR */
+    0x18, 0xf1,			/* 0x800d: JR 0x8000 */
+  };
+
+  benchmark_z80_program( "memory writes, LDIR screen clear", program,
+                         sizeof( program ), Z80_LOOP_COUNT );
+
+  return 0;
+}
+
+/* The 32 bit scalers over a whole screen of noise, using each instruction set
+   this CPU supports and split into bands over several threads; every
+   version must give exactly the same output as the plain C one */
+#define SCALER_FRAMES 20
+#define SCALER_THREADS 4
+#define SCALER_MARGIN 4
+
+static void
+benchmark_scaler_frames( ScalerProc *proc, float scaling_factor, int threads,
+                         const libspectrum_byte *src, libspectrum_byte *dst,
+                         const char *scaler, const char *version )
+{
+  const libspectrum_dword src_pitch =
+    ( DISPLAY_SCREEN_WIDTH + 2 * SCALER_MARGIN ) * 4;
+  const libspectrum_dword dst_pitch = DISPLAY_SCREEN_WIDTH * 4 * 4;
+  char name[ 80 ];
+  double start;
+  int i;
+
+  start = timer_get_time();
+
+  for( i = 0; i < SCALER_FRAMES; i++ )
+    scaler_run_bands( proc, scaling_factor, threads, src, src_pitch, dst,
+                      dst_pitch, DISPLAY_SCREEN_WIDTH, DISPLAY_SCREEN_HEIGHT );
+
+  snprintf( name, sizeof( name ), "scaler %s, %s", scaler, version );
+  benchmark_report( name, timer_get_time() - start, SCALER_FRAMES );
+}
+
+static int
+benchmark_scalers( void )
+{
+  static const char * const simd_names[] = { "C", "SSE2", "AVX2" };
+  const size_t src_size = ( DISPLAY_SCREEN_WIDTH + 2 * SCALER_MARGIN ) *
+                          ( DISPLAY_SCREEN_HEIGHT + 2 * SCALER_MARGIN ) * 4;
+  const size_t dst_size = DISPLAY_SCREEN_WIDTH * 4 * 4 *
+                          DISPLAY_SCREEN_HEIGHT * 4;
+  libspectrum_byte *src, *expected, *dst;
+  const libspectrum_byte *area;
+  libspectrum_dword seed = 1;
+  scaler_simd_type best = scaler_simd_best(), simd;
+  scaler_type scaler;
+  ScalerProc *plain, *proc;
+  float scaling_factor;
+  char version[ 40 ];
+  size_t i;
+  int error = 0;
+
+  src = libspectrum_new( libspectrum_byte, src_size );
+  expected = libspectrum_new( libspectrum_byte, dst_size );
+  dst = libspectrum_new( libspectrum_byte, dst_size );
+
+  /* Mostly runs of the same colour, as on a real screen, with some noise so
+     that every HQ pattern gets used */
+  for( i = 0; i < src_size; i += 4 ) {
+    seed = seed * 1103515245 + 12345;
+    if( i == 0 || ( seed >> 28 ) < 4 ) {
+      src[i] = seed >> 8; src[i + 1] = seed >> 16; src[i + 2] = seed >> 24;
+    } else {
+      memcpy( &src[i], &src[i - 4], 3 );
+    }
+    src[i + 3] = 0;
+  }
+
+  area = src + ( ( DISPLAY_SCREEN_WIDTH + 2 * SCALER_MARGIN ) * SCALER_MARGIN +
+                 SCALER_MARGIN ) * 4;
+
+  for( scaler = 0; scaler < SCALER_NUM; scaler++ ) {
+    plain = scaler_get_proc32_simd( scaler, SCALER_SIMD_NONE );
+    scaling_factor = scaler_get_scaling_factor( scaler );
+
+    memset( expected, 0, dst_size );
+    benchmark_scaler_frames( plain, scaling_factor, 1, area, expected,
+                             scaler_name( scaler ), simd_names[0] );
+
+    for( simd = SCALER_SIMD_NONE; simd <= best; simd++ ) {
+      proc = scaler_get_proc32_simd( scaler, simd );
+      if( simd != SCALER_SIMD_NONE &&
+          proc == scaler_get_proc32_simd( scaler, simd - 1 ) ) continue;
+
+      if( simd != SCALER_SIMD_NONE ) {
+        memset( dst, 0, dst_size );
+        benchmark_scaler_frames( proc, scaling_factor, 1, area, dst,
+                                 scaler_name( scaler ), simd_names[ simd ] );
+        if( memcmp( dst, expected, dst_size ) ) {
+          printf( "benchmark: %s scaler output differs using %s\n",
+                  scaler_name( scaler ), simd_names[ simd ] );
+          error = 1;
+        }
+      }
+
+      if( scaler_get_flags( scaler ) & SCALER_FLAGS_NO_BANDS ) continue;
+
+      memset( dst, 0, dst_size );
+      snprintf( version, sizeof( version ), "%s, %d threads",
+                simd_names[ simd ], SCALER_THREADS );
+      benchmark_scaler_frames( proc, scaling_factor, SCALER_THREADS, area,
+                               dst, scaler_name( scaler ), version );
+      if( memcmp( dst, expected, dst_size ) ) {
+        printf( "benchmark: %s scaler output differs using %s\n",
+                scaler_name( scaler ), version );
+        error = 1;
+      }
+    }
+  }
+
+  libspectrum_free( dst );
+  libspectrum_free( expected );
+  libspectrum_free( src );
+
+  return error;
+}
+
+#ifdef BUILD_SPECTRANET
+
+static void
+benchmark_xfs_command( struct xfs_registers_t *registers, uint8_t command )
+{
+  registers->command = command;
+  xfs_handle_command( registers );
+}
+
+/* Sequential reads of a local file, a workspace at a time as the
+   Spectranet ROM asks for them, through the same command handlers the XFS
+   worker thread runs, and each block then copied out of the register page
+   as the Z80 would. The mount points at a directory of its own for the
+   run, so nothing is left in the user's XFS directory */
+static int
+benchmark_xfs_reads( void )
+{
+  const size_t file_size = 4 * 1024 * 1024;
+  const int passes = 16;
+  static struct xfs_registers_t registers;
+  static libspectrum_byte block[ sizeof( registers.workspace ) ];
+  const bool debug = xfs_debug_is_enabled();
+  char saved_base_path[ XFS_BASE_PATH_MAX ];
+  char path[ XFS_BASE_PATH_MAX + 32 ];
+  unsigned long blocks = 0;
+  double start, seconds;
+  FILE *f;
+  size_t i;
+  int pass, error = 0;
+
+  strcpy( saved_base_path, xfs_base_path );
+  snprintf( xfs_base_path, XFS_BASE_PATH_MAX, "%s/fuse-benchmark-%ld",
+            compat_get_temp_path(), (long)getpid() );
+#ifdef WIN32
+  if( _mkdir( xfs_base_path ) ) {
+#else
+  if( mkdir( xfs_base_path, 0700 ) ) {
+#endif
+    printf( "benchmark: can't create '%s'\n", xfs_base_path );
+    strcpy( xfs_base_path, saved_base_path );
+    return 1;
+  }
+
+  snprintf( path, sizeof( path ), "%s/fuse-benchmark.bin", xfs_base_path );
+  f = fopen( path, "wb" );
+  if( !f ) {
+    printf( "benchmark: can't create '%s'\n", path );
+    rmdir( xfs_base_path );
+    strcpy( xfs_base_path, saved_base_path );
+    return 1;
+  }
+  for( i = 0; i < file_size; i++ ) fputc( i & 0xff, f );
+  fclose( f );
+
+  xfs_debug_enable( false );
+
+  memset( &registers, 0, sizeof( registers ) );
+  strcpy( registers.arguments.mount.protocol, "xfs" );
+  strcpy( registers.arguments.mount.hostname, "ram" );
+  strcpy( registers.arguments.mount.path, "/" );
+  benchmark_xfs_command( &registers, XFS_CMD_MOUNT );
+
+  memset( &registers.arguments, 0, sizeof( registers.arguments ) );
+  strcpy( registers.arguments.open.path, "/fuse-benchmark.bin" );
+  registers.arguments.open.flags = 0x0001;
+  benchmark_xfs_command( &registers, XFS_CMD_OPEN );
+
+  if( registers.status != XFS_STATUS_COMPLETE ) {
+    printf( "benchmark: XFS can't open '%s'\n", path );
+    error = 1;
+    goto end;
+  }
+
+  start = timer_get_time();
+
+  for( pass = 0; pass < passes; pass++ ) {
+    registers.arguments.lseek.offset = 0;
+    registers.arguments.lseek.whence = XFS_SEEK_SET;
+    benchmark_xfs_command( &registers, XFS_CMD_LSEEK );
+
+    do {
+      registers.arguments.read.size = sizeof( registers.workspace );
+      benchmark_xfs_command( &registers, XFS_CMD_READ );
+      if( registers.result <= 0 ) break;
+
+      memcpy( block, registers.workspace, registers.result );
+      blocks++;
+    } while( 1 );
+  }
+
+  seconds = timer_get_time() - start;
+
+  benchmark_report( "XFS reads, 1K blocks, local file", seconds, blocks );
+  printf( "%-40s %10.1f MB/s\n", "", seconds > 0 ?
+          (double)file_size * passes / ( 1024 * 1024 ) / seconds : 0.0 );
+
+  benchmark_xfs_command( &registers, XFS_CMD_CLOSE );
+
+end:
+  xfs_free();
+  xfs_debug_enable( debug );
+  unlink( path );
+  rmdir( xfs_base_path );
+  strcpy( xfs_base_path, saved_base_path );
+
+  return error;
+}
+
+#endif			/* #ifdef BUILD_SPECTRANET */
+
+int
+benchmark_run( void )
+{
+  int r = 0;
+
+  r += benchmark_events();
+  r += benchmark_port_io();
+  r += benchmark_ay();
+  r += benchmark_z80_loops();
+  r += benchmark_memory_writes();
+  r += benchmark_scalers();
+#ifdef BUILD_SPECTRANET
+  r += benchmark_xfs_reads();
+#endif			/* #ifdef BUILD_SPECTRANET */
+
+  return r;
+}
@@ -0,0 +1,29 @@
+/* benchmark.h: Micro-benchmarks for the Fuse emulation core
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_BENCHMARK_H
+#define FUSE_BENCHMARK_H
+
+int benchmark_run( void );
+
+/* Print the result of one benchmark in a common format */
+void benchmark_report( const char *name, double seconds,
+                       unsigned long iterations );
+
+#endif				/* #ifndef FUSE_BENCHMARK_H */
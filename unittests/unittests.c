@@ -27,6 +27,7 @@
 #include "libspectrum.h"
 
 #include "debugger/debugger.h"
+#include "event.h"
 #include "fuse.h"
 #include "machine.h"
 #include "mempool.h"
@@ -36,6 +37,9 @@
 #include "peripherals/disk/disciple.h"
 #include "peripherals/disk/opus.h"
 #include "peripherals/disk/plusd.h"
+#ifdef BUILD_SPECTRANET
+#include "peripherals/fs/xfs_https_cache.h"
+#endif				/* #ifdef BUILD_SPECTRANET */
 #include "peripherals/ide/divide.h"
 #include "peripherals/ide/divmmc.h"
 #include "peripherals/ide/zxatasp.h"
@@ -48,6 +52,7 @@
 #include "peripherals/ula.h"
 #include "peripherals/usource.h"
 #include "settings.h"
+#include "sound.h"
 #include "unittests.h"
 
 static int
@@ -785,9 +790,17 @@ unittests_run( void )
   r += contention_test();
   r += floating_bus_test();
   r += floating_bus_merge_test();
+  r += periph_unittest();
   r += mempool_test();
   r += paging_test();
   r += debugger_disassemble_unittest();
+  r += sound_ay_unittest();
+#ifdef BUILD_SPECTRANET
+  r += https_cache_unittest();
+#endif				/* #ifdef BUILD_SPECTRANET */
+
+  /* Run last as it clears the event list */
+  r += event_unittest();
 
   printf("Final return value: %d (should be 0)\n", r);
 
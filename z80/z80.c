@@ -34,6 +34,7 @@
 #include "module.h"
 #include "peripherals/scld.h"
 #include "peripherals/spectranet.h"
+#include "profile.h"
 #include "rzx.h"
 #include "settings.h"
 #include "spectrum.h"
@@ -239,6 +240,8 @@ z80_interrupt( void )
     z80.memptr.w = PC;
     Q = 0;
 
+    if( profile_active ) profile_interrupt();
+
     return 1;			/* Accepted an interrupt */
 
   } else {
@@ -282,6 +285,8 @@ z80_nmi( libspectrum_dword ts, int type, void *user_data )
 
   Q = 0;
   PC = 0x0066;
+
+  if( profile_active ) profile_interrupt();
 }
 
 /* Special peripheral processing for RETN */
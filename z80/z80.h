@@ -73,6 +73,26 @@ void z80_retn( void );
 
 void z80_do_opcodes(void);
 
+/* The versions of the main loop; z80_do_opcodes() picks the most
+   specialised one which handles the checks currently needed */
+typedef enum z80_loop_type {
+  Z80_LOOP_GENERIC,
+  Z80_LOOP_CONTENDED,
+  Z80_LOOP_CONTENDED_BETA,
+  Z80_LOOP_UNCONTENDED,
+  Z80_LOOP_UNCONTENDED_BETA,
+
+  Z80_LOOP_COUNT
+} z80_loop_type;
+
+/* Note whether the current machine has any memory contention; called
+   whenever the contention tables are rebuilt */
+void z80_loop_select( void );
+
+/* Run a specific version of the main loop; for benchmarking only */
+void z80_do_opcodes_loop( z80_loop_type type );
+const char* z80_loop_name( z80_loop_type type );
+
 void z80_enable_interrupts( void );
 
 extern processor z80;
@@ -0,0 +1,277 @@
+/* z80_loop.c: The body of the main Z80 loop
+   Copyright (c) 1999-2005 Philip Kendall, Witold Filipczyk
+   Copyright (c) 2015 Stuart Brady
+   Copyright (c) 2015 Gergely Szasz
+   Copyright (c) 2015 Sergio Baldoví
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* This file is included by z80_ops.c once for each version of the main
+   loop. The includer must define CHECK(), END_CHECK and LOOP_LABEL() (for
+   the labels which only the computed gotos jump to), and declare `opcode'
+   and `last_Q'. Z80_LOOP_GENERIC selects the fully general loop, which
+   may also skip the checks away from trap addresses */
+
+  while( tstates < event_next_event ) {
+
+#ifdef Z80_LOOP_GENERIC
+    if( skip_checks && !beta_active && !TRAP_MAP_TEST( PC ) ) {
+      contend_read( PC, 4 );
+      opcode = readbyte_internal( PC );
+      goto end_opcode;
+    }
+#endif				/* #ifdef Z80_LOOP_GENERIC */
+
+    /* Profiler */
+    CHECK( profile, profile_active )
+
+    profile_map( PC );
+
+    END_CHECK
+
+    /* If we're due an end of frame from RZX playback, generate one */
+    CHECK( rzx, rzx_playback )
+
+    if( R + rzx_instructions_offset >= rzx_instruction_count ) {
+      event_add( tstates, spectrum_frame_event );
+      break;		/* And break out of the execution loop to let
+			   the interrupt happen */
+    }
+
+    END_CHECK
+
+    /* Check if the debugger should become active at this point */
+    CHECK( debugger, (debugger_mode != DEBUGGER_MODE_INACTIVE) || is_debugger_enabled() )
+    
+    {
+      uint16_t new_clock_l = CLOCKL + debugger_track_tstates();
+      
+      if (new_clock_l < CLOCKL) {
+        CLOCKH++;
+      }
+      
+      CLOCKL = new_clock_l;
+    }
+
+    if( debugger_check( DEBUGGER_BREAKPOINT_TYPE_EXECUTE, PC ) )
+      debugger_trap();
+
+    END_CHECK
+
+    CHECK( beta, beta_available )
+
+#define NOT_128_TYPE_OR_IS_48_TYPE ( !( machine_current->capabilities & \
+            LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY ) || \
+            machine_current->ram.current_rom )
+
+    if( beta_active ) {
+      if( NOT_128_TYPE_OR_IS_48_TYPE && PC >= 16384 ) {
+	beta_unpage();
+      }
+    } else if( ( PC & beta_pc_mask ) == beta_pc_value &&
+               NOT_128_TYPE_OR_IS_48_TYPE ) {
+      beta_page();
+    }
+
+    END_CHECK
+
+    CHECK( plusd, plusd_available )
+
+    if( PC == 0x0008 || PC == 0x003a || PC == 0x0066 || PC == 0x028e ) {
+      plusd_page();
+    }
+
+    END_CHECK
+
+    CHECK( didaktik80, didaktik80_available )
+
+    if( PC == 0x0000 || PC == 0x0008 ) {
+      didaktik80_page();
+    } else if( PC == 0x1700 ) {
+      didaktik80_unpage();
+    }
+
+    END_CHECK
+
+    CHECK( disciple, disciple_available )
+
+    if( PC == 0x0001 || PC == 0x0008 || PC == 0x0066 || PC == 0x028e ) {
+      disciple_page();
+    }
+
+    END_CHECK
+
+    CHECK( usource, usource_available )
+
+    if( PC == 0x2bae ) {
+      usource_toggle();
+    }
+
+    END_CHECK
+
+    CHECK( multiface, multiface_activated )
+
+    if( PC == 0x0066 ) {
+      multiface_setic8();
+    }
+
+    END_CHECK
+
+    CHECK( if1p, if1_available )
+
+    if( PC == 0x0008 || PC == 0x1708 ) {
+      if1_page();
+    }
+
+    END_CHECK
+
+    CHECK( divide_early, settings_current.divide_enabled )
+    
+    if( ( PC & 0xff00 ) == 0x3d00 ) {
+      divide_set_automap( 1 );
+    }
+    
+    END_CHECK
+
+    CHECK( divmmc_early, settings_current.divmmc_enabled )
+    
+    if( ( PC & 0xff00 ) == 0x3d00 ) {
+      divmmc_set_automap( 1 );
+    }
+    
+    END_CHECK
+
+    CHECK( spectranet_page, spectranet_available && !settings_current.spectranet_disable )
+
+    if( PC == 0x0008 || ((PC & 0xfff8) == 0x3ff8) )
+      spectranet_page( 0 );
+
+    if( PC == spectranet_programmable_trap &&
+      spectranet_programmable_trap_active )
+      event_add( 0, z80_nmi_event );
+
+    END_CHECK
+
+  LOOP_LABEL( opcode_delay )
+
+    contend_read( PC, 4 );
+
+    /* Check to see if M1 cycles happen on even tstates */
+    CHECK( evenm1, even_m1 )
+
+    if( tstates & 1 ) {
+      if( ++tstates == event_next_event ) {
+	break;
+      }
+    }
+
+    END_CHECK
+
+  LOOP_LABEL( run_opcode )
+    /* Do the instruction fetch; readbyte_internal used here to avoid
+       triggering read breakpoints */
+    opcode = readbyte_internal( PC );
+
+    CHECK( if1u, if1_available )
+
+    if( PC == 0x0700 ) {
+      if1_unpage();
+    }
+
+    END_CHECK
+
+    CHECK( divide_late, settings_current.divide_enabled )
+
+    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
+      divide_set_automap( 0 );
+    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
+      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
+      divide_set_automap( 1 );
+    }
+    
+    END_CHECK
+
+    CHECK( divmmc_late, settings_current.divmmc_enabled )
+
+    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
+      divmmc_set_automap( 0 );
+    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
+      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
+      divmmc_set_automap( 1 );
+    }
+    
+    END_CHECK
+
+    CHECK( opus, opus_available )
+
+    if( opus_active ) {
+      if( PC == 0x1748 ) {
+        opus_unpage();
+      }
+    } else if( PC == 0x0008 || PC == 0x0048 || PC == 0x1708 ) {
+      opus_page();
+    }
+
+    END_CHECK
+
+    CHECK( spectranet_unpage, spectranet_available )
+
+    if( PC == 0x007c )
+      spectranet_unpage();
+
+    END_CHECK
+
+    CHECK( z80_iff2_read, z80.iff2_read )
+
+    z80.iff2_read = 0;
+    /* Execute *one* instruction before reevaluating the checks */
+    event_add( tstates, z80_nmos_iff2_event );
+
+    END_CHECK
+
+    CHECK( didaktik80snap, didaktik80_snap )
+
+    if( PC == 0x0066 && !didaktik80_active ) {
+      opcode = 0xc7;	/* RST 00 */
+      didaktik80_snap = 0; /* FIXME: this should be a time-based reset */
+    }
+
+    END_CHECK
+
+    CHECK( svg_capture, svg_capture_active )
+
+    svg_capture();
+
+    END_CHECK
+
+  end_opcode:
+    PC++; R++;
+    if (++CLOCKL == 0) {
+      CLOCKH++;
+    }
+    last_Q = Q; /* keep Q value from previous opcode for SCF and CCF */
+    Q = 0;      /* preempt Q value assuming next opcode doesn't set flags */
+
+    switch(opcode) {
+#include "z80/opcodes_base.c"
+    }
+
+  }
@@ -109,18 +109,22 @@
 
 #ifndef CORETEST
 
+/* z80_ops.c sets this to 0 while building the versions of the main loop
+   for machines with no memory contention */
+#define Z80_CONTENTION 1
+
 #define contend_read(address,time) \
-  if( memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
+  if( Z80_CONTENTION && memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
     tstates += ula_contention[ tstates ]; \
   tstates += (time);
 
 #define contend_read_no_mreq(address,time) \
-  if( memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
+  if( Z80_CONTENTION && memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
     tstates += ula_contention_no_mreq[ tstates ]; \
   tstates += (time);
 
 #define contend_write_no_mreq(address,time) \
-  if( memory_map_write[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
+  if( Z80_CONTENTION && memory_map_write[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
     tstates += ula_contention_no_mreq[ tstates ]; \
   tstates += (time);
 
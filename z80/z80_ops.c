@@ -27,6 +27,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "debugger/debugger.h"
 #include "event.h"
@@ -83,8 +84,6 @@ static void z80_ddfdcbxx( libspectrum_byte opcode3 );
    [1] see 'C Extensions', 'Labels as Values' in the gcc info page.
 */
 
-#ifdef __GNUC__
-
 #define SETUP_CHECK( label, condition ) \
   pos_##label,
 #define SETUP_NEXT( label )
@@ -94,6 +93,8 @@ enum {
   numchecks
 };
 
+#ifdef __GNUC__
+
 #define CHECK( label, condition ) goto *cgoto[ pos_##label ]; label:
 #define END_CHECK
 
@@ -104,278 +105,341 @@ enum {
 
 #endif				/* #ifdef __GNUC__ */
 
+#define LOOP_LABEL( label ) label:
+
 #ifndef HAVE_ENOUGH_MEMORY
 static libspectrum_byte opcode = 0x00;
 #endif
 
-/* Execute Z80 opcodes until the next event */
-void
-z80_do_opcodes( void )
-{
-#ifdef HAVE_ENOUGH_MEMORY
-  libspectrum_byte opcode = 0x00;
-#endif
-  libspectrum_byte last_Q;
-
-  int even_m1 =
-    machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_EVEN_M1; 
-
-#ifdef __GNUC__
-
-#undef SETUP_CHECK
-#define SETUP_CHECK( label, condition ) \
-  if( condition ) { cgoto[ next ] = &&label; next = pos_##label + 1; } \
-  check++;
-
-#undef SETUP_NEXT
-#define SETUP_NEXT( label ) \
-  if( next != check ) { cgoto[ next ] = &&label; } \
-  next = check;
-
-  void *cgoto[ numchecks ]; size_t next = 0; size_t check = 0;
-
-#include "z80_checks.h"
-
-#endif				/* #ifdef __GNUC__ */
-
-  while( tstates < event_next_event ) {
+/* Most of the checks above are the paging traps of the various
+   interfaces, which can only fire at a handful of addresses. Rather
+   than running through all of them for every instruction, keep a map
+   of every address at which one of the enabled traps could fire; when
+   PC is not in the map and none of the other checks are needed, the
+   whole chain can be skipped. The map depends only on which traps are
+   enabled, not on memory contents, so it is rebuilt only when the set
+   of traps changes */
+
+typedef struct trap_map_key_t {
+  int beta, plusd, didaktik80, disciple, usource, multiface, if1;
+  int divide, divmmc, spectranet_page, spectranet_unpage, opus;
+  int spectranet_trap_active;
+  libspectrum_word beta_pc_mask, beta_pc_value, spectranet_trap;
+} trap_map_key_t;
+
+static libspectrum_byte trap_map[ 0x10000 / 8 ];
+static trap_map_key_t trap_map_key;
+static int trap_map_valid = 0;
+
+#define TRAP_MAP_TEST( address ) \
+  ( trap_map[ (address) >> 3 ] & ( 1 << ( (address) & 0x07 ) ) )
 
-    /* Profiler */
-    CHECK( profile, profile_active )
+static void
+trap_map_mark_range( libspectrum_dword from, libspectrum_dword to )
+{
+  libspectrum_dword address;
 
-    profile_map( PC );
+  for( address = from; address <= to; address++ )
+    trap_map[ address >> 3 ] |= 1 << ( address & 0x07 );
+}
 
-    END_CHECK
+static void
+trap_map_mark( libspectrum_word address )
+{
+  trap_map_mark_range( address, address );
+}
 
-    /* If we're due an end of frame from RZX playback, generate one */
-    CHECK( rzx, rzx_playback )
+/* The divIDE and DivMMC automapping addresses */
+static void
+trap_map_mark_automap( void )
+{
+  trap_map_mark_range( 0x3d00, 0x3dff );
+  trap_map_mark_range( 0x1ff8, 0x1fff );
+  trap_map_mark( 0x0000 ); trap_map_mark( 0x0008 ); trap_map_mark( 0x0038 );
+  trap_map_mark( 0x0066 ); trap_map_mark( 0x04c6 ); trap_map_mark( 0x0562 );
+}
 
-    if( R + rzx_instructions_offset >= rzx_instruction_count ) {
-      event_add( tstates, spectrum_frame_event );
-      break;		/* And break out of the execution loop to let
-			   the interrupt happen */
-    }
+static void
+trap_map_update( void )
+{
+  trap_map_key_t key;
+  libspectrum_dword address;
+
+  /* Zero any padding so the keys can be compared with memcmp() */
+  memset( &key, 0, sizeof( key ) );
+
+  key.beta = beta_available;
+  key.plusd = plusd_available;
+  key.didaktik80 = didaktik80_available;
+  key.disciple = disciple_available;
+  key.usource = usource_available;
+  key.multiface = multiface_activated;
+  key.if1 = if1_available;
+  key.divide = settings_current.divide_enabled;
+  key.divmmc = settings_current.divmmc_enabled;
+  key.spectranet_page = spectranet_available &&
+                        !settings_current.spectranet_disable;
+  key.spectranet_unpage = spectranet_available;
+  key.opus = opus_available;
+  key.spectranet_trap_active = key.spectranet_page &&
+                               spectranet_programmable_trap_active;
+  key.beta_pc_mask = beta_pc_mask;
+  key.beta_pc_value = beta_pc_value;
+  key.spectranet_trap = spectranet_programmable_trap;
+
+  if( trap_map_valid && !memcmp( &key, &trap_map_key, sizeof( key ) ) )
+    return;
+
+  memset( trap_map, 0, sizeof( trap_map ) );
+
+  /* Paging in only; while the Beta 128 ROM is paged the checks are
+     always run */
+  if( key.beta ) {
+    for( address = 0; address < 0x10000; address++ )
+      if( ( address & key.beta_pc_mask ) == key.beta_pc_value )
+        trap_map_mark( address );
+  }
 
-    END_CHECK
-
-    /* Check if the debugger should become active at this point */
-    CHECK( debugger, (debugger_mode != DEBUGGER_MODE_INACTIVE) || is_debugger_enabled() )
-    
-    {
-      uint16_t new_clock_l = CLOCKL + debugger_track_tstates();
-      
-      if (new_clock_l < CLOCKL) {
-        CLOCKH++;
-      }
-      
-      CLOCKL = new_clock_l;
-    }
+  if( key.plusd ) {
+    trap_map_mark( 0x0008 ); trap_map_mark( 0x003a );
+    trap_map_mark( 0x0066 ); trap_map_mark( 0x028e );
+  }
 
-    if( debugger_check( DEBUGGER_BREAKPOINT_TYPE_EXECUTE, PC ) )
-      debugger_trap();
+  if( key.didaktik80 ) {
+    trap_map_mark( 0x0000 ); trap_map_mark( 0x0008 ); trap_map_mark( 0x1700 );
+  }
 
-    END_CHECK
+  if( key.disciple ) {
+    trap_map_mark( 0x0001 ); trap_map_mark( 0x0008 );
+    trap_map_mark( 0x0066 ); trap_map_mark( 0x028e );
+  }
 
-    CHECK( beta, beta_available )
+  if( key.usource ) trap_map_mark( 0x2bae );
 
-#define NOT_128_TYPE_OR_IS_48_TYPE ( !( machine_current->capabilities & \
-            LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY ) || \
-            machine_current->ram.current_rom )
+  if( key.multiface ) trap_map_mark( 0x0066 );
 
-    if( beta_active ) {
-      if( NOT_128_TYPE_OR_IS_48_TYPE && PC >= 16384 ) {
-	beta_unpage();
-      }
-    } else if( ( PC & beta_pc_mask ) == beta_pc_value &&
-               NOT_128_TYPE_OR_IS_48_TYPE ) {
-      beta_page();
-    }
+  if( key.if1 ) {
+    trap_map_mark( 0x0008 ); trap_map_mark( 0x1708 ); trap_map_mark( 0x0700 );
+  }
 
-    END_CHECK
+  if( key.divide || key.divmmc ) trap_map_mark_automap();
 
-    CHECK( plusd, plusd_available )
+  if( key.spectranet_page ) {
+    trap_map_mark( 0x0008 );
+    trap_map_mark_range( 0x3ff8, 0x3fff );
+  }
 
-    if( PC == 0x0008 || PC == 0x003a || PC == 0x0066 || PC == 0x028e ) {
-      plusd_page();
-    }
+  if( key.spectranet_trap_active ) trap_map_mark( key.spectranet_trap );
 
-    END_CHECK
+  if( key.spectranet_unpage ) trap_map_mark( 0x007c );
 
-    CHECK( didaktik80, didaktik80_available )
+  if( key.opus ) {
+    trap_map_mark( 0x0008 ); trap_map_mark( 0x0048 );
+    trap_map_mark( 0x1708 ); trap_map_mark( 0x1748 );
+  }
 
-    if( PC == 0x0000 || PC == 0x0008 ) {
-      didaktik80_page();
-    } else if( PC == 0x1700 ) {
-      didaktik80_unpage();
-    }
+  trap_map_key = key;
+  trap_map_valid = 1;
+}
 
-    END_CHECK
+/* Execute Z80 opcodes until the next event, running whichever checks
+   are needed */
+static void
+z80_do_opcodes_generic( void )
+{
+#ifdef HAVE_ENOUGH_MEMORY
+  libspectrum_byte opcode = 0x00;
+#endif
+  libspectrum_byte last_Q;
 
-    CHECK( disciple, disciple_available )
+  int even_m1 =
+    machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_EVEN_M1; 
 
-    if( PC == 0x0001 || PC == 0x0008 || PC == 0x0066 || PC == 0x028e ) {
-      disciple_page();
-    }
+  /* Can instructions away from the trap addresses skip the checks? */
+  int skip_checks = !profile_active && !rzx_playback &&
+    debugger_mode == DEBUGGER_MODE_INACTIVE && !is_debugger_enabled() &&
+    !even_m1 && !z80.iff2_read && !didaktik80_snap && !svg_capture_active;
 
-    END_CHECK
+  if( skip_checks ) trap_map_update();
 
-    CHECK( usource, usource_available )
+#ifdef __GNUC__
 
-    if( PC == 0x2bae ) {
-      usource_toggle();
-    }
+#undef SETUP_CHECK
+#define SETUP_CHECK( label, condition ) \
+  if( condition ) { cgoto[ next ] = &&label; next = pos_##label + 1; } \
+  check++;
 
-    END_CHECK
+#undef SETUP_NEXT
+#define SETUP_NEXT( label ) \
+  if( next != check ) { cgoto[ next ] = &&label; } \
+  next = check;
 
-    CHECK( multiface, multiface_activated )
+  void *cgoto[ numchecks ]; size_t next = 0; size_t check = 0;
 
-    if( PC == 0x0066 ) {
-      multiface_setic8();
-    }
+#include "z80_checks.h"
 
-    END_CHECK
+#endif				/* #ifdef __GNUC__ */
 
-    CHECK( if1p, if1_available )
+#define Z80_LOOP_GENERIC
+#include "z80_loop.c"
+#undef Z80_LOOP_GENERIC
 
-    if( PC == 0x0008 || PC == 0x1708 ) {
-      if1_page();
-    }
+}
 
-    END_CHECK
+#ifndef CORETEST
 
-    CHECK( divide_early, settings_current.divide_enabled )
-    
-    if( ( PC & 0xff00 ) == 0x3d00 ) {
-      divide_set_automap( 1 );
-    }
-    
-    END_CHECK
+/* For the most common configurations, the checks needed on each
+   instruction are known in advance: none at all for a bare 48K or 128K
+   machine, or just the Beta 128 paging for a Pentagon or Scorpion. For
+   these, z80_loop.c is also compiled with the set of checks fixed at
+   compile time, so no per-instruction test or indirect jump remains. The
+   machines with no memory contention additionally get versions with the
+   contention tests compiled out */
 
-    CHECK( divmmc_early, settings_current.divmmc_enabled )
-    
-    if( ( PC & 0xff00 ) == 0x3d00 ) {
-      divmmc_set_automap( 1 );
-    }
-    
-    END_CHECK
+#undef CHECK
+#define CHECK( label, condition ) \
+  if( Z80_LOOP_CHECKS & ( 1UL << pos_##label ) ) {
+#undef END_CHECK
+#define END_CHECK }
 
-    CHECK( spectranet_page, spectranet_available && !settings_current.spectranet_disable )
+#undef LOOP_LABEL
+#define LOOP_LABEL( label )
 
-    if( PC == 0x0008 || ((PC & 0xfff8) == 0x3ff8) )
-      spectranet_page( 0 );
+#ifdef HAVE_ENOUGH_MEMORY
+#define Z80_LOOP_LOCALS libspectrum_byte opcode = 0x00; libspectrum_byte last_Q;
+#else
+#define Z80_LOOP_LOCALS libspectrum_byte last_Q;
+#endif
 
-    if( PC == spectranet_programmable_trap &&
-      spectranet_programmable_trap_active )
-      event_add( 0, z80_nmi_event );
+#define Z80_LOOP_BETA ( 1UL << pos_beta )
 
-    END_CHECK
+#define Z80_LOOP_CHECKS 0
 
-  opcode_delay:
+static void
+z80_do_opcodes_contended( void )
+{
+  Z80_LOOP_LOCALS
+#include "z80_loop.c"
+}
 
-    contend_read( PC, 4 );
+#undef Z80_LOOP_CHECKS
+#define Z80_LOOP_CHECKS Z80_LOOP_BETA
 
-    /* Check to see if M1 cycles happen on even tstates */
-    CHECK( evenm1, even_m1 )
+static void
+z80_do_opcodes_contended_beta( void )
+{
+  Z80_LOOP_LOCALS
+#include "z80_loop.c"
+}
 
-    if( tstates & 1 ) {
-      if( ++tstates == event_next_event ) {
-	break;
-      }
-    }
+#undef Z80_CONTENTION
+#define Z80_CONTENTION 0
 
-    END_CHECK
+#undef Z80_LOOP_CHECKS
+#define Z80_LOOP_CHECKS 0
 
-  run_opcode:
-    /* Do the instruction fetch; readbyte_internal used here to avoid
-       triggering read breakpoints */
-    opcode = readbyte_internal( PC );
+static void
+z80_do_opcodes_uncontended( void )
+{
+  Z80_LOOP_LOCALS
+#include "z80_loop.c"
+}
 
-    CHECK( if1u, if1_available )
+#undef Z80_LOOP_CHECKS
+#define Z80_LOOP_CHECKS Z80_LOOP_BETA
 
-    if( PC == 0x0700 ) {
-      if1_unpage();
-    }
+static void
+z80_do_opcodes_uncontended_beta( void )
+{
+  Z80_LOOP_LOCALS
+#include "z80_loop.c"
+}
 
-    END_CHECK
+#undef Z80_LOOP_CHECKS
 
-    CHECK( divide_late, settings_current.divide_enabled )
+#undef Z80_CONTENTION
+#define Z80_CONTENTION 1
 
-    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
-      divide_set_automap( 0 );
-    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
-      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
-      divide_set_automap( 1 );
-    }
-    
-    END_CHECK
+static const struct {
+  const char *name;
+  void (*fn)( void );
+} z80_loops[ Z80_LOOP_COUNT ] = {
+  { "generic",          z80_do_opcodes_generic },
+  { "contended",        z80_do_opcodes_contended },
+  { "contended, Beta",  z80_do_opcodes_contended_beta },
+  { "uncontended",      z80_do_opcodes_uncontended },
+  { "uncontended, Beta", z80_do_opcodes_uncontended_beta },
+};
 
-    CHECK( divmmc_late, settings_current.divmmc_enabled )
+/* Does the current machine have no memory contention at all? */
+static int z80_loop_uncontended = 0;
 
-    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
-      divmmc_set_automap( 0 );
-    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
-      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
-      divmmc_set_automap( 1 );
-    }
-    
-    END_CHECK
+void
+z80_loop_select( void )
+{
+  size_t i;
 
-    CHECK( opus, opus_available )
+  z80_loop_uncontended = 1;
 
-    if( opus_active ) {
-      if( PC == 0x1748 ) {
-        opus_unpage();
-      }
-    } else if( PC == 0x0008 || PC == 0x0048 || PC == 0x1708 ) {
-      opus_page();
+  for( i = 0; i < ULA_CONTENTION_SIZE; i++ ) {
+    if( ula_contention[ i ] || ula_contention_no_mreq[ i ] ) {
+      z80_loop_uncontended = 0;
+      break;
     }
+  }
+}
 
-    END_CHECK
-
-    CHECK( spectranet_unpage, spectranet_available )
-
-    if( PC == 0x007c )
-      spectranet_unpage();
-
-    END_CHECK
-
-    CHECK( z80_iff2_read, z80.iff2_read )
-
-    z80.iff2_read = 0;
-    /* Execute *one* instruction before reevaluating the checks */
-    event_add( tstates, z80_nmos_iff2_event );
+/* Pick the loop to use for the checks currently needed */
+static z80_loop_type
+z80_loop_choose( void )
+{
+  unsigned long checks = 0;
 
-    END_CHECK
+  int even_m1 =
+    machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_EVEN_M1;
 
-    CHECK( didaktik80snap, didaktik80_snap )
+#undef SETUP_CHECK
+#define SETUP_CHECK( label, condition ) \
+  if( condition ) checks |= 1UL << pos_##label;
 
-    if( PC == 0x0066 && !didaktik80_active ) {
-      opcode = 0xc7;	/* RST 00 */
-      didaktik80_snap = 0; /* FIXME: this should be a time-based reset */
-    }
+#undef SETUP_NEXT
+#define SETUP_NEXT( label )
 
-    END_CHECK
+#include "z80_checks.h"
 
-    CHECK( svg_capture, svg_capture_active )
+  if( checks == 0 )
+    return z80_loop_uncontended ? Z80_LOOP_UNCONTENDED : Z80_LOOP_CONTENDED;
 
-    svg_capture();
+  if( checks == Z80_LOOP_BETA )
+    return z80_loop_uncontended ? Z80_LOOP_UNCONTENDED_BETA :
+                                  Z80_LOOP_CONTENDED_BETA;
 
-    END_CHECK
+  return Z80_LOOP_GENERIC;
+}
 
-  end_opcode:
-    PC++; R++;
-    if (++CLOCKL == 0) {
-      CLOCKH++;
-    }
-    last_Q = Q; /* keep Q value from previous opcode for SCF and CCF */
-    Q = 0;      /* preempt Q value assuming next opcode doesn't set flags */
+void
+z80_do_opcodes_loop( z80_loop_type type )
+{
+  z80_loops[ type ].fn();
+}
 
-    switch(opcode) {
-#include "z80/opcodes_base.c"
-    }
+const char*
+z80_loop_name( z80_loop_type type )
+{
+  return z80_loops[ type ].name;
+}
 
-  }
+#endif				/* #ifndef CORETEST */
 
+/* Execute Z80 opcodes until the next event */
+void
+z80_do_opcodes( void )
+{
+#ifndef CORETEST
+  z80_loops[ z80_loop_choose() ].fn();
+#else				/* #ifndef CORETEST */
+  z80_do_opcodes_generic();
+#endif				/* #ifndef CORETEST */
 }
 
 #ifndef HAVE_ENOUGH_MEMORY